@@ -1067,7 +1067,7 @@ void CL_SendConnectPacket( void )
 	}
 	else
 	{
-		int extensions = NET_EXT_SPLITSIZE;
+		int extensions = NET_EXT_SPLITSIZE|NET_EXT_DEFLATE;
 
 		if( cl_dlmax->value > FRAGMENT_MAX_SIZE  || cl_dlmax->value < FRAGMENT_MIN_SIZE )
 			Cvar_SetValue( "cl_dlmax", FRAGMENT_DEFAULT_SIZE );
@@ -1454,6 +1454,12 @@ void CL_Reconnect( qboolean setup_netchan )
 			{
 				Con_Reportf( "^2NET_EXT_SPLITSIZE enabled^7 (packet size is %d)\n", (int)cl_dlmax->value );
 			}
+
+			if( cls.extensions & NET_EXT_DEFLATE )
+			{
+				cls.netchan.deflate_fragments = true;
+				Con_Reportf( "^2NET_EXT_DEFLATE enabled^7\n" );
+			}
 		}
 
 	}
@@ -2612,9 +2618,62 @@ void CL_Physinfo_f( void )
 	Con_Printf( "Total %i symbols\n", Q_strlen( cls.physinfo ));
 }
 
+/*
+==============
+CL_CountResources
+
+resources left to precache, for the loading bar
+==============
+*/
+static int CL_CountResources( void )
+{
+	resource_t	*pRes;
+	int		total = 0;
+
+	for( pRes = cl.resourcesonhand.pNext; pRes && pRes != &cl.resourcesonhand; pRes = pRes->pNext )
+	{
+		if( !FBitSet( pRes->ucFlags, RES_PRECACHED ))
+			total++;
+	}
+
+	return total;
+}
+
+/*
+==============
+CL_PrecacheProgress
+
+update the loading bar while resources are precached
+==============
+*/
+static void CL_PrecacheProgress( int done, int total )
+{
+	static double	lastupdate;
+	double		curtime;
+
+	if( cls.state == ca_active || total <= 0 )
+		return;
+
+	Cvar_SetValue( "scr_loading", 100.0f * done / total );
+
+	curtime = Sys_DoubleTime();
+
+	// don't let the screen refresh slow down the loading
+	if( done < total && curtime - lastupdate < 0.1 )
+		return;
+
+	lastupdate = curtime;
+	SCR_UpdateScreen();
+}
+
 qboolean CL_PrecacheResources( void )
 {
 	resource_t	*pRes;
+	int		done = 0, total;
+
+	// listen server has already started counting
+	if( cls.state != ca_active && !SV_Active( ))
+		FS_ResetStats();
 
 	// NOTE: world need to be loaded as first model
 	for( pRes = cl.resourcesonhand.pNext; pRes && pRes != &cl.resourcesonhand; pRes = pRes->pNext )
@@ -2659,12 +2718,16 @@ qboolean CL_PrecacheResources( void )
 	if( cls.state != ca_active )
 		S_BeginRegistration();
 
+	total = CL_CountResources();
+
 	// precache all the remaining resources where order is doesn't matter
 	for( pRes = cl.resourcesonhand.pNext; pRes && pRes != &cl.resourcesonhand; pRes = pRes->pNext )
 	{
 		if( FBitSet( pRes->ucFlags, RES_PRECACHED ))
 			continue;
 
+		CL_PrecacheProgress( done++, total );
+
 		switch( pRes->type )
 		{
 		case t_sound:
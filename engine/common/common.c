@@ -20,6 +20,8 @@ GNU General Public License for more details.
 #include "client.h"
 #include "library.h"
 #include "sequence.h"
+#define MINIZ_HEADER_FILE_ONLY
+#include "miniz.h"
 
 static const char *file_exts[] =
 {
@@ -429,6 +431,99 @@ uint LZSS_Decompress( const byte *pInput, byte *pOutput )
 	return totalBytes;
 }
 
+/*
+===============================================================================
+
+	Deflate Compression
+
+	Same header as LZSS followed by a raw deflate stream. Faster
+	and tighter than LZSS, used when the other side announced it
+	can decompress it
+
+===============================================================================
+*/
+#define DEFLATE_ID		(('T'<<24)|('L'<<16)|('F'<<8)|('D'))
+#define DEFLATE_LEVEL	1	// fastest, still much better ratio than LZSS
+
+qboolean Deflate_IsCompressed( const byte *source )
+{
+	lzss_header_t	*phdr = (lzss_header_t *)source;
+
+	if( phdr && phdr->id == DEFLATE_ID )
+		return true;
+	return false;
+}
+
+uint Deflate_GetActualSize( const byte *source )
+{
+	lzss_header_t	*phdr = (lzss_header_t *)source;
+
+	if( phdr && phdr->id == DEFLATE_ID )
+		return phdr->size;
+	return 0;
+}
+
+/*
+==============
+Deflate_Compress
+
+same contract as LZSS_Compress: returns malloc'ed
+buffer or NULL if data can't be made smaller
+==============
+*/
+byte *Deflate_Compress( byte *pInput, int inputLength, uint *pOutputSize )
+{
+	int		flags = tdefl_create_comp_flags_from_zip_params( DEFLATE_LEVEL, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY );
+	lzss_header_t	*header;
+	byte		*pStart;
+	size_t		size;
+
+	if( inputLength <= sizeof( lzss_header_t ))
+		return NULL;
+
+	pStart = (byte *)malloc( inputLength );
+	header = (lzss_header_t *)pStart;
+	header->id = DEFLATE_ID;
+	header->size = inputLength;
+
+	size = tdefl_compress_mem_to_mem( pStart + sizeof( lzss_header_t ), inputLength - sizeof( lzss_header_t ), pInput, inputLength, flags );
+
+	// zero means output didn't fit
+	if( !size )
+	{
+		free( pStart );
+		return NULL;
+	}
+
+	if( pOutputSize )
+		*pOutputSize = size + sizeof( lzss_header_t );
+
+	return pStart;
+}
+
+/*
+==============
+Deflate_Decompress
+
+returns decompressed size, zero on error
+==============
+*/
+uint Deflate_Decompress( const byte *pInput, uint inputLength, byte *pOutput, uint outputLength )
+{
+	uint	actualSize = Deflate_GetActualSize( pInput );
+	size_t	size;
+
+	if( !actualSize || actualSize > outputLength || inputLength < sizeof( lzss_header_t ))
+		return 0;
+
+	size = tinfl_decompress_mem_to_mem( pOutput, actualSize, pInput + sizeof( lzss_header_t ), inputLength - sizeof( lzss_header_t ), 0 );
+
+	if( size != actualSize )
+		return 0;
+
+	return actualSize;
+}
+
 
 
 
@@ -1296,3 +1391,44 @@ only exists in PlayStation version
 void GAME_EXPORT pfnResetTutorMessageDecayData( void )
 {
 }
+
+#if XASH_ENGINE_TESTS
+#include "tests.h"
+
+static void Test_CodecRoundTrip( void )
+{
+	static byte	src[65536], dst[65536];
+	uint		i, seed = 0x1337, size = 0;
+	byte		*comp;
+
+	// half text-like, half noise, like a typical map lump mix
+	for( i = 0; i < sizeof( src ); i++ )
+	{
+		seed = seed * 1103515245 + 12345;
+		src[i] = i < sizeof( src ) / 2 ? "xash3d fwgs "[i % 12] : ( seed >> 16 );
+	}
+
+	comp = Deflate_Compress( src, sizeof( src ), &size );
+	TASSERT( comp != NULL );
+	if( !comp ) return;
+
+	TASSERT( Deflate_IsCompressed( comp ) && !LZSS_IsCompressed( comp ));
+	TASSERT( Deflate_GetActualSize( comp ) == sizeof( src ));
+	TASSERT( Deflate_Decompress( comp, size, dst, sizeof( dst )) == sizeof( src ));
+	TASSERT( !memcmp( src, dst, sizeof( src )));
+
+	// truncated stream and short output buffer must fail
+	TASSERT( Deflate_Decompress( comp, size / 2, dst, sizeof( dst )) == 0 );
+	TASSERT( Deflate_Decompress( comp, size, dst, sizeof( dst ) - 1 ) == 0 );
+	free( comp );
+
+	// noise doesn't fit, caller sends it uncompressed
+	comp = Deflate_Compress( src + sizeof( src ) / 2, 1024, &size );
+	TASSERT( comp == NULL );
+}
+
+void Test_RunCommon( void )
+{
+	TRUN( Test_CodecRoundTrip() );
+}
+#endif /* XASH_ENGINE_TESTS */
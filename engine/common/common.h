@@ -435,6 +435,7 @@ typedef struct host_parm_s
 	int		sv_cvars_restored;	// count of restored server cvars
 	qboolean		crashed;		// set to true if crashed
 	qboolean		daemonized;
+	qboolean		benchmark;	// run frames back to back, see SV_RunBenchmark
 	qboolean		enabledll;
 	qboolean		textmode;
 
@@ -516,6 +517,7 @@ void _Mem_Check( const char *filename, int fileline );
 qboolean Mem_IsAllocatedExt( poolhandle_t poolptr, void *data );
 void Mem_PrintList( size_t minallocationsize );
 void Mem_PrintStats( void );
+void Mem_Bench_f( void );
 
 #define Mem_Malloc( pool, size ) _Mem_Alloc( pool, size, false, __FILE__, __LINE__ )
 #define Mem_Calloc( pool, size ) _Mem_Alloc( pool, size, true, __FILE__, __LINE__ )
@@ -530,9 +532,20 @@ void Mem_PrintStats( void );
 //
 // filesystem.c
 //
+typedef struct fs_stats_s
+{
+	int		lookups;
+	double		lookuptime;	// seconds spent in FS_FindFile
+	size_t		readbytes;
+	double		readtime;		// seconds spent reading from disk in FS_Read
+	size_t		mappedbytes;	// handed out by FS_MapFile without a copy
+} fs_stats_t;
+
 void FS_Init( void );
 void FS_Path( void );
 void FS_Rescan( void );
+void FS_ResetStats( void );
+void FS_GetStats( fs_stats_t *stats );
 void FS_Shutdown( void );
 void FS_ClearSearchPath( void );
 void FS_AllowDirectPaths( qboolean enable );
@@ -543,6 +556,9 @@ const char *FS_GetDiskPath( const char *name, qboolean gamedironly );
 byte *W_LoadLump( wfile_t *wad, const char *lumpname, size_t *lumpsizeptr, const char type );
 void W_Close( wfile_t *wad );
 byte *FS_LoadFile( const char *path, fs_offset_t *filesizeptr, qboolean gamedironly );
+const byte *FS_MapFile( const char *path, fs_offset_t *filesizeptr, qboolean gamedironly );
+void FS_UnmapFile( const byte *data );
+void FS_RecordLoad( const char *name, double seconds );
 qboolean CRC32_File( dword *crcvalue, const char *filename );
 qboolean MD5_HashFile( byte digest[16], const char *pszFileName, uint seed[4] );
 byte *FS_LoadDirectFile( const char *path, fs_offset_t *filesizeptr );
@@ -727,6 +743,7 @@ void SV_Shutdown( const char *finalmsg );
 void SV_ShutdownFilter( void );
 void Host_ServerFrame( void );
 qboolean SV_Active( void );
+void SV_RunBenchmark( void );
 
 /*
 ==============================================================
@@ -944,6 +961,10 @@ qboolean LZSS_IsCompressed( const byte *source );
 uint LZSS_GetActualSize( const byte *source );
 byte *LZSS_Compress( byte *pInput, int inputLength, uint *pOutputSize );
 uint LZSS_Decompress( const byte *pInput, byte *pOutput );
+qboolean Deflate_IsCompressed( const byte *source );
+uint Deflate_GetActualSize( const byte *source );
+byte *Deflate_Compress( byte *pInput, int inputLength, uint *pOutputSize );
+uint Deflate_Decompress( const byte *pInput, uint inputLength, byte *pOutput, uint outputLength );
 void GL_FreeImage( const char *name );
 void VID_InitDefaultResolution( void );
 void VID_Init( void );
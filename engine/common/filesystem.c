@@ -27,6 +27,13 @@ GNU General Public License for more details.
 #include <dirent.h>
 #include <errno.h>
 #endif
+#if XASH_LINUX
+#include <sys/inotify.h>
+#endif
+#if !XASH_WIN32 && !XASH_DOS4GW && !defined( XASH_REDUCE_FD )
+#define HAVE_MMAP
+#include <sys/mman.h>
+#endif
 #include "miniz.h" // header-only zlib replacement
 #include "common.h"
 #include "wadfile.h"
@@ -37,6 +44,9 @@ GNU General Public License for more details.
 
 #define FILE_COPY_SIZE		(1024 * 1024)
 #define FILE_BUFF_SIZE		(2048)
+#define ZIP_INPUT_BUFF_SIZE		(16384)		// compressed bytes read at once from a deflated entry
+#define ZIP_CHECKPOINT_STEP		(1024 * 1024)	// minimal distance between inflate checkpoints
+#define ZIP_MAX_CHECKPOINTS		64
 
 // PAK errors
 #define PAK_LOAD_OK			0
@@ -78,6 +88,30 @@ typedef struct wadtype_s
 	signed char		type;
 } wadtype_t;
 
+typedef struct zipcheckpoint_s
+{
+	fs_offset_t	in_position;		// compressed bytes consumed by inflate
+	fs_offset_t	out_position;		// uncompressed bytes produced
+	dword		crc;			// running crc32 up to out_position
+	inflate_state	state;			// decompressor state, including the 32k window
+} zipcheckpoint_t;
+
+typedef struct ztoolkit_s
+{
+	z_stream		zstream;
+	string		name;			// entry name, for error messages
+	fs_offset_t	comp_length;		// length of the compressed data
+	fs_offset_t	in_position;		// compressed bytes read from the package
+	fs_offset_t	out_position;		// uncompressed bytes produced
+	dword		crc;			// running crc32 of the inflated data
+	dword		expected_crc;		// crc32 from the central directory
+	qboolean		error;			// stream is corrupted, refuse to read
+	zipcheckpoint_t	*checkpoints;		// built once the file is seeked backwards
+	int		numcheckpoints;
+	fs_offset_t	checkpoint_step;		// 0 if checkpoints are disabled
+	byte		input[ZIP_INPUT_BUFF_SIZE];
+} ztoolkit_t;
+
 struct file_s
 {
 	int		handle;			// file descriptor
@@ -89,6 +123,7 @@ struct file_s
 						// contents buffer
 	fs_offset_t		buff_ind, buff_len;		// buffer current index and length
 	byte		buff[FILE_BUFF_SIZE];	// intermediate buffer
+	ztoolkit_t	*ztk;			// inflate state for deflated zip entries
 #ifdef XASH_REDUCE_FD
 	const char *backup_path;
 	fs_offset_t backup_position;
@@ -122,6 +157,7 @@ typedef struct zipfile_s
 	fs_offset_t	offset; // offset of local file header
 	fs_offset_t	size; //original file size
 	fs_offset_t	compressed_size; // compressed file size
+	dword		crc32; // crc32 of the uncompressed data
 	unsigned short flags;
 } zipfile_t;
 
@@ -141,6 +177,9 @@ typedef struct searchpath_s
 	wfile_t		*wad;
 	zip_t		*zip;
 	int		flags;
+	int		order;		// position in the chain when the index was built
+	qboolean		indexed;		// found through the index instead of walking
+	int		numindexed;
 	struct searchpath_s *next;
 } searchpath_t;
 
@@ -156,6 +195,74 @@ static qboolean		fs_ext_path = false;	// attempt to read\write from ./ or ../ pa
 static qboolean		fs_caseinsensitive = true; // try to search missing files
 #endif
 
+typedef struct fs_indexentry_s
+{
+	struct fs_indexentry_s	*next;	// in the same bucket
+	searchpath_t		*search;
+	const char		*name;	// as stored in package or on disk
+	uint			hash;
+	int			index;	// in package, -1 for files on disk
+} fs_indexentry_t;
+
+typedef struct
+{
+	int			wd;
+	searchpath_t		*search;	// NULL when the directory is gone
+	char			*dir;	// relative to search path, with trailing slash
+} fs_watch_t;
+
+static struct
+{
+	poolhandle_t		mempool;
+	qboolean			valid;	// rebuilt on the next lookup when cleared
+	qboolean			disabled;
+	fs_indexentry_t		**hash;
+	uint			hashsize;
+	uint			numentries;
+	fs_watch_t		*watches;
+	int			numwatches;
+	int			maxwatches;
+	int			inotify;
+	double			lastpoll;
+	qboolean			missingroots;	// some search path directories don't exist yet
+} fs_index;
+
+static fs_stats_t		fs_stats;
+
+typedef struct fs_mapping_s
+{
+	struct fs_mapping_s	*next;
+	searchpath_t	*search;		// NULL once the search path is gone
+	int		index;		// in package, -1 for files on disk
+	char		name[MAX_SYSPATH];
+	void		*base;		// page aligned start of the mapping
+	size_t		maplen;
+	const byte	*data;
+	fs_offset_t	size;
+	int		refcount;
+} fs_mapping_t;
+
+static fs_mapping_t		*fs_mappings;		// views handed out by FS_MapFile
+
+#define LOADSTAT_HASH_SIZE	1024	// must be power of two
+
+typedef struct fs_loadstat_s
+{
+	char		name[MAX_QPATH];
+	uint		hash;
+	int		next;		// in the same bucket, index + 1
+	double		loadtime;
+	int		loads;
+} fs_loadstat_t;
+
+static struct
+{
+	fs_loadstat_t	*assets;
+	int		numassets;
+	int		maxassets;
+	int		hash[LOADSTAT_HASH_SIZE];	// index + 1 of the first asset
+} fs_loadstats;
+
 #ifdef XASH_REDUCE_FD
 static file_t *fs_last_readfile;
 static zip_t *fs_last_zip;
@@ -233,6 +340,11 @@ static int FS_SysFileTime( const char *filename );
 static signed char W_TypeFromExt( const char *lumpname );
 static const char *W_ExtFromType( signed char lumptype );
 static void FS_Purge( file_t* file );
+static void FS_DetachMappings( searchpath_t *search );
+static void FS_LoadStats_f( void );
+static void FS_InvalidateIndex( void );
+static void FS_IndexWrittenFile( const char *name, qboolean exists );
+static void FS_FreeIndex( void );
 
 /*
 =============================================================================
@@ -548,6 +660,7 @@ void FS_Path_f( void )
 		if( s->pack ) Con_Printf( "%s (%i files)", s->pack->filename, s->pack->numfiles );
 		else if( s->wad ) Con_Printf( "%s (%i files)", s->wad->filename, s->wad->numlumps );
 		else if( s->zip ) Con_Printf( "%s (%i files)", s->zip->filename, s->zip->numfiles );
+		else if( s->indexed ) Con_Printf( "%s (%i files)", s->filename, s->numindexed );
 		else Con_Printf( "%s", s->filename );
 
 		if( s->flags & FS_GAMERODIR_PATH ) Con_Printf( " ^2rodir^7" );
@@ -824,6 +937,7 @@ static zip_t *FS_LoadZip( const char *zipfile, int *error )
 
 			info[numpackfiles].size = header_cdf.uncompressed_size;
 			info[numpackfiles].compressed_size = header_cdf.compressed_size;
+			info[numpackfiles].crc32 = header_cdf.crc32;
 			info[numpackfiles].offset = header_cdf.local_header_offset;
 			numpackfiles++;
 		}
@@ -921,7 +1035,6 @@ static byte *Zip_LoadFile( const char *path, fs_offset_t *sizeptr, qboolean game
 		decompressed_buffer[file->size] = '\0';
 
 		read( search->zip->handle, decompressed_buffer, file->size );
-#if 0
 		CRC32_Init( &test_crc );
 		CRC32_ProcessBuffer( &test_crc, decompressed_buffer, file->size );
 
@@ -933,7 +1046,6 @@ static byte *Zip_LoadFile( const char *path, fs_offset_t *sizeptr, qboolean game
 			Mem_Free( decompressed_buffer );
 			return NULL;
 		}
-#endif
 		if( sizeptr ) *sizeptr = file->size;
 
 		FS_EnsureOpenZip( NULL );
@@ -972,7 +1084,6 @@ static byte *Zip_LoadFile( const char *path, fs_offset_t *sizeptr, qboolean game
 		if( zlib_result == Z_OK || zlib_result == Z_STREAM_END )
 		{
 			Mem_Free( compressed_buffer ); // finaly free compressed buffer
-#if 0
 			CRC32_Init( &test_crc );
 			CRC32_ProcessBuffer( &test_crc, decompressed_buffer, file->size );
 
@@ -984,7 +1095,6 @@ static byte *Zip_LoadFile( const char *path, fs_offset_t *sizeptr, qboolean game
 				Mem_Free( decompressed_buffer );
 				return NULL;
 			}
-#endif
 			if( sizeptr ) *sizeptr = file->size;
 
 			FS_EnsureOpenZip( NULL );
@@ -1043,6 +1153,7 @@ static qboolean FS_AddWad_Fullpath( const char *wadfile, qboolean *already_loade
 		search->next = fs_searchpaths;
 		search->flags |= flags;
 		fs_searchpaths = search;
+		FS_InvalidateIndex();
 
 		Con_Reportf( "Adding wadfile: %s (%i files)\n", wadfile, wad->numlumps );
 		return true;
@@ -1100,6 +1211,7 @@ static qboolean FS_AddPak_Fullpath( const char *pakfile, qboolean *already_loade
 		search->next = fs_searchpaths;
 		search->flags |= flags;
 		fs_searchpaths = search;
+		FS_InvalidateIndex();
 
 		Con_Reportf( "Adding pakfile: %s (%i files)\n", pakfile, pak->numfiles );
 
@@ -1154,6 +1266,7 @@ qboolean FS_AddZip_Fullpath( const char *zipfile, qboolean *already_loaded, int
 		search->next = fs_searchpaths;
 		search->flags |= flags;
 		fs_searchpaths = search;
+		FS_InvalidateIndex();
 
 		Con_Reportf( "Adding zipfile: %s (%i files)\n", zipfile, zip->numfiles );
 
@@ -1239,6 +1352,7 @@ void FS_AddGameDirectory( const char *dir, uint flags )
 	search->next = fs_searchpaths;
 	search->flags = flags;
 	fs_searchpaths = search;
+	FS_InvalidateIndex();
 }
 
 /*
@@ -1300,6 +1414,8 @@ FS_ClearSearchPath
 */
 void FS_ClearSearchPath( void )
 {
+	FS_InvalidateIndex();
+
 	while( fs_searchpaths )
 	{
 		searchpath_t	*search = fs_searchpaths;
@@ -1334,6 +1450,7 @@ void FS_ClearSearchPath( void )
 			Zip_Close(search->zip);
 		}
 
+		FS_DetachMappings( search );
 		Mem_Free( search );
 	}
 }
@@ -2047,6 +2164,10 @@ void FS_Init( void )
 	Cmd_AddCommand( "fs_rescan", FS_Rescan_f, "rescan filesystem search pathes" );
 	Cmd_AddCommand( "fs_path", FS_Path_f, "show filesystem search pathes" );
 	Cmd_AddCommand( "fs_clearpaths", FS_ClearPaths_f, "clear filesystem search pathes" );
+	Cmd_AddCommand( "loadstats", FS_LoadStats_f, "show per-asset load times of the last map, [count]" );
+
+	if( Sys_CheckParm( "-nofsindex" ))
+		fs_index.disabled = true;
 
 #if !XASH_WIN32
 	if( Sys_CheckParm( "-casesensitive" ) )
@@ -2165,7 +2286,9 @@ void FS_Shutdown( void )
 	memset( &SI, 0, sizeof( sysinfo_t ));
 
 	FS_ClearSearchPath(); // release all wad files too
+	FS_FreeIndex();
 	Mem_FreePool( &fs_mempool );
+	memset( &fs_loadstats, 0, sizeof( fs_loadstats ));
 }
 
 /*
@@ -2344,16 +2467,234 @@ Open a packed file using its package file descriptor
 file_t *FS_OpenZipFile( zip_t *zip, int pack_ind )
 {
 	zipfile_t	*pfile;
+	file_t	*file;
 	pfile = &zip->files[pack_ind];
 
-	// compressed files handled in Zip_LoadFile
-	if( pfile->flags != ZIP_COMPRESSION_NO_COMPRESSION )
+	if( pfile->flags != ZIP_COMPRESSION_NO_COMPRESSION && pfile->flags != ZIP_COMPRESSION_DEFLATED )
+	{
+		Con_Printf( S_ERROR "%s: %s compressed with unknown algorithm\n", __FUNCTION__, pfile->name );
+		return NULL;
+	}
+
+	file = FS_OpenHandle( zip->filename, zip->handle, pfile->offset, pfile->size );
+
+	if( !file || pfile->flags == ZIP_COMPRESSION_NO_COMPRESSION )
+		return file;
+
+	// deflated entries are inflated on the fly by FS_Read
+	file->ztk = (ztoolkit_t *)Mem_Calloc( fs_mempool, sizeof( ztoolkit_t ));
+	Q_strncpy( file->ztk->name, pfile->name, sizeof( file->ztk->name ));
+	file->ztk->comp_length = pfile->compressed_size;
+	file->ztk->expected_crc = pfile->crc32;
+	CRC32_Init( &file->ztk->crc );
+
+	if( inflateInit2( &file->ztk->zstream, -MAX_WBITS ) != Z_OK )
 	{
-		Con_Printf( S_ERROR "%s: can't open compressed file %s\n", __FUNCTION__, pfile->name );
+		Con_Printf( S_ERROR "%s: inflateInit2 failed for %s\n", __FUNCTION__, pfile->name );
+		FS_Close( file );
 		return NULL;
 	}
 
-	return FS_OpenHandle( zip->filename, zip->handle, pfile->offset, pfile->size );
+	return file;
+}
+
+/*
+====================
+FS_RestartInflate
+
+Rewind a deflated zip entry to its beginning
+====================
+*/
+static void FS_RestartInflate( file_t *file )
+{
+	ztoolkit_t	*ztk = file->ztk;
+
+	inflateReset( &ztk->zstream );
+	ztk->zstream.avail_in = 0;
+	ztk->in_position = 0;
+	CRC32_Init( &ztk->crc );
+	ztk->out_position = 0;
+}
+
+/*
+====================
+FS_ZipCheckpoint
+
+Save the inflate state every checkpoint_step bytes,
+so backward seeks don't have to start over
+====================
+*/
+static void FS_ZipCheckpoint( file_t *file )
+{
+	ztoolkit_t	*ztk = file->ztk;
+	zipcheckpoint_t	*cp;
+	fs_offset_t	last = 0;
+
+	if( ztk->numcheckpoints >= ZIP_MAX_CHECKPOINTS )
+		return;
+
+	if( ztk->numcheckpoints )
+		last = ztk->checkpoints[ztk->numcheckpoints - 1].out_position;
+
+	if( ztk->out_position < last + ztk->checkpoint_step || ztk->out_position >= file->real_length )
+		return;
+
+	ztk->checkpoints = (zipcheckpoint_t *)Mem_Realloc( fs_mempool, ztk->checkpoints, sizeof( zipcheckpoint_t ) * ( ztk->numcheckpoints + 1 ));
+	cp = &ztk->checkpoints[ztk->numcheckpoints++];
+
+	cp->in_position = ztk->in_position - ztk->zstream.avail_in;
+	cp->out_position = ztk->out_position;
+	cp->crc = ztk->crc;
+	memcpy( &cp->state, ztk->zstream.state, sizeof( cp->state ));
+}
+
+/*
+====================
+FS_RestoreZipCheckpoint
+
+Continue inflating from a saved checkpoint
+====================
+*/
+static void FS_RestoreZipCheckpoint( file_t *file, const zipcheckpoint_t *cp )
+{
+	ztoolkit_t	*ztk = file->ztk;
+
+	memcpy( ztk->zstream.state, &cp->state, sizeof( cp->state ));
+	ztk->zstream.avail_in = 0;
+	ztk->in_position = cp->in_position;
+	ztk->crc = cp->crc;
+	ztk->out_position = cp->out_position;
+}
+
+/*
+====================
+FS_Inflate
+
+Inflate up to "count" bytes of a deflated zip entry into "buffer",
+reading the compressed data through a small window.
+Returns -1 if the stream is corrupted
+====================
+*/
+static fs_offset_t FS_Inflate( file_t *file, byte *buffer, fs_offset_t count )
+{
+	ztoolkit_t	*ztk = file->ztk;
+	fs_offset_t	done = 0, nb;
+	int		ret = Z_OK;
+
+	if( ztk->error )
+		return -1;
+
+	while( done < count )
+	{
+		// refill the input window
+		if( ztk->zstream.avail_in == 0 && ztk->in_position < ztk->comp_length )
+		{
+			nb = ztk->comp_length - ztk->in_position;
+			if( nb > (fs_offset_t)sizeof( ztk->input ))
+				nb = sizeof( ztk->input );
+
+			FS_EnsureOpenFile( file );
+			lseek( file->handle, file->offset + ztk->in_position, SEEK_SET );
+			nb = read( file->handle, ztk->input, nb );
+
+			if( nb <= 0 )
+			{
+				ret = Z_DATA_ERROR;
+				break;
+			}
+
+			fs_stats.readbytes += nb;
+			ztk->in_position += nb;
+			ztk->zstream.next_in = ztk->input;
+			ztk->zstream.avail_in = nb;
+		}
+
+		ztk->zstream.next_out = buffer + done;
+		ztk->zstream.avail_out = count - done;
+		ret = inflate( &ztk->zstream, Z_NO_FLUSH );
+
+		nb = ( count - done ) - ztk->zstream.avail_out;
+		CRC32_ProcessBuffer( &ztk->crc, buffer + done, nb );
+		ztk->out_position += nb;
+		done += nb;
+
+		if( ztk->checkpoint_step )
+			FS_ZipCheckpoint( file );
+
+		if( ret != Z_OK )
+			break;
+	}
+
+	if(( ret != Z_OK && ret != Z_STREAM_END ) || ( ret == Z_STREAM_END && ztk->out_position != file->real_length ))
+	{
+		Con_Reportf( S_ERROR "%s: %s: error while decompressing, zlib return code %d\n", __FUNCTION__, ztk->name, ret );
+		ztk->error = true;
+		return -1;
+	}
+
+	if( ztk->out_position == file->real_length && CRC32_Final( ztk->crc ) != ztk->expected_crc )
+	{
+		Con_Reportf( S_ERROR "%s: %s: file crc32 mismatch\n", __FUNCTION__, ztk->name );
+		ztk->error = true;
+		return -1;
+	}
+
+	return done;
+}
+
+/*
+====================
+FS_SeekDeflated
+
+Reposition a deflated zip entry. Forward seeks inflate and drop the data,
+backward seeks restart the stream from the nearest checkpoint
+====================
+*/
+static int FS_SeekDeflated( file_t *file, fs_offset_t offset )
+{
+	ztoolkit_t	*ztk = file->ztk;
+	zipcheckpoint_t	*cp = NULL;
+	fs_offset_t	count;
+	int		i;
+
+	if( ztk->error )
+		return -1;
+
+	for( i = ztk->numcheckpoints - 1; i >= 0; i-- )
+	{
+		if( ztk->checkpoints[i].out_position <= offset )
+		{
+			cp = &ztk->checkpoints[i];
+			break;
+		}
+	}
+
+	if( offset < ztk->out_position )
+	{
+		// file is used for random access, remember where to restart from
+		if( !ztk->checkpoint_step && file->real_length > ZIP_CHECKPOINT_STEP )
+			ztk->checkpoint_step = Q_max( ZIP_CHECKPOINT_STEP, file->real_length / ZIP_MAX_CHECKPOINTS );
+
+		if( cp ) FS_RestoreZipCheckpoint( file, cp );
+		else FS_RestartInflate( file );
+	}
+	else if( cp && cp->out_position > ztk->out_position )
+	{
+		FS_RestoreZipCheckpoint( file, cp );
+	}
+
+	while( ztk->out_position < offset )
+	{
+		count = offset - ztk->out_position;
+		if( count > (fs_offset_t)sizeof( file->buff ))
+			count = sizeof( file->buff );
+
+		if( FS_Inflate( file, file->buff, count ) <= 0 )
+			return -1;
+	}
+
+	file->position = offset;
+	return 0;
 }
 
 /*
@@ -2429,142 +2770,146 @@ qboolean FS_SysFolderExists( const char *path )
 
 /*
 ====================
-FS_FindFile
-
-Look for a file in the packages and in the filesystem
+FS_FindInPack
 
-Return the searchpath where the file was found (or NULL)
-and the file index in the package if relevant
+binary search, returns index of the file or -1
 ====================
 */
-static searchpath_t *FS_FindFile( const char *name, int *index, qboolean gamedironly )
+static int FS_FindInPack( pack_t *pak, const char *name )
 {
-	searchpath_t	*search;
-	char		*pEnvPath;
+	int	left, right, middle;
 
-	// search through the path, one element at a time
-	for( search = fs_searchpaths; search; search = search->next )
+	// look for the file (binary search)
+	left = 0;
+	right = pak->numfiles - 1;
+	while( left <= right )
 	{
-		if( gamedironly & !FBitSet( search->flags, FS_GAMEDIRONLY_SEARCH_FLAGS ))
-			continue;
+		int	diff;
 
-		// is the element a pak file?
-		if( search->pack )
-		{
-			int	left, right, middle;
-			pack_t	*pak;
+		middle = (left + right) / 2;
+		diff = Q_stricmp( pak->files[middle].name, name );
 
-			pak = search->pack;
+		// Found it
+		if( !diff )
+			return middle;
 
-			// look for the file (binary search)
-			left = 0;
-			right = pak->numfiles - 1;
-			while( left <= right )
-			{
-				int	diff;
+		// if we're too far in the list
+		if( diff > 0 )
+			right = middle - 1;
+		else left = middle + 1;
+	}
 
-				middle = (left + right) / 2;
-				diff = Q_stricmp( pak->files[middle].name, name );
+	return -1;
+}
 
-				// Found it
-				if( !diff )
-				{
-					if( index ) *index = middle;
-					return search;
-				}
+/*
+====================
+FS_FindInZip
 
-				// if we're too far in the list
-				if( diff > 0 )
-					right = middle - 1;
-				else left = middle + 1;
-			}
-		}
-		else if( search->wad )
-		{
-			dlumpinfo_t	*lump;
-			signed char		type = W_TypeFromExt( name );
-			qboolean		anywadname = true;
-			string		wadname, wadfolder;
-			string		shortname;
+binary search, returns index of the file or -1
+====================
+*/
+static int FS_FindInZip( zip_t *zip, const char *name )
+{
+	int     left, right, middle;
 
-			// quick reject by filetype
-			if( type == TYP_NONE ) continue;
-			COM_ExtractFilePath( name, wadname );
-			wadfolder[0] = '\0';
+	// look for the file (binary search)
+	left = 0;
+	right = zip->numfiles - 1;
 
-			if( COM_CheckStringEmpty( wadname ) )
-			{
-				COM_FileBase( wadname, wadname );
-				Q_strncpy( wadfolder, wadname, sizeof( wadfolder ));
-				COM_DefaultExtension( wadname, ".wad" );
-				anywadname = false;
-			}
+	while( left <= right )
+	{
+		int     diff;
 
-			// make wadname from wad fullpath
-			COM_FileBase( search->wad->filename, shortname );
-			COM_DefaultExtension( shortname, ".wad" );
+		middle = (left + right) / 2;
+		diff = Q_stricmp( zip->files[middle].name, name );
 
-			// quick reject by wadname
-			if( !anywadname && Q_stricmp( wadname, shortname ))
-				continue;
+		// Found it
+		if( !diff )
+			return middle;
 
-			// NOTE: we can't using long names for wad,
-			// because we using original wad names[16];
-			COM_FileBase( name, shortname );
+		// if we're too far in the list
+		if( diff > 0 )
+			right = middle - 1;
+		else left = middle + 1;
+	}
 
-			lump = W_FindLump( search->wad, shortname, type );
+	return -1;
+}
 
-			if( lump )
-			{
-				if( index )
-					*index = lump - search->wad->lumps;
-				return search;
-			}
-		}
-		else if( search->zip )
-		{
-			int     left, right, middle;
-			zip_t  *zip;
+/*
+====================
+FS_FindInWad
 
-			zip = search->zip;
+returns index of the lump or -1
+====================
+*/
+static int FS_FindInWad( wfile_t *wad, const char *name, signed char type )
+{
+	dlumpinfo_t	*lump;
+	qboolean		anywadname = true;
+	string		wadname, wadfolder;
+	string		shortname;
 
-			// look for the file (binary search)
-			left = 0;
-			right = zip->numfiles - 1;
+	// quick reject by filetype
+	if( type == TYP_NONE ) return -1;
+	COM_ExtractFilePath( name, wadname );
+	wadfolder[0] = '\0';
 
-			while( left <= right )
-			{
-				int     diff;
+	if( COM_CheckStringEmpty( wadname ) )
+	{
+		COM_FileBase( wadname, wadname );
+		Q_strncpy( wadfolder, wadname, sizeof( wadfolder ));
+		COM_DefaultExtension( wadname, ".wad" );
+		anywadname = false;
+	}
 
-				middle = (left + right) / 2;
-				diff = Q_stricmp( zip->files[middle].name, name );
+	// make wadname from wad fullpath
+	COM_FileBase( wad->filename, shortname );
+	COM_DefaultExtension( shortname, ".wad" );
 
-				// Found it
-				if( !diff )
-				{
-					if( index ) *index = middle;
-					return search;
-				}
+	// quick reject by wadname
+	if( !anywadname && Q_stricmp( wadname, shortname ))
+		return -1;
 
-				// if we're too far in the list
-				if( diff > 0 )
-					right = middle - 1;
-				else left = middle + 1;
-			}
-		}
-		else
-		{
-			char	netpath[MAX_SYSPATH];
+	// NOTE: we can't using long names for wad,
+	// because we using original wad names[16];
+	COM_FileBase( name, shortname );
 
-			Q_sprintf( netpath, "%s%s", search->filename, name );
+	lump = W_FindLump( wad, shortname, type );
 
-			if( FS_SysFileExists( netpath, !( search->flags & FS_CUSTOM_PATH ) ))
-			{
-				if( index != NULL ) *index = -1;
-				return search;
-			}
-		}
-	}
+	if( lump )
+		return lump - wad->lumps;
+	return -1;
+}
+
+/*
+====================
+FS_FindOnDisk
+
+====================
+*/
+static qboolean FS_FindOnDisk( searchpath_t *search, const char *name )
+{
+	char	netpath[MAX_SYSPATH];
+
+	Q_sprintf( netpath, "%s%s", search->filename, name );
+
+	return FS_SysFileExists( netpath, !( search->flags & FS_CUSTOM_PATH ));
+}
+
+/*
+====================
+FS_FindDirectPath
+
+Look for a file relative to the root folder,
+only when direct paths are allowed
+====================
+*/
+static searchpath_t *FS_FindDirectPath( const char *name, int *index )
+{
+	searchpath_t	*search;
+	char		*pEnvPath;
 
 	if( fs_ext_path )
 	{
@@ -2613,477 +2958,1702 @@ static searchpath_t *FS_FindFile( const char *name, int *index, qboolean gamedir
 	return NULL;
 }
 
-
 /*
-===========
-FS_OpenReadFile
+====================
+FS_WalkSearchPaths
 
-Look for a file in the search paths and open it in read-only mode
-===========
+Look for a file in every search path in turn, used for
+names the index can't answer and when it's disabled
+====================
 */
-file_t *FS_OpenReadFile( const char *filename, const char *mode, qboolean gamedironly )
+static searchpath_t *FS_WalkSearchPaths( const char *name, int *index, qboolean gamedironly )
 {
 	searchpath_t	*search;
-	int		pack_ind;
+	int		found;
 
-	search = FS_FindFile( filename, &pack_ind, gamedironly );
+	// search through the path, one element at a time
+	for( search = fs_searchpaths; search; search = search->next )
+	{
+		if( gamedironly & !FBitSet( search->flags, FS_GAMEDIRONLY_SEARCH_FLAGS ))
+			continue;
 
-	// not found?
-	if( search == NULL )
-		return NULL;
-
-	if( search->pack )
-		return FS_OpenPackedFile( search->pack, pack_ind );
-	else if( search->wad )
-		return NULL; // let W_LoadFile get lump correctly
-	else if( search->zip )
-		return FS_OpenZipFile( search->zip, pack_ind );
-	else if( pack_ind < 0 )
-	{
-		char	path [MAX_SYSPATH];
+		// is the element a pak file?
+		if( search->pack )
+			found = FS_FindInPack( search->pack, name );
+		else if( search->wad )
+			found = FS_FindInWad( search->wad, name, W_TypeFromExt( name ));
+		else if( search->zip )
+			found = FS_FindInZip( search->zip, name );
+		else if( FS_FindOnDisk( search, name ))
+		{
+			if( index != NULL ) *index = -1;
+			return search;
+		}
+		else continue;
 
-		// found in the filesystem?
-		Q_sprintf( path, "%s%s", search->filename, filename );
-		return FS_SysOpen( path, mode );
+		if( found != -1 )
+		{
+			if( index ) *index = found;
+			return search;
+		}
 	}
 
-	return NULL;
+	return FS_FindDirectPath( name, index );
 }
 
 /*
 =============================================================================
 
-MAIN PUBLIC FUNCTIONS
+FILE INDEX
+
+Files of every pak, zip and game directory are hashed by their
+lowercase names, so a lookup walks one bucket instead of doing a
+binary search per package and a stat, or a readdir to fix the
+case, per directory. The whole index is rebuilt on the first
+lookup after search paths change, directories are scanned
+recursively then. The engine's own writes update it in place,
+changes made by other programs are picked up from inotify on
+Linux, elsewhere files missing from the index are looked up on
+disk and removed ones need fs_rescan. Directories that are too big
+or can't be watched are left out and searched on disk, and wads
+keep their own matching rules, both still in search path order
 
 =============================================================================
 */
+#define FS_INDEX_MAX_FILES	65536	// per directory, bigger ones are searched on disk
+#define FS_INDEX_MIN_HASH	4096	// must be power of two
+
 /*
 ====================
-FS_Open
+FS_HashName
 
-Open a file. The syntax is the same as fopen
 ====================
 */
-file_t *FS_Open( const char *filepath, const char *mode, qboolean gamedironly )
+static uint FS_HashName( const char *name )
 {
-	// some stupid mappers used leading '/' or '\' in path to models or sounds
-	if( filepath[0] == '/' || filepath[0] == '\\' )
-		filepath++;
+	uint	hash = 2166136261u;
 
-	if( filepath[0] == '/' || filepath[0] == '\\' )
-		filepath++;
+	while( *name )
+		hash = ( hash ^ (byte)Q_tolower( *name++ )) * 16777619u;
 
-	if( FS_CheckNastyPath( filepath, false ))
-		return NULL;
+	return hash;
+}
 
-	// if the file is opened in "write", "append", or "read/write" mode
-	if( mode[0] == 'w' || mode[0] == 'a'|| mode[0] == 'e' || Q_strchr( mode, '+' ))
+/*
+====================
+FS_IndexableName
+
+names that can go through FS_SysFileExists in other ways
+than by exact path, and dotfiles, are left to the walk
+====================
+*/
+static qboolean FS_IndexableName( const char *name )
+{
+	const char	*p;
+
+	if( !COM_CheckString( name ) || name[0] == '.' || name[0] == '/' )
+		return false;
+
+	for( p = name; *p; p++ )
 	{
-		char	real_path[MAX_SYSPATH];
+		if( *p == '\\' || *p == ':' )
+			return false;
 
-		// open the file on disk directly
-		Q_sprintf( real_path, "%s/%s", fs_writedir, filepath );
-		FS_CreatePath( real_path );// Create directories up to the file
-		return FS_SysOpen( real_path, mode );
+		if( *p == '/' && ( p[1] == '/' || p[1] == '.' ))
+			return false;
 	}
 
-	// else, we look at the various search paths and open the file in read-only mode
-	return FS_OpenReadFile( filepath, mode, gamedironly );
+	return true;
 }
 
 /*
 ====================
-FS_Close
+FS_IndexNameMatch
 
-Close a file
+packages are always case insensitive, files on disk follow
+the rules of FS_SysFileExists where only the last path element
+may differ in case
 ====================
 */
-int FS_Close( file_t *file )
+static qboolean FS_IndexNameMatch( const fs_indexentry_t *e, const char *name )
 {
-	if( !file ) return 0;
+#if !XASH_WIN32
+	const char	*base;
+	size_t		len;
 
-	FS_BackupFileName( file, NULL, 0 );
+	if( e->index < 0 )
+	{
+		if( !fs_caseinsensitive || FBitSet( e->search->flags, FS_CUSTOM_PATH ))
+			return !Q_strcmp( e->name, name );
 
-	if( file->handle >= 0 )
-		if( close( file->handle ))
-			return EOF;
+		base = Q_strrchr( name, '/' );
+		len = base ? base - name + 1 : 0;
 
-	Mem_Free( file );
-	return 0;
+		return !Q_strncmp( e->name, name, len ) && !Q_stricmp( e->name + len, name + len );
+	}
+#endif
+	return !Q_stricmp( e->name, name );
 }
 
 /*
 ====================
-FS_Write
+FS_InvalidateIndex
 
-Write "datasize" bytes into a file
 ====================
 */
-fs_offset_t FS_Write( file_t *file, const void *data, size_t datasize )
+static void FS_InvalidateIndex( void )
 {
-	fs_offset_t	result;
+	int	i;
 
-	if( !file ) return 0;
+	// search paths may be freed before the rebuild,
+	// don't let late events reach them
+	for( i = 0; i < fs_index.numwatches; i++ )
+		fs_index.watches[i].search = NULL;
 
-	// if necessary, seek to the exact file position we're supposed to be
-	if( file->buff_ind != file->buff_len )
-		lseek( file->handle, file->buff_ind - file->buff_len, SEEK_CUR );
+	fs_index.valid = false;
+}
 
-	// purge cached data
-	FS_Purge( file );
+/*
+====================
+FS_IndexFindExact
 
-	// write the buffer and update the position
-	result = write( file->handle, data, (fs_offset_t)datasize );
-	file->position = lseek( file->handle, 0, SEEK_CUR );
+entry of a file on disk with exactly this name
+====================
+*/
+static fs_indexentry_t *FS_IndexFindExact( searchpath_t *search, const char *name )
+{
+	uint		hash = FS_HashName( name );
+	fs_indexentry_t	*e;
 
-	if( file->real_length < file->position )
-		file->real_length = file->position;
+	for( e = fs_index.hash[hash & ( fs_index.hashsize - 1 )]; e; e = e->next )
+	{
+		if( e->hash == hash && e->search == search && !Q_strcmp( e->name, name ))
+			return e;
+	}
 
-	if( result < 0 )
-		return 0;
-	return result;
+	return NULL;
 }
 
 /*
 ====================
-FS_Read
+FS_IndexInsert
 
-Read up to "buffersize" bytes from a file
 ====================
 */
-fs_offset_t FS_Read( file_t *file, void *buffer, size_t buffersize )
+static void FS_IndexInsert( searchpath_t *search, const char *name, int index )
 {
-	fs_offset_t	count, done;
-	fs_offset_t	nb;
-
-	// nothing to copy
-	if( buffersize == 0 ) return 1;
+	fs_indexentry_t	*e, **bucket;
+	uint		i;
 
-	// Get rid of the ungetc character
-	if( file->ungetc != EOF )
+	if( fs_index.numentries >= fs_index.hashsize * 2 )
 	{
-		((char*)buffer)[0] = file->ungetc;
-		buffersize--;
-		file->ungetc = EOF;
-		done = 1;
+		fs_indexentry_t	**old = fs_index.hash;
+		uint		oldsize = fs_index.hashsize;
+
+		fs_index.hashsize *= 2;
+		fs_index.hash = Mem_Calloc( fs_index.mempool, fs_index.hashsize * sizeof( *fs_index.hash ));
+
+		for( i = 0; i < oldsize; i++ )
+		{
+			while(( e = old[i] ) != NULL )
+			{
+				old[i] = e->next;
+				bucket = &fs_index.hash[e->hash & ( fs_index.hashsize - 1 )];
+				e->next = *bucket;
+				*bucket = e;
+			}
+		}
+
+		Mem_Free( old );
 	}
-	else done = 0;
 
-	// first, we copy as many bytes as we can from "buff"
-	if( file->buff_ind < file->buff_len )
+	if( index < 0 )
 	{
-		count = file->buff_len - file->buff_ind;
-
-		done += ((fs_offset_t)buffersize > count ) ? count : (fs_offset_t)buffersize;
-		memcpy( buffer, &file->buff[file->buff_ind], done );
-		file->buff_ind += done;
+		size_t	len = Q_strlen( name ) + 1;
 
-		buffersize -= done;
-		if( buffersize == 0 )
-			return done;
+		// names of files on disk live right after their entries
+		e = Mem_Malloc( fs_index.mempool, sizeof( *e ) + len );
+		memcpy( e + 1, name, len );
+		e->name = (const char *)( e + 1 );
+	}
+	else
+	{
+		e = Mem_Malloc( fs_index.mempool, sizeof( *e ));
+		e->name = name;
 	}
 
-	// NOTE: at this point, the read buffer is always empty
+	e->search = search;
+	e->index = index;
+	e->hash = FS_HashName( name );
 
-	FS_EnsureOpenFile( file );
-	// we must take care to not read after the end of the file
-	count = file->real_length - file->position;
+	bucket = &fs_index.hash[e->hash & ( fs_index.hashsize - 1 )];
+	e->next = *bucket;
+	*bucket = e;
 
-	// if we have a lot of data to get, put them directly into "buffer"
-	if( buffersize > sizeof( file->buff ) / 2 )
+	fs_index.numentries++;
+	search->numindexed++;
+}
+
+/*
+====================
+FS_IndexRemove
+
+====================
+*/
+static void FS_IndexRemove( fs_indexentry_t *e )
+{
+	fs_indexentry_t	**link;
+
+	for( link = &fs_index.hash[e->hash & ( fs_index.hashsize - 1 )]; *link; link = &(*link)->next )
 	{
-		if( count > (fs_offset_t)buffersize )
-			count = (fs_offset_t)buffersize;
-		lseek( file->handle, file->offset + file->position, SEEK_SET );
-		nb = read (file->handle, &((byte *)buffer)[done], count );
+		if( *link != e )
+			continue;
 
-		if( nb > 0 )
+		*link = e->next;
+		e->search->numindexed--;
+		fs_index.numentries--;
+		Mem_Free( e );
+		return;
+	}
+}
+
+/*
+====================
+FS_IndexRemoveSearch
+
+drops a search path that will be searched on disk
+====================
+*/
+static void FS_IndexRemoveSearch( searchpath_t *search )
+{
+	fs_indexentry_t	**link, *e;
+	uint		i;
+	int		j;
+
+	for( i = 0; i < fs_index.hashsize; i++ )
+	{
+		for( link = &fs_index.hash[i]; ( e = *link ) != NULL; )
 		{
-			done += nb;
-			file->position += nb;
-			// purge cached data
-			FS_Purge( file );
+			if( e->search != search )
+			{
+				link = &e->next;
+				continue;
+			}
+
+			*link = e->next;
+			fs_index.numentries--;
+			Mem_Free( e );
 		}
 	}
-	else
+
+	for( j = 0; j < fs_index.numwatches; j++ )
 	{
-		if( count > (fs_offset_t)sizeof( file->buff ))
-			count = (fs_offset_t)sizeof( file->buff );
-		lseek( file->handle, file->offset + file->position, SEEK_SET );
-		nb = read( file->handle, file->buff, count );
+		if( fs_index.watches[j].search == search )
+			fs_index.watches[j].search = NULL;
+	}
 
-		if( nb > 0 )
-		{
-			file->buff_len = nb;
-			file->position += nb;
+	search->numindexed = 0;
+	search->indexed = false;
+}
 
-			// copy the requested data in "buffer" (as much as we can)
-			count = (fs_offset_t)buffersize > file->buff_len ? file->buff_len : (fs_offset_t)buffersize;
-			memcpy( &((byte *)buffer)[done], file->buff, count );
-			file->buff_ind = count;
-			done += count;
-		}
+/*
+====================
+FS_IndexAddWatch
+
+====================
+*/
+static qboolean FS_IndexAddWatch( searchpath_t *search, const char *path, const char *reldir )
+{
+#if XASH_LINUX
+	fs_watch_t	*w;
+	int		wd;
+
+	if( fs_index.inotify < 0 )
+		return false;
+
+	wd = inotify_add_watch( fs_index.inotify, path, IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR );
+
+	if( wd < 0 )
+		return false;
+
+	if( fs_index.numwatches == fs_index.maxwatches )
+	{
+		fs_index.maxwatches = Q_max( fs_index.maxwatches * 2, 64 );
+		if( fs_index.watches )
+			fs_index.watches = Mem_Realloc( fs_index.mempool, fs_index.watches, fs_index.maxwatches * sizeof( fs_watch_t ));
+		else fs_index.watches = Mem_Malloc( fs_index.mempool, fs_index.maxwatches * sizeof( fs_watch_t ));
 	}
 
-	return done;
+	w = &fs_index.watches[fs_index.numwatches++];
+	w->wd = wd;
+	w->search = search;
+	w->dir = Mem_Malloc( fs_index.mempool, Q_strlen( reldir ) + 1 );
+	Q_strcpy( w->dir, reldir );
+#endif
+	return true;
 }
 
+static qboolean FS_IndexScan( searchpath_t *search, const char *reldir );
+
 /*
 ====================
-FS_Print
+FS_IndexScanEntry
 
-Print a string into a file
 ====================
 */
-int FS_Print( file_t *file, const char *msg )
+static qboolean FS_IndexScanEntry( searchpath_t *search, const char *reldir, const char *name, qboolean isdir )
 {
-	return FS_Write( file, msg, Q_strlen( msg ));
+	char	relpath[MAX_SYSPATH];
+
+	// dotfiles and dot directories never pass FS_IndexableName
+	if( name[0] == '.' )
+		return true;
+
+	if( Q_snprintf( relpath, sizeof( relpath ), isdir ? "%s%s/" : "%s%s", reldir, name ) < 0 )
+		return true; // too long to be looked up anyway
+
+	if( isdir )
+		return FS_IndexScan( search, relpath );
+
+	if( search->numindexed >= FS_INDEX_MAX_FILES )
+		return false;
+
+	// the engine may have added it already
+	if( !FS_IndexFindExact( search, relpath ))
+		FS_IndexInsert( search, relpath, -1 );
+
+	return true;
 }
 
 /*
 ====================
-FS_Printf
+FS_IndexScan
 
-Print a string into a file
+adds every file below the directory, returns
+false if it's too big or couldn't be watched
 ====================
 */
-int FS_Printf( file_t *file, const char *format, ... )
+static qboolean FS_IndexScan( searchpath_t *search, const char *reldir )
 {
-	int	result;
-	va_list	args;
+	char		path[MAX_SYSPATH];
+	qboolean		ok = true;
+#if XASH_WIN32
+	struct _finddata_t	n_file;
+	intptr_t		hFile;
+#elif !XASH_DOS4GW
+	char		filepath[MAX_SYSPATH];
+	struct dirent	*entry;
+	struct stat	buf;
+	qboolean		isdir;
+	DIR		*dir;
+#endif
+
+	Q_snprintf( path, sizeof( path ), "%s%s", search->filename, reldir );
+
+#if XASH_WIN32
+	Q_strncat( path, "*", sizeof( path ));
+
+	if(( hFile = _findfirst( path, &n_file )) == -1 )
+		return true;
+
+	do
+	{
+		ok = FS_IndexScanEntry( search, reldir, n_file.name, FBitSet( n_file.attrib, _A_SUBDIR ));
+	} while( ok && _findnext( hFile, &n_file ) == 0 );
+
+	_findclose( hFile );
+#elif XASH_DOS4GW
+	// names are mangled to 8.3 by FS_FixFileCase, leave them to it
+	ok = false;
+#else
+	if( !FS_IndexAddWatch( search, path, reldir ))
+	{
+		// missing search paths are empty until a directory appears
+		if( !*reldir && errno == ENOENT )
+		{
+			fs_index.missingroots = true;
+			return true;
+		}
+		return false;
+	}
+
+	if( !( dir = opendir( path )))
+		return true;
+
+	while( ok && ( entry = readdir( dir )))
+	{
+#ifdef DT_DIR
+		if( entry->d_type == DT_DIR )
+			isdir = true;
+		else if( entry->d_type == DT_REG )
+			isdir = false;
+		else
+#endif
+		{
+			// symlinks and filesystems that don't tell the type
+			Q_snprintf( filepath, sizeof( filepath ), "%s%s", path, entry->d_name );
+
+			if( stat( filepath, &buf ) < 0 )
+				continue;
+
+			if( S_ISDIR( buf.st_mode ))
+				isdir = true;
+			else if( S_ISREG( buf.st_mode ))
+				isdir = false;
+			else continue;
+		}
+
+		ok = FS_IndexScanEntry( search, reldir, entry->d_name, isdir );
+	}
+
+	closedir( dir );
+#endif
+	return ok;
+}
+
+/*
+====================
+FS_ClearIndex
+
+====================
+*/
+static void FS_ClearIndex( void )
+{
+	if( fs_index.mempool )
+		Mem_EmptyPool( fs_index.mempool );
+	else fs_index.mempool = Mem_AllocPool( "FileSystem Index" );
+
+	fs_index.hash = NULL;
+	fs_index.watches = NULL;
+	fs_index.numentries = fs_index.hashsize = 0;
+	fs_index.numwatches = fs_index.maxwatches = 0;
+	fs_index.missingroots = false;
+	fs_index.valid = false;
+}
+
+/*
+====================
+FS_FreeIndex
+
+====================
+*/
+static void FS_FreeIndex( void )
+{
+	FS_ClearIndex();
+	Mem_FreePool( &fs_index.mempool );
+#if XASH_LINUX
+	if( fs_index.inotify >= 0 )
+		close( fs_index.inotify );
+#endif
+	fs_index.inotify = -1;
+}
+
+/*
+====================
+FS_BuildIndex
+
+====================
+*/
+static void FS_BuildIndex( void )
+{
+	double		start = Sys_DoubleTime();
+	searchpath_t	*search;
+	int		i, order = 0;
+
+	FS_ClearIndex();
+
+	fs_index.hashsize = FS_INDEX_MIN_HASH;
+	fs_index.hash = Mem_Calloc( fs_index.mempool, fs_index.hashsize * sizeof( *fs_index.hash ));
+#if XASH_LINUX
+	// closing inotify is slow, keep it and let old watches
+	// go stale, events from before the scan are dropped
+	if( fs_index.inotify < 0 )
+		fs_index.inotify = inotify_init1( IN_NONBLOCK|IN_CLOEXEC );
+	else
+	{
+		char	buf[4096];
+
+		while( read( fs_index.inotify, buf, sizeof( buf )) > 0 );
+	}
+#endif
+
+	for( search = fs_searchpaths; search; search = search->next )
+	{
+		search->order = order++;
+		search->numindexed = 0;
+		search->indexed = false;
+
+		if( search->pack )
+		{
+			for( i = 0; i < search->pack->numfiles; i++ )
+				FS_IndexInsert( search, search->pack->files[i].name, i );
+			search->indexed = true;
+		}
+		else if( search->zip )
+		{
+			for( i = 0; i < search->zip->numfiles; i++ )
+				FS_IndexInsert( search, search->zip->files[i].name, i );
+			search->indexed = true;
+		}
+		else if( !search->wad )
+		{
+			if( FS_IndexScan( search, "" ))
+			{
+				search->indexed = true;
+			}
+			else
+			{
+				Con_Reportf( "FS_BuildIndex: %s is searched on disk\n", search->filename );
+				FS_IndexRemoveSearch( search );
+			}
+		}
+	}
+
+	fs_index.valid = true;
+	fs_index.lastpoll = host.realtime;
+
+	Con_Reportf( "FS_BuildIndex: %u files in %.2f ms\n", fs_index.numentries, ( Sys_DoubleTime() - start ) * 1000.0 );
+}
+
+#if XASH_LINUX
+/*
+====================
+FS_IndexWatchEvent
+
+====================
+*/
+static void FS_IndexWatchEvent( int watch, const struct inotify_event *ev )
+{
+	searchpath_t	*search = fs_index.watches[watch].search;
+	char		relpath[MAX_SYSPATH];
+	fs_indexentry_t	*e;
+
+	if( !search )
+		return;
+
+	// watch descriptors are reused once the kernel drops them
+	if( FBitSet( ev->mask, IN_IGNORED ))
+	{
+		fs_index.watches[watch].search = NULL;
+		return;
+	}
+
+	if( !ev->len || ev->name[0] == '.' )
+		return;
+
+	if( Q_snprintf( relpath, sizeof( relpath ), "%s%s", fs_index.watches[watch].dir, ev->name ) < 0 )
+		return;
+
+	if( FBitSet( ev->mask, IN_ISDIR ))
+	{
+		if( FBitSet( ev->mask, IN_CREATE|IN_MOVED_TO ) && !fs_index.missingroots )
+		{
+			Q_strncat( relpath, "/", sizeof( relpath ));
+			if( FS_IndexScan( search, relpath ))
+				return;
+		}
+
+		// a whole subtree went away, didn't fit or
+		// may be a missing search path, start over
+		FS_InvalidateIndex();
+		return;
+	}
+
+	e = FS_IndexFindExact( search, relpath );
+
+	if( FBitSet( ev->mask, IN_CREATE|IN_MOVED_TO ) && !e )
+		FS_IndexInsert( search, relpath, -1 );
+	else if( FBitSet( ev->mask, IN_DELETE|IN_MOVED_FROM ) && e )
+		FS_IndexRemove( e );
+}
+#endif // XASH_LINUX
+
+/*
+====================
+FS_PollIndexWatches
+
+once per host frame, so loading a level costs no syscalls
+====================
+*/
+static void FS_PollIndexWatches( void )
+{
+#if XASH_LINUX
+	union
+	{
+		struct inotify_event	ev;
+		char			buf[4096];
+	} events;
+	struct inotify_event	*ev;
+	ssize_t			len, ofs;
+	int			i;
+
+	if( fs_index.inotify < 0 || fs_index.lastpoll == host.realtime )
+		return;
+
+	fs_index.lastpoll = host.realtime;
+
+	while(( len = read( fs_index.inotify, events.buf, sizeof( events.buf ))) > 0 )
+	{
+		// the rebuild will see these changes anyway
+		if( !fs_index.valid )
+			continue;
+
+		for( ofs = 0; ofs < len; ofs += sizeof( struct inotify_event ) + ev->len )
+		{
+			ev = (struct inotify_event *)( events.buf + ofs );
+
+			if( FBitSet( ev->mask, IN_Q_OVERFLOW ))
+			{
+				FS_InvalidateIndex();
+				return;
+			}
+
+			// several search paths may share a directory
+			for( i = 0; i < fs_index.numwatches; i++ )
+			{
+				if( fs_index.watches[i].wd == ev->wd )
+					FS_IndexWatchEvent( i, ev );
+
+				if( !fs_index.valid )
+					return;
+			}
+		}
+	}
+#endif
+}
+
+/*
+====================
+FS_IndexWrittenFile
+
+keeps the index in step with files the engine itself
+creates, renames or deletes in the write directory
+====================
+*/
+static void FS_IndexWrittenFile( const char *name, qboolean exists )
+{
+	searchpath_t	*search;
+	fs_indexentry_t	*e;
+
+	if( !fs_index.valid || !FS_IndexableName( name ))
+		return;
+
+	for( search = fs_searchpaths; search; search = search->next )
+	{
+		if( !search->indexed || search->pack || search->zip || Q_strcmp( search->filename, fs_writedir ))
+			continue;
+
+		e = FS_IndexFindExact( search, name );
+
+		if( exists && !e )
+			FS_IndexInsert( search, name, -1 );
+		else if( !exists && e )
+			FS_IndexRemove( e );
+	}
+}
+
+/*
+====================
+FS_FindIndexed
+
+====================
+*/
+static searchpath_t *FS_FindIndexed( const char *name, int *index, qboolean gamedironly )
+{
+	uint		hash = FS_HashName( name );
+	fs_indexentry_t	*e, *best = NULL;
+	searchpath_t	*search;
+	signed char	type;
+	int		found;
+
+	for( e = fs_index.hash[hash & ( fs_index.hashsize - 1 )]; e; e = e->next )
+	{
+		if( e->hash != hash || ( best && best->search->order <= e->search->order ))
+			continue;
+
+		if( gamedironly & !FBitSet( e->search->flags, FS_GAMEDIRONLY_SEARCH_FLAGS ))
+			continue;
+
+		if( FS_IndexNameMatch( e, name ))
+			best = e;
+	}
+
+	// wads and directories left out of the index
+	// may still come first in the search order
+	type = W_TypeFromExt( name );
+
+	for( search = fs_searchpaths; search && ( !best || search != best->search ); search = search->next )
+	{
+		if( search->indexed )
+			continue;
+
+		if( gamedironly & !FBitSet( search->flags, FS_GAMEDIRONLY_SEARCH_FLAGS ))
+			continue;
+
+		if( search->wad )
+		{
+			if(( found = FS_FindInWad( search->wad, name, type )) == -1 )
+				continue;
+
+			if( index ) *index = found;
+			return search;
+		}
+
+		if( FS_FindOnDisk( search, name ))
+		{
+			if( index ) *index = -1;
+			return search;
+		}
+	}
+
+	if( best )
+	{
+		if( index ) *index = best->index;
+		return best->search;
+	}
+
+	// without inotify files made by other programs are
+	// unknown to the index, look for them on disk
+	if( fs_index.inotify < 0 )
+	{
+		for( search = fs_searchpaths; search; search = search->next )
+		{
+			if( !search->indexed || search->pack || search->zip )
+				continue;
+
+			if( gamedironly & !FBitSet( search->flags, FS_GAMEDIRONLY_SEARCH_FLAGS ))
+				continue;
+
+			if( FS_FindOnDisk( search, name ))
+			{
+				if( index ) *index = -1;
+				return search;
+			}
+		}
+	}
+
+	return FS_FindDirectPath( name, index );
+}
+
+/*
+====================
+FS_FindFile
+
+Look for a file in the packages and in the filesystem
+
+Return the searchpath where the file was found (or NULL)
+and the file index in the package if relevant
+====================
+*/
+static searchpath_t *FS_FindFile( const char *name, int *index, qboolean gamedironly )
+{
+	double		start = Sys_DoubleTime();
+	searchpath_t	*search;
+
+	if( !fs_index.disabled && FS_IndexableName( name ))
+	{
+		FS_PollIndexWatches();
+
+		if( !fs_index.valid )
+			FS_BuildIndex();
+
+		search = FS_FindIndexed( name, index, gamedironly );
+	}
+	else search = FS_WalkSearchPaths( name, index, gamedironly );
+
+	fs_stats.lookups++;
+	fs_stats.lookuptime += Sys_DoubleTime() - start;
+
+	return search;
+}
+
+/*
+====================
+FS_ResetStats
+
+====================
+*/
+void FS_ResetStats( void )
+{
+	memset( &fs_stats, 0, sizeof( fs_stats ));
+
+	fs_loadstats.numassets = 0;
+	memset( fs_loadstats.hash, 0, sizeof( fs_loadstats.hash ));
+}
+
+/*
+====================
+FS_GetStats
+
+lookups and disk reads since the last reset
+====================
+*/
+void FS_GetStats( fs_stats_t *stats )
+{
+	*stats = fs_stats;
+}
+
+
+/*
+===========
+FS_OpenReadFile
+
+Look for a file in the search paths and open it in read-only mode
+===========
+*/
+file_t *FS_OpenReadFile( const char *filename, const char *mode, qboolean gamedironly )
+{
+	searchpath_t	*search;
+	int		pack_ind;
+
+	search = FS_FindFile( filename, &pack_ind, gamedironly );
+
+	// not found?
+	if( search == NULL )
+		return NULL;
+
+	if( search->pack )
+		return FS_OpenPackedFile( search->pack, pack_ind );
+	else if( search->wad )
+		return NULL; // let W_LoadFile get lump correctly
+	else if( search->zip )
+		return FS_OpenZipFile( search->zip, pack_ind );
+	else if( pack_ind < 0 )
+	{
+		char	path [MAX_SYSPATH];
+
+		// found in the filesystem?
+		Q_sprintf( path, "%s%s", search->filename, filename );
+		return FS_SysOpen( path, mode );
+	}
+
+	return NULL;
+}
+
+/*
+=============================================================================
+
+MAIN PUBLIC FUNCTIONS
+
+=============================================================================
+*/
+/*
+====================
+FS_Open
+
+Open a file. The syntax is the same as fopen
+====================
+*/
+file_t *FS_Open( const char *filepath, const char *mode, qboolean gamedironly )
+{
+	// some stupid mappers used leading '/' or '\' in path to models or sounds
+	if( filepath[0] == '/' || filepath[0] == '\\' )
+		filepath++;
+
+	if( filepath[0] == '/' || filepath[0] == '\\' )
+		filepath++;
+
+	if( FS_CheckNastyPath( filepath, false ))
+		return NULL;
+
+	// if the file is opened in "write", "append", or "read/write" mode
+	if( mode[0] == 'w' || mode[0] == 'a'|| mode[0] == 'e' || Q_strchr( mode, '+' ))
+	{
+		char	real_path[MAX_SYSPATH];
+		file_t	*file;
+
+		// open the file on disk directly
+		Q_sprintf( real_path, "%s/%s", fs_writedir, filepath );
+		FS_CreatePath( real_path );// Create directories up to the file
+
+		if(( file = FS_SysOpen( real_path, mode )) != NULL )
+			FS_IndexWrittenFile( filepath, true );
+		return file;
+	}
+
+	// else, we look at the various search paths and open the file in read-only mode
+	return FS_OpenReadFile( filepath, mode, gamedironly );
+}
+
+/*
+====================
+FS_Close
+
+Close a file
+====================
+*/
+int FS_Close( file_t *file )
+{
+	if( !file ) return 0;
+
+	FS_BackupFileName( file, NULL, 0 );
+
+	if( file->ztk )
+	{
+		inflateEnd( &file->ztk->zstream );
+		if( file->ztk->checkpoints )
+			Mem_Free( file->ztk->checkpoints );
+		Mem_Free( file->ztk );
+	}
+
+	if( file->handle >= 0 )
+		if( close( file->handle ))
+			return EOF;
+
+	Mem_Free( file );
+	return 0;
+}
+
+/*
+====================
+FS_Write
+
+Write "datasize" bytes into a file
+====================
+*/
+fs_offset_t FS_Write( file_t *file, const void *data, size_t datasize )
+{
+	fs_offset_t	result;
+
+	if( !file ) return 0;
+
+	// if necessary, seek to the exact file position we're supposed to be
+	if( file->buff_ind != file->buff_len )
+		lseek( file->handle, file->buff_ind - file->buff_len, SEEK_CUR );
+
+	// purge cached data
+	FS_Purge( file );
+
+	// write the buffer and update the position
+	result = write( file->handle, data, (fs_offset_t)datasize );
+	file->position = lseek( file->handle, 0, SEEK_CUR );
+
+	if( file->real_length < file->position )
+		file->real_length = file->position;
+
+	if( result < 0 )
+		return 0;
+	return result;
+}
+
+/*
+====================
+FS_SysRead
+
+Read "count" bytes at the current position
+straight from the file descriptor, or inflate them
+====================
+*/
+static fs_offset_t FS_SysRead( file_t *file, void *buffer, fs_offset_t count )
+{
+	fs_offset_t	nb;
+
+	if( file->ztk )
+		return FS_Inflate( file, buffer, count );
+
+	lseek( file->handle, file->offset + file->position, SEEK_SET );
+	nb = read( file->handle, buffer, count );
+
+	if( nb > 0 )
+		fs_stats.readbytes += nb;
+
+	return nb;
+}
+
+/*
+====================
+FS_Read
+
+Read up to "buffersize" bytes from a file
+====================
+*/
+fs_offset_t FS_Read( file_t *file, void *buffer, size_t buffersize )
+{
+	fs_offset_t	count, done;
+	fs_offset_t	nb;
+	double		start;
+
+	// nothing to copy
+	if( buffersize == 0 ) return 1;
+
+	// Get rid of the ungetc character
+	if( file->ungetc != EOF )
+	{
+		((char*)buffer)[0] = file->ungetc;
+		buffersize--;
+		file->ungetc = EOF;
+		done = 1;
+	}
+	else done = 0;
+
+	// first, we copy as many bytes as we can from "buff"
+	if( file->buff_ind < file->buff_len )
+	{
+		count = file->buff_len - file->buff_ind;
+
+		done += ((fs_offset_t)buffersize > count ) ? count : (fs_offset_t)buffersize;
+		memcpy( buffer, &file->buff[file->buff_ind], done );
+		file->buff_ind += done;
+
+		buffersize -= done;
+		if( buffersize == 0 )
+			return done;
+	}
+
+	// NOTE: at this point, the read buffer is always empty
+	start = Sys_DoubleTime();
+
+	FS_EnsureOpenFile( file );
+	// we must take care to not read after the end of the file
+	count = file->real_length - file->position;
+
+	// if we have a lot of data to get, put them directly into "buffer"
+	if( buffersize > sizeof( file->buff ) / 2 )
+	{
+		if( count > (fs_offset_t)buffersize )
+			count = (fs_offset_t)buffersize;
+		nb = FS_SysRead( file, &((byte *)buffer)[done], count );
+
+		if( nb > 0 )
+		{
+			done += nb;
+			file->position += nb;
+			// purge cached data
+			FS_Purge( file );
+		}
+	}
+	else
+	{
+		if( count > (fs_offset_t)sizeof( file->buff ))
+			count = (fs_offset_t)sizeof( file->buff );
+		nb = FS_SysRead( file, file->buff, count );
+
+		if( nb > 0 )
+		{
+			file->buff_len = nb;
+			file->position += nb;
+
+			// copy the requested data in "buffer" (as much as we can)
+			count = (fs_offset_t)buffersize > file->buff_len ? file->buff_len : (fs_offset_t)buffersize;
+			memcpy( &((byte *)buffer)[done], file->buff, count );
+			file->buff_ind = count;
+			done += count;
+		}
+	}
+
+	fs_stats.readtime += Sys_DoubleTime() - start;
+
+	return done;
+}
+
+/*
+====================
+FS_Print
+
+Print a string into a file
+====================
+*/
+int FS_Print( file_t *file, const char *msg )
+{
+	return FS_Write( file, msg, Q_strlen( msg ));
+}
+
+/*
+====================
+FS_Printf
+
+Print a string into a file
+====================
+*/
+int FS_Printf( file_t *file, const char *format, ... )
+{
+	int	result;
+	va_list	args;
+
+	va_start( args, format );
+	result = FS_VPrintf( file, format, args );
+	va_end( args );
+
+	return result;
+}
+
+/*
+====================
+FS_VPrintf
+
+Print a string into a file
+====================
+*/
+int FS_VPrintf( file_t *file, const char *format, va_list ap )
+{
+	int	len;
+	fs_offset_t	buff_size = MAX_SYSPATH;
+	char	*tempbuff;
+
+	if( !file ) return 0;
+
+	while( 1 )
+	{
+		tempbuff = (char *)Mem_Malloc( fs_mempool, buff_size );
+		len = Q_vsprintf( tempbuff, format, ap );
+
+		if( len >= 0 && len < buff_size )
+			break;
+
+		Mem_Free( tempbuff );
+		buff_size *= 2;
+	}
+
+	len = write( file->handle, tempbuff, len );
+	Mem_Free( tempbuff );
+
+	return len;
+}
+
+/*
+====================
+FS_Getc
+
+Get the next character of a file
+====================
+*/
+int FS_Getc( file_t *file )
+{
+	char	c;
+
+	if( FS_Read( file, &c, 1 ) != 1 )
+		return EOF;
+
+	return c;
+}
+
+/*
+====================
+FS_UnGetc
+
+Put a character back into the read buffer (only supports one character!)
+====================
+*/
+int FS_UnGetc( file_t *file, byte c )
+{
+	// If there's already a character waiting to be read
+	if( file->ungetc != EOF )
+		return EOF;
+
+	file->ungetc = c;
+	return c;
+}
+
+/*
+====================
+FS_Gets
+
+Same as fgets
+====================
+*/
+int FS_Gets( file_t *file, byte *string, size_t bufsize )
+{
+	int	c, end = 0;
+
+	while( 1 )
+	{
+		c = FS_Getc( file );
+
+		if( c == '\r' || c == '\n' || c < 0 )
+			break;
+
+		if( end < bufsize - 1 )
+			string[end++] = c;
+	}
+	string[end] = 0;
+
+	// remove \n following \r
+	if( c == '\r' )
+	{
+		c = FS_Getc( file );
+
+		if( c != '\n' )
+			FS_UnGetc( file, (byte)c );
+	}
+
+	return c;
+}
+
+/*
+====================
+FS_Seek
+
+Move the position index in a file
+====================
+*/
+int FS_Seek( file_t *file, fs_offset_t offset, int whence )
+{
+	// compute the file offset
+	switch( whence )
+	{
+	case SEEK_CUR:
+		offset += file->position - file->buff_len + file->buff_ind;
+		break;
+	case SEEK_SET:
+		break;
+	case SEEK_END:
+		offset += file->real_length;
+		break;
+	default:
+		return -1;
+	}
+
+	if( offset < 0 || offset > file->real_length )
+		return -1;
+
+	// if we have the data in our read buffer, we don't need to actually seek
+	if( file->position - file->buff_len <= offset && offset <= file->position )
+	{
+		file->buff_ind = offset + file->buff_len - file->position;
+		return 0;
+	}
+
+	FS_EnsureOpenFile( file );
+	// Purge cached data
+	FS_Purge( file );
+
+	if( file->ztk )
+		return FS_SeekDeflated( file, offset );
+
+	if( lseek( file->handle, file->offset + offset, SEEK_SET ) == -1 )
+		return -1;
+	file->position = offset;
+
+	return 0;
+}
+
+/*
+====================
+FS_Tell
+
+Give the current position in a file
+====================
+*/
+fs_offset_t FS_Tell( file_t *file )
+{
+	if( !file ) return 0;
+	return file->position - file->buff_len + file->buff_ind;
+}
+
+/*
+====================
+FS_Eof
+
+indicates at reached end of file
+====================
+*/
+qboolean FS_Eof( file_t *file )
+{
+	if( !file ) return true;
+	return (( file->position - file->buff_len + file->buff_ind ) == file->real_length ) ? true : false;
+}
+
+/*
+====================
+FS_Purge
+
+Erases any buffered input or output data
+====================
+*/
+void FS_Purge( file_t *file )
+{
+	file->buff_len = 0;
+	file->buff_ind = 0;
+	file->ungetc = EOF;
+}
+
+/*
+============
+FS_LoadFile
+
+Filename are relative to the xash directory.
+Always appends a 0 byte.
+============
+*/
+byte *FS_LoadFile( const char *path, fs_offset_t *filesizeptr, qboolean gamedironly )
+{
+	file_t	*file;
+	byte	*buf = NULL;
+	fs_offset_t	filesize = 0;
+
+	file = FS_Open( path, "rb", gamedironly );
+
+	if( file )
+	{
+		filesize = file->real_length;
+
+		buf = (byte *)Mem_Malloc( fs_mempool, filesize + 1 );
+		buf[filesize] = '\0';
+
+		if( filesize && FS_Read( file, buf, filesize ) != filesize )
+		{
+			// broken compressed entry
+			Mem_Free( buf );
+			buf = NULL;
+			filesize = 0;
+		}
+		FS_Close( file );
+	}
+	else
+	{
+		buf = W_LoadFile( path, &filesize, gamedironly );
+
+		if( !buf )
+			buf = Zip_LoadFile( path, &filesize, gamedironly );
+
+	}
+
+	if( filesizeptr )
+		*filesizeptr = filesize;
+
+	return buf;
+}
+
+/*
+=============================================================================
+
+MAPPED FILES
+
+Loaders that only parse a file can borrow a view of it instead of a copy.
+Uncompressed pak, zip and wad entries and files on disk are mapped from
+the page cache, everything else falls back to FS_LoadFile. Views of the
+same file are shared and refcounted. Unlike FS_LoadFile a view is not
+null terminated, and it must be released with FS_UnmapFile.
+
+=============================================================================
+*/
+/*
+====================
+FS_MapRegion
+
+Map "size" bytes at "offset" of a file descriptor. Pages are copy-on-write,
+so the few loaders that fix up data in place don't touch the file
+====================
+*/
+static fs_mapping_t *FS_MapRegion( int handle, fs_offset_t offset, fs_offset_t size )
+{
+#ifdef HAVE_MMAP
+	fs_offset_t	pagesize = sysconf( _SC_PAGESIZE );
+	fs_offset_t	start = offset & ~( pagesize - 1 );
+	fs_mapping_t	*m;
+	void		*base;
+
+	if( handle < 0 || size <= 0 )
+		return NULL;
+
+	base = mmap( NULL, size + offset - start, PROT_READ|PROT_WRITE, MAP_PRIVATE, handle, start );
+
+	if( base == MAP_FAILED )
+		return NULL;
+
+	m = (fs_mapping_t *)Mem_Calloc( fs_mempool, sizeof( fs_mapping_t ));
+	m->base = base;
+	m->maplen = size + offset - start;
+	m->data = (const byte *)base + ( offset - start );
+	m->size = size;
+
+	return m;
+#else
+	return NULL;
+#endif
+}
+
+/*
+====================
+FS_MapSearchFile
+
+Map a file found by FS_FindFile, if it's stored uncompressed
+====================
+*/
+static fs_mapping_t *FS_MapSearchFile( searchpath_t *search, int index, const char *path )
+{
+	if( search->pack )
+	{
+		dpackfile_t	*pfile = &search->pack->files[index];
+
+		return FS_MapRegion( search->pack->handle, pfile->filepos, pfile->filelen );
+	}
+	else if( search->zip )
+	{
+		zipfile_t	*pfile = &search->zip->files[index];
+
+		// deflated entries are inflated into a copy
+		if( pfile->flags != ZIP_COMPRESSION_NO_COMPRESSION )
+			return NULL;
+
+		return FS_MapRegion( search->zip->handle, pfile->offset, pfile->size );
+	}
+	else if( search->wad )
+	{
+		dlumpinfo_t	*lump = &search->wad->lumps[index];
+		file_t		*file = search->wad->handle;
+
+		if( file->ztk )
+			return NULL;
+
+		return FS_MapRegion( file->handle, file->offset + lump->filepos, lump->disksize );
+	}
+	else if( index < 0 )
+	{
+		char		syspath[MAX_SYSPATH];
+		fs_mapping_t	*m;
+		int		handle;
+
+		Q_snprintf( syspath, sizeof( syspath ), "%s%s", search->filename, path );
+		handle = open( syspath, O_RDONLY|O_BINARY );
+#if !XASH_WIN32
+		if( handle < 0 )
+		{
+			const char *fpath = FS_FixFileCase( syspath );
+			if( fpath != syspath )
+				handle = open( fpath, O_RDONLY|O_BINARY );
+		}
+#endif
+		if( handle < 0 )
+			return NULL;
 
-	va_start( args, format );
-	result = FS_VPrintf( file, format, args );
-	va_end( args );
+		m = FS_MapRegion( handle, 0, lseek( handle, 0, SEEK_END ));
+		close( handle ); // the mapping stays valid
 
-	return result;
+		return m;
+	}
+
+	return NULL;
 }
 
 /*
 ====================
-FS_VPrintf
+FS_MapFile
 
-Print a string into a file
+Returns a read-only view of the file contents
 ====================
 */
-int FS_VPrintf( file_t *file, const char *format, va_list ap )
+const byte *FS_MapFile( const char *path, fs_offset_t *filesizeptr, qboolean gamedironly )
 {
-	int	len;
-	fs_offset_t	buff_size = MAX_SYSPATH;
-	char	*tempbuff;
+	searchpath_t	*search;
+	fs_mapping_t	*m;
+	int		index;
 
-	if( !file ) return 0;
+	if( filesizeptr ) *filesizeptr = 0;
 
-	while( 1 )
-	{
-		tempbuff = (char *)Mem_Malloc( fs_mempool, buff_size );
-		len = Q_vsprintf( tempbuff, format, ap );
+	if( path[0] == '/' || path[0] == '\\' )
+		path++;
 
-		if( len >= 0 && len < buff_size )
+	if( FS_CheckNastyPath( path, false ))
+		return NULL;
+
+	search = FS_FindFile( path, &index, gamedironly );
+
+	if( !search )
+		return NULL;
+
+	for( m = fs_mappings; m; m = m->next )
+	{
+		if( m->search == search && m->index == index && ( index >= 0 || !Q_stricmp( m->name, path )))
 			break;
+	}
 
-		Mem_Free( tempbuff );
-		buff_size *= 2;
+	if( !m && ( m = FS_MapSearchFile( search, index, path )) != NULL )
+	{
+		m->search = search;
+		m->index = index;
+		Q_strncpy( m->name, path, sizeof( m->name ));
+		m->next = fs_mappings;
+		fs_mappings = m;
 	}
 
-	len = write( file->handle, tempbuff, len );
-	Mem_Free( tempbuff );
+	if( !m )
+		return FS_LoadFile( path, filesizeptr, gamedironly );
 
-	return len;
+	m->refcount++;
+	fs_stats.mappedbytes += m->size;
+	if( filesizeptr ) *filesizeptr = m->size;
+
+	return m->data;
 }
 
 /*
 ====================
-FS_Getc
+FS_UnmapFile
 
-Get the next character of a file
+Release a view returned by FS_MapFile
 ====================
 */
-int FS_Getc( file_t *file )
+void FS_UnmapFile( const byte *data )
 {
-	char	c;
+	fs_mapping_t	**prev, *m;
 
-	if( FS_Read( file, &c, 1 ) != 1 )
-		return EOF;
+	if( !data ) return;
 
-	return c;
-}
+	for( prev = &fs_mappings; ( m = *prev ) != NULL; prev = &m->next )
+	{
+		if( m->data != data )
+			continue;
 
-/*
-====================
-FS_UnGetc
+		if( --m->refcount > 0 )
+			return;
 
-Put a character back into the read buffer (only supports one character!)
-====================
-*/
-int FS_UnGetc( file_t *file, byte c )
-{
-	// If there's already a character waiting to be read
-	if( file->ungetc != EOF )
-		return EOF;
+		*prev = m->next;
+#ifdef HAVE_MMAP
+		munmap( m->base, m->maplen );
+#endif
+		Mem_Free( m );
+		return;
+	}
 
-	file->ungetc = c;
-	return c;
+	// it was a copy made by FS_LoadFile
+	Mem_Free( (void *)data );
 }
 
 /*
 ====================
-FS_Gets
+FS_DetachMappings
 
-Same as fgets
+Search path is going away, views stay valid until released
+but must not be handed out again
 ====================
 */
-int FS_Gets( file_t *file, byte *string, size_t bufsize )
+static void FS_DetachMappings( searchpath_t *search )
 {
-	int	c, end = 0;
+	fs_mapping_t	*m;
 
-	while( 1 )
+	for( m = fs_mappings; m; m = m->next )
 	{
-		c = FS_Getc( file );
-
-		if( c == '\r' || c == '\n' || c < 0 )
-			break;
-
-		if( end < bufsize - 1 )
-			string[end++] = c;
+		if( m->search == search )
+			m->search = NULL;
 	}
-	string[end] = 0;
+}
 
-	// remove \n following \r
-	if( c == '\r' )
-	{
-		c = FS_Getc( file );
+/*
+=============================================================================
 
-		if( c != '\n' )
-			FS_UnGetc( file, (byte)c );
-	}
+ASSET LOAD STATS
 
-	return c;
-}
+Image, sound and model loaders report how long every asset took,
+so the slowest ones of a map load can be found with loadstats
 
+=============================================================================
+*/
 /*
 ====================
-FS_Seek
+FS_LoadStat
 
-Move the position index in a file
+Find or add the stats of an asset
 ====================
 */
-int FS_Seek( file_t *file, fs_offset_t offset, int whence )
+static fs_loadstat_t *FS_LoadStat( const char *name )
 {
-	// compute the file offset
-	switch( whence )
+	uint		hash = FS_HashName( name );
+	int		*bucket = &fs_loadstats.hash[hash & ( LOADSTAT_HASH_SIZE - 1 )];
+	fs_loadstat_t	*stat;
+	int		i;
+
+	for( i = *bucket; i; i = stat->next )
 	{
-	case SEEK_CUR:
-		offset += file->position - file->buff_len + file->buff_ind;
-		break;
-	case SEEK_SET:
-		break;
-	case SEEK_END:
-		offset += file->real_length;
-		break;
-	default:
-		return -1;
-	}
+		stat = &fs_loadstats.assets[i - 1];
 
-	if( offset < 0 || offset > file->real_length )
-		return -1;
+		if( stat->hash == hash && !Q_stricmp( stat->name, name ))
+			return stat;
+	}
 
-	// if we have the data in our read buffer, we don't need to actually seek
-	if( file->position - file->buff_len <= offset && offset <= file->position )
+	if( fs_loadstats.numassets == fs_loadstats.maxassets )
 	{
-		file->buff_ind = offset + file->buff_len - file->position;
-		return 0;
+		fs_loadstats.maxassets = Q_max( 256, fs_loadstats.maxassets * 2 );
+		fs_loadstats.assets = (fs_loadstat_t *)Mem_Realloc( fs_mempool, fs_loadstats.assets, sizeof( fs_loadstat_t ) * fs_loadstats.maxassets );
 	}
 
-	FS_EnsureOpenFile( file );
-	// Purge cached data
-	FS_Purge( file );
-
-	if( lseek( file->handle, file->offset + offset, SEEK_SET ) == -1 )
-		return -1;
-	file->position = offset;
+	stat = &fs_loadstats.assets[fs_loadstats.numassets++];
+	memset( stat, 0, sizeof( *stat ));
+	Q_strncpy( stat->name, name, sizeof( stat->name ));
+	stat->hash = hash;
+	stat->next = *bucket;
+	*bucket = fs_loadstats.numassets;
 
-	return 0;
+	return stat;
 }
 
 /*
 ====================
-FS_Tell
+FS_RecordLoad
 
-Give the current position in a file
+Called by the loaders on the main thread
 ====================
 */
-fs_offset_t FS_Tell( file_t *file )
+void FS_RecordLoad( const char *name, double seconds )
 {
-	if( !file ) return 0;
-	return file->position - file->buff_len + file->buff_ind;
+	fs_loadstat_t	*stat = FS_LoadStat( name );
+
+	stat->loadtime += seconds;
+	stat->loads++;
 }
 
 /*
 ====================
-FS_Eof
+FS_SortLoadStats
 
-indicates at reached end of file
+slowest first
 ====================
 */
-qboolean FS_Eof( file_t *file )
+static int FS_SortLoadStats( const void *a, const void *b )
 {
-	if( !file ) return true;
-	return (( file->position - file->buff_len + file->buff_ind ) == file->real_length ) ? true : false;
+	const fs_loadstat_t	*s1 = (const fs_loadstat_t *)a;
+	const fs_loadstat_t	*s2 = (const fs_loadstat_t *)b;
+
+	if( s1->loadtime > s2->loadtime )
+		return -1;
+	if( s1->loadtime < s2->loadtime )
+		return 1;
+	return 0;
 }
 
 /*
 ====================
-FS_Purge
+FS_LoadStats_f
 
-Erases any buffered input or output data
+Show per-asset timing of the last map load
 ====================
 */
-void FS_Purge( file_t *file )
+static void FS_LoadStats_f( void )
 {
-	file->buff_len = 0;
-	file->buff_ind = 0;
-	file->ungetc = EOF;
-}
+	double	loadtime = 0.0;
+	int	i, count = 20;
 
-/*
-============
-FS_LoadFile
+	if( Cmd_Argc() > 1 )
+		count = Q_atoi( Cmd_Argv( 1 ));
 
-Filename are relative to the xash directory.
-Always appends a 0 byte.
-============
-*/
-byte *FS_LoadFile( const char *path, fs_offset_t *filesizeptr, qboolean gamedironly )
-{
-	file_t	*file;
-	byte	*buf = NULL;
-	fs_offset_t	filesize = 0;
+	for( i = 0; i < fs_loadstats.numassets; i++ )
+		loadtime += fs_loadstats.assets[i].loadtime;
 
-	file = FS_Open( path, "rb", gamedironly );
+	qsort( fs_loadstats.assets, fs_loadstats.numassets, sizeof( fs_loadstat_t ), FS_SortLoadStats );
 
-	if( file )
+	// sorting moved them around
+	memset( fs_loadstats.hash, 0, sizeof( fs_loadstats.hash ));
+	for( i = 0; i < fs_loadstats.numassets; i++ )
 	{
-		filesize = file->real_length;
+		int	*bucket = &fs_loadstats.hash[fs_loadstats.assets[i].hash & ( LOADSTAT_HASH_SIZE - 1 )];
 
-		buf = (byte *)Mem_Malloc( fs_mempool, filesize + 1 );
-		buf[filesize] = '\0';
-		FS_Read( file, buf, filesize );
-		FS_Close( file );
+		fs_loadstats.assets[i].next = *bucket;
+		*bucket = i + 1;
 	}
-	else
-	{
-		buf = W_LoadFile( path, &filesize, gamedironly );
 
-		if( !buf )
-			buf = Zip_LoadFile( path, &filesize, gamedironly );
+	Con_Printf( "%i assets loaded in %.2f ms\n", fs_loadstats.numassets, loadtime * 1000.0 );
 
-	}
+	if( !fs_loadstats.numassets )
+		return;
 
-	if( filesizeptr )
-		*filesizeptr = filesize;
+	Con_Printf( "   load ms  loads  name\n" );
 
-	return buf;
+	for( i = 0; i < Q_min( count, fs_loadstats.numassets ); i++ )
+	{
+		fs_loadstat_t	*stat = &fs_loadstats.assets[i];
+
+		Con_Printf( "%10.2f  %5i  %s\n", stat->loadtime * 1000.0, stat->loads, stat->name );
+	}
 }
 
 qboolean CRC32_File( dword *crcvalue, const char *filename )
@@ -3464,6 +5034,12 @@ qboolean FS_Rename( const char *oldname, const char *newname )
 
 	iRet = rename( oldpath, newpath );
 
+	if( iRet == 0 )
+	{
+		FS_IndexWrittenFile( oldpath + Q_strlen( fs_writedir ), false );
+		FS_IndexWrittenFile( newpath + Q_strlen( fs_writedir ), true );
+	}
+
 	return (iRet == 0);
 }
 
@@ -3486,6 +5062,9 @@ qboolean GAME_EXPORT FS_Delete( const char *path )
 	COM_FixSlashes( real_path );
 	iRet = remove( real_path );
 
+	if( iRet == 0 )
+		FS_IndexWrittenFile( real_path + Q_strlen( fs_writedir ), false );
+
 	return (iRet == 0);
 }
 
@@ -3744,6 +5323,7 @@ void FS_InitMemory( void )
 {
 	fs_mempool = Mem_AllocPool( "FileSystem Pool" );
 	fs_searchpaths = NULL;
+	fs_index.inotify = -1;
 }
 
 /*
@@ -4119,3 +5699,292 @@ static byte *W_LoadFile( const char *path, fs_offset_t *lumpsizeptr, qboolean ga
 		return W_ReadLump( search->wad, &search->wad->lumps[index], lumpsizeptr );
 	return NULL;
 }
+
+#if XASH_ENGINE_TESTS
+#include "tests.h"
+
+static qboolean Test_SameLookup( const char *name, qboolean gamedironly )
+{
+	searchpath_t	*indexed, *walked;
+	int		i1 = -2, i2 = -2;
+
+	indexed = FS_FindFile( name, &i1, gamedironly );
+	walked = FS_WalkSearchPaths( name, &i2, gamedironly );
+
+	return indexed == walked && i1 == i2;
+}
+
+static void Test_IndexLookups( void )
+{
+	const char	*names[] =
+	{
+		"gameinfo.txt", "GameInfo.TXT", "liblist.gam", "gfx.wad", "maps/none.bsp",
+		"gfx/palette.lmp", "palette.pal", "sprites/none.spr", "fsindex_none",
+	};
+	int		i;
+
+	for( i = 0; i < sizeof( names ) / sizeof( names[0] ); i++ )
+	{
+		TASSERT( Test_SameLookup( names[i], false ));
+		TASSERT( Test_SameLookup( names[i], true ));
+	}
+}
+
+static void Test_IndexWrites( void )
+{
+	char	path[MAX_SYSPATH];
+#if XASH_LINUX
+	int	fd, inotify;
+#endif
+
+	TASSERT( FS_WriteFile( "fsindex_test/Index.txt", "test", 4 ));
+	TASSERT( FS_FileExists( "fsindex_test/Index.txt", false ));
+
+	// only the file name may differ in case, like on disk
+	TASSERT( Test_SameLookup( "fsindex_test/index.txt", false ));
+	TASSERT( Test_SameLookup( "FSINDEX_TEST/Index.txt", false ));
+
+	TASSERT( FS_Rename( "fsindex_test/Index.txt", "fsindex_test/moved.txt" ));
+	TASSERT( !FS_FileExists( "fsindex_test/Index.txt", false ));
+	TASSERT( FS_FileExists( "fsindex_test/moved.txt", false ));
+
+	TASSERT( FS_Delete( "fsindex_test/moved.txt" ));
+	TASSERT( !FS_FileExists( "fsindex_test/moved.txt", false ));
+
+#if XASH_LINUX
+	if( fs_index.inotify >= 0 )
+	{
+		// files made behind the engine's back show up on the next frame
+		Q_snprintf( path, sizeof( path ), "%sfsindex_test/external.txt", fs_writedir );
+		fd = open( path, O_WRONLY|O_CREAT, 0666 );
+		TASSERT( fd >= 0 );
+		if( fd >= 0 ) close( fd );
+
+		fs_index.lastpoll = -1.0;
+		TASSERT( FS_FileExists( "fsindex_test/external.txt", false ));
+		TASSERT( Test_SameLookup( "fsindex_test/external.txt", false ));
+
+		remove( path );
+		fs_index.lastpoll = -1.0;
+		TASSERT( !FS_FileExists( "fsindex_test/external.txt", false ));
+
+		// events that come while the index is invalid are dropped
+		FS_InvalidateIndex();
+		for( fd = 0; fd < fs_index.numwatches; fd++ )
+			TASSERT( fs_index.watches[fd].search == NULL );
+
+		fd = open( path, O_WRONLY|O_CREAT, 0666 );
+		if( fd >= 0 ) close( fd );
+		fs_index.lastpoll = -1.0;
+		TASSERT( FS_FileExists( "fsindex_test/external.txt", false ));
+		remove( path );
+		fs_index.lastpoll = -1.0;
+		TASSERT( !FS_FileExists( "fsindex_test/external.txt", false ));
+
+		// without inotify, misses are looked up on disk
+		inotify = fs_index.inotify;
+		fs_index.inotify = -1;
+		fd = open( path, O_WRONLY|O_CREAT, 0666 );
+		if( fd >= 0 ) close( fd );
+		TASSERT( FS_FileExists( "fsindex_test/external.txt", false ));
+		remove( path );
+		fs_index.inotify = inotify;
+	}
+#endif
+
+	Q_snprintf( path, sizeof( path ), "%sfsindex_test", fs_writedir );
+#if XASH_WIN32
+	_rmdir( path );
+#else
+	rmdir( path );
+#endif
+}
+
+static void Test_ZipStreaming( void )
+{
+	const int		size = ZIP_CHECKPOINT_STEP * 3 + 1234;
+	const char	*entry = "stream.bin";
+	zip_header_t	header = { 0 };
+	zip_cdf_header_t	cdf = { 0 };
+	zip_header_eocd_t	eocd = { 0 };
+	uint		signature = ZIP_HEADER_EOCD;
+	char		path[MAX_SYSPATH];
+	byte		*data, *comp, *buf;
+	dword		crc, seed = 1;
+	z_stream		zs = { 0 };
+	file_t		*f;
+	zip_t		*zip;
+	int		i;
+
+	// half random, half repeated, so the window matters
+	data = (byte *)Mem_Malloc( fs_mempool, size );
+	for( i = 0; i < size; i++ )
+	{
+		seed = seed * 1103515245 + 12345;
+		data[i] = ( i & 4096 ) ? data[i - 4096] : ( seed >> 16 ) & 0x3f;
+	}
+
+	comp = (byte *)Mem_Malloc( fs_mempool, size + size / 8 + 1024 );
+	deflateInit2( &zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 9, Z_DEFAULT_STRATEGY );
+	zs.next_in = data;
+	zs.avail_in = size;
+	zs.next_out = comp;
+	zs.avail_out = size + size / 8 + 1024;
+	TASSERT( deflate( &zs, Z_FINISH ) == Z_STREAM_END );
+	deflateEnd( &zs );
+
+	CRC32_Init( &crc );
+	CRC32_ProcessBuffer( &crc, data, size );
+
+	header.signature = ZIP_HEADER_LF;
+	header.compression_flags = ZIP_COMPRESSION_DEFLATED;
+	header.crc32 = CRC32_Final( crc );
+	header.compressed_size = zs.total_out;
+	header.uncompressed_size = size;
+	header.filename_len = Q_strlen( entry );
+
+	cdf.signature = ZIP_HEADER_CDF;
+	cdf.flags = ZIP_COMPRESSION_DEFLATED;
+	cdf.crc32 = header.crc32;
+	cdf.compressed_size = header.compressed_size;
+	cdf.uncompressed_size = header.uncompressed_size;
+	cdf.filename_len = header.filename_len;
+
+	eocd.number_central_directory_record = eocd.total_central_directory_record = 1;
+	eocd.size_of_central_directory = sizeof( cdf ) + cdf.filename_len;
+	eocd.central_directory_offset = sizeof( header ) + header.filename_len + header.compressed_size;
+
+	f = FS_Open( "fszip_test.pk3", "wb", false );
+	TASSERT( f != NULL );
+	if( f )
+	{
+		FS_Write( f, &header, sizeof( header ));
+		FS_Write( f, entry, header.filename_len );
+		FS_Write( f, comp, header.compressed_size );
+		FS_Write( f, &cdf, sizeof( cdf ));
+		FS_Write( f, entry, cdf.filename_len );
+		FS_Write( f, &signature, sizeof( signature ));
+		FS_Write( f, &eocd, sizeof( eocd ));
+		FS_Close( f );
+	}
+
+	Q_snprintf( path, sizeof( path ), "%sfszip_test.pk3", fs_writedir );
+	zip = FS_LoadZip( path, NULL );
+	TASSERT( zip != NULL );
+
+	if( zip )
+	{
+		buf = (byte *)Mem_Malloc( fs_mempool, size );
+
+		f = FS_OpenZipFile( zip, 0 );
+		TASSERT( f != NULL && f->ztk != NULL );
+
+		if( f )
+		{
+			TASSERT( FS_Read( f, buf, size ) == size );
+			TASSERT( !memcmp( buf, data, size ));
+			TASSERT( FS_Eof( f ));
+
+			// backward seek restarts the stream and starts collecting checkpoints
+			TASSERT( FS_Seek( f, 100, SEEK_SET ) == 0 );
+			TASSERT( FS_Read( f, buf, 64 ) == 64 );
+			TASSERT( !memcmp( buf, data + 100, 64 ));
+
+			TASSERT( FS_Seek( f, -10, SEEK_END ) == 0 );
+			TASSERT( FS_Read( f, buf, 10 ) == 10 );
+			TASSERT( !memcmp( buf, data + size - 10, 10 ));
+			TASSERT( f->ztk->numcheckpoints == 3 );
+
+			// resumes from the second checkpoint
+			TASSERT( FS_Seek( f, ZIP_CHECKPOINT_STEP * 5 / 2, SEEK_SET ) == 0 );
+			for( i = 0; i < 100; i++ )
+				TASSERT( FS_Getc( f ) == data[ZIP_CHECKPOINT_STEP * 5 / 2 + i] );
+			TASSERT( FS_Tell( f ) == ZIP_CHECKPOINT_STEP * 5 / 2 + 100 );
+
+			FS_Close( f );
+		}
+
+		// a corrupted entry must not be returned
+		zip->files[0].crc32 ^= 1;
+		f = FS_OpenZipFile( zip, 0 );
+		TASSERT( f != NULL );
+
+		if( f )
+		{
+			TASSERT( FS_Read( f, buf, size ) != size );
+			FS_Close( f );
+		}
+
+		Mem_Free( buf );
+		Zip_Close( zip );
+	}
+
+	FS_Delete( "fszip_test.pk3" );
+	Mem_Free( comp );
+	Mem_Free( data );
+}
+
+static void Test_MapFile( void )
+{
+	const char	*data = "mapped file contents";
+	const byte	*view1, *view2;
+	fs_offset_t	size1, size2;
+
+	TASSERT( FS_WriteFile( "fsmap_test.bin", data, Q_strlen( data )));
+
+	view1 = FS_MapFile( "fsmap_test.bin", &size1, false );
+	view2 = FS_MapFile( "FSMAP_TEST.bin", &size2, false );
+	TASSERT( view1 != NULL && view2 != NULL );
+	TASSERT( size1 == Q_strlen( data ) && size2 == size1 );
+	TASSERT( view1 && !memcmp( view1, data, size1 ));
+#ifdef HAVE_MMAP
+	TASSERT( view1 == view2 );
+	TASSERT( fs_mappings != NULL && fs_mappings->refcount == 2 );
+#endif
+	FS_UnmapFile( view2 );
+	FS_UnmapFile( view1 );
+	TASSERT( fs_mappings == NULL );
+
+	TASSERT( FS_MapFile( "fsmap_none.bin", &size1, false ) == NULL && size1 == 0 );
+	FS_Delete( "fsmap_test.bin" );
+}
+
+static void Test_LoadStats( void )
+{
+	char	name[MAX_QPATH];
+	int	i;
+
+	FS_ResetStats();
+
+	for( i = 0; i < 2000; i++ )
+	{
+		Q_snprintf( name, sizeof( name ), "models/test%i.mdl", i );
+		FS_RecordLoad( name, i * 0.001 );
+	}
+
+	FS_RecordLoad( "MODELS/TEST5.MDL", 1.0 );
+	TASSERT( fs_loadstats.numassets == 2000 );
+	TASSERT( FS_LoadStat( "models/test5.mdl" )->loads == 2 );
+
+	// sorting must keep the lookups working
+	Cmd_TokenizeString( "loadstats 0" );
+	FS_LoadStats_f();
+	TASSERT( !Q_stricmp( fs_loadstats.assets[0].name, "models/test1999.mdl" ));
+	TASSERT( FS_LoadStat( "models/test5.mdl" )->loads == 2 );
+	TASSERT( FS_LoadStat( "models/test1234.mdl" )->loads == 1 );
+	TASSERT( fs_loadstats.numassets == 2000 );
+
+	FS_ResetStats();
+	TASSERT( FS_LoadStat( "models/test5.mdl" )->loads == 0 );
+	FS_ResetStats();
+}
+
+void Test_RunFilesystem( void )
+{
+	TRUN( Test_IndexLookups() );
+	TRUN( Test_IndexWrites() );
+	TRUN( Test_ZipStreaming() );
+	TRUN( Test_MapFile() );
+	TRUN( Test_LoadStats() );
+}
+#endif /* XASH_ENGINE_TESTS */
@@ -41,6 +41,7 @@ GNU General Public License for more details.
 #include "enginefeatures.h"
 #include "render_api.h"	// decallist_t
 #include "tests.h"
+#include "threads.h"
 
 pfnChangeGame	pChangeGame = NULL;
 host_parm_t		host;	// host parms
@@ -90,6 +91,7 @@ void Sys_PrintUsage( void )
 #endif // !XASH_WIN32
 #if !XASH_MOBILE_PLATFORM
 	O("-daemonize       ","run engine in background, dedicated only")
+	O("-benchmark <map> ","run server ticks with bots and write timings, dedicated only")
 #endif // !XASH_MOBILE_PLATFORM
 
 #if !XASH_DEDICATED
@@ -271,6 +273,9 @@ void Host_CheckSleep( void )
 {
 	int sleeptime = host_sleeptime->value;
 
+	if( host.benchmark )
+		return; // measure frames, not sleeps
+
 	if( Host_IsDedicated() )
 	{
 		// let the dedicated server some sleep
@@ -783,8 +788,16 @@ static void Host_RunTests( int stage )
 	case 0: // early engine load
 		memset( &tests_stats, 0, sizeof( tests_stats ));
 		Test_RunLibCommon();
+		Test_RunNetBuffer();
+		Test_RunCommon();
+		Test_RunWorld();
+		Test_RunPmove();
+		Test_RunBmodel();
+		Test_RunUnlag();
+		Test_RunMemory();
 		break;
 	case 1: // after FS load
+		Test_RunFilesystem();
 		Test_RunImagelib();
 		Msg( "Done! %d passed, %d failed\n", tests_stats.passed, tests_stats.failed );
 		Sys_Quit();
@@ -989,6 +1002,7 @@ void Host_InitCommon( int argc, char **argv, const char *progname, qboolean bCha
 
 	Cmd_AddCommand( "exec", Host_Exec_f, "execute a script file" );
 	Cmd_AddCommand( "memlist", Host_MemStats_f, "prints memory pool information" );
+	Cmd_AddCommand( "mem_bench", Mem_Bench_f, "time small allocations of the memory pools" );
 	Cmd_AddCommand( "userconfigd", Host_Userconfigd_f, "execute all scripts from userconfig.d" );
 
 	FS_Init();
@@ -1137,6 +1151,9 @@ int EXPORT Host_Main( int argc, char **argv, const char *progname, int bChangeGa
 		// so we have a chance to set servercfgfile
 		Cbuf_AddText( va( "exec %s\n", Cvar_VariableString( "servercfgfile" )));
 		Cbuf_Execute();
+
+		if( Sys_CheckParm( "-benchmark" ))
+			SV_RunBenchmark(); // quits when done
 	}
 
 	// main window message loop
@@ -1176,6 +1193,7 @@ void EXPORT Host_Shutdown( void )
 	Mod_Shutdown();
 	NET_Shutdown();
 	HTTP_Shutdown();
+	Jobs_Shutdown();
 	Host_FreeCommon();
 	Platform_Shutdown();
 
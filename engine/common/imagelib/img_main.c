@@ -219,6 +219,7 @@ rgbdata_t *FS_LoadImage( const char *filename, const byte *buffer, size_t size )
 	const loadpixformat_t *format;
 	const cubepack_t	*cmap;
 	byte		*f;
+	double		start = Sys_DoubleTime();
 
 	Q_strncpy( loadname, filename, sizeof( loadname ));
 	Image_Reset(); // clear old image
@@ -256,6 +257,7 @@ rgbdata_t *FS_LoadImage( const char *filename, const byte *buffer, size_t size )
 				if( format->loadfunc( path, f, filesize ))
 				{
 					Mem_Free( f ); // release buffer
+					FS_RecordLoad( path, Sys_DoubleTime() - start );
 					return ImagePack(); // loaded
 				}
 				else Mem_Free( f ); // release buffer
@@ -494,6 +496,7 @@ rgbdata_t *FS_CopyImage( rgbdata_t *in )
 
 #if XASH_ENGINE_TESTS
 #include "tests.h"
+#include "xash3d_mathlib.h"
 
 static void GeneratePixel( byte *pix, uint i, uint j, uint w, uint h, qboolean genAlpha )
 {
@@ -173,11 +173,32 @@ typedef struct
 	size_t		*count;
 } mlumpinfo_t;
 
+// decompressed PVS rows, least recently used one is reused first
+typedef struct
+{
+	const mleaf_t	*leafs;		// leaf of cluster i is leafs[i + 1]
+	byte		*rows;		// numslots rows, rowbytes each
+	int		*slot;		// [numclusters] slot that holds the row, or -1
+	int		*cluster;		// [numslots] cluster in the slot, or -1
+	int		*prev;		// [numslots] toward the most recent
+	int		*next;		// [numslots] toward the least recent
+	int		head;		// most recently used
+	int		tail;		// least recently used
+	int		numclusters;
+	int		numslots;
+	int		rowbytes;
+	size_t		memory;
+	uint		hits;
+	uint		misses;
+	uint		evictions;
+} pvscache_t;
+
 world_static_t		world;
 static dbspmodel_t		srcmodel;
 static loadstat_t		loadstat;
 static model_t		*worldmodel;
 static byte		g_visdata[(MAX_MAP_LEAFS+7)/8];	// intermediate buffer
+static pvscache_t		pvscache;
 static mlumpstat_t		worldstats[HEADER_LUMPS+EXTRA_LUMPS];
 static mlumpinfo_t		srclumps[HEADER_LUMPS] =
 {
@@ -490,6 +511,210 @@ byte *Mod_DecompressPVS( const byte *in, int visbytes )
 	return g_visdata;
 }
 
+/*
+===============================================================================
+
+			VISIBILITY CACHE
+
+===============================================================================
+*/
+/*
+==================
+Mod_ClearPVSCache
+
+rows live in the world mempool and go away with it
+==================
+*/
+void Mod_ClearPVSCache( void )
+{
+	memset( &pvscache, 0, sizeof( pvscache ));
+}
+
+/*
+==================
+Mod_PVSCacheUnlink
+
+==================
+*/
+static void Mod_PVSCacheUnlink( int slot )
+{
+	if( pvscache.prev[slot] >= 0 )
+		pvscache.next[pvscache.prev[slot]] = pvscache.next[slot];
+	else pvscache.head = pvscache.next[slot];
+
+	if( pvscache.next[slot] >= 0 )
+		pvscache.prev[pvscache.next[slot]] = pvscache.prev[slot];
+	else pvscache.tail = pvscache.prev[slot];
+}
+
+/*
+==================
+Mod_PVSCacheLinkHead
+
+==================
+*/
+static void Mod_PVSCacheLinkHead( int slot )
+{
+	pvscache.prev[slot] = -1;
+	pvscache.next[slot] = pvscache.head;
+
+	if( pvscache.head >= 0 )
+		pvscache.prev[pvscache.head] = slot;
+	else pvscache.tail = slot;
+
+	pvscache.head = slot;
+}
+
+/*
+==================
+Mod_PVSCacheFill
+
+decompress row of the cluster into the slot
+==================
+*/
+static byte *Mod_PVSCacheFill( int slot, int cluster )
+{
+	byte	*row = pvscache.rows + (size_t)slot * pvscache.rowbytes;
+
+	// decompression may run past visbytes, so not in place
+	Mod_DecompressPVS( pvscache.leafs[cluster + 1].compressed_vis, world.visbytes );
+	memcpy( row, g_visdata, world.visbytes );
+	memset( row + world.visbytes, 0, pvscache.rowbytes - world.visbytes );
+
+	pvscache.slot[cluster] = slot;
+	pvscache.cluster[slot] = cluster;
+
+	return row;
+}
+
+/*
+==================
+Mod_SetupPVSCache
+
+keeps rows of all clusters if they fit into maxmemory,
+otherwise as many as fit and they are swapped on demand
+==================
+*/
+static void Mod_SetupPVSCache( poolhandle_t pool, const mleaf_t *leafs, int numclusters, size_t maxmemory )
+{
+	size_t	rowbytes = ( world.visbytes + 3 ) & ~3;
+	size_t	perslot = rowbytes + sizeof( int ) * 3;
+	int	i;
+
+	Mod_ClearPVSCache();
+
+	if( numclusters <= 0 || maxmemory <= numclusters * sizeof( int ) + perslot )
+		return;
+
+	pvscache.numslots = Q_min(( maxmemory - numclusters * sizeof( int )) / perslot, numclusters );
+	pvscache.numclusters = numclusters;
+	pvscache.rowbytes = rowbytes;
+	pvscache.leafs = leafs;
+
+	pvscache.rows = Mem_Malloc( pool, pvscache.numslots * rowbytes );
+	pvscache.slot = Mem_Malloc( pool, numclusters * sizeof( int ));
+	pvscache.cluster = Mem_Malloc( pool, pvscache.numslots * sizeof( int ));
+	pvscache.prev = Mem_Malloc( pool, pvscache.numslots * sizeof( int ));
+	pvscache.next = Mem_Malloc( pool, pvscache.numslots * sizeof( int ));
+	pvscache.memory = numclusters * sizeof( int ) + pvscache.numslots * perslot;
+	pvscache.head = pvscache.tail = -1;
+
+	for( i = 0; i < numclusters; i++ )
+		pvscache.slot[i] = -1;
+
+	// materialize everything that fits right away, first row ends up last in line
+	for( i = 0; i < pvscache.numslots; i++ )
+	{
+		Mod_PVSCacheFill( i, i );
+		Mod_PVSCacheLinkHead( i );
+	}
+}
+
+/*
+==================
+Mod_InitPVSCache
+
+called when world is loaded
+==================
+*/
+static void Mod_InitPVSCache( model_t *mod )
+{
+	Mod_ClearPVSCache();
+
+	if( !mod->visdata || !mod_pvscache || mod_pvscache->value <= 0.0f )
+		return;
+
+	Mod_SetupPVSCache( mod->mempool, mod->leafs, mod->submodels[0].visleafs, mod_pvscache->value * 1024.0f * 1024.0f );
+
+	if( pvscache.numslots )
+	{
+		Con_Reportf( "PVS cache: %i of %i rows, %s\n", pvscache.numslots, pvscache.numclusters, Q_memprint( pvscache.memory ));
+	}
+}
+
+/*
+==================
+Mod_LeafPVS
+
+decompressed PVS of the leaf, may be a cached row
+==================
+*/
+static byte *Mod_LeafPVS( const mleaf_t *leaf )
+{
+	int	slot, cluster = leaf->cluster;
+
+	if( !pvscache.numslots || cluster < 0 || cluster >= pvscache.numclusters )
+		return Mod_DecompressPVS( leaf->compressed_vis, world.visbytes );
+
+	slot = pvscache.slot[cluster];
+
+	if( slot >= 0 )
+	{
+		pvscache.hits++;
+
+		if( slot != pvscache.head )
+		{
+			Mod_PVSCacheUnlink( slot );
+			Mod_PVSCacheLinkHead( slot );
+		}
+
+		return pvscache.rows + (size_t)slot * pvscache.rowbytes;
+	}
+
+	pvscache.misses++;
+
+	slot = pvscache.tail;
+	pvscache.evictions++;
+	pvscache.slot[pvscache.cluster[slot]] = -1;
+
+	Mod_PVSCacheUnlink( slot );
+	Mod_PVSCacheLinkHead( slot );
+
+	return Mod_PVSCacheFill( slot, cluster );
+}
+
+/*
+==================
+Mod_PVSCacheStats_f
+
+==================
+*/
+void Mod_PVSCacheStats_f( void )
+{
+	uint	total = pvscache.hits + pvscache.misses;
+
+	if( !pvscache.numslots )
+	{
+		Con_Printf( "PVS cache is not in use\n" );
+		return;
+	}
+
+	Con_Printf( "%i of %i rows cached, %i bytes each, %s total\n", pvscache.numslots, pvscache.numclusters,
+		pvscache.rowbytes, Q_memprint( pvscache.memory ));
+	Con_Printf( "%u hits, %u misses (%.1f%% hit), %u evictions\n", pvscache.hits, pvscache.misses,
+		total ? pvscache.hits * 100.0 / total : 0.0, pvscache.evictions );
+}
+
 /*
 ==================
 Mod_PointInLeaf
@@ -539,7 +764,7 @@ byte *Mod_GetPVSForPoint( const vec3_t p )
 	}
 
 	if( leaf && leaf->cluster >= 0 )
-		return Mod_DecompressPVS( leaf->compressed_vis, world.visbytes );
+		return Mod_LeafPVS( leaf );
 	return NULL;
 }
 
@@ -572,7 +797,7 @@ static void Mod_FatPVS_RecursiveBSPNode( const vec3_t org, float radius, byte *v
 	// if this leaf is in a cluster, accumulate the vis bits
 	if(((mleaf_t *)node)->cluster >= 0 )
 	{
-		byte	*vis = Mod_DecompressPVS( ((mleaf_t *)node)->compressed_vis, world.visbytes );
+		byte	*vis = Mod_LeafPVS( (mleaf_t *)node );
 
 		for( i = 0; i < visbytes; i++ )
 			visbuffer[i] |= vis[i];
@@ -2829,6 +3054,7 @@ qboolean Mod_LoadBmodelLumps( const byte *mod_base, qboolean isworld )
 	if( isworld )
 	{
 		loadmodel = mod;		// restore pointer to world
+		Mod_InitPVSCache( mod );
 #if !XASH_DEDICATED
 		Mod_InitDebugHulls();	// FIXME: build hulls for separate bmodels (shells, medkits etc)
 		world.deluxedata = bmod->deluxedata_out;	// deluxemap data pointer
@@ -3179,3 +3405,88 @@ int Mod_SaveLump( const char *filename, const int lump, void *lumpdata, int lump
 	FS_Close( f );
 	return LUMP_SAVE_OK;
 }
+
+#if XASH_ENGINE_TESTS
+#include "tests.h"
+
+#define TEST_CLUSTERS	64
+#define TEST_VISBYTES	( TEST_CLUSTERS / 8 )
+
+static int Test_CompressVis( const byte *in, byte *out )
+{
+	byte	*dst = out;
+	int	j, rep;
+
+	for( j = 0; j < TEST_VISBYTES; j++ )
+	{
+		*dst++ = in[j];
+
+		if( in[j] )
+			continue;
+
+		for( rep = 1; j + 1 < TEST_VISBYTES && !in[j + 1]; rep++, j++ );
+		*dst++ = rep;
+	}
+
+	return dst - out;
+}
+
+static void Test_PVSCache( void )
+{
+	static mleaf_t	leafs[TEST_CLUSTERS + 1];
+	static byte	raw[TEST_CLUSTERS][TEST_VISBYTES];
+	static byte	packed[TEST_CLUSTERS][TEST_VISBYTES * 2];
+	poolhandle_t	pool = Mem_AllocPool( "PVS cache test" );
+	size_t		oldvisbytes = world.visbytes;
+	qboolean		same = true;
+	int		i, j;
+
+	world.visbytes = TEST_VISBYTES;
+
+	for( i = 0; i < TEST_CLUSTERS; i++ )
+	{
+		for( j = 0; j < TEST_VISBYTES; j++ )
+			raw[i][j] = ( i & 1 ) && j > 1 && j < 6 ? 0 : (byte)( i * 7 + j * 13 ) | 1;
+
+		Test_CompressVis( raw[i], packed[i] );
+		leafs[i + 1].cluster = i;
+		leafs[i + 1].compressed_vis = packed[i];
+	}
+
+	// everything fits
+	Mod_SetupPVSCache( pool, leafs, TEST_CLUSTERS, 1024 * 1024 );
+	TASSERT( pvscache.numslots == TEST_CLUSTERS );
+
+	for( i = 0; i < TEST_CLUSTERS; i++ )
+		same &= !memcmp( Mod_LeafPVS( &leafs[i + 1] ), raw[i], TEST_VISBYTES );
+
+	TASSERT( same );
+	TASSERT( pvscache.hits == TEST_CLUSTERS && pvscache.misses == 0 );
+
+	// room for 16 rows only
+	Mod_SetupPVSCache( pool, leafs, TEST_CLUSTERS, TEST_CLUSTERS * sizeof( int ) + 16 * ( TEST_VISBYTES + sizeof( int ) * 3 ) + 8 );
+	TASSERT( pvscache.numslots == 16 );
+
+	for( i = 0; i < TEST_CLUSTERS; i++ )
+		same &= !memcmp( Mod_LeafPVS( &leafs[i + 1] ), raw[i], TEST_VISBYTES );
+
+	TASSERT( same );
+	TASSERT( pvscache.hits == 16 && pvscache.misses == TEST_CLUSTERS - 16 );
+	TASSERT( pvscache.evictions == TEST_CLUSTERS - 16 );
+
+	// 48 is the least recent now, unless it's touched
+	Mod_LeafPVS( &leafs[48 + 1] );
+	Mod_LeafPVS( &leafs[0 + 1] );
+	TASSERT( pvscache.slot[48] >= 0 && pvscache.slot[49] < 0 );
+	TASSERT( !memcmp( Mod_LeafPVS( &leafs[49 + 1] ), raw[49], TEST_VISBYTES ));
+
+	Mod_ClearPVSCache();
+	world.visbytes = oldvisbytes;
+	Mem_FreePool( &pool );
+}
+
+void Test_RunBmodel( void )
+{
+	TRUN( Test_PVSCache() );
+}
+#endif
@@ -120,6 +120,7 @@ extern world_static_t	world;
 extern poolhandle_t     com_studiocache;
 extern model_t		*loadmodel;
 extern convar_t		*mod_studiocache;
+extern convar_t		*mod_pvscache;
 extern convar_t		*r_wadtextures;
 extern convar_t		*r_showhull;
 
@@ -162,6 +163,8 @@ int Mod_SampleSizeForFace( msurface_t *surf );
 byte *Mod_GetPVSForPoint( const vec3_t p );
 void Mod_UnloadBrushModel( model_t *mod );
 void Mod_PrintWorldStats_f( void );
+void Mod_ClearPVSCache( void );
+void Mod_PVSCacheStats_f( void );
 
 //
 // mod_dbghulls.c
@@ -190,6 +193,7 @@ void *R_StudioGetAnim( studiohdr_t *m_pStudioHeader, model_t *m_pSubModel, mstud
 void Mod_StudioComputeBounds( void *buffer, vec3_t mins, vec3_t maxs, qboolean ignore_sequences );
 int Mod_HitgroupForStudioHull( int index );
 void Mod_ClearStudioCache( void );
+void Mod_StudioCacheStats_f( void );
 
 //
 // mod_sprite.c
@@ -19,45 +19,79 @@ GNU General Public License for more details.
 #include "r_studioint.h"
 #include "library.h"
 #include "ref_common.h"
+#include "threads.h"
 
 typedef int (*STUDIOAPI)( int, sv_blending_interface_t**, server_studio_api_t*,  float (*transform)[3][4], float (*bones)[MAXSTUDIOBONES][3][4] );
 
 typedef struct mstudiocache_s
 {
+	model_t	*model;
 	float	frame;
 	int	sequence;
 	vec3_t	angles;
 	vec3_t	origin;
-	vec3_t	size;
 	byte	controller[4];
 	byte	blending[2];
-	model_t	*model;
-	uint	current_hull;
-	uint	current_plane;
-	uint	numhitboxes;
+	uint	framecount;	// entry is only valid during this host frame
+	int	numbones;
+	matrix3x4	bones[MAXSTUDIOBONES];
 } mstudiocache_t;
 
-#define STUDIO_CACHESIZE		16
+#define STUDIO_CACHESIZE		256	// must be power of two
 #define STUDIO_CACHEMASK		(STUDIO_CACHESIZE - 1)
 
+// hulls are built per thread so traces can run in parallel
+typedef struct
+{
+	hull_t	hull[MAXSTUDIOBONES];
+	mplane_t	planes[MAXSTUDIOBONES*6];
+	uint	hitgroup[MAXSTUDIOBONES];
+} studioscratch_t;
+
 // trace global variables
 static sv_blending_interface_t	*pBlendAPI = NULL;
 static studiohdr_t			*mod_studiohdr;
 static matrix3x4			studio_transform;
-static hull_t			cache_hull[MAXSTUDIOBONES];
-static hull_t			studio_hull[MAXSTUDIOBONES];
 static matrix3x4			studio_bones[MAXSTUDIOBONES];
-static uint			studio_hull_hitgroup[MAXSTUDIOBONES];
-static uint			cache_hull_hitgroup[MAXSTUDIOBONES];
-static mstudiocache_t		cache_studio[STUDIO_CACHESIZE];
 static mclipnode_t			studio_clipnodes[6];
-static mplane_t			studio_planes[768];
-static mplane_t			cache_planes[768];
+static XASH_THREAD_LOCAL studioscratch_t	studio_scratch;
 
-// current cache state
-static int			cache_current;
-static int			cache_current_hull;
-static int			cache_current_plane;
+// bone setup writes the globals above that the blending interface
+// holds pointers to, so it and the cache are serialized by studio_lock
+static mstudiocache_t		cache_studio[STUDIO_CACHESIZE];
+static volatile int			studio_lock;
+static XASH_THREAD_LOCAL int		studio_lockdepth;
+
+// cache stats since the last Mod_ClearStudioCache
+static int			cache_hits;
+static int			cache_misses;
+static int			cache_evictions;
+
+/*
+====================
+Mod_StudioScratch
+
+lazily sets up hulls of the calling thread
+====================
+*/
+static studioscratch_t *Mod_StudioScratch( void )
+{
+	studioscratch_t	*scratch = &studio_scratch;
+	int		i;
+
+	if( scratch->hull[0].planes != NULL )
+		return scratch;
+
+	for( i = 0; i < MAXSTUDIOBONES; i++ )
+	{
+		scratch->hull[i].clipnodes = studio_clipnodes;
+		scratch->hull[i].planes = &scratch->planes[i*6];
+		scratch->hull[i].firstclipnode = 0;
+		scratch->hull[i].lastclipnode = 5;
+	}
+
+	return scratch;
+}
 
 /*
 ====================
@@ -68,9 +102,6 @@ void Mod_InitStudioHull( void )
 {
 	int	i, side;
 
-	if( studio_hull[0].planes != NULL )
-		return;	// already initailized
-
 	for( i = 0; i < 6; i++ )
 	{
 		studio_clipnodes[i].planenum = i;
@@ -82,13 +113,31 @@ void Mod_InitStudioHull( void )
 		else studio_clipnodes[i].children[side^1] = CONTENTS_SOLID;
 	}
 
-	for( i = 0; i < MAXSTUDIOBONES; i++ )
-	{
-		studio_hull[i].clipnodes = studio_clipnodes;
-		studio_hull[i].planes = &studio_planes[i*6];
-		studio_hull[i].firstclipnode = 0;
-		studio_hull[i].lastclipnode = 5;
-	}
+	Mod_StudioScratch();
+}
+
+/*
+====================
+Mod_StudioLock
+
+recursive, the blending interface may call back into us
+====================
+*/
+static void Mod_StudioLock( void )
+{
+	if( studio_lockdepth++ == 0 )
+		Sys_SpinLock( &studio_lock );
+}
+
+/*
+====================
+Mod_StudioUnlock
+====================
+*/
+static void Mod_StudioUnlock( void )
+{
+	if( --studio_lockdepth == 0 )
+		Sys_SpinUnlock( &studio_lock );
 }
 
 /*
@@ -106,46 +155,38 @@ ClearStudioCache
 void Mod_ClearStudioCache( void )
 {
 	memset( cache_studio, 0, sizeof( cache_studio ));
-	cache_current_hull = cache_current_plane = 0;
+	cache_hits = cache_misses = cache_evictions = 0;
 
-	cache_current = 0;
+	// recover after Host_Error thrown out of a locked section
+	studio_lockdepth = 0;
+	studio_lock = 0;
 }
 
 /*
 ====================
-AddToStudioCache
+StudioCacheSlot
+
+entities keep their own slot, edict-less
+callers (pmove) are spread by model and origin
 ====================
 */
-void Mod_AddToStudioCache( float frame, int sequence, vec3_t angles, vec3_t origin, vec3_t size, byte *pcontroller, byte *pblending, model_t *model, hull_t *hull, int numhitboxes )
+static mstudiocache_t *Mod_StudioCacheSlot( const model_t *model, const vec3_t origin, const edict_t *pEdict )
 {
-	mstudiocache_t *pCache;
-
-	if( numhitboxes + cache_current_hull >= MAXSTUDIOBONES )
-		Mod_ClearStudioCache();
-
-	cache_current++;
-	pCache = &cache_studio[cache_current & STUDIO_CACHEMASK];
-
-	pCache->frame = frame;
-	pCache->sequence = sequence;
-	VectorCopy( angles, pCache->angles );
-	VectorCopy( origin, pCache->origin );
-	VectorCopy( size, pCache->size );
+	uint	hash, bits;
+	int	i;
 
-	memcpy( pCache->controller, pcontroller, 4 );
-	memcpy( pCache->blending, pblending, 2 );
+	if( SV_IsValidEdict( pEdict ))
+		return &cache_studio[NUM_FOR_EDICT( pEdict ) & STUDIO_CACHEMASK];
 
-	pCache->model = model;
-	pCache->current_hull = cache_current_hull;
-	pCache->current_plane = cache_current_plane;
+	hash = (uint)(size_t)model;
 
-	memcpy( &cache_hull[cache_current_hull], hull, numhitboxes * sizeof( hull_t ));
-	memcpy( &cache_planes[cache_current_plane], studio_planes, numhitboxes * sizeof( mplane_t ) * 6 );
-	memcpy( &cache_hull_hitgroup[cache_current_hull], studio_hull_hitgroup, numhitboxes * sizeof( uint ));
+	for( i = 0; i < 3; i++ )
+	{
+		memcpy( &bits, &origin[i], sizeof( bits ));
+		hash = hash * 31 + bits;
+	}
 
-	cache_current_hull += numhitboxes;
-	cache_current_plane += numhitboxes * 6;
-	pCache->numhitboxes = numhitboxes;
+	return &cache_studio[( hash ^ ( hash >> 16 )) & STUDIO_CACHEMASK];
 }
 
 /*
@@ -153,43 +194,83 @@ void Mod_AddToStudioCache( float frame, int sequence, vec3_t angles, vec3_t orig
 CheckStudioCache
 ====================
 */
-mstudiocache_t *Mod_CheckStudioCache( model_t *model, float frame, int sequence, vec3_t angles, vec3_t origin, vec3_t size, byte *controller, byte *blending )
+static qboolean Mod_CheckStudioCache( const mstudiocache_t *pCached, model_t *model, float frame, int sequence, const vec3_t angles, const vec3_t origin, const byte *controller, const byte *blending )
 {
-	mstudiocache_t	*pCached;
-	int		i;
+	if( pCached->framecount != host.framecount )
+		return false;
 
-	for( i = 0; i < STUDIO_CACHESIZE; i++ )
-	{
-		pCached = &cache_studio[(cache_current - i) & STUDIO_CACHEMASK];
+	if( pCached->model != model )
+		return false;
 
-		if( pCached->model != model )
-			continue;
+	if( pCached->frame != frame )
+		return false;
 
-		if( pCached->frame != frame )
-			continue;
+	if( pCached->sequence != sequence )
+		return false;
 
-		if( pCached->sequence != sequence )
-			continue;
+	if( !VectorCompare( pCached->angles, angles ))
+		return false;
 
-		if( !VectorCompare( pCached->angles, angles ))
-			continue;
+	if( !VectorCompare( pCached->origin, origin ))
+		return false;
 
-		if( !VectorCompare( pCached->origin, origin ))
-			continue;
+	if( memcmp( pCached->controller, controller, 4 ) != 0 )
+		return false;
 
-		if( !VectorCompare( pCached->size, size ))
-			continue;
+	if( memcmp( pCached->blending, blending, 2 ) != 0 )
+		return false;
 
-		if( memcmp( pCached->controller, controller, 4 ) != 0 )
-			continue;
+	return true;
+}
 
-		if( memcmp( pCached->blending, blending, 2 ) != 0 )
-			continue;
+/*
+====================
+AddToStudioCache
+
+copies bones left by the last full setup
+====================
+*/
+static void Mod_AddToStudioCache( mstudiocache_t *pCache, model_t *model, float frame, int sequence, const vec3_t angles, const vec3_t origin, const byte *pcontroller, const byte *pblending )
+{
+	// slot is still in use by someone else this frame
+	if( pCache->model && pCache->framecount == host.framecount )
+		cache_evictions++;
+
+	pCache->model = model;
+	pCache->frame = frame;
+	pCache->sequence = sequence;
+	VectorCopy( angles, pCache->angles );
+	VectorCopy( origin, pCache->origin );
+
+	memcpy( pCache->controller, pcontroller, 4 );
+	memcpy( pCache->blending, pblending, 2 );
+
+	pCache->framecount = host.framecount;
+	pCache->numbones = bound( 0, mod_studiohdr->numbones, MAXSTUDIOBONES );
+	memcpy( pCache->bones, studio_bones, pCache->numbones * sizeof( matrix3x4 ));
+}
+
+/*
+====================
+Mod_StudioCacheStats_f
+====================
+*/
+void Mod_StudioCacheStats_f( void )
+{
+	int	i, live = 0;
+	int	total = cache_hits + cache_misses;
 
-		return pCached;
+	for( i = 0; i < STUDIO_CACHESIZE; i++ )
+	{
+		if( cache_studio[i].model && cache_studio[i].framecount == host.framecount )
+			live++;
 	}
 
-	return NULL;
+	Con_Printf( "studio cache: %s, %i slots, %s\n", mod_studiocache->value ? "on" : "off",
+		STUDIO_CACHESIZE, Q_memprint( sizeof( cache_studio )));
+	Con_Printf( "%i hits, %i misses (%.1f%% hit rate), %i evictions\n", cache_hits, cache_misses,
+		total ? cache_hits * 100.0f / total : 0.0f, cache_evictions );
+	Con_Printf( "%i slots filled this frame\n", live );
 }
 
 /*
@@ -204,17 +285,17 @@ mstudiocache_t *Mod_CheckStudioCache( model_t *model, float frame, int sequence,
 SetStudioHullPlane
 ====================
 */
-void Mod_SetStudioHullPlane( int planenum, int bone, int axis, float offset, const vec3_t size )
+static void Mod_SetStudioHullPlane( mplane_t *planes, const matrix3x4 *bones, int planenum, int bone, int axis, float offset, const vec3_t size )
 {
-	mplane_t	*pl = &studio_planes[planenum];
+	mplane_t	*pl = &planes[planenum];
 
 	pl->type = 5;
 
-	pl->normal[0] = studio_bones[bone][0][axis];
-	pl->normal[1] = studio_bones[bone][1][axis];
-	pl->normal[2] = studio_bones[bone][2][axis];
+	pl->normal[0] = bones[bone][0][axis];
+	pl->normal[1] = bones[bone][1][axis];
+	pl->normal[2] = bones[bone][2][axis];
 
-	pl->dist = (pl->normal[0] * studio_bones[bone][0][3]) + (pl->normal[1] * studio_bones[bone][1][3]) + (pl->normal[2] * studio_bones[bone][2][3]) + offset;
+	pl->dist = (pl->normal[0] * bones[bone][0][3]) + (pl->normal[1] * bones[bone][1][3]) + (pl->normal[2] * bones[bone][2][3]) + offset;
 
 	if( planenum & 1 ) pl->dist -= DotProductFabs( pl->normal, size );
 	else pl->dist += DotProductFabs( pl->normal, size );
@@ -226,12 +307,16 @@ void Mod_SetStudioHullPlane( int planenum, int bone, int axis, float offset, con
 HullForStudio
 
 NOTE: pEdict may be NULL
+returned hulls belong to the calling thread
+and are valid until its next call
 ====================
 */
 hull_t *Mod_HullForStudio( model_t *model, float frame, int sequence, vec3_t angles, vec3_t origin, vec3_t size, byte *pcontroller, byte *pblending, int *numhitboxes, edict_t *pEdict )
 {
+	studioscratch_t	*scratch = Mod_StudioScratch();
+	mstudiocache_t	*bonecache = NULL;
+	const matrix3x4	*bones = studio_bones;
 	vec3_t		angles2;
-	mstudiocache_t	*bonecache;
 	mstudiobbox_t	*phitbox;
 	qboolean		bSkipShield;
 	int		i, j;
@@ -239,30 +324,43 @@ hull_t *Mod_HullForStudio( model_t *model, float frame, int sequence, vec3_t ang
 	bSkipShield = false;
 	*numhitboxes = 0; // assume error
 
+	Mod_StudioLock();
+
+	mod_studiohdr = Mod_StudioExtradata( model );
+	if( !mod_studiohdr )
+	{
+		Mod_StudioUnlock();
+		return NULL; // probably not a studiomodel
+	}
+
 	if( mod_studiocache->value )
 	{
-		bonecache = Mod_CheckStudioCache( model, frame, sequence, angles, origin, size, pcontroller, pblending );
+		bonecache = Mod_StudioCacheSlot( model, origin, pEdict );
 
-		if( bonecache != NULL )
+		if( Mod_CheckStudioCache( bonecache, model, frame, sequence, angles, origin, pcontroller, pblending ))
 		{
-			memcpy( studio_planes, &cache_planes[bonecache->current_plane], bonecache->numhitboxes * sizeof( mplane_t ) * 6 );
-			memcpy( studio_hull_hitgroup, &cache_hull_hitgroup[bonecache->current_hull], bonecache->numhitboxes * sizeof( uint ));
-			memcpy( studio_hull, &cache_hull[bonecache->current_hull], bonecache->numhitboxes * sizeof( hull_t ));
-
-			*numhitboxes = bonecache->numhitboxes;
-			return studio_hull;
+			bones = bonecache->bones;
+			cache_hits++;
+		}
+		else
+		{
+			cache_misses++;
 		}
 	}
 
-	mod_studiohdr = Mod_StudioExtradata( model );
-	if( !mod_studiohdr ) return NULL; // probably not a studiomodel
+	if( bones == studio_bones )
+	{
+		VectorCopy( angles, angles2 );
 
-	VectorCopy( angles, angles2 );
+		if( !FBitSet( host.features, ENGINE_COMPENSATE_QUAKE_BUG ))
+			angles2[PITCH] = -angles2[PITCH]; // stupid quake bug
 
-	if( !FBitSet( host.features, ENGINE_COMPENSATE_QUAKE_BUG ))
-		angles2[PITCH] = -angles2[PITCH]; // stupid quake bug
+		pBlendAPI->SV_StudioSetupBones( model, frame, sequence, angles2, origin, pcontroller, pblending, -1, pEdict );
+
+		if( bonecache != NULL )
+			Mod_AddToStudioCache( bonecache, model, frame, sequence, angles, origin, pcontroller, pblending );
+	}
 
-	pBlendAPI->SV_StudioSetupBones( model, frame, sequence, angles2, origin, pcontroller, pblending, -1, pEdict );
 	phitbox = (mstudiobbox_t *)((byte *)mod_studiohdr + mod_studiohdr->hitboxindex);
 
 	if( SV_IsValidEdict( pEdict ) && pEdict->v.gamestate == 1 )
@@ -273,23 +371,22 @@ hull_t *Mod_HullForStudio( model_t *model, float frame, int sequence, vec3_t ang
 		if( bSkipShield && i == 21 )
 			continue;	// CS stuff
 
-		studio_hull_hitgroup[i] = phitbox[i].group;
+		scratch->hitgroup[i] = phitbox[i].group;
 
-		Mod_SetStudioHullPlane( j + 0, phitbox[i].bone, 0, phitbox[i].bbmax[0], size );
-		Mod_SetStudioHullPlane( j + 1, phitbox[i].bone, 0, phitbox[i].bbmin[0], size );
-		Mod_SetStudioHullPlane( j + 2, phitbox[i].bone, 1, phitbox[i].bbmax[1], size );
-		Mod_SetStudioHullPlane( j + 3, phitbox[i].bone, 1, phitbox[i].bbmin[1], size );
-		Mod_SetStudioHullPlane( j + 4, phitbox[i].bone, 2, phitbox[i].bbmax[2], size );
-		Mod_SetStudioHullPlane( j + 5, phitbox[i].bone, 2, phitbox[i].bbmin[2], size );
+		Mod_SetStudioHullPlane( scratch->planes, bones, j + 0, phitbox[i].bone, 0, phitbox[i].bbmax[0], size );
+		Mod_SetStudioHullPlane( scratch->planes, bones, j + 1, phitbox[i].bone, 0, phitbox[i].bbmin[0], size );
+		Mod_SetStudioHullPlane( scratch->planes, bones, j + 2, phitbox[i].bone, 1, phitbox[i].bbmax[1], size );
+		Mod_SetStudioHullPlane( scratch->planes, bones, j + 3, phitbox[i].bone, 1, phitbox[i].bbmin[1], size );
+		Mod_SetStudioHullPlane( scratch->planes, bones, j + 4, phitbox[i].bone, 2, phitbox[i].bbmax[2], size );
+		Mod_SetStudioHullPlane( scratch->planes, bones, j + 5, phitbox[i].bone, 2, phitbox[i].bbmin[2], size );
 	}
 
 	// tell trace code about hitbox count
 	*numhitboxes = (bSkipShield) ? (mod_studiohdr->numhitboxes - 1) : (mod_studiohdr->numhitboxes);
 
-	if( mod_studiocache->value )
-		Mod_AddToStudioCache( frame, sequence, angles, origin, size, pcontroller, pblending, model, studio_hull, *numhitboxes );
+	Mod_StudioUnlock();
 
-	return studio_hull;
+	return scratch->hull;
 }
 
 /*
@@ -754,11 +851,20 @@ void Mod_StudioGetAttachment( const edict_t *e, int iAtt, float *origin, float *
 	model_t			*mod;
 
 	mod = SV_ModelHandle( e->v.modelindex );
+
+	Mod_StudioLock();
+
 	mod_studiohdr = (studiohdr_t *)Mod_StudioExtradata( mod );
-	if( !mod_studiohdr ) return;
+	if( !mod_studiohdr )
+	{
+		Mod_StudioUnlock();
+		return;
+	}
 
 	if( mod_studiohdr->numattachments <= 0 )
 	{
+		Mod_StudioUnlock();
+
 		if( origin ) VectorCopy( e->v.origin, origin );
 
 		if( FBitSet( host.features, ENGINE_COMPUTE_STUDIO_LERP ) && angles )
@@ -782,6 +888,8 @@ void Mod_StudioGetAttachment( const edict_t *e, int iAtt, float *origin, float *
 	Matrix3x4_SetOrigin( localPose, pAtt->org[0], pAtt->org[1], pAtt->org[2] );
 	Matrix3x4_ConcatTransforms( worldPose, studio_bones[pAtt->bone], localPose );
 
+	Mod_StudioUnlock();
+
 	if( origin != NULL ) // origin is used always
 		Matrix3x4_OriginFromMatrix( worldPose, origin );
 
@@ -799,13 +907,22 @@ void Mod_GetBonePosition( const edict_t *e, int iBone, float *origin, float *ang
 	model_t	*mod;
 
 	mod = SV_ModelHandle( e->v.modelindex );
+
+	Mod_StudioLock();
+
 	mod_studiohdr = (studiohdr_t *)Mod_StudioExtradata( mod );
-	if( !mod_studiohdr ) return;
+	if( !mod_studiohdr )
+	{
+		Mod_StudioUnlock();
+		return;
+	}
 
 	pBlendAPI->SV_StudioSetupBones( mod, e->v.frame, e->v.sequence, e->v.angles, e->v.origin, e->v.controller, e->v.blending, iBone, e );
 
 	if( origin ) Matrix3x4_OriginFromMatrix( studio_bones[iBone], origin );
 	if( angles ) Matrix3x4_AnglesFromMatrix( studio_bones[iBone], angles );
+
+	Mod_StudioUnlock();
 }
 
 /*
@@ -815,7 +932,7 @@ HitgroupForStudioHull
 */
 int Mod_HitgroupForStudioHull( int index )
 {
-	return studio_hull_hitgroup[index];
+	return studio_scratch.hitgroup[index];
 }
 
 /*
@@ -29,6 +29,7 @@ static model_t	mod_known[MAX_MODELS];
 static int	mod_numknown = 0;
 poolhandle_t      com_studiocache;		// cache for submodels
 convar_t		*mod_studiocache;
+convar_t		*mod_pvscache;
 convar_t		*r_wadtextures;
 convar_t		*r_showhull;
 model_t		*loadmodel;
@@ -114,6 +115,7 @@ void Mod_FreeModel( model_t *mod )
 	{
 		world.shadowdata = NULL;
 		world.deluxedata = NULL;
+		Mod_ClearPVSCache();
 	}
 
 	memset( mod, 0, sizeof( *mod ));
@@ -135,11 +137,14 @@ void Mod_Init( void )
 {
 	com_studiocache = Mem_AllocPool( "Studio Cache" );
 	mod_studiocache = Cvar_Get( "r_studiocache", "1", FCVAR_ARCHIVE, "enables studio cache for speedup tracing hitboxes" );
+	mod_pvscache = Cvar_Get( "mod_pvscache", "0", FCVAR_ARCHIVE, "megabytes of decompressed world visibility kept in memory, 0 disables" );
 	r_wadtextures = Cvar_Get( "r_wadtextures", "0", 0, "completely ignore textures in the bsp-file if enabled" );
 	r_showhull = Cvar_Get( "r_showhull", "0", 0, "draw collision hulls 1-3" );
 
 	Cmd_AddCommand( "mapstats", Mod_PrintWorldStats_f, "show stats for currently loaded map" );
 	Cmd_AddCommand( "modellist", Mod_Modellist_f, "display loaded models list" );
+	Cmd_AddCommand( "studiocachestats", Mod_StudioCacheStats_f, "show studio hitbox cache usage" );
+	Cmd_AddCommand( "pvscachestats", Mod_PVSCacheStats_f, "show world visibility cache usage" );
 
 	Mod_ResetStudioAPI ();
 	Mod_InitStudioHull ();
@@ -254,8 +259,9 @@ model_t *Mod_LoadModel( model_t *mod, qboolean crash )
 	char		tempname[MAX_QPATH];
 	fs_offset_t		length = 0;
 	qboolean		loaded;
-	byte		*buf;
+	const byte	*buf;
 	model_info_t	*p;
+	double		start = Sys_DoubleTime();
 
 	ASSERT( mod != NULL );
 
@@ -272,7 +278,7 @@ model_t *Mod_LoadModel( model_t *mod, qboolean crash )
 	Q_strncpy( tempname, mod->name, sizeof( tempname ));
 	COM_FixSlashes( tempname );
 
-	buf = FS_LoadFile( tempname, &length, false );
+	buf = FS_MapFile( tempname, &length, false );
 
 	if( !buf )
 	{
@@ -290,7 +296,7 @@ model_t *Mod_LoadModel( model_t *mod, qboolean crash )
 	loadmodel = mod;
 
 	// call the apropriate loader
-	switch( *(uint *)buf )
+	switch( *(const uint *)buf )
 	{
 	case IDSTUDIOHEADER:
 		Mod_LoadStudioModel( mod, buf, &loaded );
@@ -309,7 +315,7 @@ model_t *Mod_LoadModel( model_t *mod, qboolean crash )
 		// ref.dllFuncs.Mod_LoadModel( mod_brush, mod, buf, &loaded, 0 );
 		break;
 	default:
-		Mem_Free( buf );
+		FS_UnmapFile( buf );
 		if( crash ) Host_Error( "%s has unknown format\n", tempname );
 		else Con_Printf( S_ERROR "%s has unknown format\n", tempname );
 		return NULL;
@@ -338,7 +344,7 @@ model_t *Mod_LoadModel( model_t *mod, qboolean crash )
 	if( !loaded )
 	{
 		Mod_FreeModel( mod );
-		Mem_Free( buf );
+		FS_UnmapFile( buf );
 
 		if( crash ) Host_Error( "Could not load model %s\n", tempname );
 		else Con_Printf( S_ERROR "Could not load model %s\n", tempname );
@@ -368,7 +374,8 @@ model_t *Mod_LoadModel( model_t *mod, qboolean crash )
 			p->initialCRC = currentCRC;
 		}
 	}
-	Mem_Free( buf );
+	FS_UnmapFile( buf );
+	FS_RecordLoad( tempname, Sys_DoubleTime() - start );
 
 	return mod;
 }
@@ -519,7 +526,7 @@ void Mod_LoadCacheFile( const char *filename, cache_user_t *cu )
 {
 	char	modname[MAX_QPATH];
 	fs_offset_t	size;
-	byte	*buf;
+	const byte	*buf;
 
 	Assert( cu != NULL );
 
@@ -529,11 +536,11 @@ void Mod_LoadCacheFile( const char *filename, cache_user_t *cu )
 	Q_strncpy( modname, filename, sizeof( modname ));
 	COM_FixSlashes( modname );
 
-	buf = FS_LoadFile( modname, &size, false );
+	buf = FS_MapFile( modname, &size, false );
 	if( !buf || !size ) Host_Error( "LoadCacheFile: ^1can't load %s^7\n", filename );
 	cu->data = Mem_Malloc( com_studiocache, size );
 	memcpy( cu->data, buf, size );
-	Mem_Free( buf );
+	FS_UnmapFile( buf );
 }
 
 /*
@@ -27,6 +27,13 @@ GNU General Public License for more details.
 static dword	BitWriteMasks[32][33];
 static dword	ExtraMasks[32];
 
+// on little endian machines bit stream is the same as a stream of
+// little endian words, so any field up to 32 bits fits into a single
+// unaligned 64-bit word starting at the byte of the first bit
+#ifdef XASH_LITTLE_ENDIAN
+#define MSG_WORD_ACCESS
+#endif
+
 unsigned short MSG_BigShort( unsigned short swap )
 {
 	return (swap >> 8)|(swap << 8);
@@ -147,7 +154,15 @@ void MSG_WriteOneBit( sizebuf_t *sb, int nValue )
 	}
 }
 
-void MSG_WriteUBitLong( sizebuf_t *sb, uint curData, int numbits )
+/*
+=======================
+MSG_WriteUBitLongDword
+
+dword at a time writer, used close to the end of buffer
+where a 64-bit word doesn't fit anymore
+=======================
+*/
+static void MSG_WriteUBitLongDword( sizebuf_t *sb, uint curData, int numbits )
 {
 	Assert( numbits >= 0 && numbits <= 32 );
 
@@ -188,6 +203,36 @@ void MSG_WriteUBitLong( sizebuf_t *sb, uint curData, int numbits )
 	}
 }
 
+void MSG_WriteUBitLong( sizebuf_t *sb, uint curData, int numbits )
+{
+#ifdef MSG_WORD_ACCESS
+	int	iCurByte = sb->iCurBit >> 3;
+
+	Assert( numbits >= 0 && numbits <= 32 );
+
+	// whole word is inside of the buffer, so
+	// there is no need to check for overflow
+	if( iCurByte + 8 <= ( sb->nDataBits >> 3 ))
+	{
+		int	shift = sb->iCurBit & 7;
+		uint64_t	mask = ((((uint64_t)1 ) << numbits ) - 1 ) << shift;
+		uint64_t	word;
+
+		memcpy( &word, sb->pData + iCurByte, sizeof( word ));
+		word = ( word & ~mask ) | ((((uint64_t)curData ) << shift ) & mask );
+		memcpy( sb->pData + iCurByte, &word, sizeof( word ));
+
+		sb->iCurBit += numbits;
+		return;
+	}
+#endif
+	// don't leak garbage above numbits into the next field
+	if( numbits < 32 )
+		curData &= ExtraMasks[numbits];
+
+	MSG_WriteUBitLongDword( sb, curData, numbits );
+}
+
 /*
 =======================
 MSG_WriteSBitLong
@@ -406,7 +451,14 @@ int MSG_ReadOneBit( sizebuf_t *sb )
 	return 0;
 }
 
-uint MSG_ReadUBitLong( sizebuf_t *sb, int numbits )
+/*
+=======================
+MSG_ReadUBitLongDword
+
+dword at a time reader, used close to the end of buffer
+=======================
+*/
+static uint MSG_ReadUBitLongDword( sizebuf_t *sb, int numbits )
 {
 	int	idword1;
 	uint	dword1, ret;
@@ -428,6 +480,7 @@ uint MSG_ReadUBitLong( sizebuf_t *sb, int numbits )
 
 	Assert( numbits > 0 && numbits <= 32 );
 
+
 	// Read the current dword.
 	idword1 = sb->iCurBit >> 5;
 	dword1 = ((uint *)sb->pData)[idword1];
@@ -454,6 +507,30 @@ uint MSG_ReadUBitLong( sizebuf_t *sb, int numbits )
 	return ret;
 }
 
+uint MSG_ReadUBitLong( sizebuf_t *sb, int numbits )
+{
+#ifdef MSG_WORD_ACCESS
+	// whole word is inside of the message, so
+	// there is no need to check for overflow
+	if(( sb->iCurBit >> 3 ) + 8 <= ( sb->nDataBits >> 3 ))
+	{
+		uint64_t	word;
+		uint	ret;
+
+		Assert( numbits > 0 && numbits <= 32 );
+
+		memcpy( &word, sb->pData + ( sb->iCurBit >> 3 ), sizeof( word ));
+		ret = (uint)( word >> ( sb->iCurBit & 7 ));
+		sb->iCurBit += numbits;
+
+		if( numbits != 32 )
+			ret &= ExtraMasks[numbits];
+		return ret;
+	}
+#endif
+	return MSG_ReadUBitLongDword( sb, numbits );
+}
+
 float MSG_ReadBitFloat( sizebuf_t *sb )
 {
 	int	val;
@@ -677,6 +754,13 @@ void MSG_ExciseBits( sizebuf_t *sb, int startbit, int bitstoremove )
 	MSG_StartWriting( &temp, sb->pData, MSG_GetMaxBytes( sb ), startbit, -1 );
 	MSG_SeekToBit( sb, endbit, SEEK_SET );
 
+	// every dword is read before it's written over, and
+	// the writer always stays behind the reader
+	for( ; remaining_to_end >= 32 && MSG_GetNumBitsLeft( &temp ) >= 32; remaining_to_end -= 32 )
+	{
+		MSG_WriteUBitLong( &temp, MSG_ReadUBitLong( sb, 32 ), 32 );
+	}
+
 	for( i = 0; i < remaining_to_end; i++ )
 	{
 		MSG_WriteOneBit( &temp, MSG_ReadOneBit( sb ));
@@ -685,3 +769,139 @@ void MSG_ExciseBits( sizebuf_t *sb, int startbit, int bitstoremove )
 	MSG_SeekToBit( sb, startbit, SEEK_SET );
 	sb->nDataBits -= bitstoremove;
 }
+
+#if XASH_ENGINE_TESTS
+#include "tests.h"
+
+static uint test_seed;
+
+static uint Test_Rand( void )
+{
+	// xorshift32, fuzzing must be reproducible
+	test_seed ^= test_seed << 13;
+	test_seed ^= test_seed >> 17;
+	test_seed ^= test_seed << 5;
+	return test_seed;
+}
+
+static qboolean Test_CompareBuffers( sizebuf_t *a, sizebuf_t *b, int nBytes )
+{
+	return a->iCurBit == b->iCurBit && a->nDataBits == b->nDataBits
+		&& a->bOverflow == b->bOverflow && !memcmp( a->pData, b->pData, nBytes );
+}
+
+static void Test_ReferenceExcise( sizebuf_t *sb, int startbit, int bitstoremove )
+{
+	int	i, endbit = startbit + bitstoremove;
+	int	remaining_to_end = sb->nDataBits - endbit;
+	sizebuf_t	temp;
+
+	MSG_StartWriting( &temp, sb->pData, MSG_GetMaxBytes( sb ), startbit, -1 );
+	MSG_SeekToBit( sb, endbit, SEEK_SET );
+
+	for( i = 0; i < remaining_to_end; i++ )
+		MSG_WriteOneBit( &temp, MSG_ReadOneBit( sb ));
+
+	MSG_SeekToBit( sb, startbit, SEEK_SET );
+	sb->nDataBits -= bitstoremove;
+}
+
+/*
+=======================
+Test_FuzzBitWriter
+
+runs random writes, seeks and excises on two buffers, one
+with the word writer and another with the dword one, and
+expects them to be the same after every step
+=======================
+*/
+static void Test_FuzzBitWriter( void )
+{
+	uint	buf_a[32], buf_b[32];
+	sizebuf_t	a, b;
+	int	round, step, nBytes;
+	int	failed = 0;
+
+	for( round = 0; round < 2000 && !failed; round++ )
+	{
+		nBytes = 4 * ( 1 + Test_Rand() % 32 );
+
+		for( step = 0; step < 32; step++ )
+			buf_a[step] = buf_b[step] = Test_Rand();
+
+		MSG_Init( &a, "FuzzA", buf_a, nBytes );
+		MSG_Init( &b, "FuzzB", buf_b, nBytes );
+
+		for( step = 0; step < 200 && !failed; step++ )
+		{
+			uint	value = Test_Rand();
+			int	numbits = 1 + Test_Rand() % 32;
+			int	pos;
+
+			switch( Test_Rand() % 8 )
+			{
+			case 0:
+				MSG_WriteOneBit( &a, value & 1 );
+				MSG_WriteOneBit( &b, value & 1 );
+				break;
+			case 1:
+				if( b.iCurBit > 0 )
+				{
+					pos = Test_Rand() % b.iCurBit;
+					MSG_SeekToBit( &a, pos, SEEK_SET );
+					MSG_SeekToBit( &b, pos, SEEK_SET );
+				}
+				break;
+			case 2:
+				if( b.iCurBit > 0 && !b.bOverflow )
+				{
+					pos = Test_Rand() % b.iCurBit;
+					numbits = Test_Rand() % ( b.iCurBit - pos + 1 );
+					MSG_ExciseBits( &a, pos, numbits );
+					Test_ReferenceExcise( &b, pos, numbits );
+				}
+				break;
+			case 3:
+				pos = a.iCurBit;
+				MSG_WriteSBitLong( &a, (int)value, numbits );
+				MSG_WriteUBitLongDword( &b, (uint)( value < 0x80000000 ? value : value - 0x80000000 ) & ((uint)BIT( numbits - 1 ) - 1 ), numbits - 1 );
+				MSG_WriteOneBit( &b, ( (int)value < 0 ) ? 1 : 0 );
+				break;
+			case 4:
+				// read back what was written
+				if( a.iCurBit >= numbits )
+				{
+					pos = Test_Rand() % ( a.iCurBit - numbits + 1 );
+					MSG_SeekToBit( &a, pos, SEEK_SET );
+					MSG_SeekToBit( &b, pos, SEEK_SET );
+
+					if( MSG_ReadUBitLong( &a, numbits ) != MSG_ReadUBitLongDword( &b, numbits ))
+						failed = 1;
+				}
+				break;
+			default:
+				// dword writer doesn't mask the data, word writer does
+				MSG_WriteUBitLong( &a, value, numbits );
+				MSG_WriteUBitLongDword( &b, numbits < 32 ? value & ((uint)BIT( numbits ) - 1 ) : value, numbits );
+				break;
+			}
+
+			if( !Test_CompareBuffers( &a, &b, sizeof( buf_a )))
+				failed = 1;
+		}
+	}
+
+	if( failed )
+		Msg( "bit writer mismatch, seed %u, round %d\n", test_seed, round );
+
+	TASSERT( !failed );
+}
+
+void Test_RunNetBuffer( void )
+{
+	MSG_InitMasks();
+	test_seed = 0x1337;
+
+	TRUN( Test_FuzzBitWriter() );
+}
+#endif /* XASH_ENGINE_TESTS */
@@ -236,6 +236,117 @@ void NetSplit_SendLong( netsrc_t sock, size_t length, void *data, netadr_t to, u
 
 }
 
+/*
+===============
+Netchan_CompressBench_f
+
+times fragment codecs on game files
+===============
+*/
+static void Netchan_CompressBench_f( void )
+{
+	const char	*patterns[] = { "maps/*.bsp", "*.wad", "models/*.mdl" };
+	const char	*names[2] = { "LZSS", "Deflate" };
+	double		comptime[2] = { 0 }, decomptime[2] = { 0 };
+	size_t		packed[2] = { 0 }, total = 0;
+	int		i, j, codec, numfiles = 0, failed = 0;
+
+	Con_Printf( "compress_bench: testing codecs, this may take a while...\n" );
+
+	for( i = 0; i < ARRAYSIZE( patterns ); i++ )
+	{
+		search_t	*t = NULL;
+		int	count;
+
+		// explicit list of files overrides the default corpus
+		if( Cmd_Argc() > 1 )
+		{
+			if( i > 0 ) break;
+			count = Cmd_Argc() - 1;
+		}
+		else
+		{
+			if(( t = FS_Search( patterns[i], true, false )) == NULL )
+				continue;
+			count = t->numfilenames;
+		}
+
+		for( j = 0; j < count; j++ )
+		{
+			const char	*filename = t ? t->filenames[j] : Cmd_Argv( j + 1 );
+			fs_offset_t	size;
+			byte		*data, *out;
+
+			if(( data = FS_LoadFile( filename, &size, false )) == NULL )
+				continue;
+
+			if( size <= 0 )
+			{
+				Mem_Free( data );
+				continue;
+			}
+
+			out = Mem_Malloc( net_mempool, size );
+
+			for( codec = 0; codec < 2; codec++ )
+			{
+				uint	compsize = 0, outsize;
+				double	start;
+				byte	*comp;
+
+				start = Sys_DoubleTime();
+				comp = codec ? Deflate_Compress( data, size, &compsize ) : LZSS_Compress( data, size, &compsize );
+				comptime[codec] += Sys_DoubleTime() - start;
+
+				if( !comp )
+				{
+					// incompressible, sent as is
+					packed[codec] += size;
+					continue;
+				}
+
+				start = Sys_DoubleTime();
+				outsize = codec ? Deflate_Decompress( comp, compsize, out, size ) : LZSS_Decompress( comp, out );
+				decomptime[codec] += Sys_DoubleTime() - start;
+
+				if( outsize != size || memcmp( data, out, size ))
+					failed++;
+
+				packed[codec] += compsize;
+				free( comp );
+			}
+
+			total += size;
+			numfiles++;
+			Mem_Free( out );
+			Mem_Free( data );
+		}
+
+		if( t ) Mem_Free( t );
+	}
+
+	if( !numfiles )
+	{
+		Con_Printf( "compress_bench: no files found\n" );
+		return;
+	}
+
+	Con_Printf( "%i files, %s\n", numfiles, Q_memprint( total ));
+
+	for( codec = 0; codec < 2; codec++ )
+	{
+		double	mb = total / ( 1024.0 * 1024.0 );
+
+		Con_Printf( "%-8s ratio %5.1f%%, compress %7.1f MB/s, decompress %7.1f MB/s\n", names[codec],
+			100.0 * packed[codec] / total,
+			comptime[codec] > 0.0 ? mb / comptime[codec] : 0.0,
+			decomptime[codec] > 0.0 ? mb / decomptime[codec] : 0.0 );
+	}
+
+	if( failed )
+		Con_Printf( S_ERROR "compress_bench: %i files didn't survive round trip\n", failed );
+}
+
 /*
 ===============
 Netchan_Init
@@ -256,10 +367,13 @@ void Netchan_Init( void )
 	net_mempool = Mem_AllocPool( "Network Pool" );
 
 	MSG_InitMasks();	// initialize bit-masks
+
+	Cmd_AddCommand( "compress_bench", Netchan_CompressBench_f, "time fragment compression codecs on game files" );
 }
 
 void Netchan_Shutdown( void )
 {
+	Cmd_RemoveCommand( "compress_bench" );
 	Mem_FreePool( &net_mempool );
 }
 
@@ -689,6 +803,46 @@ void Netchan_AddBufferToList( fragbuf_t **pplist, fragbuf_t *pbuf )
 	pprev->next = pbuf;
 }
 
+/*
+==============================
+Netchan_Compress
+
+compresses with the best codec remote side
+can decompress, LZSS for legacy clients
+==============================
+*/
+static byte *Netchan_Compress( netchan_t *chan, byte *data, int size, uint *outsize )
+{
+	if( chan->deflate_fragments )
+		return Deflate_Compress( data, size, outsize );
+	return LZSS_Compress( data, size, outsize );
+}
+
+/*
+==============================
+Netchan_IsCompressed
+
+==============================
+*/
+static qboolean Netchan_IsCompressed( const byte *data )
+{
+	return LZSS_IsCompressed( data ) || Deflate_IsCompressed( data );
+}
+
+/*
+==============================
+Netchan_CompressedFileName
+
+compressed downloads are cached next to the
+source file, one cache per codec
+==============================
+*/
+static void Netchan_CompressedFileName( netchan_t *chan, const char *filename, char *out, size_t size )
+{
+	Q_strncpy( out, filename, size );
+	COM_ReplaceExtension( out, chan->deflate_fragments ? ".dtmp" : ".ztmp" );
+}
+
 /*
 ==============================
 Netchan_CreateFragments_
@@ -713,11 +867,11 @@ static void Netchan_CreateFragments_( netchan_t *chan, sizebuf_t *msg )
 
 	wait = (fragbufwaiting_t *)Mem_Calloc( net_mempool, sizeof( fragbufwaiting_t ));
 
-	if( !LZSS_IsCompressed( MSG_GetData( msg )))
+	if( !Netchan_IsCompressed( MSG_GetData( msg )))
 	{
 		uint	uCompressedSize = 0;
 		uint	uSourceSize = MSG_GetNumBytesWritten( msg );
-		byte	*pbOut = LZSS_Compress( msg->pData, uSourceSize, &uCompressedSize );
+		byte	*pbOut = Netchan_Compress( chan, msg->pData, uSourceSize, &uCompressedSize );
 
 		if( pbOut && uCompressedSize > 0 && uCompressedSize < uSourceSize )
 		{
@@ -872,10 +1026,10 @@ void Netchan_CreateFileFragmentsFromBuffer( netchan_t *chan, const char *filenam
 		chunksize = chan->pfnBlockSize( chan->client, FRAGSIZE_FRAG );
 	else chunksize = FRAGMENT_MAX_SIZE; // fallback
 
-	if( !LZSS_IsCompressed( pbuf ))
+	if( !Netchan_IsCompressed( pbuf ))
 	{
 		uint	uCompressedSize = 0;
-		byte	*pbOut = LZSS_Compress( pbuf, size, &uCompressedSize );
+		byte	*pbOut = Netchan_Compress( chan, pbuf, size, &uCompressedSize );
 
 		if( pbOut && uCompressedSize > 0 && uCompressedSize < size )
 		{
@@ -970,16 +1124,20 @@ int Netchan_CreateFileFragments( netchan_t *chan, const char *filename )
 		chunksize = chan->pfnBlockSize( chan->client, FRAGSIZE_FRAG );
 	else chunksize = FRAGMENT_MAX_SIZE; // fallback
 
-	Q_strncpy( compressedfilename, filename, sizeof( compressedfilename ));
-	COM_ReplaceExtension( compressedfilename, ".ztmp" );
+	Netchan_CompressedFileName( chan, filename, compressedfilename, sizeof( compressedfilename ));
 	compressedFileTime = FS_FileTime( compressedfilename, false );
 	fileTime = FS_FileTime( filename, false );
 
 	if( compressedFileTime >= fileTime )
 	{
 		// if compressed file already created and newer than source
-		if( FS_FileSize( compressedfilename, false ) != -1 )
+		fs_offset_t	compressedsize = FS_FileSize( compressedfilename, false );
+
+		if( compressedsize != -1 )
+		{
+			filesize = compressedsize;
 			bCompressed = true;
+		}
 	}
 	else
 	{
@@ -988,7 +1146,7 @@ int Netchan_CreateFileFragments( netchan_t *chan, const char *filename )
 		byte	*compressed;
 
 		uncompressed = FS_LoadFile( filename, &filesize, false );
-		compressed = LZSS_Compress( uncompressed, filesize, &uCompressedSize );
+		compressed = Netchan_Compress( chan, uncompressed, filesize, &uCompressedSize );
 
 		if( compressed )
 		{
@@ -1131,6 +1289,19 @@ qboolean Netchan_CopyNormalFragments( netchan_t *chan, sizebuf_t *msg, size_t *l
 			return false;
 		}
 	}
+	else if( Deflate_IsCompressed( MSG_GetData( msg )))
+	{
+		byte	buf[NET_MAX_MESSAGE];
+
+		size = Deflate_Decompress( MSG_GetData( msg ), size, buf, sizeof( buf ));
+
+		if( !size )
+		{
+			Con_Printf( S_ERROR "failed to decompress message\n" );
+			return false;
+		}
+		memcpy( msg->pData, buf, size );
+	}
 
 	chan->incomingbufs[FRAG_NORMAL_STREAM] = NULL;
 
@@ -1246,6 +1417,25 @@ qboolean Netchan_CopyFileFragments( netchan_t *chan, sizebuf_t *msg )
 		Mem_Free( buffer );
 		buffer = uncompressedBuffer;
 	}
+	else if( Deflate_IsCompressed( buffer ))
+	{
+		uint	uncompressedSize = Deflate_GetActualSize( buffer ) + 1;
+		byte	*uncompressedBuffer = Mem_Calloc( net_mempool, uncompressedSize );
+
+		nsize = Deflate_Decompress( buffer, pos, uncompressedBuffer, uncompressedSize );
+		Mem_Free( buffer );
+		buffer = uncompressedBuffer;
+
+		if( !nsize )
+		{
+			Con_Printf( S_ERROR "failed to decompress %s\n", filename );
+			Mem_Free( buffer );
+			MSG_Clear( msg );
+			chan->incomingbufs[FRAG_FILE_STREAM] = NULL;
+			chan->incomingready[FRAG_FILE_STREAM] = false;
+			return false;
+		}
+	}
 
 	// customization files goes int tempbuffer
 	if( filename[0] == '!' )
@@ -1545,8 +1735,7 @@ void Netchan_TransmitBits( netchan_t *chan, int length, byte *data )
 					{
 						char	compressedfilename[MAX_OSPATH];
 
-						Q_strncpy( compressedfilename, pbuf->filename, sizeof( compressedfilename ));
-						COM_ReplaceExtension( compressedfilename, ".ztmp" );
+						Netchan_CompressedFileName( chan, pbuf->filename, compressedfilename, sizeof( compressedfilename ));
 						file = FS_Open( compressedfilename, "rb", false );
 					}
 					else file = FS_Open( pbuf->filename, "rb", false );
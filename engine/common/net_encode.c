@@ -25,10 +25,39 @@ GNU General Public License for more details.
 #include "event_args.h"
 #include "protocol.h"
 #include "client.h"
+#include "threads.h"
 
 #define DELTA_PATH		"delta.lst"
 
+// field kinds with a fast path, anything else goes through Delta_WriteField code
+enum
+{
+	DELTA_OP_GENERIC = 0,
+	DELTA_OP_INT8,
+	DELTA_OP_UINT8,
+	DELTA_OP_INT16,
+	DELTA_OP_UINT16,
+	DELTA_OP_INT32,
+	DELTA_OP_FLOAT,
+	DELTA_OP_ANGLE,
+};
+
+// delta_t with flags decoded once
+typedef struct delta_op_s
+{
+	int		kind;
+	int		offset;
+	int		bits;
+	qboolean		bSigned;
+	qboolean		clamp;		// bits < 32
+	int		minval;
+	int		maxval;
+	double		multiplier;	// DELTA_OP_FLOAT only
+	delta_t		*field;		// source field, for bInactive and generic ops
+} delta_op_t;
+
 static qboolean		delta_init = false;
+static qboolean		delta_compiled = true;
 
 // list of all the struct names
 static const delta_field_t cmd_fields[] =
@@ -436,6 +465,12 @@ qboolean Delta_AddField( const char *pStructName, const char *pName, int flags,
 			pField->bits = bits;
 			pField->multiplier = mul;
 			pField->post_multiplier = post_mul;
+
+			if( dt->ops )
+			{
+				Z_Free( dt->ops );
+				dt->ops = NULL;
+			}
 			return true;
 		}
 	}
@@ -454,6 +489,13 @@ qboolean Delta_AddField( const char *pStructName, const char *pName, int flags,
 		return false; // too many fields specified (duplicated ?)
 	}
 
+	// compiled fields point to the old list
+	if( dt->ops )
+	{
+		Z_Free( dt->ops );
+		dt->ops = NULL;
+	}
+
 	// allocate a new one
 	dt->pFields = Z_Realloc( dt->pFields, (dt->numFields + 1) * sizeof( delta_t ));
 	for( i = 0, pField = dt->pFields; i < dt->numFields; i++, pField++ );
@@ -803,7 +845,13 @@ void Delta_Init( void )
 	dt = Delta_FindStruct( "movevars_t" );
 
 	Assert( dt != NULL );
-	if( dt->bInitialized ) return;	// "movevars_t" already specified by user
+
+	// "movevars_t" already specified by user
+	if( dt->bInitialized )
+	{
+		Delta_CompileTables();
+		return;
+	}
 
 	// create movevars_t delta internal
 	Delta_AddField( "movevars_t", "gravity", DT_FLOAT|DT_SIGNED, 16, 8.0f, 1.0f );
@@ -841,6 +889,8 @@ void Delta_Init( void )
 
 	// now done
 	dt->bInitialized = true;
+
+	Delta_CompileTables();
 }
 
 void Delta_InitClient( void )
@@ -860,6 +910,8 @@ void Delta_InitClient( void )
 	}
 
 	if( numActive ) delta_init = true;
+
+	Delta_CompileTables();
 }
 
 void Delta_Shutdown( void )
@@ -881,12 +933,139 @@ void Delta_Shutdown( void )
 			dt_info[i].pFields = NULL;
 		}
 
+		if( dt_info[i].ops )
+		{
+			Z_Free( dt_info[i].ops );
+			dt_info[i].ops = NULL;
+		}
+
 		dt_info[i].bInitialized = false;
 	}
 
 	delta_init = false;
 }
 
+/*
+=====================
+Delta_CompileField
+
+=====================
+*/
+static void Delta_CompileField( delta_t *pField, delta_op_t *op )
+{
+	qboolean	bSigned = FBitSet( pField->flags, DT_SIGNED ) ? true : false;
+	qboolean	scaled = !Q_equal( pField->multiplier, 1.0 );
+
+	memset( op, 0, sizeof( *op ));
+	op->field = pField;
+	op->offset = pField->offset;
+	op->bits = pField->bits;
+	op->bSigned = bSigned;
+	op->multiplier = pField->multiplier;
+
+	// same as Delta_ClampIntegerField
+	if( pField->bits < 32 )
+	{
+		int signbits = bSigned ? ( pField->bits - 1 ) : pField->bits;
+
+		op->clamp = true;
+		op->maxval = BIT( signbits ) - 1;
+		op->minval = bSigned ? ( -op->maxval - 1 ) : 0;
+	}
+
+	// keep the order of checks from Delta_WriteField, scaled
+	// integers and time windows aren't worth a fast path
+	if( FBitSet( pField->flags, DT_BYTE ))
+		op->kind = scaled ? DELTA_OP_GENERIC : bSigned ? DELTA_OP_INT8 : DELTA_OP_UINT8;
+	else if( FBitSet( pField->flags, DT_SHORT ))
+		op->kind = scaled ? DELTA_OP_GENERIC : bSigned ? DELTA_OP_INT16 : DELTA_OP_UINT16;
+	else if( FBitSet( pField->flags, DT_INTEGER ))
+		op->kind = scaled ? DELTA_OP_GENERIC : DELTA_OP_INT32;
+	else if( FBitSet( pField->flags, DT_FLOAT ))
+		op->kind = DELTA_OP_FLOAT;
+	else if( FBitSet( pField->flags, DT_ANGLE ))
+		op->kind = DELTA_OP_ANGLE;
+	else op->kind = DELTA_OP_GENERIC;
+}
+
+/*
+=====================
+Delta_CompileTables
+
+decode field flags of initialized tables once,
+so encoders don't have to do it for every value
+=====================
+*/
+void Delta_CompileTables( void )
+{
+	delta_info_t	*dt;
+	int		i, j;
+
+	for( i = 0; i < NUM_FIELDS( dt_info ); i++ )
+	{
+		dt = &dt_info[i];
+
+		if( dt->ops )
+		{
+			Z_Free( dt->ops );
+			dt->ops = NULL;
+		}
+
+		if( !dt->bInitialized || dt->numFields <= 0 || !dt->pFields )
+			continue;
+
+		dt->ops = Z_Malloc( dt->numFields * sizeof( delta_op_t ));
+
+		for( j = 0; j < dt->numFields; j++ )
+			Delta_CompileField( &dt->pFields[j], &dt->ops[j] );
+	}
+}
+
+/*
+=====================
+Delta_SetCompiledEncoders
+
+allows to compare against field-by-field encoding
+=====================
+*/
+void Delta_SetCompiledEncoders( qboolean enable )
+{
+	delta_compiled = enable;
+}
+
+#ifdef _DEBUG
+// overflows found while jobs were running, console isn't thread-safe
+static struct
+{
+	volatile int	lock;
+	int		count;
+	const char	*name;		// first one
+	int		value;
+	uint		limit;
+} delta_overflows;
+#endif
+
+/*
+=====================
+Delta_ReportOverflows
+
+prints overflows deferred by Delta_ClampIntegerField,
+called on the main thread after the jobs are done
+=====================
+*/
+void Delta_ReportOverflows( void )
+{
+#ifdef _DEBUG
+	if( !delta_overflows.count )
+		return;
+
+	Con_Reportf( S_WARN "Delta_ClampIntegerField: field %s = %d overflowed %d%s\n", delta_overflows.name, delta_overflows.value,
+		delta_overflows.limit, delta_overflows.count > 1 ? va( " (and %d more)", delta_overflows.count - 1 ) : "" );
+
+	delta_overflows.count = 0;
+#endif
+}
+
 /*
 =====================
 Delta_ClampIntegerField
@@ -898,7 +1077,20 @@ int Delta_ClampIntegerField( delta_t *pField, int iValue, qboolean bSigned, int
 {
 #ifdef _DEBUG
 	if( numbits < 32 && abs( iValue ) >= (uint)BIT( numbits ))
-		Con_Reportf( S_WARN "Delta_ClampIntegerField: field %s = %d overflowed %d\n", pField->name, abs( iValue ), (uint)BIT( numbits ));
+	{
+		if( Jobs_Running( ))
+		{
+			Sys_SpinLock( &delta_overflows.lock );
+			if( !delta_overflows.count++ )
+			{
+				delta_overflows.name = pField->name;
+				delta_overflows.value = abs( iValue );
+				delta_overflows.limit = (uint)BIT( numbits );
+			}
+			Sys_SpinUnlock( &delta_overflows.lock );
+		}
+		else Con_Reportf( S_WARN "Delta_ClampIntegerField: field %s = %d overflowed %d\n", pField->name, abs( iValue ), (uint)BIT( numbits ));
+	}
 #endif
 	if( numbits < 32 )
 	{
@@ -913,13 +1105,13 @@ int Delta_ClampIntegerField( delta_t *pField, int iValue, qboolean bSigned, int
 
 /*
 =====================
-Delta_CompareField
+Delta_CompareValue
 
-compare fields by offsets
-assume from and to is valid
+compare field values by offsets, ignoring the
+inactive flag. Doesn't touch any shared state
 =====================
 */
-qboolean Delta_CompareField( delta_t *pField, void *from, void *to, double timebase )
+static qboolean Delta_CompareValue( delta_t *pField, void *from, void *to, double timebase )
 {
 	qboolean	bSigned = ( pField->flags & DT_SIGNED ) ? true : false;
 	float	val_a, val_b;
@@ -929,9 +1121,6 @@ qboolean Delta_CompareField( delta_t *pField, void *from, void *to, double timeb
 	Assert( from != NULL );
 	Assert( to != NULL );
 
-	if( pField->bInactive )
-		return true;
-
 	fromF = toF = 0;
 
 	if( pField->flags & DT_BYTE )
@@ -1053,6 +1242,76 @@ qboolean Delta_CompareField( delta_t *pField, void *from, void *to, double timeb
 	return ( fromF == toF ) ? true : false;
 }
 
+/*
+=====================
+Delta_CompareField
+
+compare fields by offsets
+assume from and to is valid
+=====================
+*/
+qboolean Delta_CompareField( delta_t *pField, void *from, void *to, double timebase )
+{
+	if( pField->bInactive )
+		return true;
+
+	return Delta_CompareValue( pField, from, to, timebase );
+}
+
+/*
+=====================
+Delta_LoadOp
+
+fetch integer or raw float bits of compiled field
+=====================
+*/
+static int Delta_LoadOp( const delta_op_t *op, const byte *base )
+{
+	const byte	*p = base + op->offset;
+
+	switch( op->kind )
+	{
+	case DELTA_OP_INT8:
+		return *(const int8_t *)p;
+	case DELTA_OP_UINT8:
+		return *(const uint8_t *)p;
+	case DELTA_OP_INT16:
+		return *(const int16_t *)p;
+	case DELTA_OP_UINT16:
+		return *(const uint16_t *)p;
+	default:
+		return *(const int32_t *)p; // also float bits
+	}
+}
+
+/*
+=====================
+Delta_CompareOp
+
+same as Delta_CompareValue for compiled field
+=====================
+*/
+static qboolean Delta_CompareOp( const delta_op_t *op, byte *from, byte *to, double timebase )
+{
+	int	a, b;
+
+	if( op->kind == DELTA_OP_GENERIC )
+		return Delta_CompareValue( op->field, from, to, timebase );
+
+	a = Delta_LoadOp( op, from );
+	b = Delta_LoadOp( op, to );
+
+	if( a == b )
+		return true;
+
+	// floats and angles are compared bitwise, integers
+	// may still be equal when both are out of range
+	if( op->clamp && op->kind != DELTA_OP_FLOAT && op->kind != DELTA_OP_ANGLE )
+		return bound( op->minval, a, op->maxval ) == bound( op->minval, b, op->maxval );
+
+	return false;
+}
+
 /*
 =====================
 Delta_TestBaseline
@@ -1088,9 +1347,34 @@ int Delta_TestBaseline( entity_state_t *from, entity_state_t *to, qboolean playe
 	pField = dt->pFields;
 	Assert( pField != NULL );
 
+	// identical states don't change any field
+	if( delta_compiled && from && !memcmp( from, to, sizeof( *to )))
+		return countBits + dt->numFields;
+
 	// activate fields and call custom encode func
 	Delta_CustomEncode( dt, from, to );
 
+	if( delta_compiled && dt->ops )
+	{
+		const delta_op_t	*op = dt->ops;
+
+		for( i = 0; i < dt->numFields; i++, op++ )
+		{
+			// flag about field change (sets always)
+			countBits++;
+
+			if( op->field->bInactive || Delta_CompareOp( op, (byte *)from, (byte *)to, timebase ))
+				continue;
+
+			// strings are handled difference
+			if( FBitSet( op->field->flags, DT_STRING ))
+				countBits += Q_strlen((char *)((byte *)to + op->offset )) * 8;
+			else countBits += op->bits;
+		}
+
+		return countBits;
+	}
+
 	// process fields
 	for( i = 0; i < dt->numFields; i++, pField++ )
 	{
@@ -1112,27 +1396,18 @@ int Delta_TestBaseline( entity_state_t *from, entity_state_t *to, qboolean playe
 
 /*
 =====================
-Delta_WriteField
+Delta_WriteFieldData
 
-write fields by offsets
-assume from and to is valid
+write changed field value, without a change bit
 =====================
 */
-qboolean Delta_WriteField( sizebuf_t *msg, delta_t *pField, void *from, void *to, double timebase )
+static void Delta_WriteFieldData( sizebuf_t *msg, delta_t *pField, void *to, double timebase )
 {
 	qboolean	bSigned = ( pField->flags & DT_SIGNED ) ? true : false;
 	float		flValue, flAngle, flTime;
 	uint		iValue;
 	const char	*pStr;
 
-	if( Delta_CompareField( pField, from, to, timebase ))
-	{
-		MSG_WriteOneBit( msg, 0 );	// unchanged
-		return false;
-	}
-
-	MSG_WriteOneBit( msg, 1 );	// changed
-
 	if( pField->flags & DT_BYTE )
 	{
 		if( bSigned )
@@ -1215,9 +1490,87 @@ qboolean Delta_WriteField( sizebuf_t *msg, delta_t *pField, void *from, void *to
 		pStr = (char *)((byte *)to + pField->offset );
 		MSG_WriteString( msg, pStr );
 	}
+}
+
+/*
+=====================
+Delta_WriteFieldValue
+
+write fields by offsets, inactive state is passed by caller
+so this can be used from several threads at once
+=====================
+*/
+static qboolean Delta_WriteFieldValue( sizebuf_t *msg, delta_t *pField, void *from, void *to, double timebase, qboolean inactive )
+{
+	if( inactive || Delta_CompareValue( pField, from, to, timebase ))
+	{
+		MSG_WriteOneBit( msg, 0 );	// unchanged
+		return false;
+	}
+
+	MSG_WriteOneBit( msg, 1 );	// changed
+	Delta_WriteFieldData( msg, pField, to, timebase );
+
+	return true;
+}
+
+/*
+=====================
+Delta_WriteOp
+
+same as Delta_WriteFieldValue for compiled field
+=====================
+*/
+static qboolean Delta_WriteOp( sizebuf_t *msg, const delta_op_t *op, byte *from, byte *to, double timebase, qboolean inactive )
+{
+	int	iValue;
+
+	if( inactive || Delta_CompareOp( op, from, to, timebase ))
+	{
+		MSG_WriteOneBit( msg, 0 );	// unchanged
+		return false;
+	}
+
+	MSG_WriteOneBit( msg, 1 );	// changed
+
+	switch( op->kind )
+	{
+	case DELTA_OP_GENERIC:
+		Delta_WriteFieldData( msg, op->field, to, timebase );
+		break;
+	case DELTA_OP_ANGLE:
+		// NOTE: never applies multipliers to angle because
+		// result may be wrong on client-side
+		MSG_WriteBitAngle( msg, *(float *)( to + op->offset ), op->bits );
+		break;
+	case DELTA_OP_FLOAT:
+		iValue = (int)((double)*(float *)( to + op->offset ) * op->multiplier );
+		if( op->clamp ) iValue = bound( op->minval, iValue, op->maxval );
+		MSG_WriteBitLong( msg, iValue, op->bits, op->bSigned );
+		break;
+	default:
+		iValue = Delta_LoadOp( op, to );
+		if( op->clamp ) iValue = bound( op->minval, iValue, op->maxval );
+		MSG_WriteBitLong( msg, iValue, op->bits, op->bSigned );
+		break;
+	}
+
 	return true;
 }
 
+/*
+=====================
+Delta_WriteField
+
+write fields by offsets
+assume from and to is valid
+=====================
+*/
+qboolean Delta_WriteField( sizebuf_t *msg, delta_t *pField, void *from, void *to, double timebase )
+{
+	return Delta_WriteFieldValue( msg, pField, from, to, timebase, pField->bInactive );
+}
+
 /*
 =====================
 Delta_ReadField
@@ -1740,18 +2093,83 @@ entity_state_t communication
 */
 /*
 ==================
-MSG_WriteDeltaEntity
+Delta_FindEntityStruct
 
-Writes part of a packetentities message, including the entity number.
-Can delta from either a baseline or a previous packet_entity
-If to is NULL, a remove entity update will be sent
-If force is not set, then nothing at all will be generated if the entity is
-identical, under the assumption that the in-order delta code will catch it.
 ==================
 */
-void MSG_WriteDeltaEntity( entity_state_t *from, entity_state_t *to, sizebuf_t *msg, qboolean force, int delta_type, double timebase, int baseline )
+static delta_info_t *Delta_FindEntityStruct( const entity_state_t *to, int delta_type )
 {
-	delta_info_t	*dt = NULL;
+	delta_info_t	*dt;
+
+	if( FBitSet( to->entityType, ENTITY_BEAM ))
+		dt = Delta_FindStruct( "custom_entity_state_t" );
+	else if( delta_type == DELTA_PLAYER )
+		dt = Delta_FindStruct( "entity_state_player_t" );
+	else dt = Delta_FindStruct( "entity_state_t" );
+
+	Assert( dt && dt->bInitialized );
+
+	return dt;
+}
+
+/*
+==================
+MSG_DeltaEntityMask
+
+Runs the custom encoder for an entity delta and stores
+which fields it has disabled. This touches the shared delta
+tables and calls into game dll so it must be called from the
+main thread, MSG_WriteDeltaEntityMasked can run anywhere then
+==================
+*/
+void MSG_DeltaEntityMask( entity_state_t *from, entity_state_t *to, int delta_type, delta_mask_t *mask )
+{
+	delta_info_t	*dt;
+	int		i;
+
+	memset( mask, 0, sizeof( *mask ));
+
+	if( to == NULL )
+		return;
+
+	if( to->number < 0 || to->number >= GI->max_edicts )
+		Host_Error( "MSG_WriteDeltaEntity: Bad entity number: %i\n", to->number );
+
+	// static entities won't to be custom encoded
+	if( delta_type == DELTA_STATIC )
+		return;
+
+	// nothing can be sent for identical states, whatever encoder says
+	if( delta_compiled && from && !memcmp( from, to, sizeof( *to )))
+		return;
+
+	dt = Delta_FindEntityStruct( to, delta_type );
+
+	if( dt->numFields > DELTA_MASK_BITS )
+		Host_Error( "MSG_DeltaEntityMask: %s has too many fields (%i)\n", dt->pName, dt->numFields );
+
+	// activate fields and call custom encode func
+	Delta_CustomEncode( dt, from, to );
+
+	for( i = 0; i < dt->numFields; i++ )
+	{
+		if( dt->pFields[i].bInactive )
+			SetBits( mask->inactive[i >> 5], BIT( i & 31 ));
+	}
+}
+
+/*
+==================
+MSG_WriteDeltaEntityMasked
+
+Same as MSG_WriteDeltaEntity but field activity comes
+from a mask built by MSG_DeltaEntityMask. Only reads shared
+data, so several messages can be written at the same time
+==================
+*/
+void MSG_WriteDeltaEntityMasked( entity_state_t *from, entity_state_t *to, sizebuf_t *msg, qboolean force, int delta_type, double timebase, int baseline, const delta_mask_t *mask )
+{
+	delta_info_t	*dt;
 	delta_t		*pField;
 	int		i, startBit;
 	int		numChanges = 0;
@@ -1776,10 +2194,11 @@ void MSG_WriteDeltaEntity( entity_state_t *from, entity_state_t *to, sizebuf_t *
 		return;
 	}
 
-	startBit = msg->iCurBit;
+	// unchanged entity, the whole message would be killed below anyway
+	if( delta_compiled && !force && !memcmp( from, to, sizeof( *to )))
+		return;
 
-	if( to->number < 0 || to->number >= GI->max_edicts )
-		Host_Error( "MSG_WriteDeltaEntity: Bad entity number: %i\n", to->number );
+	startBit = msg->iCurBit;
 
 	MSG_WriteUBitLong( msg, to->number, MAX_ENTITY_BITS );
 	MSG_WriteUBitLong( msg, 0, 2 ); // alive
@@ -1799,47 +2218,53 @@ void MSG_WriteDeltaEntity( entity_state_t *from, entity_state_t *to, sizebuf_t *
 	}
 	else MSG_WriteOneBit( msg, 0 );
 
-	if( FBitSet( to->entityType, ENTITY_BEAM ))
-	{
-		dt = Delta_FindStruct( "custom_entity_state_t" );
-	}
-	else if( delta_type == DELTA_PLAYER )
-	{
-		dt = Delta_FindStruct( "entity_state_player_t" );
-	}
-	else
-	{
-		dt = Delta_FindStruct( "entity_state_t" );
-	}
-
-	Assert( dt && dt->bInitialized );
-
+	dt = Delta_FindEntityStruct( to, delta_type );
 	pField = dt->pFields;
 	Assert( pField != NULL );
 
-	if( delta_type == DELTA_STATIC )
+	if( delta_compiled && dt->ops )
 	{
-		// static entities won't to be custom encoded
-		for( i = 0; i < dt->numFields; i++ )
-			dt->pFields[i].bInactive = false;
+		const delta_op_t	*op = dt->ops;
+
+		for( i = 0; i < dt->numFields; i++, op++ )
+		{
+			if( Delta_WriteOp( msg, op, (byte *)from, (byte *)to, timebase, FBitSet( mask->inactive[i >> 5], BIT( i & 31 )) != 0 ))
+				numChanges++;
+		}
 	}
 	else
 	{
-		// activate fields and call custom encode func
-		Delta_CustomEncode( dt, from, to );
-	}
-
-	// process fields
-	for( i = 0; i < dt->numFields; i++, pField++ )
-	{
-		if( Delta_WriteField( msg, pField, from, to, timebase ))
-			numChanges++;
+		// process fields
+		for( i = 0; i < dt->numFields; i++, pField++ )
+		{
+			if( Delta_WriteFieldValue( msg, pField, from, to, timebase, FBitSet( mask->inactive[i >> 5], BIT( i & 31 )) != 0 ))
+				numChanges++;
+		}
 	}
 
 	// if we have no changes - kill the message
 	if( !numChanges && !force ) MSG_SeekToBit( msg, startBit, SEEK_SET );
 }
 
+/*
+==================
+MSG_WriteDeltaEntity
+
+Writes part of a packetentities message, including the entity number.
+Can delta from either a baseline or a previous packet_entity
+If to is NULL, a remove entity update will be sent
+If force is not set, then nothing at all will be generated if the entity is
+identical, under the assumption that the in-order delta code will catch it.
+==================
+*/
+void MSG_WriteDeltaEntity( entity_state_t *from, entity_state_t *to, sizebuf_t *msg, qboolean force, int delta_type, double timebase, int baseline )
+{
+	delta_mask_t	mask;
+
+	MSG_DeltaEntityMask( from, to, delta_type, &mask );
+	MSG_WriteDeltaEntityMasked( from, to, msg, force, delta_type, timebase, baseline, &mask );
+}
+
 /*
 ==================
 MSG_ReadDeltaEntity
@@ -76,6 +76,14 @@ struct delta_s
 	qboolean		bInactive;	// unsetted by user request
 };
 
+// fields disabled by custom encoder, one bit per field
+#define DELTA_MASK_BITS	128
+
+typedef struct
+{
+	uint		inactive[DELTA_MASK_BITS / 32];
+} delta_mask_t;
+
 typedef void (*pfnDeltaEncode)( struct delta_s *pFields, const byte *from, const byte *to );
 
 typedef struct
@@ -91,6 +99,8 @@ typedef struct
 	char		funcName[32];
 	pfnDeltaEncode	userCallback;
 	qboolean		bInitialized;
+
+	struct delta_op_s	*ops;		// fields compiled by Delta_CompileTables, may be NULL
 } delta_info_t;
 
 //
@@ -101,6 +111,9 @@ void Delta_InitClient( void );
 void Delta_Shutdown( void );
 void Delta_InitFields( void );
 int Delta_NumTables( void );
+void Delta_CompileTables( void );
+void Delta_SetCompiledEncoders( qboolean enable );
+void Delta_ReportOverflows( void );
 delta_info_t *Delta_FindStructByIndex( int index );
 void Delta_AddEncoder( char *name, pfnDeltaEncode encodeFunc );
 int Delta_FindField( delta_t *pFields, const char *fieldname );
@@ -132,6 +145,8 @@ void MSG_ReadClientData( sizebuf_t *msg, struct clientdata_s *from, struct clien
 void MSG_WriteWeaponData( sizebuf_t *msg, struct weapon_data_s *from, struct weapon_data_s *to, double timebase, int index );
 void MSG_ReadWeaponData( sizebuf_t *msg, struct weapon_data_s *from, struct weapon_data_s *to, double timebase );
 void MSG_WriteDeltaEntity( struct entity_state_s *from, struct entity_state_s *to, sizebuf_t *msg, qboolean force, int type, double timebase, int ofs );
+void MSG_DeltaEntityMask( struct entity_state_s *from, struct entity_state_s *to, int type, delta_mask_t *mask );
+void MSG_WriteDeltaEntityMasked( struct entity_state_s *from, struct entity_state_s *to, sizebuf_t *msg, qboolean force, int type, double timebase, int ofs, const delta_mask_t *mask );
 qboolean MSG_ReadDeltaEntity( sizebuf_t *msg, struct entity_state_s *from, struct entity_state_s *to, int num, int type, double timebase );
 int Delta_TestBaseline( struct entity_state_s *from, struct entity_state_s *to, qboolean player, double timebase );
 
@@ -12,11 +12,13 @@ but WITHOUT ANY WARRANTY; without even the implied warranty of
 MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
 GNU General Public License for more details.
 */
+#define _GNU_SOURCE // recvmmsg, sendmmsg
 
 #include "common.h"
 #include "client.h" // ConnectionProgress
 #include "netchan.h"
 #include "xash3d_mathlib.h"
+#include "threads.h"
 #if XASH_WIN32
 // Winsock
 #include <WS2tcpip.h>
@@ -98,6 +100,16 @@ typedef int WSAsize_t;
 
 #define NET_USE_FRAGMENTS
 
+#if XASH_LINUX && !defined XASH_NO_NETWORK && defined MSG_WAITFORONE
+#define NET_USE_MMSG
+#endif
+
+#if defined XASH_THREADS_AVAILABLE && !XASH_WIN32 && !defined XASH_NO_NETWORK
+#define NET_USE_RECVTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 #define PORT_ANY			-1
 #define MAX_LOOPBACK		4
 #define MASK_LOOPBACK		(MAX_LOOPBACK - 1)
@@ -176,6 +188,7 @@ static convar_t		*net_ipclientport;
 static convar_t		*net_fakelag;
 static convar_t		*net_fakeloss;
 static convar_t		*net_address;
+static convar_t		*net_batchio;
 convar_t			*net_clockwindow;
 netadr_t			net_local;
 
@@ -1079,6 +1092,641 @@ qboolean NET_GetLong( byte *pData, int size, size_t *outSize, int splitsize )
 	return false;
 }
 
+/*
+=============================================================================
+
+BATCHED SOCKET I/O
+
+Linux can move many datagrams with a single syscall. Server socket
+drains incoming packets with recvmmsg into a ring of preallocated
+buffers and SV_SendClientMessages flushes outgoing ones with sendmmsg
+
+=============================================================================
+*/
+#ifdef NET_USE_MMSG
+#define NET_BATCH_SIZE		32
+#define NET_RECV_BATCH		16		// every slot holds NET_MAX_FRAGMENT bytes
+#define NET_SEND_POOL		( 256 * 1024 )
+#define NET_SEND_DIRECT		( NET_SEND_POOL / 4 )	// bigger packets are sent immediately
+
+typedef struct
+{
+	struct mmsghdr	hdr[NET_RECV_BATCH];
+	struct iovec	iov[NET_RECV_BATCH];
+	struct sockaddr	addr[NET_RECV_BATCH];
+	byte		data[NET_RECV_BATCH][NET_MAX_FRAGMENT];
+	int		count;		// received by last call
+	int		next;		// next one to return
+} net_recvbatch_t;
+
+typedef struct
+{
+	struct mmsghdr	hdr[NET_BATCH_SIZE];
+	struct iovec	iov[NET_BATCH_SIZE];
+	struct sockaddr	addr[NET_BATCH_SIZE];
+	netadr_t		to[NET_BATCH_SIZE];	// for error reports
+	byte		pool[NET_SEND_POOL];
+	int		count;
+	int		used;		// bytes in pool
+} net_sendbatch_t;
+
+static net_recvbatch_t	*net_recvbatch;
+static net_sendbatch_t	*net_sendbatch;
+static qboolean		net_batching;	// between NET_BeginSendBatch and NET_EndSendBatch
+#endif // NET_USE_MMSG
+
+static void NET_ReportSendError( netadr_t to );
+
+#ifdef NET_USE_MMSG
+/*
+==================
+NET_RecvBatch
+
+returns number of received datagrams or SOCKET_ERROR
+==================
+*/
+static int NET_RecvBatch( net_recvbatch_t *batch, int net_socket )
+{
+	int	i, ret;
+
+	for( i = 0; i < NET_RECV_BATCH; i++ )
+	{
+		batch->iov[i].iov_base = batch->data[i];
+		batch->iov[i].iov_len = sizeof( batch->data[i] );
+		memset( &batch->hdr[i], 0, sizeof( batch->hdr[i] ));
+		batch->hdr[i].msg_hdr.msg_iov = &batch->iov[i];
+		batch->hdr[i].msg_hdr.msg_iovlen = 1;
+		batch->hdr[i].msg_hdr.msg_name = &batch->addr[i];
+		batch->hdr[i].msg_hdr.msg_namelen = sizeof( batch->addr[i] );
+	}
+
+	ret = recvmmsg( net_socket, batch->hdr, NET_RECV_BATCH, MSG_DONTWAIT, NULL );
+
+	batch->count = ret > 0 ? ret : 0;
+	batch->next = 0;
+
+	return ret;
+}
+
+/*
+==================
+NET_SendBatch
+
+sends everything collected so far, returns number of syscalls made
+==================
+*/
+static int NET_SendBatch( net_sendbatch_t *batch, int net_socket )
+{
+	int	sent = 0, calls = 0;
+
+	while( sent < batch->count )
+	{
+		int	ret = sendmmsg( net_socket, batch->hdr + sent, batch->count - sent, MSG_DONTWAIT );
+
+		calls++;
+
+		if( NET_IsSocketError( ret ))
+		{
+			// first datagram of the rest has failed, skip it
+			NET_ReportSendError( batch->to[sent] );
+			sent++;
+		}
+		else sent += ret;
+	}
+
+	batch->count = 0;
+	batch->used = 0;
+
+	return calls;
+}
+
+/*
+==================
+NET_AddToSendBatch
+
+returns number of syscalls made to free up space
+==================
+*/
+static int NET_AddToSendBatch( net_sendbatch_t *batch, int net_socket, const void *data, size_t length, const struct sockaddr *to, netadr_t adr )
+{
+	int	i, calls = 0;
+
+	if( batch->count == NET_BATCH_SIZE || batch->used + length > sizeof( batch->pool ))
+		calls = NET_SendBatch( batch, net_socket );
+
+	i = batch->count++;
+	memcpy( batch->pool + batch->used, data, length );
+	batch->addr[i] = *to;
+	batch->to[i] = adr;
+	batch->iov[i].iov_base = batch->pool + batch->used;
+	batch->iov[i].iov_len = length;
+	memset( &batch->hdr[i], 0, sizeof( batch->hdr[i] ));
+	batch->hdr[i].msg_hdr.msg_iov = &batch->iov[i];
+	batch->hdr[i].msg_hdr.msg_iovlen = 1;
+	batch->hdr[i].msg_hdr.msg_name = &batch->addr[i];
+	batch->hdr[i].msg_hdr.msg_namelen = sizeof( batch->addr[i] );
+	batch->used += length;
+
+	return calls;
+}
+
+/*
+==================
+NET_RecvBatched
+
+recvfrom replacement for the server socket
+==================
+*/
+static int NET_RecvBatched( int net_socket, struct sockaddr *addr, byte **data )
+{
+	net_recvbatch_t	*batch;
+	int		i;
+
+	if( !net_recvbatch )
+		net_recvbatch = Mem_Calloc( host.mempool, sizeof( *net_recvbatch ));
+	batch = net_recvbatch;
+
+	if( batch->next >= batch->count )
+	{
+		if( NET_RecvBatch( batch, net_socket ) <= 0 )
+			return SOCKET_ERROR;
+	}
+
+	i = batch->next++;
+	*addr = batch->addr[i];
+	*data = batch->data[i];
+
+	return batch->hdr[i].msg_len;
+}
+#endif // NET_USE_MMSG
+
+/*
+==================
+NET_BeginSendBatch
+
+collect outgoing datagrams instead of sending them one by one
+==================
+*/
+void NET_BeginSendBatch( netsrc_t sock )
+{
+#ifdef NET_USE_MMSG
+	if( sock != NS_SERVER || !net_batchio->value || !NET_IsSocketValid( net.ip_sockets[sock] ))
+		return;
+
+	if( !net_sendbatch )
+		net_sendbatch = Mem_Calloc( host.mempool, sizeof( *net_sendbatch ));
+
+	// previous batch could be interrupted by an error
+	if( net_sendbatch->count )
+		NET_SendBatch( net_sendbatch, net.ip_sockets[sock] );
+
+	net_batching = true;
+#endif
+}
+
+/*
+==================
+NET_EndSendBatch
+
+==================
+*/
+void NET_EndSendBatch( netsrc_t sock )
+{
+#ifdef NET_USE_MMSG
+	if( sock != NS_SERVER || !net_batching )
+		return;
+
+	net_batching = false;
+
+	if( net_sendbatch->count && NET_IsSocketValid( net.ip_sockets[sock] ))
+		NET_SendBatch( net_sendbatch, net.ip_sockets[sock] );
+	net_sendbatch->count = net_sendbatch->used = 0;
+#endif
+}
+
+#ifdef NET_USE_MMSG
+/*
+==================
+NET_Bench_f
+
+compares plain and batched socket I/O on the loopback interface
+==================
+*/
+static void NET_Bench_f( void )
+{
+	const char	*names[2] = { "sendto/recvfrom", "sendmmsg/recvmmsg" };
+	int		perframe = Cmd_Argc() > 1 ? Q_atoi( Cmd_Argv( 1 )) : 64;
+	int		frames = Cmd_Argc() > 2 ? Q_atoi( Cmd_Argv( 2 )) : 1000;
+	int		rcvbuf = 4 * 1024 * 1024, _true = 1;
+	net_recvbatch_t	*recvbatch;
+	net_sendbatch_t	*sendbatch;
+	struct sockaddr_in	addr;
+	WSAsize_t		addrlen = sizeof( addr );
+	byte		packet[200];
+	netadr_t		adr;
+	int		a, b, mode;
+
+	perframe = bound( 1, perframe, 1024 );
+	frames = Q_max( frames, 1 );
+
+	a = socket( PF_INET, SOCK_DGRAM, IPPROTO_UDP );
+	b = socket( PF_INET, SOCK_DGRAM, IPPROTO_UDP );
+
+	memset( &addr, 0, sizeof( addr ));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+	if( !NET_IsSocketValid( a ) || !NET_IsSocketValid( b )
+		|| NET_IsSocketError( bind( b, (struct sockaddr *)&addr, sizeof( addr )))
+		|| NET_IsSocketError( getsockname( b, (struct sockaddr *)&addr, &addrlen )))
+	{
+		Con_Printf( S_ERROR "net_bench: %s\n", NET_ErrorString( ));
+		if( NET_IsSocketValid( a )) closesocket( a );
+		if( NET_IsSocketValid( b )) closesocket( b );
+		return;
+	}
+
+	ioctlsocket( a, FIONBIO, (void *)&_true );
+	ioctlsocket( b, FIONBIO, (void *)&_true );
+	setsockopt( b, SOL_SOCKET, SO_RCVBUF, (char *)&rcvbuf, sizeof( rcvbuf ));
+
+	recvbatch = Mem_Calloc( host.mempool, sizeof( *recvbatch ));
+	sendbatch = Mem_Calloc( host.mempool, sizeof( *sendbatch ));
+	memset( packet, 0x55, sizeof( packet ));
+	NET_SockadrToNetadr( (struct sockaddr *)&addr, &adr );
+
+	Con_Printf( "net_bench: %i packets per frame, %i frames\n", perframe, frames );
+
+	for( mode = 0; mode < 2; mode++ )
+	{
+		int	i, f, ret, received = 0, syscalls = 0;
+		double	start = Sys_DoubleTime(), elapsed;
+
+		for( f = 0; f < frames; f++ )
+		{
+			// like SV_SendClientMessages
+			for( i = 0; i < perframe; i++ )
+			{
+				if( mode )
+				{
+					syscalls += NET_AddToSendBatch( sendbatch, a, packet, sizeof( packet ), (struct sockaddr *)&addr, adr );
+				}
+				else
+				{
+					sendto( a, packet, sizeof( packet ), 0, (struct sockaddr *)&addr, sizeof( addr ));
+					syscalls++;
+				}
+			}
+
+			if( mode ) syscalls += NET_SendBatch( sendbatch, a );
+
+			// like SV_ReadPackets, the last call finds the socket empty
+			do
+			{
+				if( mode )
+				{
+					ret = NET_RecvBatch( recvbatch, b );
+					if( ret > 0 ) received += ret;
+				}
+				else
+				{
+					byte	buf[NET_MAX_FRAGMENT];
+
+					ret = recv( b, buf, sizeof( buf ), 0 );
+					if( ret > 0 ) received++;
+				}
+				syscalls++;
+			} while( ret > 0 );
+		}
+
+		elapsed = Q_max( Sys_DoubleTime() - start, 0.000001 );
+
+		Con_Printf( "%-18s %9.0f packets/s, %6.2f syscalls per frame, %i of %i received\n",
+			names[mode], received / elapsed, (double)syscalls / frames, received, perframe * frames );
+	}
+
+	Mem_Free( recvbatch );
+	Mem_Free( sendbatch );
+	closesocket( a );
+	closesocket( b );
+}
+#endif // NET_USE_MMSG
+
+/*
+=============================================================================
+
+NETWORK RECEIVE THREAD
+
+Optional thread that waits on the server socket, answers stateless
+queries through a callback and passes everything else to the main
+loop through a single producer, single consumer ring of timestamped
+packets. Producer only moves head, consumer only moves tail
+
+=============================================================================
+*/
+#ifdef NET_USE_RECVTHREAD
+#define NET_QUEUE_SIZE		( 4 * 1024 * 1024 ) // must be power of two
+#define NET_QUEUE_ALIGN		16
+
+typedef struct
+{
+	int		size;		// data size, -1 for padding up to the ring end
+	netadr_t		from;
+	double		time;		// when the thread got it
+} net_queued_t;
+
+static struct
+{
+	pthread_t		thread;
+	qboolean		running;
+	volatile int	quit;
+	netsrc_t		sock;
+	int		net_socket;
+	net_queryfunc_t	query;
+	int		wake[2];		// pipe, readable when something was queued
+
+	byte		*ring;
+	volatile int	head;		// bytes ever written, producer only
+	volatile int	tail;		// bytes ever read, consumer only
+
+	// statistics
+	volatile int	received;
+	volatile int	answered;
+	volatile int	queued;
+	volatile int	dropped;
+	volatile int	maxdepth;
+	int		popped;
+	double		waittime;		// total time packets spent in queue
+} netthread;
+
+/*
+==================
+NET_QueueRecord
+
+reserves room for a packet, NULL if queue is full
+==================
+*/
+static net_queued_t *NET_QueueRecord( int length, int *advance )
+{
+	uint	head = netthread.head;
+	uint	tail = Sys_AtomicAdd( &netthread.tail, 0 );
+	uint	size = ( sizeof( net_queued_t ) + length + NET_QUEUE_ALIGN - 1 ) & ~( NET_QUEUE_ALIGN - 1 );
+	uint	ofs = head & ( NET_QUEUE_SIZE - 1 );
+	uint	pad = 0;
+
+	// records never wrap, skip the rest of the ring
+	if( ofs + size > NET_QUEUE_SIZE )
+		pad = NET_QUEUE_SIZE - ofs;
+
+	if(( head - tail ) + pad + size > NET_QUEUE_SIZE )
+		return NULL;
+
+	if( pad )
+	{
+		((net_queued_t *)( netthread.ring + ofs ))->size = -1;
+		ofs = 0;
+	}
+
+	*advance = pad + size;
+
+	return (net_queued_t *)( netthread.ring + ofs );
+}
+
+/*
+==================
+NET_RecvThread
+
+==================
+*/
+static void *NET_RecvThread( void *unused )
+{
+	byte		buf[NET_MAX_FRAGMENT];
+	byte		reply[NET_MAX_FRAGMENT];
+
+	while( !netthread.quit )
+	{
+		struct timeval	timeout;
+		qboolean		wakeup = false;
+		fd_set		fdset;
+
+		FD_ZERO( &fdset );
+		FD_SET( netthread.net_socket, &fdset );
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 100000; // to notice quit request
+
+		if( select( netthread.net_socket + 1, &fdset, NULL, NULL, &timeout ) <= 0 )
+			continue;
+
+		while( 1 )
+		{
+			struct sockaddr	addr;
+			WSAsize_t		addr_len = sizeof( addr );
+			net_queued_t	*rec;
+			netadr_t		from;
+			size_t		replylen = 0;
+			int		ret, advance, depth;
+
+			ret = recvfrom( netthread.net_socket, buf, sizeof( buf ), MSG_DONTWAIT, &addr, &addr_len );
+
+			if( NET_IsSocketError( ret ))
+				break;
+
+			Sys_AtomicAdd( &netthread.received, 1 );
+			memset( &from, 0, sizeof( from ));
+			NET_SockadrToNetadr( &addr, &from );
+
+			if( ret >= 4 && *(int *)buf == NET_HEADER_OUTOFBANDPACKET && netthread.query( from, buf, ret, reply, &replylen ))
+			{
+				if( replylen > 0 )
+					sendto( netthread.net_socket, reply, replylen, 0, &addr, addr_len );
+				Sys_AtomicAdd( &netthread.answered, 1 );
+				continue;
+			}
+
+			if(( rec = NET_QueueRecord( ret, &advance )) == NULL )
+			{
+				Sys_AtomicAdd( &netthread.dropped, 1 );
+				continue;
+			}
+
+			rec->size = ret;
+			rec->from = from;
+			rec->time = Sys_DoubleTime();
+			memcpy( rec + 1, buf, ret );
+
+			// publish it
+			Sys_AtomicAdd( &netthread.head, advance );
+			depth = Sys_AtomicAdd( &netthread.queued, 1 ) + 1 - netthread.popped;
+			if( depth > netthread.maxdepth )
+				netthread.maxdepth = depth;
+			wakeup = true;
+		}
+
+		// pipe could be full, but then it's readable anyway
+		if( wakeup && write( netthread.wake[1], "", 1 ) < 0 )
+			continue;
+	}
+
+	return NULL;
+}
+
+/*
+==================
+NET_PopThreadPacket
+
+returns packet size or SOCKET_ERROR if queue is empty
+==================
+*/
+static int NET_PopThreadPacket( netadr_t *from, byte *data, size_t maxsize )
+{
+	while( 1 )
+	{
+		uint		tail = netthread.tail;
+		uint		head = Sys_AtomicAdd( &netthread.head, 0 );
+		net_queued_t	*rec;
+		int		size;
+
+		if( head == tail )
+		{
+			errno = EWOULDBLOCK;
+			return SOCKET_ERROR;
+		}
+
+		rec = (net_queued_t *)( netthread.ring + ( tail & ( NET_QUEUE_SIZE - 1 )));
+
+		if( rec->size < 0 )
+		{
+			// padding, continue from the ring start
+			Sys_AtomicAdd( &netthread.tail, NET_QUEUE_SIZE - ( tail & ( NET_QUEUE_SIZE - 1 )));
+			continue;
+		}
+
+		size = Q_min( rec->size, maxsize );
+		*from = rec->from;
+		memcpy( data, rec + 1, size );
+
+		netthread.waittime += Sys_DoubleTime() - rec->time;
+		netthread.popped++;
+
+		Sys_AtomicAdd( &netthread.tail, ( sizeof( net_queued_t ) + rec->size + NET_QUEUE_ALIGN - 1 ) & ~( NET_QUEUE_ALIGN - 1 ));
+
+		return size;
+	}
+}
+#endif // NET_USE_RECVTHREAD
+
+/*
+==================
+NET_StartRecvThread
+
+query is called on the network thread for connectionless
+packets and must return true if it has answered them
+==================
+*/
+qboolean NET_StartRecvThread( netsrc_t sock, net_queryfunc_t query )
+{
+#ifdef NET_USE_RECVTHREAD
+	if( netthread.running )
+		return netthread.sock == sock;
+
+	if( !NET_IsSocketValid( net.ip_sockets[sock] ))
+		return false;
+
+	if( pipe( netthread.wake ) < 0 )
+		return false;
+
+	fcntl( netthread.wake[0], F_SETFL, O_NONBLOCK );
+	fcntl( netthread.wake[1], F_SETFL, O_NONBLOCK );
+
+	netthread.sock = sock;
+	netthread.net_socket = net.ip_sockets[sock];
+	netthread.query = query;
+	netthread.ring = Mem_Malloc( host.mempool, NET_QUEUE_SIZE );
+	netthread.quit = false;
+
+	if( pthread_create( &netthread.thread, NULL, NET_RecvThread, NULL ))
+	{
+		Con_Printf( S_ERROR "couldn't start network thread\n" );
+		close( netthread.wake[0] );
+		close( netthread.wake[1] );
+		Mem_Free( netthread.ring );
+		memset( &netthread, 0, sizeof( netthread ));
+		return false;
+	}
+
+	netthread.running = true;
+	Con_Reportf( "Network thread started\n" );
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+/*
+==================
+NET_StopRecvThread
+
+packets still in queue are lost
+==================
+*/
+void NET_StopRecvThread( void )
+{
+#ifdef NET_USE_RECVTHREAD
+	if( !netthread.running )
+		return;
+
+	netthread.quit = true;
+	pthread_join( netthread.thread, NULL );
+
+	close( netthread.wake[0] );
+	close( netthread.wake[1] );
+	Mem_Free( netthread.ring );
+	memset( &netthread, 0, sizeof( netthread ));
+	Con_Reportf( "Network thread stopped\n" );
+#endif
+}
+
+/*
+==================
+NET_RecvThreadActive
+
+==================
+*/
+qboolean NET_RecvThreadActive( netsrc_t sock )
+{
+#ifdef NET_USE_RECVTHREAD
+	return netthread.running && netthread.sock == sock;
+#else
+	return false;
+#endif
+}
+
+/*
+==================
+NET_RecvThreadStats_f
+
+==================
+*/
+static void NET_RecvThreadStats_f( void )
+{
+#ifdef NET_USE_RECVTHREAD
+	if( !netthread.running )
+	{
+		Con_Printf( "network thread is not running\n" );
+		return;
+	}
+
+	Con_Printf( "network thread: %i received, %i answered, %i queued, %i dropped\n",
+		netthread.received, netthread.answered, netthread.queued, netthread.dropped );
+	Con_Printf( "queue depth %i, max %i, average wait %.3f ms\n",
+		netthread.queued - netthread.popped, netthread.maxdepth,
+		netthread.popped ? netthread.waittime * 1000.0 / netthread.popped : 0.0 );
+#else
+	Con_Printf( "network thread is not supported on this platform\n" );
+#endif
+}
+
 /*
 ==================
 NET_QueuePacket
@@ -1089,6 +1737,7 @@ queue normal and lagged packets
 qboolean NET_QueuePacket( netsrc_t sock, netadr_t *from, byte *data, size_t *length )
 {
 	byte		buf[NET_MAX_FRAGMENT];
+	byte		*pbuf = buf;
 	int		ret;
 	int		net_socket;
 	WSAsize_t	addr_len;
@@ -1100,17 +1749,36 @@ qboolean NET_QueuePacket( netsrc_t sock, netadr_t *from, byte *data, size_t *len
 
 	if( NET_IsSocketValid( net_socket ) )
 	{
-		addr_len = sizeof( addr );
-		ret = recvfrom( net_socket, buf, sizeof( buf ), 0, (struct sockaddr *)&addr, &addr_len );
+#ifdef NET_USE_RECVTHREAD
+		if( NET_RecvThreadActive( sock ))
+		{
+			// thread has already converted the address
+			ret = NET_PopThreadPacket( from, buf, sizeof( buf ));
+			addr.sa_family = AF_UNSPEC;
+		}
+		else
+#endif
+#ifdef NET_USE_MMSG
+		if( sock == NS_SERVER && net_batchio->value )
+		{
+			ret = NET_RecvBatched( net_socket, &addr, &pbuf );
+		}
+		else
+#endif
+		{
+			addr_len = sizeof( addr );
+			ret = recvfrom( net_socket, buf, sizeof( buf ), 0, (struct sockaddr *)&addr, &addr_len );
+		}
 
 		if( !NET_IsSocketError( ret ) )
 		{
-			NET_SockadrToNetadr( &addr, from );
+			if( addr.sa_family != AF_UNSPEC )
+				NET_SockadrToNetadr( &addr, from );
 
 			if( ret < NET_MAX_FRAGMENT )
 			{
 				// Transfer data
-				memcpy( data, buf, ret );
+				memcpy( data, pbuf, ret );
 				*length = ret;
 #if !XASH_DEDICATED
 				if( CL_LegacyMode() )
@@ -1278,34 +1946,56 @@ void NET_SendPacketEx( netsrc_t sock, size_t length, const void *data, netadr_t
 
 	NET_NetadrToSockadr( &to, &addr );
 
+#ifdef NET_USE_MMSG
+	if( net_batching && sock == NS_SERVER )
+	{
+		// packets which NET_SendLong would split keep going
+		// the slow way, but after everything queued before
+		if( length <= NET_SEND_DIRECT && !( splitsize > sizeof( SPLITPACKET ) && length > splitsize ))
+		{
+			NET_AddToSendBatch( net_sendbatch, net_socket, data, length, &addr, to );
+			return;
+		}
+
+		NET_SendBatch( net_sendbatch, net_socket );
+	}
+#endif
+
 	ret = NET_SendLong( sock, net_socket, data, length, 0, &addr, sizeof( addr ), splitsize );
 
 	if( NET_IsSocketError( ret ))
-	{
-		int err = WSAGetLastError();
+		NET_ReportSendError( to );
+}
 
-		// WSAEWOULDBLOCK is silent
-		if( err == WSAEWOULDBLOCK )
-			return;
+/*
+==================
+NET_ReportSendError
+==================
+*/
+static void NET_ReportSendError( netadr_t to )
+{
+	int err = WSAGetLastError();
 
-		// some PPP links don't allow broadcasts
-		if( err == WSAEADDRNOTAVAIL && to.type == NA_BROADCAST )
-			return;
+	// WSAEWOULDBLOCK is silent
+	if( err == WSAEWOULDBLOCK )
+		return;
 
-		if( Host_IsDedicated() )
-		{
-			Con_DPrintf( S_ERROR "NET_SendPacket: %s to %s\n", NET_ErrorString(), NET_AdrToString( to ));
-		}
-		else if( err == WSAEADDRNOTAVAIL || err == WSAENOBUFS )
-		{
-			Con_DPrintf( S_ERROR "NET_SendPacket: %s to %s\n", NET_ErrorString(), NET_AdrToString( to ));
-		}
-		else
-		{
-			Con_Printf( S_ERROR "NET_SendPacket: %s to %s\n", NET_ErrorString(), NET_AdrToString( to ));
-		}
-	}
+	// some PPP links don't allow broadcasts
+	if( err == WSAEADDRNOTAVAIL && to.type == NA_BROADCAST )
+		return;
 
+	if( Host_IsDedicated() )
+	{
+		Con_DPrintf( S_ERROR "NET_SendPacket: %s to %s\n", NET_ErrorString(), NET_AdrToString( to ));
+	}
+	else if( err == WSAEADDRNOTAVAIL || err == WSAENOBUFS )
+	{
+		Con_DPrintf( S_ERROR "NET_SendPacket: %s to %s\n", NET_ErrorString(), NET_AdrToString( to ));
+	}
+	else
+	{
+		Con_Printf( S_ERROR "NET_SendPacket: %s to %s\n", NET_ErrorString(), NET_AdrToString( to ));
+	}
 }
 
 /*
@@ -1599,6 +2289,9 @@ void NET_Config( qboolean multiplayer )
 	{
 		int	i;
 
+		// thread must not wait on a closed socket
+		NET_StopRecvThread();
+
 		// shut down any existing sockets
 		for( i = 0; i < NS_COUNT; i++ )
 		{
@@ -1608,6 +2301,13 @@ void NET_Config( qboolean multiplayer )
 				net.ip_sockets[i] = INVALID_SOCKET;
 			}
 		}
+
+#ifdef NET_USE_MMSG
+		// anything left in batches belongs to closed sockets
+		if( net_recvbatch ) net_recvbatch->count = net_recvbatch->next = 0;
+		if( net_sendbatch ) net_sendbatch->count = net_sendbatch->used = 0;
+		net_batching = false;
+#endif
 	}
 
 	NET_ClearLoopback ();
@@ -1656,6 +2356,25 @@ void NET_Sleep( int msec )
 
 	FD_ZERO( &fdset );
 
+#ifdef NET_USE_RECVTHREAD
+	if( NET_RecvThreadActive( NS_SERVER ))
+	{
+		char	dummy[64];
+
+		// socket belongs to the thread, wait until it queues something
+		if( netthread.head == netthread.tail )
+		{
+			FD_SET( netthread.wake[0], &fdset );
+			timeout.tv_sec = msec / 1000;
+			timeout.tv_usec = (msec % 1000) * 1000;
+			select( netthread.wake[0] + 1, &fdset, NULL, NULL, &timeout );
+		}
+
+		while( read( netthread.wake[0], dummy, sizeof( dummy )) > 0 );
+		return;
+	}
+#endif
+
 	if( net.ip_sockets[NS_SERVER] != INVALID_SOCKET )
 	{
 		FD_SET( net.ip_sockets[NS_SERVER], &fdset ); // network socket
@@ -1702,6 +2421,11 @@ void NET_Init( void )
 	net_clientport = Cvar_Get( "clientport", va( "%i", PORT_CLIENT ), FCVAR_READ_ONLY, "network default client port" );
 	net_fakelag = Cvar_Get( "fakelag", "0", 0, "lag all incoming network data (including loopback) by xxx ms." );
 	net_fakeloss = Cvar_Get( "fakeloss", "0", 0, "act like we dropped the packet this % of the time." );
+	net_batchio = Cvar_Get( "net_batchio", "1", FCVAR_ARCHIVE, "move server packets with recvmmsg/sendmmsg where supported" );
+#ifdef NET_USE_MMSG
+	Cmd_AddCommand( "net_bench", NET_Bench_f, "compare plain and batched socket I/O on loopback" );
+#endif
+	Cmd_AddCommand( "net_threadstats", NET_RecvThreadStats_f, "show network thread queue depth and drop counters" );
 
 	// prepare some network data
 	for( i = 0; i < NS_COUNT; i++ )
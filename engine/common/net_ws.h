@@ -66,6 +66,15 @@ qboolean NET_BufferToBufferCompress( byte *dest, uint *destLen, byte *source, ui
 qboolean NET_BufferToBufferDecompress( byte *dest, uint *destLen, byte *source, uint sourceLen );
 void NET_SendPacket( netsrc_t sock, size_t length, const void *data, netadr_t to );
 void NET_SendPacketEx( netsrc_t sock, size_t length, const void *data, netadr_t to, size_t splitsize );
+void NET_BeginSendBatch( netsrc_t sock );
+void NET_EndSendBatch( netsrc_t sock );
+
+// called on the network thread, answer goes to reply
+typedef qboolean (*net_queryfunc_t)( netadr_t from, const byte *data, size_t length, byte *reply, size_t *replylen );
+
+qboolean NET_StartRecvThread( netsrc_t sock, net_queryfunc_t query );
+void NET_StopRecvThread( void );
+qboolean NET_RecvThreadActive( netsrc_t sock );
 void NET_ClearLagData( qboolean bClient, qboolean bServer );
 
 #if !XASH_DEDICATED
@@ -273,6 +273,7 @@ typedef struct netchan_s
 	size_t		total_sended;
 	size_t		total_received;
 	qboolean	split;
+	qboolean	deflate_fragments;	// remote side can decompress deflate
 	unsigned int	maxpacket;
 	unsigned int	splitid;
 	netsplit_t netsplit;
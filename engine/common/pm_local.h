@@ -18,6 +18,8 @@ GNU General Public License for more details.
 
 #include "pm_defs.h"
 
+#define PM_TRACE_PACKET	8	// rays tested together by PM_HullTraceMany
+
 typedef int (*pfnIgnore)( physent_t *pe );	// custom trace filter
 
 //
@@ -33,6 +35,8 @@ void Pmove_Init( void );
 void PM_InitBoxHull( void );
 hull_t *PM_HullForBsp( physent_t *pe, playermove_t *pmove, float *offset );
 qboolean PM_RecursiveHullCheck( hull_t *hull, int num, float p1f, float p2f, vec3_t p1, vec3_t p2, pmtrace_t *trace );
+void PM_HullTraceMany( hull_t *hull, int count, const vec3_t *p1, const vec3_t *p2, pmtrace_t *traces );
+void PM_HullTraceBench( model_t *model, int numrays, int passes );
 pmtrace_t PM_PlayerTraceExt( playermove_t *pm, vec3_t p1, vec3_t p2, int flags, int numents, physent_t *ents, int ignore_pe, pfnIgnore pmFilter );
 int PM_TestPlayerPosition( playermove_t *pmove, vec3_t pos, pmtrace_t *ptrace, pfnIgnore pmFilter );
 int PM_HullPointContents( hull_t *hull, int num, const vec3_t p );
@@ -195,10 +195,13 @@ hull_t *PM_HullForStudio( physent_t *pe, playermove_t *pmove, int *numhitboxes )
 
 /*
 ==================
-PM_RecursiveHullCheck
+PM_HullCheckRecursive
+
+reference implementation, also takes over when a tree
+is deeper than the explicit stack of PM_RecursiveHullCheck
 ==================
 */
-qboolean PM_RecursiveHullCheck( hull_t *hull, int num, float p1f, float p2f, vec3_t p1, vec3_t p2, pmtrace_t *trace )
+static qboolean PM_HullCheckRecursive( hull_t *hull, int num, float p1f, float p2f, vec3_t p1, vec3_t p2, pmtrace_t *trace )
 {
 	mclipnode_t	*node;
 	mplane_t		*plane;
@@ -264,14 +267,14 @@ loc0:
 	VectorLerp( p1, frac, p2, mid );
 
 	// move up to the node
-	if( !PM_RecursiveHullCheck( hull, node->children[side], p1f, midf, p1, mid, trace ))
+	if( !PM_HullCheckRecursive( hull, node->children[side], p1f, midf, p1, mid, trace ))
 		return false;
 
 	// this recursion can not be optimized because mid would need to be duplicated on a stack
 	if( PM_HullPointContents( hull, node->children[side^1], mid ) != CONTENTS_SOLID )
 	{
 		// go past the node
-		return PM_RecursiveHullCheck( hull, node->children[side^1], midf, p2f, mid, p2, trace );
+		return PM_HullCheckRecursive( hull, node->children[side^1], midf, p2f, mid, p2, trace );
 	}
 
 	// never got out of the solid area
@@ -313,6 +316,492 @@ loc0:
 	return false;
 }
 
+/*
+===============================================================================
+
+	ITERATIVE HULL TRACE
+
+	Same walk as PM_HullCheckRecursive with the near side of every
+	crossed plane kept on an explicit stack. Segments are stored by
+	value and every float is computed in the same order, so results
+	are bit exact with the recursive version.
+
+===============================================================================
+*/
+#define PM_TRACE_STACK	64
+
+typedef struct
+{
+	mplane_t		*plane;
+	int		far;	// child on the other side of the plane
+	int		side;
+	float		p1f, p2f;
+	float		frac, midf;
+	vec3_t		p1, p2;
+	vec3_t		mid;
+} pm_traceframe_t;
+
+/*
+==================
+PM_HullImpact
+
+the far side of a split is solid, back up out of it
+==================
+*/
+static qboolean PM_HullImpact( hull_t *hull, pm_traceframe_t *frame, pmtrace_t *trace )
+{
+	float	frac = frame->frac;
+
+	// never got out of the solid area
+	if( trace->allsolid )
+		return false;
+
+	if( !frame->side )
+	{
+		VectorCopy( frame->plane->normal, trace->plane.normal );
+		trace->plane.dist = frame->plane->dist;
+	}
+	else
+	{
+		VectorNegate( frame->plane->normal, trace->plane.normal );
+		trace->plane.dist = -frame->plane->dist;
+	}
+
+	while( PM_HullPointContents( hull, hull->firstclipnode, frame->mid ) == CONTENTS_SOLID )
+	{
+		// shouldn't really happen, but does occasionally
+		frac -= 0.1f;
+
+		if( frac < 0.0f )
+		{
+			trace->fraction = frame->midf;
+			VectorCopy( frame->mid, trace->endpos );
+			Con_Reportf( S_WARN "trace backed up past 0.0\n" );
+			return false;
+		}
+
+		frame->midf = frame->p1f + ( frame->p2f - frame->p1f ) * frac;
+		VectorLerp( frame->p1, frac, frame->p2, frame->mid );
+	}
+
+	trace->fraction = frame->midf;
+	VectorCopy( frame->mid, trace->endpos );
+
+	return false;
+}
+
+/*
+==================
+PM_RecursiveHullCheck
+
+returns false when the trace was blocked
+==================
+*/
+qboolean PM_RecursiveHullCheck( hull_t *hull, int num, float p1f, float p2f, vec3_t p1, vec3_t p2, pmtrace_t *trace )
+{
+	pm_traceframe_t	stack[PM_TRACE_STACK];
+	pm_traceframe_t	*frame;
+	mclipnode_t	*node;
+	mplane_t		*plane;
+	vec3_t		start, end;
+	float		t1, t2;
+	int		depth = 0;
+
+	VectorCopy( p1, start );
+	VectorCopy( p2, end );
+
+	while( 1 )
+	{
+		if( num < 0 )
+		{
+			if( num != CONTENTS_SOLID )
+			{
+				trace->allsolid = false;
+				if( num == CONTENTS_EMPTY )
+					trace->inopen = true;
+				else trace->inwater = true;
+			}
+			else trace->startsolid = true;
+		}
+		else if( hull->firstclipnode >= hull->lastclipnode )
+		{
+			// empty hull?
+			trace->allsolid = false;
+			trace->inopen = true;
+		}
+		else
+		{
+			if( num < hull->firstclipnode || num > hull->lastclipnode )
+				Host_Error( "PM_RecursiveHullCheck: bad node number %i\n", num );
+
+			node = hull->clipnodes + num;
+			plane = hull->planes + node->planenum;
+
+			t1 = PlaneDiff( start, plane );
+			t2 = PlaneDiff( end, plane );
+
+			if( t1 >= 0.0f && t2 >= 0.0f )
+			{
+				num = node->children[0];
+				continue;
+			}
+
+			if( t1 < 0.0f && t2 < 0.0f )
+			{
+				num = node->children[1];
+				continue;
+			}
+
+			if( depth < PM_TRACE_STACK )
+			{
+				frame = &stack[depth++];
+				frame->plane = plane;
+
+				// put the crosspoint DIST_EPSILON pixels on the near side
+				frame->side = (t1 < 0.0f);
+				frame->far = node->children[frame->side^1];
+
+				if( frame->side ) frame->frac = ( t1 + DIST_EPSILON ) / ( t1 - t2 );
+				else frame->frac = ( t1 - DIST_EPSILON ) / ( t1 - t2 );
+
+				if( frame->frac < 0.0f ) frame->frac = 0.0f;
+				if( frame->frac > 1.0f ) frame->frac = 1.0f;
+
+				frame->p1f = p1f;
+				frame->p2f = p2f;
+				VectorCopy( start, frame->p1 );
+				VectorCopy( end, frame->p2 );
+
+				frame->midf = p1f + ( p2f - p1f ) * frame->frac;
+				VectorLerp( start, frame->frac, end, frame->mid );
+
+				// move up to the node
+				num = node->children[frame->side];
+				p2f = frame->midf;
+				VectorCopy( frame->mid, end );
+				continue;
+			}
+
+			// too deep, let the recursion handle this subtree
+			if( !PM_HullCheckRecursive( hull, num, p1f, p2f, start, end, trace ))
+				return false;
+		}
+
+		// near side is done and wasn't blocked, resume the closest split
+		if( depth == 0 )
+			return true;
+
+		frame = &stack[--depth];
+
+		if( PM_HullPointContents( hull, frame->far, frame->mid ) == CONTENTS_SOLID )
+			return PM_HullImpact( hull, frame, trace );
+
+		// go past the node
+		num = frame->far;
+		p1f = frame->midf;
+		p2f = frame->p2f;
+		VectorCopy( frame->mid, start );
+		VectorCopy( frame->p2, end );
+	}
+}
+
+/*
+==================
+PM_HullTraceMany
+
+same as PM_RecursiveHullCheck from the first clipnode
+for every ray, traces must be set up by the caller.
+Rays of a packet walk the tree together, plane distances
+are computed for the whole packet at once. A ray that
+crosses a plane leaves the packet and finishes alone
+==================
+*/
+void PM_HullTraceMany( hull_t *hull, int count, const vec3_t *p1, const vec3_t *p2, pmtrace_t *traces )
+{
+	struct { int num; uint mask; } stack[PM_TRACE_STACK];
+	float	x1[PM_TRACE_PACKET], y1[PM_TRACE_PACKET], z1[PM_TRACE_PACKET];
+	float	x2[PM_TRACE_PACKET], y2[PM_TRACE_PACKET], z2[PM_TRACE_PACKET];
+	float	t1[PM_TRACE_PACKET], t2[PM_TRACE_PACKET];
+	float	*c1[3] = { x1, y1, z1 }, *c2[3] = { x2, y2, z2 };
+	int	i, k, base, numrays, depth, num;
+	uint	mask, front, back, cross;
+	mclipnode_t	*node;
+	mplane_t	*plane;
+	pmtrace_t	*trace;
+
+	for( base = 0; base < count; base += PM_TRACE_PACKET )
+	{
+		numrays = Q_min( count - base, PM_TRACE_PACKET );
+
+		// spare lanes repeat the first ray, they're masked out anyway
+		for( k = 0; k < PM_TRACE_PACKET; k++ )
+		{
+			i = base + ( k < numrays ? k : 0 );
+			x1[k] = p1[i][0]; y1[k] = p1[i][1]; z1[k] = p1[i][2];
+			x2[k] = p2[i][0]; y2[k] = p2[i][1]; z2[k] = p2[i][2];
+		}
+
+		stack[0].num = hull->firstclipnode;
+		stack[0].mask = ( 1U << numrays ) - 1;
+		depth = 1;
+
+		while( depth > 0 )
+		{
+			depth--;
+			num = stack[depth].num;
+			mask = stack[depth].mask;
+
+			while( num >= 0 && mask )
+			{
+				if( hull->firstclipnode >= hull->lastclipnode )
+					break;
+
+				if( num < hull->firstclipnode || num > hull->lastclipnode )
+					Host_Error( "PM_HullTraceMany: bad node number %i\n", num );
+
+				node = hull->clipnodes + num;
+				plane = hull->planes + node->planenum;
+
+				if( plane->type < 3 )
+				{
+					const float *v1 = c1[plane->type], *v2 = c2[plane->type];
+
+					for( k = 0; k < PM_TRACE_PACKET; k++ )
+					{
+						t1[k] = v1[k] - plane->dist;
+						t2[k] = v2[k] - plane->dist;
+					}
+				}
+				else
+				{
+					for( k = 0; k < PM_TRACE_PACKET; k++ )
+					{
+						t1[k] = ( x1[k] * plane->normal[0] + y1[k] * plane->normal[1] + z1[k] * plane->normal[2] ) - plane->dist;
+						t2[k] = ( x2[k] * plane->normal[0] + y2[k] * plane->normal[1] + z2[k] * plane->normal[2] ) - plane->dist;
+					}
+				}
+
+				front = back = 0;
+
+				for( k = 0; k < PM_TRACE_PACKET; k++ )
+				{
+					front |= (uint)( t1[k] >= 0.0f && t2[k] >= 0.0f ) << k;
+					back |= (uint)( t1[k] < 0.0f && t2[k] < 0.0f ) << k;
+				}
+
+				front &= mask;
+				back &= mask;
+				cross = mask & ~( front | back );
+
+				// so far these rays only moved down whole,
+				// so they can start over from this node
+				for( k = 0; cross; k++, cross >>= 1 )
+				{
+					if( cross & 1 )
+						PM_RecursiveHullCheck( hull, num, 0.0f, 1.0f, (float *)p1[base + k], (float *)p2[base + k], &traces[base + k] );
+				}
+
+				if( front && back )
+				{
+					if( depth < PM_TRACE_STACK )
+					{
+						stack[depth].num = node->children[1];
+						stack[depth].mask = back;
+						depth++;
+					}
+					else
+					{
+						for( k = 0; back; k++, back >>= 1 )
+						{
+							if( back & 1 )
+								PM_RecursiveHullCheck( hull, node->children[1], 0.0f, 1.0f, (float *)p1[base + k], (float *)p2[base + k], &traces[base + k] );
+						}
+					}
+				}
+
+				if( front )
+				{
+					num = node->children[0];
+					mask = front;
+				}
+				else
+				{
+					num = node->children[1];
+					mask = back;
+				}
+			}
+
+			// reached a leaf together, or the hull is empty
+			for( k = 0; mask; k++, mask >>= 1 )
+			{
+				if( !( mask & 1 ))
+					continue;
+
+				trace = &traces[base + k];
+
+				if( num >= 0 )
+				{
+					trace->allsolid = false;
+					trace->inopen = true;
+				}
+				else if( num != CONTENTS_SOLID )
+				{
+					trace->allsolid = false;
+					if( num == CONTENTS_EMPTY )
+						trace->inopen = true;
+					else trace->inwater = true;
+				}
+				else trace->startsolid = true;
+			}
+		}
+	}
+}
+
+/*
+===============================================================================
+
+	HULL TRACE BENCHMARK
+
+===============================================================================
+*/
+static uint PM_BenchRandom( uint *seed )
+{
+	*seed = *seed * 1664525 + 1013904223;
+	return *seed >> 8;
+}
+
+static float PM_BenchRandomFloat( uint *seed, float low, float high )
+{
+	return low + ( high - low ) * ( PM_BenchRandom( seed ) / (float)( 1 << 24 ));
+}
+
+static void PM_InitBenchTrace( pmtrace_t *trace, const vec3_t end )
+{
+	memset( trace, 0, sizeof( *trace ));
+	VectorCopy( end, trace->endpos );
+	trace->fraction = 1.0f;
+	trace->allsolid = true;
+}
+
+static qboolean PM_CompareTraces( const pmtrace_t *a, const pmtrace_t *b )
+{
+	if( a->fraction != b->fraction || !VectorCompare( a->endpos, b->endpos ))
+		return false;
+
+	if( a->plane.dist != b->plane.dist || !VectorCompare( a->plane.normal, b->plane.normal ))
+		return false;
+
+	return a->allsolid == b->allsolid && a->startsolid == b->startsolid
+		&& a->inopen == b->inopen && a->inwater == b->inwater;
+}
+
+/*
+==================
+PM_HullTraceBench
+
+traces bursts of nearly parallel rays through every hull of
+a brush model with the recursive, iterative and packet kernels.
+Rays come from a fixed seed so runs on one map are comparable
+==================
+*/
+void PM_HullTraceBench( model_t *model, int numrays, int passes )
+{
+	vec3_t	*starts, *ends, dir, burst;
+	pmtrace_t	*ref, *test;
+	double	start, time[3];
+	uint	seed = 0x1234567;
+	int	i, j, h, mismatch;
+
+	numrays = Q_max( PM_TRACE_PACKET, numrays - numrays % PM_TRACE_PACKET );
+	passes = Q_max( 1, passes );
+
+	starts = Mem_Malloc( host.mempool, numrays * sizeof( vec3_t ));
+	ends = Mem_Malloc( host.mempool, numrays * sizeof( vec3_t ));
+	ref = Mem_Malloc( host.mempool, numrays * sizeof( pmtrace_t ));
+	test = Mem_Malloc( host.mempool, numrays * sizeof( pmtrace_t ));
+
+	// every packet is a shotgun blast from a random point
+	for( i = 0; i < numrays; i += PM_TRACE_PACKET )
+	{
+		for( j = 0; j < 3; j++ )
+		{
+			burst[j] = PM_BenchRandomFloat( &seed, model->mins[j], model->maxs[j] );
+			dir[j] = PM_BenchRandomFloat( &seed, -1.0f, 1.0f );
+		}
+		VectorNormalize( dir );
+
+		for( h = i; h < i + PM_TRACE_PACKET; h++ )
+		{
+			vec3_t	spread;
+
+			for( j = 0; j < 3; j++ )
+				spread[j] = dir[j] + PM_BenchRandomFloat( &seed, -0.05f, 0.05f );
+
+			VectorCopy( burst, starts[h] );
+			VectorMA( burst, 4096.0f, spread, ends[h] );
+		}
+	}
+
+	Con_Printf( "%i rays in bursts of %i, %i passes\n", numrays, PM_TRACE_PACKET, passes );
+	Con_Printf( "%-5s %12s %12s %12s %9s\n", "hull", "recursive/s", "iterative/s", "packet/s", "mismatch" );
+
+	for( h = 0; h < MAX_MAP_HULLS; h++ )
+	{
+		hull_t	*hull = &model->hulls[h];
+
+		if( !hull->planes || hull->firstclipnode >= hull->lastclipnode )
+			continue;
+
+		start = Sys_DoubleTime();
+		for( j = 0; j < passes; j++ )
+		{
+			for( i = 0; i < numrays; i++ )
+			{
+				PM_InitBenchTrace( &ref[i], ends[i] );
+				PM_HullCheckRecursive( hull, hull->firstclipnode, 0.0f, 1.0f, starts[i], ends[i], &ref[i] );
+			}
+		}
+		time[0] = Sys_DoubleTime() - start;
+
+		mismatch = 0;
+		start = Sys_DoubleTime();
+		for( j = 0; j < passes; j++ )
+		{
+			for( i = 0; i < numrays; i++ )
+			{
+				PM_InitBenchTrace( &test[i], ends[i] );
+				PM_RecursiveHullCheck( hull, hull->firstclipnode, 0.0f, 1.0f, starts[i], ends[i], &test[i] );
+			}
+		}
+		time[1] = Sys_DoubleTime() - start;
+
+		for( i = 0; i < numrays; i++ )
+			mismatch += !PM_CompareTraces( &ref[i], &test[i] );
+
+		start = Sys_DoubleTime();
+		for( j = 0; j < passes; j++ )
+		{
+			for( i = 0; i < numrays; i++ )
+				PM_InitBenchTrace( &test[i], ends[i] );
+			PM_HullTraceMany( hull, numrays, (const vec3_t *)starts, (const vec3_t *)ends, test );
+		}
+		time[2] = Sys_DoubleTime() - start;
+
+		for( i = 0; i < numrays; i++ )
+			mismatch += !PM_CompareTraces( &ref[i], &test[i] );
+
+		Con_Printf( "%-5i %12.0f %12.0f %12.0f %9i\n", h,
+			numrays * passes / Q_max( time[0], 0.000001 ),
+			numrays * passes / Q_max( time[1], 0.000001 ),
+			numrays * passes / Q_max( time[2], 0.000001 ), mismatch );
+	}
+
+	Mem_Free( starts );
+	Mem_Free( ends );
+	Mem_Free( ref );
+	Mem_Free( test );
+}
+
 pmtrace_t PM_PlayerTraceExt( playermove_t *pmove, vec3_t start, vec3_t end, int flags, int numents, physent_t *ents, int ignore_pe, pfnIgnore pmFilter )
 {
 	physent_t	*pe;
@@ -733,3 +1222,101 @@ int PM_PointContents( playermove_t *pmove, const vec3_t p )
 
 	return contents;
 }
+
+#if XASH_ENGINE_TESTS
+#include "tests.h"
+
+static int Test_HullTraceMismatches( hull_t *hull, int numrays, float range, uint seed )
+{
+	vec3_t	starts[64], ends[64];
+	pmtrace_t	ref[64], iter[64], packet[64];
+	int	i, j, mismatch = 0;
+
+	numrays = Q_min( numrays, 64 );
+
+	for( i = 0; i < numrays; i++ )
+	{
+		for( j = 0; j < 3; j++ )
+		{
+			starts[i][j] = PM_BenchRandomFloat( &seed, -range, range );
+			ends[i][j] = PM_BenchRandomFloat( &seed, -range, range );
+		}
+
+		PM_InitBenchTrace( &ref[i], ends[i] );
+		PM_InitBenchTrace( &iter[i], ends[i] );
+		PM_InitBenchTrace( &packet[i], ends[i] );
+
+		PM_HullCheckRecursive( hull, hull->firstclipnode, 0.0f, 1.0f, starts[i], ends[i], &ref[i] );
+		PM_RecursiveHullCheck( hull, hull->firstclipnode, 0.0f, 1.0f, starts[i], ends[i], &iter[i] );
+	}
+
+	PM_HullTraceMany( hull, numrays, (const vec3_t *)starts, (const vec3_t *)ends, packet );
+
+	for( i = 0; i < numrays; i++ )
+		mismatch += !PM_CompareTraces( &ref[i], &iter[i] ) + !PM_CompareTraces( &ref[i], &packet[i] );
+
+	return mismatch;
+}
+
+static void Test_HullTrace( void )
+{
+	static mclipnode_t	nodes[100];
+	static mplane_t	planes[100];
+	hull_t		hull;
+	pmtrace_t		ref, iter;
+	vec3_t		start = { 200, 0, 0 }, end = { -1, 0, 0 };
+	int		i;
+
+	hull.clipnodes = nodes;
+	hull.planes = planes;
+	hull.firstclipnode = 0;
+
+	// box with a slanted pool of water inside, like PM_InitBoxHull
+	for( i = 0; i < 6; i++ )
+	{
+		nodes[i].planenum = i;
+		nodes[i].children[i & 1] = CONTENTS_EMPTY;
+		nodes[i].children[( i & 1 ) ^ 1] = ( i != 5 ) ? i + 1 : 6;
+		VectorClear( planes[i].normal );
+		planes[i].normal[i >> 1] = 1.0f;
+		planes[i].type = i >> 1;
+		planes[i].dist = ( i & 1 ) ? -32.0f : 32.0f;
+	}
+
+	nodes[6].planenum = 6;
+	nodes[6].children[0] = CONTENTS_WATER;
+	nodes[6].children[1] = CONTENTS_SOLID;
+	VectorSet( planes[6].normal, 0.6f, 0.8f, 0.0f );
+	planes[6].type = 3;
+	planes[6].dist = 8.0f;
+	hull.lastclipnode = 6;
+
+	TASSERT( Test_HullTraceMismatches( &hull, 64, 64.0f, 1 ) == 0 );
+	TASSERT( Test_HullTraceMismatches( &hull, 13, 48.0f, 2 ) == 0 );
+
+	// nested splits deeper than the explicit stack
+	for( i = 0; i < 100; i++ )
+	{
+		nodes[i].planenum = i;
+		nodes[i].children[0] = ( i == 99 ) ? CONTENTS_EMPTY : i + 1;
+		nodes[i].children[1] = ( i == 30 ) ? CONTENTS_SOLID : CONTENTS_WATER;
+		VectorSet( planes[i].normal, 1.0f, 0.0f, 0.0f );
+		planes[i].type = 0;
+		planes[i].dist = i;
+	}
+	hull.lastclipnode = 99;
+
+	PM_InitBenchTrace( &ref, end );
+	PM_InitBenchTrace( &iter, end );
+	PM_HullCheckRecursive( &hull, 0, 0.0f, 1.0f, start, end, &ref );
+	PM_RecursiveHullCheck( &hull, 0, 0.0f, 1.0f, start, end, &iter );
+	TASSERT( ref.fraction < 1.0f );
+	TASSERT( PM_CompareTraces( &ref, &iter ));
+	TASSERT( Test_HullTraceMismatches( &hull, 64, 128.0f, 3 ) == 0 );
+}
+
+void Test_RunPmove( void )
+{
+	TRUN( Test_HullTrace() );
+}
+#endif
@@ -23,6 +23,14 @@ extern struct tests_stats_s tests_stats;
 
 void Test_RunImagelib( void );
 void Test_RunLibCommon( void );
+void Test_RunNetBuffer( void );
+void Test_RunCommon( void );
+void Test_RunWorld( void );
+void Test_RunPmove( void );
+void Test_RunBmodel( void );
+void Test_RunUnlag( void );
+void Test_RunFilesystem( void );
+void Test_RunMemory( void );
 
 #endif
 
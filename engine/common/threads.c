@@ -0,0 +1,372 @@
+/*
+threads.c - tiny worker pool for data-parallel engine jobs
+Copyright (C) 2026 Xash3D FWGS contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+
+#include "common.h"
+#include "threads.h"
+#include "xash3d_mathlib.h"
+
+#if XASH_WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined XASH_THREADS_AVAILABLE
+#include <pthread.h>
+#endif
+
+/*
+===============
+Sys_AtomicAdd
+
+returns the previous value
+===============
+*/
+int Sys_AtomicAdd( volatile int *value, int add )
+{
+#if XASH_WIN32
+	return InterlockedExchangeAdd( (volatile LONG *)value, add );
+#elif defined( __GNUC__ )
+	return __sync_fetch_and_add( value, add );
+#else
+	int old = *value;
+	*value += add;
+	return old;
+#endif
+}
+
+/*
+===============
+Sys_SpinLock
+
+for short sections only, waiters burn the cpu
+===============
+*/
+void Sys_SpinLock( volatile int *lock )
+{
+#if XASH_WIN32
+	while( InterlockedExchange( (volatile LONG *)lock, 1 ))
+		YieldProcessor();
+#elif defined( __GNUC__ )
+	while( __sync_lock_test_and_set( lock, 1 ))
+	{
+		while( *lock ); // wait without hammering the cache line
+	}
+#else
+	*lock = 1;
+#endif
+}
+
+/*
+===============
+Sys_SpinUnlock
+
+===============
+*/
+void Sys_SpinUnlock( volatile int *lock )
+{
+#if XASH_WIN32
+	InterlockedExchange( (volatile LONG *)lock, 0 );
+#elif defined( __GNUC__ )
+	__sync_lock_release( lock );
+#else
+	*lock = 0;
+#endif
+}
+
+#ifdef XASH_THREADS_AVAILABLE
+
+/*
+==============================================================================
+
+	Workers sleep until the dispatcher posts a batch, then grab indices
+	from a shared counter until the batch is drained. The dispatcher
+	takes part in the batch too, so N threads means N-1 workers.
+
+==============================================================================
+*/
+static struct
+{
+	int		numworkers;	// started workers
+	qboolean		quit;
+
+	jobfunc_t		func;
+	void		*data;
+	int		count;
+	volatile int	next;		// next index to process
+	volatile int	pending;	// workers yet to finish this batch
+	int		active;		// workers invited to this batch
+
+#if XASH_WIN32
+	HANDLE		threads[MAX_JOB_THREADS];
+	HANDLE		wake;		// semaphore, one token per invited worker
+	HANDLE		done;		// auto-reset event
+#else
+	pthread_t		threads[MAX_JOB_THREADS];
+	pthread_mutex_t	lock;
+	pthread_cond_t	wake;
+	pthread_cond_t	done;
+	int		generation;
+	int		tickets;	// how many workers may still join
+#endif
+} jobs;
+
+static void Jobs_Drain( void )
+{
+	int	i;
+
+	while(( i = Sys_AtomicAdd( &jobs.next, 1 )) < jobs.count )
+		jobs.func( jobs.data, i );
+}
+
+#if XASH_WIN32
+static DWORD WINAPI Jobs_Worker( LPVOID unused )
+{
+	while( 1 )
+	{
+		WaitForSingleObject( jobs.wake, INFINITE );
+
+		if( jobs.quit )
+			break;
+
+		Jobs_Drain();
+
+		if( InterlockedDecrement( (volatile LONG *)&jobs.pending ) == 0 )
+			SetEvent( jobs.done );
+	}
+
+	return 0;
+}
+
+static void Jobs_StartWorkers( int count )
+{
+	if( !jobs.wake )
+	{
+		jobs.wake = CreateSemaphore( NULL, 0, MAX_JOB_THREADS, NULL );
+		jobs.done = CreateEvent( NULL, FALSE, FALSE, NULL );
+	}
+
+	while( jobs.numworkers < count )
+	{
+		jobs.threads[jobs.numworkers] = CreateThread( NULL, 0, Jobs_Worker, NULL, 0, NULL );
+		if( !jobs.threads[jobs.numworkers] )
+			break;
+		jobs.numworkers++;
+	}
+}
+
+static void Jobs_Dispatch( int active )
+{
+	jobs.active = jobs.pending = active;
+	ReleaseSemaphore( jobs.wake, active, NULL );
+
+	Jobs_Drain();
+
+	WaitForSingleObject( jobs.done, INFINITE );
+}
+
+static void Jobs_StopWorkers( void )
+{
+	int	i;
+
+	jobs.quit = true;
+	ReleaseSemaphore( jobs.wake, jobs.numworkers, NULL );
+
+	for( i = 0; i < jobs.numworkers; i++ )
+	{
+		WaitForSingleObject( jobs.threads[i], INFINITE );
+		CloseHandle( jobs.threads[i] );
+	}
+
+	CloseHandle( jobs.wake );
+	CloseHandle( jobs.done );
+	jobs.wake = jobs.done = NULL;
+}
+#else // !XASH_WIN32
+static void *Jobs_Worker( void *unused )
+{
+	int	generation = 0;
+
+	pthread_mutex_lock( &jobs.lock );
+
+	while( 1 )
+	{
+		while( !jobs.quit && ( generation == jobs.generation || jobs.tickets <= 0 ))
+		{
+			// batch was fully claimed, skip it
+			if( generation != jobs.generation )
+				generation = jobs.generation;
+			pthread_cond_wait( &jobs.wake, &jobs.lock );
+		}
+
+		if( jobs.quit )
+			break;
+
+		generation = jobs.generation;
+		jobs.tickets--;
+		pthread_mutex_unlock( &jobs.lock );
+
+		Jobs_Drain();
+
+		pthread_mutex_lock( &jobs.lock );
+		if( --jobs.pending == 0 )
+			pthread_cond_signal( &jobs.done );
+	}
+
+	pthread_mutex_unlock( &jobs.lock );
+	return NULL;
+}
+
+static void Jobs_StartWorkers( int count )
+{
+	if( !jobs.numworkers )
+	{
+		pthread_mutex_init( &jobs.lock, NULL );
+		pthread_cond_init( &jobs.wake, NULL );
+		pthread_cond_init( &jobs.done, NULL );
+	}
+
+	while( jobs.numworkers < count )
+	{
+		if( pthread_create( &jobs.threads[jobs.numworkers], NULL, Jobs_Worker, NULL ))
+			break;
+		jobs.numworkers++;
+	}
+}
+
+static void Jobs_Dispatch( int active )
+{
+	pthread_mutex_lock( &jobs.lock );
+	jobs.active = jobs.pending = jobs.tickets = active;
+	jobs.generation++;
+	pthread_cond_broadcast( &jobs.wake );
+	pthread_mutex_unlock( &jobs.lock );
+
+	Jobs_Drain();
+
+	pthread_mutex_lock( &jobs.lock );
+	while( jobs.pending > 0 )
+		pthread_cond_wait( &jobs.done, &jobs.lock );
+	pthread_mutex_unlock( &jobs.lock );
+}
+
+static void Jobs_StopWorkers( void )
+{
+	int	i;
+
+	pthread_mutex_lock( &jobs.lock );
+	jobs.quit = true;
+	pthread_cond_broadcast( &jobs.wake );
+	pthread_mutex_unlock( &jobs.lock );
+
+	for( i = 0; i < jobs.numworkers; i++ )
+		pthread_join( jobs.threads[i], NULL );
+
+	pthread_cond_destroy( &jobs.done );
+	pthread_cond_destroy( &jobs.wake );
+	pthread_mutex_destroy( &jobs.lock );
+}
+#endif // !XASH_WIN32
+
+#endif // XASH_THREADS_AVAILABLE
+
+/*
+===============
+Jobs_Run
+
+calls func for every index in [0, count) using up to numthreads
+threads, including the calling one, and returns when all are done
+===============
+*/
+void Jobs_Run( jobfunc_t func, void *data, int count, int numthreads )
+{
+#ifdef XASH_THREADS_AVAILABLE
+	int	active;
+
+	numthreads = Q_min( numthreads, count );
+	numthreads = Q_min( numthreads, MAX_JOB_THREADS + 1 );
+
+	if( numthreads > 1 )
+	{
+		Jobs_StartWorkers( numthreads - 1 );
+		active = Q_min( numthreads - 1, jobs.numworkers );
+
+		if( active > 0 )
+		{
+			jobs.func = func;
+			jobs.data = data;
+			jobs.count = count;
+			jobs.next = 0;
+
+			Jobs_Dispatch( active );
+			jobs.func = NULL;
+			return;
+		}
+	}
+#endif
+	{
+		int	i;
+
+		for( i = 0; i < count; i++ )
+			func( data, i );
+	}
+}
+
+/*
+===============
+Jobs_Running
+
+true while other threads may run jobs,
+shared state has to be locked or deferred
+===============
+*/
+qboolean Jobs_Running( void )
+{
+#ifdef XASH_THREADS_AVAILABLE
+	return jobs.func != NULL;
+#else
+	return false;
+#endif
+}
+
+/*
+===============
+Jobs_NumThreads
+
+how many threads can take part in a batch right now
+===============
+*/
+int Jobs_NumThreads( void )
+{
+#ifdef XASH_THREADS_AVAILABLE
+	return jobs.numworkers + 1;
+#else
+	return 1;
+#endif
+}
+
+/*
+===============
+Jobs_Shutdown
+
+===============
+*/
+void Jobs_Shutdown( void )
+{
+#ifdef XASH_THREADS_AVAILABLE
+	if( !jobs.numworkers )
+		return;
+
+	Jobs_StopWorkers();
+	memset( &jobs, 0, sizeof( jobs ));
+#endif
+}
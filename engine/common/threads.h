@@ -0,0 +1,46 @@
+/*
+threads.h - tiny worker pool for data-parallel engine jobs
+Copyright (C) 2026 Xash3D FWGS contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+
+#ifndef THREADS_H
+#define THREADS_H
+
+// same platforms that can run the async resolver can run workers
+#if !defined XASH_NO_ASYNC_NS_RESOLVE && ( XASH_WIN32 || !( XASH_EMSCRIPTEN || XASH_DOS4GW ))
+#define XASH_THREADS_AVAILABLE
+#endif
+
+#define MAX_JOB_THREADS	32
+
+#if !defined XASH_THREADS_AVAILABLE
+#define XASH_THREAD_LOCAL
+#elif defined _MSC_VER
+#define XASH_THREAD_LOCAL	__declspec( thread )
+#else
+#define XASH_THREAD_LOCAL	__thread
+#endif
+
+// called once for every index in [0, count), in unspecified order and thread
+typedef void (*jobfunc_t)( void *data, int index );
+
+void Jobs_Run( jobfunc_t func, void *data, int count, int numthreads );
+int Jobs_NumThreads( void );
+qboolean Jobs_Running( void );
+void Jobs_Shutdown( void );
+
+int Sys_AtomicAdd( volatile int *value, int add );
+void Sys_SpinLock( volatile int *lock );
+void Sys_SpinUnlock( volatile int *lock );
+
+#endif // THREADS_H
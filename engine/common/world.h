@@ -30,8 +30,9 @@ ENTITY AREA CHECKING
 ===============================================================================
 */
 #define MAX_TOTAL_ENT_LEAFS		128
-#define AREA_NODES			32
+#define AREA_NODES			32	// uniform part of the tree
 #define AREA_DEPTH			4
+#define MAX_AREA_NODES		4096	// including adaptive nodes below AREA_DEPTH
 
 #include "lightstyle.h"
 
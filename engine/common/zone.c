@@ -17,6 +17,15 @@ GNU General Public License for more details.
 
 #define MEMHEADER_SENTINEL1	0xDEADF00D
 #define MEMHEADER_SENTINEL2	0xDF
+#define MEMHEADER_FREED		0xFEEDF00D	// slab block sitting in the pool free list
+
+#define POOL_SLOT_BITS		16		// low bits of pool handle index the pool table
+#define POOL_SLOT_MASK		((1U << POOL_SLOT_BITS) - 1)
+
+#define MEM_SLAB_CLASSES		19
+#define MEM_SLAB_MAXBLOCK		1024		// bigger blocks are malloc'ed one by one
+#define MEM_SLAB_MINBLOCKS		4		// blocks in the first slab of the size class
+#define MEM_SLAB_MAXSIZE		4096	// slab size stops doubling here
 
 #ifdef XASH_CUSTOM_SWAP
 #include "platform/swap/swap.h"
@@ -40,6 +49,15 @@ typedef struct memheader_s
 	// immediately followed by data, which is followed by a MEMHEADER_SENTINEL2 byte
 } memheader_t;
 
+typedef struct memslab_s
+{
+	struct memslab_s	*next;		// next slab of this pool
+	size_t		size;		// slab size including this header
+} memslab_t;
+
+// slab blocks start at 16 bytes boundary, just like the malloc'ed ones
+#define MEMSLAB_HEADER_SIZE	(( sizeof( memslab_t ) + 15 ) & ~15 )
+
 typedef struct mempool_s
 {
 	uint		sentinel1;	// should always be MEMHEADER_SENTINEL1
@@ -51,49 +69,209 @@ typedef struct mempool_s
 	const char	*filename;	// file name and line where Mem_AllocPool was called
 	int		fileline;
 	poolhandle_t idx;
+	qboolean		noslabs;		// every block is malloc'ed separately
+	memheader_t	*freeblocks[MEM_SLAB_CLASSES];	// free slab blocks of each size class
+	uint		slabblocks[MEM_SLAB_CLASSES];	// number of blocks in the next slab of each size class
+	memslab_t		*slabs;		// chain of slabs owned by this pool
 	char		name[64];		// name of the pool
 	uint		sentinel2;	// should always be MEMHEADER_SENTINEL1
 } mempool_t;
 
 static mempool_t *poolchain = NULL; // critical stuff
 
+// Nothing here is locked, Mem_* may only be called from the main thread.
+// Jobs_Run callbacks get their buffers allocated up front. Physics prefetch
+// jobs skip studio models that are traced by hitboxes, because that path
+// can load sequence groups and allocate from the model pool
+
 // a1ba: due to mempool being passed with the model through reused 32-bit field
 // which makes engine incompatible with 64-bit pointers I changed mempool type
 // from pointer to 32-bit handle, thankfully mempool structure is private
-// But! Mempools are handled through linked list so we can't index them safely
-static uint lastidx = 0;
+// The handle keeps the pool slot in the low bits and a serial number in the
+// high bits, so stale handles of the freed pools are still caught
+static mempool_t	**poolslots = NULL;
+static uint	*freeslots = NULL;
+static uint	numpoolslots = 0;
+static uint	numfreeslots = 0;
+static uint	poolserial = 0;
+
+// block sizes of the slab size classes, header and sentinel included
+static const uint mem_classsize[MEM_SLAB_CLASSES] =
+{
+	32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512, 640, 768, 896, 1024
+};
+static byte mem_sizeclass[MEM_SLAB_MAXBLOCK >> 4];
 
 static mempool_t *Mem_FindPool( poolhandle_t poolptr )
 {
-	mempool_t *pool;
+	uint	slot = poolptr & POOL_SLOT_MASK;
+	mempool_t	*pool;
 
-	for( pool = poolchain; pool; pool = pool->next )
-	{
-		if( pool->idx == poolptr )
-			return pool;
-	}
+	if( slot < numpoolslots && ( pool = poolslots[slot] ) != NULL && pool->idx == poolptr )
+		return pool;
 
 	Sys_Error( "%s: not allocated or double freed pool %d", __FUNCTION__, poolptr );
 
 	return NULL;
 }
 
+/*
+========================
+Mem_AllocPoolSlot
+
+get a free slot of the pool table
+========================
+*/
+static uint Mem_AllocPoolSlot( void )
+{
+	mempool_t	**newslots;
+	uint	*newfree;
+	uint	i, newcount;
+
+	if( !numfreeslots )
+	{
+		newcount = numpoolslots ? numpoolslots * 2 : 64;
+		if( newcount > POOL_SLOT_MASK + 1 )
+			newcount = POOL_SLOT_MASK + 1;
+
+		if( newcount <= numpoolslots )
+			Sys_Error( "Mem_AllocPool: too many memory pools\n" );
+
+		newslots = (mempool_t **)Q_malloc( sizeof( *newslots ) * newcount );
+		newfree = (uint *)Q_malloc( sizeof( *newfree ) * newcount );
+		if( !newslots || !newfree )
+			Sys_Error( "Mem_AllocPool: out of memory\n" );
+
+		memset( newslots, 0, sizeof( *newslots ) * newcount );
+
+		if( poolslots )
+		{
+			memcpy( newslots, poolslots, sizeof( *newslots ) * numpoolslots );
+			Q_free( poolslots );
+			Q_free( freeslots );
+		}
+
+		// slot 0 is never used, so handle is never zero
+		for( i = newcount - 1; i > 0 && i >= numpoolslots; i-- )
+			newfree[numfreeslots++] = i;
+
+		poolslots = newslots;
+		freeslots = newfree;
+		numpoolslots = newcount;
+	}
+
+	return freeslots[--numfreeslots];
+}
+
+/*
+========================
+Mem_SizeClass
+
+slab size class for allocation size, -1 if it's too big
+========================
+*/
+static int Mem_SizeClass( const mempool_t *pool, size_t size )
+{
+	size_t	blocksize = sizeof( memheader_t ) + size + sizeof( int );
+
+	if( pool->noslabs || blocksize > MEM_SLAB_MAXBLOCK )
+		return -1;
+
+	return mem_sizeclass[( blocksize - 1 ) >> 4];
+}
+
+/*
+========================
+Mem_AllocSlab
+
+carve a new slab into free blocks of the size class
+========================
+*/
+static void Mem_AllocSlab( mempool_t *pool, int sizeclass, const char *filename, int fileline )
+{
+	size_t		blocksize = mem_classsize[sizeclass];
+	uint		i, numblocks;
+	memslab_t		*slab;
+	memheader_t	*mem;
+
+	numblocks = pool->slabblocks[sizeclass];
+	if( !numblocks ) numblocks = MEM_SLAB_MINBLOCKS;
+
+	// next slab of this class is twice as big
+	if( blocksize * numblocks * 2 <= MEM_SLAB_MAXSIZE )
+		pool->slabblocks[sizeclass] = numblocks * 2;
+	else pool->slabblocks[sizeclass] = numblocks;
+
+	slab = (memslab_t *)Q_malloc( MEMSLAB_HEADER_SIZE + blocksize * numblocks );
+	if( slab == NULL ) Sys_Error( "Mem_Alloc: out of memory (alloc at %s:%i)\n", filename, fileline );
+
+	slab->size = MEMSLAB_HEADER_SIZE + blocksize * numblocks;
+	slab->next = pool->slabs;
+	pool->slabs = slab;
+	pool->realsize += slab->size;
+
+	for( i = numblocks; i > 0; i-- )
+	{
+		mem = (memheader_t *)((byte *)slab + MEMSLAB_HEADER_SIZE + blocksize * ( i - 1 ));
+		mem->sentinel1 = MEMHEADER_FREED;
+		mem->prev = NULL;
+		mem->next = pool->freeblocks[sizeclass];
+		pool->freeblocks[sizeclass] = mem;
+	}
+}
+
+/*
+========================
+Mem_FreeSlabs
+
+release slabs of the pool, all their blocks must be freed already
+========================
+*/
+static void Mem_FreeSlabs( mempool_t *pool )
+{
+	memslab_t	*slab;
+
+	while(( slab = pool->slabs ) != NULL )
+	{
+		pool->slabs = slab->next;
+		pool->realsize -= slab->size;
+		Q_free( slab );
+	}
+
+	memset( pool->freeblocks, 0, sizeof( pool->freeblocks ));
+	memset( pool->slabblocks, 0, sizeof( pool->slabblocks ));
+}
+
 void *_Mem_Alloc( poolhandle_t poolptr, size_t size, qboolean clear, const char *filename, int fileline )
 {
 	memheader_t *mem;
 	mempool_t   *pool;
+	int         sizeclass;
 
 	if( size <= 0 ) return NULL;
 	if( !poolptr ) Sys_Error( "Mem_Alloc: pool == NULL (alloc at %s:%i)\n", filename, fileline );
 
 	pool = Mem_FindPool( poolptr );
+	sizeclass = Mem_SizeClass( pool, size );
 
 	pool->totalsize += size;
 
-	// big allocations are not clumped
-	pool->realsize += sizeof( memheader_t ) + size + sizeof( int );
-	mem = (memheader_t *)Q_malloc( sizeof( memheader_t ) + size + sizeof( int ));
-	if( mem == NULL ) Sys_Error( "Mem_Alloc: out of memory (alloc at %s:%i)\n", filename, fileline );
+	if( sizeclass >= 0 )
+	{
+		// small allocations are taken from the pool slabs
+		if( !pool->freeblocks[sizeclass] )
+			Mem_AllocSlab( pool, sizeclass, filename, fileline );
+
+		mem = pool->freeblocks[sizeclass];
+		pool->freeblocks[sizeclass] = mem->next;
+	}
+	else
+	{
+		// big allocations are not clumped
+		pool->realsize += sizeof( memheader_t ) + size + sizeof( int );
+		mem = (memheader_t *)Q_malloc( sizeof( memheader_t ) + size + sizeof( int ));
+		if( mem == NULL ) Sys_Error( "Mem_Alloc: out of memory (alloc at %s:%i)\n", filename, fileline );
+	}
 
 	mem->filename = filename;
 	mem->fileline = fileline;
@@ -135,6 +313,10 @@ static const char *Mem_CheckFilename( const char *filename )
 static void Mem_FreeBlock( memheader_t *mem, const char *filename, int fileline )
 {
 	mempool_t		*pool;
+	int		sizeclass;
+
+	if( mem->sentinel1 == MEMHEADER_FREED )
+		Sys_Error( "Mem_Free: not allocated or double freed (free at %s:%i)\n", filename, fileline );
 
 	if( mem->sentinel1 != MEMHEADER_SENTINEL1 )
 	{
@@ -161,6 +343,17 @@ static void Mem_FreeBlock( memheader_t *mem, const char *filename, int fileline
 
 	// memheader has been unlinked, do the actual free now
 	pool->totalsize -= mem->size;
+	sizeclass = Mem_SizeClass( pool, mem->size );
+
+	if( sizeclass >= 0 )
+	{
+		// slab block goes back to the pool
+		mem->sentinel1 = MEMHEADER_FREED;
+		mem->prev = NULL;
+		mem->next = pool->freeblocks[sizeclass];
+		pool->freeblocks[sizeclass] = mem;
+		return;
+	}
 
 	pool->realsize -= sizeof( memheader_t ) + mem->size + sizeof( int );
 	Q_free( mem );
@@ -181,8 +374,28 @@ void *_Mem_Realloc( poolhandle_t poolptr, void *memptr, size_t size, qboolean cl
 
 	if( memptr )
 	{
+		mempool_t	*pool;
+		int	sizeclass;
+
 		memhdr = (memheader_t *)((byte *)memptr - sizeof( memheader_t ));
 		if( size == memhdr->size ) return memptr;
+
+		pool = memhdr->pool;
+		sizeclass = Mem_SizeClass( pool, size );
+
+		// still fits into the same slab block
+		if( sizeclass >= 0 && pool->idx == poolptr && memhdr->sentinel1 == MEMHEADER_SENTINEL1
+			&& sizeclass == Mem_SizeClass( pool, memhdr->size ))
+		{
+			if( clear && size > memhdr->size )
+				memset((byte *)memptr + memhdr->size, 0, size - memhdr->size );
+
+			pool->totalsize += size;
+			pool->totalsize -= memhdr->size;
+			memhdr->size = size;
+			*((byte *)memhdr + sizeof( memheader_t ) + size ) = MEMHEADER_SENTINEL2;
+			return memptr;
+		}
 	}
 
 	nb = _Mem_Alloc( poolptr, size, clear, filename, fileline );
@@ -197,9 +410,10 @@ void *_Mem_Realloc( poolhandle_t poolptr, void *memptr, size_t size, qboolean cl
 	return (void *)nb;
 }
 
-poolhandle_t _Mem_AllocPool( const char *name, const char *filename, int fileline )
+static poolhandle_t Mem_AllocPoolExt( const char *name, qboolean noslabs, const char *filename, int fileline )
 {
 	mempool_t *pool;
+	uint      slot;
 
 	pool = (mempool_t *)Q_malloc( sizeof( mempool_t ));
 	if( pool == NULL )
@@ -217,14 +431,24 @@ poolhandle_t _Mem_AllocPool( const char *name, const char *filename, int filelin
 	pool->chain = NULL;
 	pool->totalsize = 0;
 	pool->realsize = sizeof( mempool_t );
+	pool->noslabs = noslabs;
 	Q_strncpy( pool->name, name, sizeof( pool->name ));
 	pool->next = poolchain;
-	pool->idx = ++lastidx;
 	poolchain = pool;
 
+	slot = Mem_AllocPoolSlot();
+	poolserial = ( poolserial + 1 ) & ( 0xFFFFFFFFU >> POOL_SLOT_BITS );
+	pool->idx = ( poolserial << POOL_SLOT_BITS ) | slot;
+	poolslots[slot] = pool;
+
 	return pool->idx;
 }
 
+poolhandle_t _Mem_AllocPool( const char *name, const char *filename, int fileline )
+{
+	return Mem_AllocPoolExt( name, false, filename, fileline );
+}
+
 void _Mem_FreePool( poolhandle_t *poolptr, const char *filename, int fileline )
 {
 	mempool_t	*pool;
@@ -241,6 +465,12 @@ void _Mem_FreePool( poolhandle_t *poolptr, const char *filename, int fileline )
 
 		// free memory owned by the pool
 		while( pool->chain ) Mem_FreeBlock( pool->chain, filename, fileline );
+		Mem_FreeSlabs( pool );
+
+		// release the handle
+		poolslots[pool->idx & POOL_SLOT_MASK] = NULL;
+		freeslots[numfreeslots++] = pool->idx & POOL_SLOT_MASK;
+
 		// free the pool itself
 		memset( pool, 0xBF, sizeof( mempool_t ));
 		Q_free( pool );
@@ -258,6 +488,7 @@ void _Mem_EmptyPool( poolhandle_t poolptr, const char *filename, int fileline )
 
 	// free memory owned by the pool
 	while( pool->chain ) Mem_FreeBlock( pool->chain, filename, fileline );
+	Mem_FreeSlabs( pool );
 }
 
 static qboolean Mem_CheckAlloc( mempool_t *pool, void *data )
@@ -337,7 +568,11 @@ void _Mem_Check( const char *filename, int fileline )
 void Mem_PrintStats( void )
 {
 	size_t    count = 0, size = 0, realsize = 0;
+	size_t    slabsize = 0, freesize = 0, numslabs = 0;
 	mempool_t *pool;
+	memslab_t *slab;
+	memheader_t *mem;
+	int       i;
 
 	Mem_Check();
 	for( pool = poolchain; pool; pool = pool->next )
@@ -345,10 +580,19 @@ void Mem_PrintStats( void )
 		count++;
 		size += pool->totalsize;
 		realsize += pool->realsize;
+
+		for( slab = pool->slabs; slab; slab = slab->next, numslabs++ )
+			slabsize += slab->size;
+
+		for( i = 0; i < MEM_SLAB_CLASSES; i++ )
+			for( mem = pool->freeblocks[i]; mem; mem = mem->next )
+				freesize += mem_classsize[i];
 	}
 
 	Con_Printf( "^3%lu^7 memory pools, totalling: ^1%s\n", count, Q_memprint( size ));
 	Con_Printf( "total allocated size: ^1%s\n", Q_memprint( realsize ));
+	Con_Printf( "^3%lu^7 slabs, totalling: ^1%s^7, ", numslabs, Q_memprint( slabsize ));
+	Con_Printf( "free blocks: ^1%s\n", Q_memprint( freesize ));
 }
 
 void Mem_PrintList( size_t minallocationsize )
@@ -383,6 +627,90 @@ void Mem_PrintList( size_t minallocationsize )
 	}
 }
 
+/*
+========================
+Mem_Bench_f
+
+time churn of small blocks, the way tempents,
+fragbufs and strings use the pools
+========================
+*/
+#define MEM_BENCH_LIVE	1024
+
+void Mem_Bench_f( void )
+{
+	const char	*names[3] = { "malloc", "pool", "pool slabs" };
+	void		*live[MEM_BENCH_LIVE];
+	int		i, mode, numallocs = 1000000;
+	size_t		totalsize = 0, realsize = 0;
+	poolhandle_t	poolptr = 0;
+	mempool_t		*pool;
+	uint		seed;
+	double		start, time;
+
+	if( Cmd_Argc() > 1 )
+		numallocs = Q_atoi( Cmd_Argv( 1 ));
+	if( numallocs <= 0 )
+		numallocs = 1;
+
+	Con_Printf( "mem_bench: %i allocations of 8..384 bytes, %i live\n", numallocs, MEM_BENCH_LIVE );
+
+	for( mode = 0; mode < 3; mode++ )
+	{
+		memset( live, 0, sizeof( live ));
+		seed = 0x12345678;
+
+		if( mode > 0 )
+			poolptr = Mem_AllocPoolExt( "Bench Pool", mode == 1, __FILE__, __LINE__ );
+
+		start = Sys_DoubleTime();
+
+		for( i = 0; i < numallocs; i++ )
+		{
+			size_t	size;
+			int	slot;
+
+			seed = seed * 1103515245 + 12345;
+			slot = ( seed >> 8 ) % MEM_BENCH_LIVE;
+			size = 8 + ( seed >> 20 ) % 377;
+
+			if( live[slot] )
+			{
+				if( mode > 0 ) Mem_Free( live[slot] );
+				else Q_free( live[slot] );
+			}
+
+			live[slot] = mode > 0 ? Mem_Malloc( poolptr, size ) : Q_malloc( size );
+			*(byte *)live[slot] = i;
+		}
+
+		if( mode > 0 )
+		{
+			pool = Mem_FindPool( poolptr );
+			totalsize = pool->totalsize;
+			realsize = pool->realsize;
+		}
+
+		for( i = 0; i < MEM_BENCH_LIVE; i++ )
+		{
+			if( !live[i] ) continue;
+
+			if( mode > 0 ) Mem_Free( live[i] );
+			else Q_free( live[i] );
+		}
+
+		time = Sys_DoubleTime() - start;
+
+		if( mode > 0 )
+		{
+			Mem_FreePool( &poolptr );
+			Con_Printf( "%10s: %6.1f ns per block, %s actual for %s allocated\n", names[mode],
+				time * 1e9 / numallocs, Q_memprint( realsize ), Q_memprint( totalsize ));
+		}
+		else Con_Printf( "%10s: %6.1f ns per block\n", names[mode], time * 1e9 / numallocs );
+	}
+}
+
 /*
 ========================
 Memory_Init
@@ -390,5 +718,95 @@ Memory_Init
 */
 void Memory_Init( void )
 {
+	int	i, sizeclass = 0;
+
 	poolchain = NULL; // init mem chain
+
+	// map block size to the smallest size class it fits
+	for( i = 0; i < sizeof( mem_sizeclass ); i++ )
+	{
+		while( mem_classsize[sizeclass] < ( i + 1 ) << 4 )
+			sizeclass++;
+		mem_sizeclass[i] = sizeclass;
+	}
+}
+
+#if XASH_ENGINE_TESTS
+#include "tests.h"
+
+static void Test_SlabBlocks( void )
+{
+	poolhandle_t	poolptr = Mem_AllocPool( "Test Pool" );
+	mempool_t		*pool = Mem_FindPool( poolptr );
+	byte		*small, *big, *p;
+	int		i;
+
+	small = Mem_Malloc( poolptr, 24 );
+	big = Mem_Malloc( poolptr, 4000 );
+	TASSERT( pool->slabs != NULL );
+	TASSERT( pool->totalsize == 24 + 4000 );
+	TASSERT((((size_t)small ) & 15 ) == (((size_t)big ) & 15 ));
+	TASSERT( Mem_IsAllocatedExt( poolptr, small ));
+	TASSERT( Mem_IsAllocatedExt( poolptr, big ));
+
+	// grows in place while it fits the size class
+	for( i = 0; i < 24; i++ )
+		small[i] = i;
+	p = Mem_Realloc( poolptr, small, 28 );
+	TASSERT( p == small );
+	TASSERT( p[23] == 23 && p[24] == 0 && p[27] == 0 );
+	TASSERT( pool->totalsize == 28 + 4000 );
+
+	// moves to the bigger one
+	small = Mem_Realloc( poolptr, p, 300 );
+	TASSERT( small != p && small[23] == 23 && small[299] == 0 );
+	TASSERT( !Mem_IsAllocatedExt( poolptr, p ));
+
+	// freed block is handed out again
+	Mem_Free( small );
+	TASSERT( Mem_Malloc( poolptr, 290 ) == small );
+	TASSERT( pool->totalsize == 290 + 4000 );
+
+	Mem_EmptyPool( poolptr );
+	TASSERT( pool->totalsize == 0 && pool->chain == NULL );
+	TASSERT( pool->slabs == NULL );
+	TASSERT( pool->realsize == sizeof( mempool_t ));
+
+	Mem_FreePool( &poolptr );
+	TASSERT( poolptr == 0 );
+}
+
+#define TEST_POOLS	100
+
+static void Test_PoolHandles( void )
+{
+	poolhandle_t	pools[TEST_POOLS], reused;
+	int		i;
+
+	for( i = 0; i < TEST_POOLS; i++ )
+	{
+		pools[i] = Mem_AllocPool( "Test Pool" );
+		TASSERT( pools[i] != 0 );
+		TASSERT( Mem_FindPool( pools[i] )->idx == pools[i] );
+	}
+
+	// slot of the freed pool is reused with a new handle
+	reused = pools[50];
+	Mem_FreePool( &pools[50] );
+	pools[50] = Mem_AllocPool( "Test Pool" );
+	TASSERT(( pools[50] & POOL_SLOT_MASK ) == ( reused & POOL_SLOT_MASK ));
+	TASSERT( pools[50] != reused );
+
+	for( i = 0; i < TEST_POOLS; i++ )
+	{
+		Mem_Malloc( pools[i], i + 1 );
+		Mem_FreePool( &pools[i] );
+	}
+}
+
+void Test_RunMemory( void )
+{
+	TRUN( Test_SlabBlocks() );
+	TRUN( Test_PoolHandles() );
 }
+#endif /* XASH_ENGINE_TESTS */
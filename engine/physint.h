@@ -58,6 +58,13 @@ typedef struct areanode_s
 	link_t		portal_edicts;
 } areanode_t;
 
+// single query of pfnTraceMany
+typedef struct tracequery_s
+{
+	vec3_t		start;
+	vec3_t		end;
+} tracequery_t;
+
 typedef struct server_physics_api_s
 {
 	// unlink edict from old position and link onto new
@@ -106,6 +113,10 @@ typedef struct server_physics_api_s
 	const byte	*(*pfnLoadImagePixels)( const char *filename, int *width, int *height );
 
 	const char*	(*pfnGetModelName)( int modelindex );
+
+	// same as pfnTrace for every query with shared size, type and ignored edict, much cheaper
+	// than separate calls for bursts (pellets, visibility checks). Doesn't write trace_* globals
+	void		(*pfnTraceMany)( const tracequery_t *queries, int count, float *mins, float *maxs, int type, edict_t *e, trace_t *results );
 } server_physics_api_t;
 
 // physic callbacks
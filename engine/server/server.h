@@ -79,6 +79,7 @@ extern int SV_UPDATE_BACKUP;
 #define FCL_HLTV_PROXY	BIT( 8 )	// this is a proxy for a HLTV client (spectator)
 #define FCL_SEND_RESOURCES	BIT( 9 )
 #define FCL_FORCE_UNMODIFIED	BIT( 10 )
+#define FCL_BENCHMARK	BIT( 11 )	// fakeclient that gets unreliable datagrams built for it, see sv_bench.c
 
 typedef enum
 {
@@ -199,8 +200,31 @@ typedef struct
 
 	int  		num_entities;
 	int  		first_entity;		// into the circular sv_packet_entities[]
+
+	int		unlagsample;		// lag compensation history sample, -1 if none
+	uint		unlagplayers;		// bit per player in the packet
 } client_frame_t;
 
+// multicast message shared between all clients it was sent to
+typedef struct sv_payload_s
+{
+	struct sv_payload_s	*next;		// in free list
+	int		refcount;
+	int		numbits;
+	int		maxbytes;
+	byte		data[1];		// variable sized
+} sv_payload_t;
+
+// unreliable messages queued for a client, written out on send
+typedef struct
+{
+	sv_payload_t	**payloads;
+	int		count;
+	int		maxcount;
+	int		numbits;		// sum of all queued payloads
+	qboolean		overflowed;
+} sv_payloadqueue_t;
+
 typedef struct sv_client_s
 {
 	cl_state_t	state;
@@ -248,8 +272,7 @@ typedef struct sv_client_s
 
 	// the datagram is written to by sound calls, prints, temp ents, etc.
 	// it can be harmlessly overflowed.
-	sizebuf_t		datagram;
-	byte		datagram_buf[MAX_DATAGRAM];
+	sv_payloadqueue_t	datagram;
 
 	client_frame_t	*frames;			// updates can be delta'd from here
 	event_state_t	events;			// delta-updated events cycle
@@ -313,6 +336,66 @@ typedef struct
 	vec3_t		finalpos;
 } sv_interp_t;
 
+#define MOVE_PREFETCH_TOUCH	32	// edicts that a prefetched trace may depend on
+
+// what SV_Move reads from an edict it clips against
+typedef struct
+{
+	edict_t		*ent;
+	edict_t		*owner;
+	int		solid;
+	int		movetype;
+	int		flags;
+	int		modelindex;
+	int		rendermode;
+	int		groupinfo;
+	int		sequence;
+	int		gaitsequence;
+	int		skin;
+	int		body;
+	int		gamestate;
+	float		frame;
+	float		scale;
+	vec3_t		origin;
+	vec3_t		angles;
+	vec3_t		mins;
+	vec3_t		maxs;
+	vec3_t		size;
+	vec3_t		absmin;
+	vec3_t		absmax;
+	byte		controller[4];
+	byte		blending[2];
+} sv_clipstate_t;
+
+// SV_Move done ahead of time by SV_MovePrefetch
+typedef struct
+{
+	vec3_t		start;
+	vec3_t		end;
+	vec3_t		mins;
+	vec3_t		maxs;
+	int		type;
+	edict_t		*passedict;
+	qboolean		monsterclip;
+
+	qboolean		valid;		// false if it needs the main thread
+	trace_t		trace;
+	float		worldfraction;
+	vec3_t		worldend;		// touch list covers the move up to here
+	int		groupop;
+	int		traceflags;
+	float		clienttrace;
+	sv_clipstate_t	pass;
+	int		numtouch;
+	sv_clipstate_t	touch[MOVE_PREFETCH_TOUCH];
+} sv_movecache_t;
+
+// string fields which FindEntityByString can look up through the index
+#define FIND_CLASSNAME	0
+#define FIND_TARGETNAME	1
+#define FIND_GLOBALNAME	2
+#define FIND_STRING_FIELDS	3
+
 typedef struct
 {
 	// user messages stuff
@@ -331,6 +414,8 @@ typedef struct
 
 	edict_t		*edicts;			// solid array of server entities
 	int		numEntities;		// actual entities count
+	struct sv_findindex_s	*findindex;		// accelerates FindEntityInSphere and FindEntityByString
+	struct sv_entleafs_s	*entleafs;		// leafs touched by edicts, see SV_LinkEdict
 
 	movevars_t	movevars;			// movement variables curstate
 	movevars_t	oldmovevars;		// movement variables oldstate
@@ -400,6 +485,15 @@ extern convar_t		sv_maxrate;
 extern convar_t		sv_downloadurl;
 extern convar_t		sv_newunit;
 extern convar_t		sv_clienttrace;
+extern convar_t		sv_findindex;
+extern convar_t		sv_threads;
+extern convar_t		sv_physics_threads;
+extern convar_t		sv_physics_verify;
+extern convar_t		sv_pmove_threads;
+extern convar_t		sv_netthread;
+extern convar_t		sv_profile;
+extern convar_t		sv_world_maxdepth;
+extern convar_t		sv_world_leafsize;
 extern convar_t		sv_failuretime;
 extern convar_t		sv_send_resources;
 extern convar_t		sv_send_logos;
@@ -495,6 +589,7 @@ void SV_Impact( edict_t *e1, edict_t *e2, trace_t *trace );
 qboolean SV_CanPushed( edict_t *ent );
 void SV_FreeOldEntities( void );
 void SV_CheckAllEnts( void );
+void SV_PhysicsStats_f( void );
 
 //
 // sv_move.c
@@ -531,6 +626,8 @@ void SV_SendServerdata( sizebuf_t *msg, sv_client_t *cl );
 void SV_ClientThink( sv_client_t *cl, usercmd_t *cmd );
 void SV_ExecuteClientMessage( sv_client_t *cl, sizebuf_t *msg );
 void SV_ConnectionlessPacket( netadr_t from, sizebuf_t *msg );
+void SV_UpdateQueryAnswers( void );
+qboolean SV_ThreadQuery( netadr_t from, const byte *data, size_t length, byte *reply, size_t *replylen );
 edict_t *SV_FakeConnect( const char *netname );
 void SV_ExecuteClientCommand( sv_client_t *cl, const char *s );
 void SV_RunCmd( sv_client_t *cl, usercmd_t *ucmd, int random_seed );
@@ -570,8 +667,52 @@ void SV_RequestMissingResources( void );
 void SV_InitFilter( void );
 void SV_ShutdownFilter( void );
 qboolean SV_CheckIP( netadr_t *adr );
+qboolean SV_HaveIPFilters( void );
 qboolean SV_CheckID( const char *id );
 
+//
+// sv_profile.c
+//
+typedef enum
+{
+	PROF_SERVERFRAME = 0,
+	PROF_READPACKETS,
+	PROF_RUNGAMEFRAME,
+	PROF_PHYSICS,
+	PROF_SENDCLIENTMESSAGES,
+	PROF_ADDENTITIESTOPACKET,
+	PROF_WRITEPACKETENTITIES,
+	PROF_GAME_STARTFRAME,	// game dll callbacks go after engine scopes
+	PROF_GAME_THINK,
+	PROF_GAME_TOUCH,
+	PROF_GAME_BLOCKED,
+	PROF_GAME_PRETHINK,
+	PROF_GAME_POSTTHINK,
+	PROF_GAME_CMDSTART,
+	PROF_GAME_CMDEND,
+	PROF_GAME_PM_MOVE,
+	PROF_GAME_CLIENTCOMMAND,
+	PROF_GAME_SETUPVISIBILITY,
+	PROF_GAME_UPDATECLIENTDATA,
+	PROF_GAME_PHYSICSENTITY,
+	PROF_GAME_ENDFRAME,
+	PROF_NUM_SCOPES
+} profscope_t;
+
+// cheap enough to leave around hot calls when profiler is off
+#define SV_PROFILE_BEGIN( scope )	do { if( sv_profiling ) SV_ProfileBegin( scope ); } while( 0 )
+#define SV_PROFILE_END()		do { if( sv_profiling ) SV_ProfileEnd(); } while( 0 )
+
+extern qboolean	sv_profiling;
+
+void SV_InitProfiler( void );
+void SV_ProfileFrame( void );
+void SV_ProfileBegin( profscope_t scope );
+void SV_ProfileEnd( void );
+void SV_ProfileReport( qboolean rolling );
+void SV_ProfileTotals( double *totals, int *calls );
+const char *SV_ProfileScopeName( profscope_t scope );
+
 //
 // sv_frame.c
 //
@@ -581,6 +722,9 @@ void SV_WriteFrameToClient( sv_client_t *client, sizebuf_t *msg );
 void SV_BuildClientFrame( sv_client_t *client );
 void SV_SendMessagesToAll( void );
 void SV_SkipUpdates( void );
+void SV_DeltaBenchmark_f( void );
+int SV_BenchmarkDatagram( sv_client_t *cl );
+void SV_FreeDatagramJobs( void );
 
 //
 // sv_game.c
@@ -616,6 +760,16 @@ void SV_EmptyStringPool( void );
 #ifdef XASH_64BIT
 void SV_PrintStr64Stats_f( void );
 #endif
+void SV_PrintFindStats_f( void );
+void SV_PrintMulticastStats_f( void );
+sv_payload_t *SV_AllocPayload( const void *data, int numbits );
+void SV_QueuePayload( sv_payloadqueue_t *queue, sv_payload_t *payload );
+void SV_ReleasePayload( sv_payload_t *payload );
+void SV_ClearPayloads( sv_payloadqueue_t *queue );
+void SV_FreePayloads( sv_payloadqueue_t *queue );
+void SV_FreePayloadCache( void );
+int SV_PayloadBytesLeft( const sv_payloadqueue_t *queue );
+void SV_WritePayloads( sizebuf_t *msg, const sv_payloadqueue_t *queue );
 sv_client_t *SV_ClientFromEdict( const edict_t *pEdict, qboolean spawned_only );
 uint SV_MapIsValid( const char *filename, const char *spawn_entity, const char *landmark_name );
 void SV_StartSound( edict_t *ent, int chan, const char *sample, float vol, float attn, int flags, int pitch );
@@ -635,6 +789,7 @@ void SV_RestartAmbientSounds( void );
 void SV_RestartDecals( void );
 void SV_RestartStaticEnts( void );
 int pfnGetCurrentPlayer( void );
+void pfnRunPlayerMove( edict_t *pClient, const float *viewangles, float fmove, float smove, float upmove, word buttons, byte impulse, byte msec );
 edict_t *SV_EdictNum( int n );
 char *SV_Localinfo( void );
 //
@@ -662,6 +817,14 @@ void SV_ClearGameState( void );
 void SV_GetTrueOrigin( sv_client_t *cl, int edictnum, vec3_t origin );
 void SV_GetTrueMinMax( sv_client_t *cl, int edictnum, vec3_t mins, vec3_t maxs );
 qboolean SV_PlayerIsFrozen( edict_t *pClient );
+void SV_RecordUnlagHistory( void );
+void SV_RecordUnlagFrame( sv_client_t *cl, client_frame_t *frame, const entity_state_t *states, int numstates );
+void SV_ClearUnlagHistory( void );
+void SV_UnlagBenchmark_f( void );
+void SV_PrefetchPmove( void );
+void SV_FinishPmovePrefetch( void );
+void SV_PmoveLinkChanged( const vec3_t absmin, const vec3_t absmax );
+void SV_PmoveStats_f( void );
 
 //
 // sv_world.c
@@ -674,11 +837,19 @@ trace_t SV_TraceHull( edict_t *ent, int hullNum, const vec3_t start, vec3_t mins
 trace_t SV_Move( const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, int type, edict_t *e, qboolean monsterclip );
 trace_t SV_MoveNoEnts( const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, int type, edict_t *e );
 trace_t SV_MoveNormal( const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, int type, edict_t *e );
+void SV_MoveMany( const tracequery_t *queries, int count, vec3_t mins, vec3_t maxs, int type, edict_t *e, trace_t *traces );
+void SV_MovePrefetch( sv_movecache_t *mc );
+qboolean SV_MoveCached( sv_movecache_t *mc, const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, int type, edict_t *e, qboolean monsterclip, trace_t *trace );
 const char *SV_TraceTexture( edict_t *ent, const vec3_t start, const vec3_t end );
 msurface_t *SV_TraceSurface( edict_t *ent, const vec3_t start, const vec3_t end );
 trace_t SV_MoveToss( edict_t *tossent, edict_t *ignore );
 void SV_LinkEdict( edict_t *ent, qboolean touch_triggers );
 void SV_TouchLinks( edict_t *ent, areanode_t *node );
+const int *SV_EntityLeafs( const edict_t *ent, int *numleafs );
+void SV_ClearEntityLeafs( void );
+void SV_PrintLinkStats_f( void );
+void SV_TraceBench_f( void );
+void SV_HullTraceBench_f( void );
 int SV_TruePointContents( const vec3_t p );
 int SV_PointContents( const vec3_t p );
 void SV_RunLightStyles( void );
@@ -686,5 +857,10 @@ void SV_SetLightStyle( int style, const char* s, float f );
 const char *SV_GetLightStyle( int style );
 int SV_LightForEntity( edict_t *pEdict );
 void SV_ClearPhysEnts( void );
+void SV_UpdateFindIndex( const edict_t *ent );
+void SV_RefreshFindIndex( void );
+void SV_CheckAreaNodes( void );
+int *SV_FindSphereCandidates( int start, const vec3_t org, float radius, int *count );
+int *SV_FindStringCandidates( int start, int field, const char *value, int *count );
 
 #endif//SERVER_H
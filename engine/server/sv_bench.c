@@ -0,0 +1,500 @@
+/*
+sv_bench.c - headless server benchmark
+Copyright (C) 2026 Xash3D FWGS contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+
+#include "common.h"
+#include "server.h"
+
+/*
+==============================================================================
+
+xash -dedicated -benchmark <map> [-benchclients N] [-benchticks K]
+	[-benchcmds file] [-benchseed S] [-benchout file] [-benchstate file]
+
+Loads the map, connects N fakeclients and runs K server ticks back
+to back, without sleeping and with sim time advancing by exactly one
+tick each frame, so runs are comparable across machines and builds.
+Bots either follow a fixed script or replay moves from a text file,
+one "msec forward side up pitch yaw buttons" per line. Every tick
+each bot also gets the datagram a remote client would, built and
+thrown away, through the same code that sends it to remote clients,
+so delta encoding is part of the cost and its size is the bandwidth
+a real client would need. Bots get unreliable sounds, tempents and
+events like remote clients do, reliable messages are not counted.
+Results go to a JSON file.
+With -benchstate the origin, velocity, flags and groundentity of
+every edict are hashed after each tick and saved to the file, or
+compared with it when it exists. Run once with sv_physics_threads 0
+and again with threads to check that they end up the same
+
+==============================================================================
+*/
+#define BENCH_WARMUP	10	// ticks to settle the map before measuring
+
+typedef struct
+{
+	byte		msec;
+	float		forwardmove;
+	float		sidemove;
+	float		upmove;
+	vec3_t		viewangles;
+	word		buttons;
+} bench_cmd_t;
+
+static struct
+{
+	bench_cmd_t	*cmds;		// replayed moves, NULL for the script
+	int		numcmds;
+	sv_client_t	*bots[MAX_CLIENTS];
+	int		numbots;
+	double		*ticktimes;
+	size_t		bytes[MAX_CLIENTS];
+
+	file_t		*statefile;
+	qboolean		statecompare;	// reading the file, not writing it
+	uint		*statehashes;
+	uint		*refhashes;
+	int		statemismatches;
+} bench;
+
+/*
+================
+SV_BenchLoadCommands
+
+================
+*/
+static qboolean SV_BenchLoadCommands( const char *filename )
+{
+	char	token[MAX_TOKEN];
+	char	*afile, *pfile;
+	float	values[7];
+	int	i, maxcmds = 0;
+
+	if( !( afile = (char *)FS_LoadFile( filename, NULL, false )))
+		return false;
+
+	for( pfile = afile; ( pfile = COM_ParseFile( pfile, token )) != NULL; )
+		maxcmds++;
+	maxcmds /= ARRAYSIZE( values );
+
+	bench.cmds = Mem_Calloc( host.mempool, Q_max( maxcmds, 1 ) * sizeof( bench_cmd_t ));
+	bench.numcmds = 0;
+	pfile = afile;
+
+	while( bench.numcmds < maxcmds )
+	{
+		bench_cmd_t	*cmd = &bench.cmds[bench.numcmds++];
+
+		for( i = 0; i < ARRAYSIZE( values ); i++ )
+		{
+			pfile = COM_ParseFile( pfile, token );
+			values[i] = Q_atof( token );
+		}
+
+		cmd->msec = bound( 1, (int)values[0], 255 );
+		cmd->forwardmove = values[1];
+		cmd->sidemove = values[2];
+		cmd->upmove = values[3];
+		cmd->viewangles[PITCH] = values[4];
+		cmd->viewangles[YAW] = values[5];
+		cmd->buttons = (word)values[6];
+	}
+
+	Mem_Free( afile );
+
+	return bench.numcmds > 0;
+}
+
+/*
+================
+SV_BenchCommand
+
+every bot runs its own lap through the same moves
+================
+*/
+static void SV_BenchCommand( int bot, int tick, int msec, bench_cmd_t *cmd )
+{
+	if( bench.numcmds )
+	{
+		*cmd = bench.cmds[(tick + bot * bench.numcmds / bench.numbots) % bench.numcmds];
+		return;
+	}
+
+	// run in circles of different phase, strafe back and forth,
+	// jump and duck now and then, so bots hit walls and each other
+	memset( cmd, 0, sizeof( *cmd ));
+	cmd->msec = msec;
+	cmd->forwardmove = 400.0f;
+	cmd->sidemove = (( tick / 64 + bot ) & 1 ) ? 200.0f : -200.0f;
+	cmd->viewangles[YAW] = anglemod( bot * 360.0f / bench.numbots + tick * 1.5f );
+
+	if(( tick + bot * 7 ) % 48 == 0 )
+		SetBits( cmd->buttons, IN_JUMP );
+	if(( tick + bot * 13 ) % 96 < 8 )
+		SetBits( cmd->buttons, IN_DUCK );
+}
+
+/*
+================
+SV_BenchConnect
+
+the game dll would do this itself for its own bots
+================
+*/
+static sv_client_t *SV_BenchConnect( int index )
+{
+	char		reject[MAX_INFO_STRING];
+	sv_client_t	*cl;
+	edict_t		*ent;
+
+	if( !( ent = SV_FakeConnect( va( "bench%i", index ))))
+		return NULL;
+
+	cl = SV_ClientFromEdict( ent, true );
+	SetBits( cl->flags, FCL_BENCHMARK );
+	reject[0] = '\0';
+
+	if( !svgame.dllFuncs.pfnClientConnect( ent, cl->name, "127.0.0.1", reject ))
+	{
+		Con_Printf( S_ERROR "benchmark: %s rejected: %s\n", cl->name, reject );
+		SV_DropClient( cl, false );
+		return NULL;
+	}
+
+	svgame.dllFuncs.pfnClientPutInServer( ent );
+
+	// fakeclients have no frames, datagrams need them for delta
+	cl->frames = (client_frame_t *)Z_Calloc( sizeof( client_frame_t ) * SV_UPDATE_BACKUP );
+	cl->delta_sequence = -1;
+
+	return cl;
+}
+
+/*
+================
+SV_BenchEdictHash
+
+what physics left in the edict
+================
+*/
+static uint SV_BenchEdictHash( edict_t *ent )
+{
+	const byte	*fields[4];
+	size_t		sizes[4];
+	uint		hash = 2166136261u;
+	int		ground, i;
+	size_t		j;
+
+	if( ent->free )
+		return 0;
+
+	ground = SV_IsValidEdict( ent->v.groundentity ) ? NUM_FOR_EDICT( ent->v.groundentity ) : -1;
+
+	fields[0] = (const byte *)ent->v.origin, sizes[0] = sizeof( ent->v.origin );
+	fields[1] = (const byte *)ent->v.velocity, sizes[1] = sizeof( ent->v.velocity );
+	fields[2] = (const byte *)&ent->v.flags, sizes[2] = sizeof( ent->v.flags );
+	fields[3] = (const byte *)&ground, sizes[3] = sizeof( ground );
+
+	for( i = 0; i < 4; i++ )
+	{
+		for( j = 0; j < sizes[i]; j++ )
+			hash = ( hash ^ fields[i][j] ) * 16777619u;
+	}
+
+	return hash;
+}
+
+/*
+================
+SV_BenchCheckState
+
+save edict state of this tick, or compare it with the saved one
+================
+*/
+static void SV_BenchCheckState( int tick )
+{
+	int	i, count = svgame.numEntities;
+	int	refcount;
+
+	if( !bench.statefile )
+		return;
+
+	for( i = 0; i < count; i++ )
+		bench.statehashes[i] = SV_BenchEdictHash( EDICT_NUM( i ));
+
+	if( !bench.statecompare )
+	{
+		FS_Write( bench.statefile, &count, sizeof( count ));
+		FS_Write( bench.statefile, bench.statehashes, count * sizeof( uint ));
+		return;
+	}
+
+	if( FS_Read( bench.statefile, &refcount, sizeof( refcount )) != sizeof( refcount ) || refcount < 0 || refcount > GI->max_edicts
+		|| FS_Read( bench.statefile, bench.refhashes, refcount * sizeof( uint )) != refcount * sizeof( uint ))
+	{
+		Con_Printf( S_WARN "benchmark: saved state ends before tick %i\n", tick );
+		FS_Close( bench.statefile );
+		bench.statefile = NULL;
+		return;
+	}
+
+	if( refcount != count )
+	{
+		if( bench.statemismatches++ < 10 )
+			Con_Printf( S_WARN "benchmark: tick %i has %i edicts, saved one has %i\n", tick, count, refcount );
+		return;
+	}
+
+	for( i = 0; i < count; i++ )
+	{
+		if( bench.statehashes[i] == bench.refhashes[i] )
+			continue;
+
+		if( bench.statemismatches++ < 10 )
+			Con_Printf( S_WARN "benchmark: tick %i, %s[%i] differs from saved state\n", tick, SV_ClassName( EDICT_NUM( i )), i );
+	}
+}
+
+static int SV_BenchCompareTimes( const void *a, const void *b )
+{
+	double	da = *(const double *)a;
+	double	db = *(const double *)b;
+
+	return ( da > db ) - ( da < db );
+}
+
+/*
+================
+SV_BenchWriteResults
+
+================
+*/
+static void SV_BenchWriteResults( const char *filename, const char *mapname, const char *cmdsname, int numticks, double fps, double seconds, double usercmdtime, double datagramtime )
+{
+	double	totals[PROF_NUM_SCOPES];
+	int	calls[PROF_NUM_SCOPES];
+	double	mean = 0.0, p50, p99;
+	size_t	allbytes = 0;
+	int	i;
+	file_t	*f;
+
+	SV_ProfileTotals( totals, calls );
+
+	for( i = 0; i < numticks; i++ )
+		mean += bench.ticktimes[i];
+	mean /= numticks;
+
+	qsort( bench.ticktimes, numticks, sizeof( double ), SV_BenchCompareTimes );
+	p50 = bench.ticktimes[numticks / 2];
+	p99 = bench.ticktimes[Q_min( numticks - 1, (int)( numticks * 0.99 ))];
+
+	for( i = 0; i < bench.numbots; i++ )
+		allbytes += bench.bytes[i];
+
+	Con_Printf( "benchmark: %s, %i clients, %i ticks in %.2f s\n", mapname, bench.numbots, numticks, seconds );
+	Con_Printf( "  %.1f ticks/s, tick p50 %.3f ms, p99 %.3f ms\n", numticks / seconds, p50 * 1000.0, p99 * 1000.0 );
+	Con_Printf( "  %.1f bytes per client per tick\n", (double)allbytes / ( bench.numbots * numticks ));
+
+	if( bench.statecompare )
+		Con_Printf( "  %i edict states differ from saved ones\n", bench.statemismatches );
+
+	if( !( f = FS_Open( filename, "w", true )))
+	{
+		Con_Printf( S_ERROR "couldn't write %s\n", filename );
+		return;
+	}
+
+	FS_Printf( f, "{\n" );
+	FS_Printf( f, "\t\"map\": \"%s\",\n", mapname );
+	FS_Printf( f, "\t\"clients\": %i,\n", bench.numbots );
+	FS_Printf( f, "\t\"ticks\": %i,\n", numticks );
+	FS_Printf( f, "\t\"tickrate\": %g,\n", fps );
+	FS_Printf( f, "\t\"commands\": \"%s\",\n", cmdsname );
+	FS_Printf( f, "\t\"seconds\": %.6f,\n", seconds );
+	FS_Printf( f, "\t\"ticks_per_second\": %.3f,\n", numticks / seconds );
+	FS_Printf( f, "\t\"tick_ms\": { \"mean\": %.4f, \"p50\": %.4f, \"p99\": %.4f, \"max\": %.4f },\n",
+		mean * 1000.0, p50 * 1000.0, p99 * 1000.0, bench.ticktimes[numticks - 1] * 1000.0 );
+	FS_Printf( f, "\t\"usercmds_ms\": %.3f,\n", usercmdtime * 1000.0 );
+	FS_Printf( f, "\t\"datagrams_ms\": %.3f,\n", datagramtime * 1000.0 );
+
+	if( bench.statecompare )
+		FS_Printf( f, "\t\"state_mismatches\": %i,\n", bench.statemismatches );
+
+	FS_Printf( f, "\t\"scopes\": {" );
+	for( i = 0; i < PROF_NUM_SCOPES; i++ )
+	{
+		FS_Printf( f, "%s\n\t\t\"%s\": { \"calls\": %i, \"total_ms\": %.3f }", i ? "," : "",
+			SV_ProfileScopeName( i ), calls[i], totals[i] * 1000.0 );
+	}
+	FS_Printf( f, "\n\t},\n" );
+
+	FS_Printf( f, "\t\"bytes_per_client\": {\n" );
+	FS_Printf( f, "\t\t\"per_tick\": %.2f,\n", (double)allbytes / ( bench.numbots * numticks ));
+	FS_Printf( f, "\t\t\"per_second\": %.2f,\n", (double)allbytes * fps / ( bench.numbots * numticks ));
+	FS_Printf( f, "\t\t\"totals\": [" );
+	for( i = 0; i < bench.numbots; i++ )
+		FS_Printf( f, "%s%lu", i ? ", " : "", (unsigned long)bench.bytes[i] );
+	FS_Printf( f, "]\n\t}\n}\n" );
+
+	FS_Close( f );
+
+	Con_Printf( "wrote %s\n", filename );
+}
+
+/*
+================
+SV_RunBenchmark
+
+called instead of the dedicated main loop, never returns
+================
+*/
+void SV_RunBenchmark( void )
+{
+	char		mapname[MAX_QPATH], outname[MAX_QPATH];
+	char		cmdsname[MAX_QPATH], value[16];
+	char		statename[MAX_QPATH];
+	int		numclients = 16, numticks = 1000, seed = 1;
+	double		fps, start, t0, t1, t2, t3;
+	double		usercmdtime = 0.0, datagramtime = 0.0;
+	float		frametime;
+	bench_cmd_t	cmd;
+	int		i, tick;
+
+	if( !Sys_GetParmFromCmdLine( "-benchmark", mapname ))
+		Sys_Error( "usage: -benchmark <map> [-benchclients N] [-benchticks K] [-benchcmds file] [-benchseed S] [-benchout file] [-benchstate file]\n" );
+
+	if( Sys_GetParmFromCmdLine( "-benchclients", value ))
+		numclients = Q_atoi( value );
+	if( Sys_GetParmFromCmdLine( "-benchticks", value ))
+		numticks = Q_atoi( value );
+	if( Sys_GetParmFromCmdLine( "-benchseed", value ))
+		seed = Q_atoi( value );
+	if( !Sys_GetParmFromCmdLine( "-benchout", outname ))
+		Q_strncpy( outname, "benchmark.json", sizeof( outname ));
+
+	numclients = bound( 1, numclients, MAX_CLIENTS );
+	numticks = Q_max( numticks, 1 );
+
+	memset( &bench, 0, sizeof( bench ));
+	Q_strncpy( cmdsname, "scripted", sizeof( cmdsname ));
+
+	if( Sys_GetParmFromCmdLine( "-benchcmds", cmdsname ) && !SV_BenchLoadCommands( cmdsname ))
+		Sys_Error( "benchmark: couldn't load moves from %s\n", cmdsname );
+
+	host.benchmark = true;
+	fps = bound( MIN_FPS, Cvar_VariableValue( "sys_ticrate" ), MAX_FPS );
+	frametime = 1.0 / fps;
+
+	// every run sees the same random numbers
+	COM_SetRandomSeed( seed );
+
+	Cvar_SetValue( "sv_profile", 0.0f );
+	Cvar_FullSet( "maxplayers", va( "%i", numclients ), FCVAR_LATCH );
+	Cbuf_AddText( va( "map %s\n", mapname ));
+	Cbuf_Execute();
+
+	for( i = 0; i < BENCH_WARMUP; i++ )
+		COM_Frame( frametime );
+
+	if( sv.state != ss_active )
+		Sys_Error( "benchmark: couldn't load %s\n", mapname );
+
+	for( i = 0; i < numclients; i++ )
+	{
+		if(( bench.bots[bench.numbots] = SV_BenchConnect( i )) == NULL )
+			break;
+		bench.numbots++;
+	}
+
+	if( !bench.numbots )
+		Sys_Error( "benchmark: couldn't connect any client\n" );
+
+	// let the bots spawn, the last warmup frame already
+	// runs with profiling so the first measured one is whole
+	for( i = 0; i < BENCH_WARMUP; i++ )
+	{
+		if( i == BENCH_WARMUP - 1 )
+			Cvar_SetValue( "sv_profile", 1000000.0f ); // never reports on its own
+		COM_Frame( frametime );
+	}
+
+	if( Sys_GetParmFromCmdLine( "-benchstate", statename ))
+	{
+		bench.statecompare = FS_FileExists( statename, true );
+		bench.statefile = FS_Open( statename, bench.statecompare ? "rb" : "wb", true );
+
+		if( !bench.statefile )
+			Sys_Error( "benchmark: couldn't open %s\n", statename );
+
+		bench.statehashes = Mem_Malloc( host.mempool, GI->max_edicts * sizeof( uint ));
+		bench.refhashes = Mem_Malloc( host.mempool, GI->max_edicts * sizeof( uint ));
+		Con_Printf( "benchmark: %s edict states %s %s\n", bench.statecompare ? "comparing" : "saving", bench.statecompare ? "with" : "to", statename );
+	}
+
+	bench.ticktimes = Mem_Malloc( host.mempool, numticks * sizeof( double ));
+	start = Sys_DoubleTime();
+
+	for( tick = 0; tick < numticks; tick++ )
+	{
+		t0 = Sys_DoubleTime();
+
+		for( i = 0; i < bench.numbots; i++ )
+		{
+			if( bench.bots[i]->state != cs_spawned )
+				continue;
+
+			SV_BenchCommand( i, tick, (int)( frametime * 1000.0f + 0.5f ), &cmd );
+			pfnRunPlayerMove( bench.bots[i]->edict, cmd.viewangles, cmd.forwardmove, cmd.sidemove,
+				cmd.upmove, cmd.buttons, 0, cmd.msec );
+		}
+
+		t1 = Sys_DoubleTime();
+		COM_Frame( frametime );
+		t2 = Sys_DoubleTime();
+
+		if( sv.state != ss_active )
+			Sys_Error( "benchmark: server went down at tick %i\n", tick );
+
+		for( i = 0; i < bench.numbots; i++ )
+		{
+			if( bench.bots[i]->state == cs_spawned )
+				bench.bytes[i] += SV_BenchmarkDatagram( bench.bots[i] );
+		}
+
+		t3 = Sys_DoubleTime();
+
+		usercmdtime += t1 - t0;
+		datagramtime += t3 - t2;
+		bench.ticktimes[tick] = t3 - t0;
+
+		// not timed, physics threads must not change the outcome
+		SV_BenchCheckState( tick );
+	}
+
+	if( bench.statefile )
+		FS_Close( bench.statefile );
+
+	SV_BenchWriteResults( outname, mapname, cmdsname, numticks, fps, Sys_DoubleTime() - start, usercmdtime, datagramtime );
+
+	Mem_Free( bench.ticktimes );
+	if( bench.cmds )
+		Mem_Free( bench.cmds );
+	if( bench.statehashes )
+	{
+		Mem_Free( bench.statehashes );
+		Mem_Free( bench.refhashes );
+	}
+
+	Sys_Quit();
+}
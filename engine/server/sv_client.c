@@ -18,6 +18,7 @@ GNU General Public License for more details.
 #include "server.h"
 #include "net_encode.h"
 #include "net_api.h"
+#include "threads.h"
 
 const char *clc_strings[clc_lastmsg+1] =
 {
@@ -42,6 +43,72 @@ typedef struct ucmd_s
 
 static int	g_userid = 1;
 
+/*
+==============================================================================
+
+NETWORK THREAD QUERIES
+
+While sv_netthread is on, the most frequent stateless queries are
+answered right on the network thread from a snapshot that the main
+thread refreshes every frame. The snapshot is guarded by a sequence
+counter which is odd while it's being rewritten
+
+==============================================================================
+*/
+static struct
+{
+	volatile int	sequence;
+	qboolean		ignore;		// single player, don't answer info
+	qboolean		deferred;		// leave everything to the main thread
+	char		info[MAX_INFO_STRING];
+	char		wrongversion[MAX_INFO_STRING];
+	byte		a2s[1024];
+	int		a2slen;
+	dword		secret[4];	// stateless challenge key, never changes
+} sv_queries;
+
+#define CHALLENGE_BUCKET	30.0	// seconds, stateless challenge is valid for one to two of them
+
+/*
+================
+SV_ChallengeBucket
+
+coarse time the stateless challenge is tied to
+================
+*/
+static int SV_ChallengeBucket( void )
+{
+	return (int)( Sys_DoubleTime() / CHALLENGE_BUCKET );
+}
+
+/*
+================
+SV_StatelessChallenge
+
+challenge that needs no table lookup, so it can be given out by
+the network thread and verified later by the main thread.
+Time bucket is mixed in so it expires
+================
+*/
+static int SV_StatelessChallenge( netadr_t from, int bucket )
+{
+	MD5Context_t	ctx;
+	byte		digest[16];
+	int		challenge;
+
+	// not CRC, it's linear and could be forged without the key
+	MD5Init( &ctx );
+	MD5Update( &ctx, (const byte *)sv_queries.secret, sizeof( sv_queries.secret ));
+	MD5Update( &ctx, (const byte *)&bucket, sizeof( bucket ));
+	MD5Update( &ctx, from.ip, sizeof( from.ip ));
+	MD5Update( &ctx, (const byte *)&from.port, sizeof( from.port ));
+	MD5Final( digest, &ctx );
+
+	memcpy( &challenge, digest, sizeof( challenge ));
+
+	return challenge;
+}
+
 /*
 =================
 SV_GetChallenge
@@ -199,6 +266,15 @@ int SV_CheckChallenge( netadr_t from, int challenge )
 		}
 	}
 
+	// may have been given out by the network thread in this or previous bucket
+	if( i == MAX_CHALLENGES && sv_queries.secret[0] )
+	{
+		int bucket = SV_ChallengeBucket();
+
+		if( challenge == SV_StatelessChallenge( from, bucket ) || challenge == SV_StatelessChallenge( from, bucket - 1 ))
+			return 1;
+	}
+
 	if( i == MAX_CHALLENGES )
 	{
 		SV_RejectConnection( from, "no challenge for your address\n" );
@@ -384,7 +460,7 @@ void SV_ConnectClient( netadr_t from )
 	newcl->frames = (client_frame_t *)Z_Calloc( sizeof( client_frame_t ) * SV_UPDATE_BACKUP );
 	newcl->userid = g_userid++;	// create unique userid
 	newcl->state = cs_connected;
-	newcl->extensions = extensions & (NET_EXT_SPLITSIZE);
+	newcl->extensions = extensions & (NET_EXT_SPLITSIZE|NET_EXT_DEFLATE);
 	Q_strncpy( newcl->useragent, protinfo, MAX_INFO_STRING );
 
 	// reset viewentities (from previous level)
@@ -394,7 +470,8 @@ void SV_ConnectClient( netadr_t from )
 
 	// initailize netchan
 	Netchan_Setup( NS_SERVER, &newcl->netchan, from, qport, newcl, SV_GetFragmentSize );
-	MSG_Init( &newcl->datagram, "Datagram", newcl->datagram_buf, sizeof( newcl->datagram_buf )); // datagram buf
+	newcl->netchan.deflate_fragments = FBitSet( newcl->extensions, NET_EXT_DEFLATE ) ? true : false;
+	SV_ClearPayloads( &newcl->datagram ); // datagram buf
 
 	Q_strncpy( newcl->hashedcdkey, Info_ValueForKey( protinfo, "uuid" ), 32 );
 	newcl->hashedcdkey[32] = '\0';
@@ -486,6 +563,7 @@ edict_t *SV_FakeConnect( const char *netname )
 	sv.current_client = cl;
 
 	if( cl->frames ) Mem_Free( cl->frames );	// fakeclients doesn't have frames
+	SV_FreePayloads( &cl->datagram );
 	memset( cl, 0, sizeof( sv_client_t ));
 
 	cl->edict = EDICT_NUM( (cl - svs.clients) + 1 );
@@ -553,12 +631,14 @@ void SV_DropClient( sv_client_t *cl, qboolean crash )
 
 	ClearBits( cl->flags, FCL_FAKECLIENT );
 	ClearBits( cl->flags, FCL_HLTV_PROXY );
+	ClearBits( cl->flags, FCL_BENCHMARK );
 	cl->state = cs_zombie; // become free in a few seconds
 	cl->name[0] = 0;
 
 	if( cl->frames )
 		Mem_Free( cl->frames ); // release delta
 	cl->frames = NULL;
+	SV_ClearPayloads( &cl->datagram );
 
 	if( NET_CompareBaseAdr( cl->netchan.remote_address, host.rd.address ))
 		SV_EndRedirect();
@@ -812,27 +892,18 @@ void SV_Ack( netadr_t from )
 
 /*
 ================
-SV_Info
+SV_BuildInfoString
 
-Responds with short info for broadcast scans
-The second parameter should be the current protocol version number.
+short info reply body for the given protocol version
 ================
 */
-void SV_Info( netadr_t from )
+static void SV_BuildInfoString( char *string, size_t size, int version )
 {
-	char	string[MAX_INFO_STRING];
-	int	version;
-
-	// ignore in single player
-	if( svs.maxclients == 1 || !svs.initialized )
-		return;
-
-	version = Q_atoi( Cmd_Argv( 1 ));
 	string[0] = '\0';
 
 	if( version != PROTOCOL_VERSION )
 	{
-		Q_snprintf( string, sizeof( string ), "%s: wrong version\n", hostname.string );
+		Q_snprintf( string, size, "%s: wrong version\n", hostname.string );
 	}
 	else
 	{
@@ -843,17 +914,35 @@ void SV_Info( netadr_t from )
 			if( svs.clients[i].state >= cs_connected )
 				count++;
 
-		Info_SetValueForKey( string, "host", hostname.string, MAX_INFO_STRING );
-		Info_SetValueForKey( string, "map", sv.name, MAX_INFO_STRING );
-		Info_SetValueForKey( string, "dm", va( "%i", (int)svgame.globals->deathmatch ), MAX_INFO_STRING );
-		Info_SetValueForKey( string, "team", va( "%i", (int)svgame.globals->teamplay ), MAX_INFO_STRING );
-		Info_SetValueForKey( string, "coop", va( "%i", (int)svgame.globals->coop ), MAX_INFO_STRING );
-		Info_SetValueForKey( string, "numcl", va( "%i", count ), MAX_INFO_STRING );
-		Info_SetValueForKey( string, "maxcl", va( "%i", svs.maxclients ), MAX_INFO_STRING );
-		Info_SetValueForKey( string, "gamedir", GI->gamefolder, MAX_INFO_STRING );
-		Info_SetValueForKey( string, "password", havePassword ? "1" : "0", MAX_INFO_STRING );
+		Info_SetValueForKey( string, "host", hostname.string, size );
+		Info_SetValueForKey( string, "map", sv.name, size );
+		Info_SetValueForKey( string, "dm", va( "%i", (int)svgame.globals->deathmatch ), size );
+		Info_SetValueForKey( string, "team", va( "%i", (int)svgame.globals->teamplay ), size );
+		Info_SetValueForKey( string, "coop", va( "%i", (int)svgame.globals->coop ), size );
+		Info_SetValueForKey( string, "numcl", va( "%i", count ), size );
+		Info_SetValueForKey( string, "maxcl", va( "%i", svs.maxclients ), size );
+		Info_SetValueForKey( string, "gamedir", GI->gamefolder, size );
+		Info_SetValueForKey( string, "password", havePassword ? "1" : "0", size );
 	}
+}
 
+/*
+================
+SV_Info
+
+Responds with short info for broadcast scans
+The second parameter should be the current protocol version number.
+================
+*/
+void SV_Info( netadr_t from )
+{
+	char	string[MAX_INFO_STRING];
+
+	// ignore in single player
+	if( svs.maxclients == 1 || !svs.initialized )
+		return;
+
+	SV_BuildInfoString( string, sizeof( string ), Q_atoi( Cmd_Argv( 1 )));
 	Netchan_OutOfBandPrint( NS_SERVER, from, "info\n%s", string );
 }
 
@@ -2138,7 +2227,9 @@ void SV_ExecuteClientCommand( sv_client_t *cl, const char *s )
 	if( !u->name && sv.state == ss_active )
 	{
 		// custom client commands
+		SV_PROFILE_BEGIN( PROF_GAME_CLIENTCOMMAND );
 		svgame.dllFuncs.pfnClientCommand( cl->edict );
+		SV_PROFILE_END();
 
 		if( !Q_strcmp( Cmd_Argv( 0 ), "fullupdate" ))
 		{
@@ -2156,16 +2247,15 @@ void SV_ExecuteClientCommand( sv_client_t *cl, const char *s )
 
 /*
 ==================
-SV_TSourceEngineQuery
+SV_BuildSourceEngineInfo
+
+writes the complete A2S_INFO reply
 ==================
 */
-void SV_TSourceEngineQuery( netadr_t from )
+static void SV_BuildSourceEngineInfo( sizebuf_t *buf )
 {
-	// A2S_INFO
-	char	answer[1024] = "";
 	int	count = 0, bots = 0;
 	int	index;
-	sizebuf_t	buf;
 
 	if( svs.clients )
 	{
@@ -2180,49 +2270,178 @@ void SV_TSourceEngineQuery( netadr_t from )
 		}
 	}
 
-	MSG_Init( &buf, "TSourceEngineQuery", answer, sizeof( answer ));
-
-	MSG_WriteLong( &buf, -1 ); // Mark as connectionless
-	MSG_WriteByte( &buf, 'm' );
-	MSG_WriteString( &buf, NET_AdrToString( net_local ));
-	MSG_WriteString( &buf, hostname.string );
-	MSG_WriteString( &buf, sv.name );
-	MSG_WriteString( &buf, GI->gamefolder );
-	MSG_WriteString( &buf, GI->title );
-	MSG_WriteByte( &buf, count );
-	MSG_WriteByte( &buf, svs.maxclients );
-	MSG_WriteByte( &buf, PROTOCOL_VERSION );
-	MSG_WriteByte( &buf, Host_IsDedicated() ? 'D' : 'L' );
+	MSG_WriteLong( buf, -1 ); // Mark as connectionless
+	MSG_WriteByte( buf, 'm' );
+	MSG_WriteString( buf, NET_AdrToString( net_local ));
+	MSG_WriteString( buf, hostname.string );
+	MSG_WriteString( buf, sv.name );
+	MSG_WriteString( buf, GI->gamefolder );
+	MSG_WriteString( buf, GI->title );
+	MSG_WriteByte( buf, count );
+	MSG_WriteByte( buf, svs.maxclients );
+	MSG_WriteByte( buf, PROTOCOL_VERSION );
+	MSG_WriteByte( buf, Host_IsDedicated() ? 'D' : 'L' );
 #if defined(_WIN32)
-	MSG_WriteByte( &buf, 'W' );
+	MSG_WriteByte( buf, 'W' );
 #else
-	MSG_WriteByte( &buf, 'L' );
+	MSG_WriteByte( buf, 'L' );
 #endif
 	if( Q_stricmp( GI->gamefolder, "valve" ))
 	{
-		MSG_WriteByte( &buf, 1 ); // mod
-		MSG_WriteString( &buf, GI->game_url );
-		MSG_WriteString( &buf, GI->update_url );
-		MSG_WriteByte( &buf, 0 );
-		MSG_WriteLong( &buf, (int)GI->version );
-		MSG_WriteLong( &buf, GI->size );
+		MSG_WriteByte( buf, 1 ); // mod
+		MSG_WriteString( buf, GI->game_url );
+		MSG_WriteString( buf, GI->update_url );
+		MSG_WriteByte( buf, 0 );
+		MSG_WriteLong( buf, (int)GI->version );
+		MSG_WriteLong( buf, GI->size );
 
 		if( GI->gamemode == 2 )
-			MSG_WriteByte( &buf, 1 ); // multiplayer_only
-		else MSG_WriteByte( &buf, 0 );
+			MSG_WriteByte( buf, 1 ); // multiplayer_only
+		else MSG_WriteByte( buf, 0 );
 
 		if( Q_strstr( GI->game_dll, "hl." ))
-			MSG_WriteByte( &buf, 0 ); // Half-Life DLL
-		else MSG_WriteByte( &buf, 1 ); // Own DLL
+			MSG_WriteByte( buf, 0 ); // Half-Life DLL
+		else MSG_WriteByte( buf, 1 ); // Own DLL
 	}
-	else MSG_WriteByte( &buf, 0 ); // Half-Life
+	else MSG_WriteByte( buf, 0 ); // Half-Life
 
-	MSG_WriteByte( &buf, GI->secure ); // unsecure
-	MSG_WriteByte( &buf, bots );
+	MSG_WriteByte( buf, GI->secure ); // unsecure
+	MSG_WriteByte( buf, bots );
+}
+
+/*
+==================
+SV_TSourceEngineQuery
+==================
+*/
+void SV_TSourceEngineQuery( netadr_t from )
+{
+	// A2S_INFO
+	char	answer[1024] = "";
+	sizebuf_t	buf;
+
+	MSG_Init( &buf, "TSourceEngineQuery", answer, sizeof( answer ));
+	SV_BuildSourceEngineInfo( &buf );
 
 	NET_SendPacket( NS_SERVER, MSG_GetNumBytesWritten( &buf ), MSG_GetData( &buf ), from );
 }
 
+/*
+================
+SV_UpdateQueryAnswers
+
+called every frame while network thread is running
+================
+*/
+void SV_UpdateQueryAnswers( void )
+{
+	sizebuf_t	buf;
+	int	i;
+
+	Sys_AtomicAdd( &sv_queries.sequence, 1 );
+
+	if( !sv_queries.secret[0] )
+	{
+		for( i = 0; i < 4; i++ )
+			sv_queries.secret[i] = ( COM_RandomLong( 0, 0xFFFF ) << 16 ) | COM_RandomLong( 0, 0xFFFF ) | 1;
+	}
+
+	sv_queries.ignore = svs.maxclients == 1;
+
+	// ban list isn't thread safe
+	sv_queries.deferred = !svs.initialized || SV_HaveIPFilters();
+
+	if( !sv_queries.deferred && !sv_queries.ignore )
+	{
+		SV_BuildInfoString( sv_queries.info, sizeof( sv_queries.info ), PROTOCOL_VERSION );
+		SV_BuildInfoString( sv_queries.wrongversion, sizeof( sv_queries.wrongversion ), 0 );
+	}
+
+	if( !sv_queries.deferred )
+	{
+		MSG_Init( &buf, "QueryAnswers", sv_queries.a2s, sizeof( sv_queries.a2s ));
+		SV_BuildSourceEngineInfo( &buf );
+		sv_queries.a2slen = MSG_CheckOverflow( &buf ) ? 0 : MSG_GetNumBytesWritten( &buf );
+	}
+
+	Sys_AtomicAdd( &sv_queries.sequence, 1 );
+}
+
+/*
+================
+SV_ThreadQuery
+
+runs on the network thread, must not touch anything but the snapshot
+================
+*/
+qboolean SV_ThreadQuery( netadr_t from, const byte *data, size_t length, byte *reply, size_t *replylen )
+{
+	char	cmd[32], *out = (char *)reply + 4;
+	int	i, seq, version = 0;
+	int	size = 0;
+
+	// copy the first token, the rest is rarely needed
+	for( i = 4; i < length && i - 4 < sizeof( cmd ) - 1; i++ )
+	{
+		if( data[i] <= ' ' )
+			break;
+		cmd[i - 4] = data[i];
+	}
+	cmd[i - 4] = '\0';
+
+	if( !Q_strcmp( cmd, "info" ))
+	{
+		while( i < length && data[i] == ' ' )
+			i++;
+		while( i < length && data[i] >= '0' && data[i] <= '9' )
+			version = version * 10 + ( data[i++] - '0' );
+	}
+	else if( Q_strcmp( cmd, "ping" ) && Q_strcmp( cmd, "i" ) && Q_strcmp( cmd, "T" "Source" ) && Q_strcmp( cmd, "getchallenge" ))
+		return false;
+
+	do
+	{
+		while(( seq = Sys_AtomicAdd( &sv_queries.sequence, 0 )) & 1 )
+			continue;
+
+		if( sv_queries.deferred || !sv_queries.secret[0] )
+			return false;
+
+		if( !Q_strcmp( cmd, "ping" ))
+		{
+			size = Q_snprintf( out, NET_MAX_FRAGMENT - 4, "ack" );
+		}
+		else if( !Q_strcmp( cmd, "i" ))
+		{
+			size = Q_snprintf( out, NET_MAX_FRAGMENT - 4, "j" ); // A2A_PING
+		}
+		else if( !Q_strcmp( cmd, "getchallenge" ))
+		{
+			size = Q_snprintf( out, NET_MAX_FRAGMENT - 4, "challenge %i", SV_StatelessChallenge( from, SV_ChallengeBucket( )));
+		}
+		else if( !Q_strcmp( cmd, "info" ))
+		{
+			if( sv_queries.ignore )
+				size = 0;
+			else size = Q_snprintf( out, NET_MAX_FRAGMENT - 4, "info\n%s",
+				version == PROTOCOL_VERSION ? sv_queries.info : sv_queries.wrongversion );
+		}
+		else
+		{
+			// reply already has the header
+			memcpy( reply, sv_queries.a2s, sv_queries.a2slen );
+			*replylen = sv_queries.a2slen;
+			continue;
+		}
+
+		// Netchan_OutOfBandPrint doesn't include terminator either
+		*(int *)reply = NET_HEADER_OUTOFBANDPACKET;
+		*replylen = size > 0 ? size + 4 : 0;
+	} while( Sys_AtomicAdd( &sv_queries.sequence, 0 ) != seq );
+
+	return true;
+}
+
 /*
 =================
 SV_ConnectionlessPacket
@@ -1037,6 +1037,18 @@ void SV_InitOperatorCommands( void )
 	Cmd_AddCommand( "entpatch", SV_EntPatch_f, "write entity patch to allow external editing" );
 	Cmd_AddCommand( "edict_usage", SV_EdictUsage_f, "show info about edicts usage" );
 	Cmd_AddCommand( "entity_info", SV_EntityInfo_f, "show more info about edicts" );
+	Cmd_AddCommand( "edict_findstats", SV_PrintFindStats_f, "show how many edicts entity searches have visited" );
+	Cmd_AddCommand( "edict_linkstats", SV_PrintLinkStats_f, "show how many relinks reused the leafs they already had" );
+	Cmd_AddCommand( "multicast_stats", SV_PrintMulticastStats_f, "show shared multicast payload and visibility cache statistics" );
+	Cmd_AddCommand( "sv_tracebench", SV_TraceBench_f, "record SV_Move calls and replay them against uniform and adaptive entity trees" );
+	Cmd_AddCommand( "sv_hulltracebench", SV_HullTraceBench_f, "compare recursive, iterative and packet hull traces on the world" );
+	Cmd_AddCommand( "sv_physics_stats", SV_PhysicsStats_f, "print prefetched trace counters since the last call" );
+	Cmd_AddCommand( "sv_pmove_stats", SV_PmoveStats_f, "print prefetched physents counters since the last call" );
+	Cmd_AddCommand( "delta_bench", SV_DeltaBenchmark_f, "time delta encoders on recorded client frames" );
+	Cmd_AddCommand( "unlag_bench", SV_UnlagBenchmark_f, "time rewinding of simulated bots for lag compensation" );
+#ifdef XASH_64BIT
+	Cmd_AddCommand( "str64stats", SV_PrintStr64Stats_f, "show 64 bit string pool statistics" );
+#endif
 	Cmd_AddCommand( "shutdownserver", SV_KillServer_f, "shutdown current server" );
 	Cmd_AddCommand( "changelevel", SV_ChangeLevel_f, "change level" );
 	Cmd_AddCommand( "changelevel2", SV_ChangeLevel2_f, "smooth change level" );
@@ -1072,6 +1084,18 @@ void SV_KillOperatorCommands( void )
 	Cmd_RemoveCommand( "entpatch" );
 	Cmd_RemoveCommand( "edict_usage" );
 	Cmd_RemoveCommand( "entity_info" );
+	Cmd_RemoveCommand( "edict_findstats" );
+	Cmd_RemoveCommand( "edict_linkstats" );
+	Cmd_RemoveCommand( "multicast_stats" );
+	Cmd_RemoveCommand( "sv_tracebench" );
+	Cmd_RemoveCommand( "sv_hulltracebench" );
+	Cmd_RemoveCommand( "sv_physics_stats" );
+	Cmd_RemoveCommand( "sv_pmove_stats" );
+	Cmd_RemoveCommand( "delta_bench" );
+	Cmd_RemoveCommand( "unlag_bench" );
+#ifdef XASH_64BIT
+	Cmd_RemoveCommand( "str64stats" );
+#endif
 	Cmd_RemoveCommand( "shutdownserver" );
 	Cmd_RemoveCommand( "changelevel" );
 	Cmd_RemoveCommand( "changelevel2" );
@@ -150,6 +150,11 @@ qboolean SV_CheckIP( netadr_t *addr )
 	return ret;
 }
 
+qboolean SV_HaveIPFilters( void )
+{
+	return ipfilter != NULL;
+}
+
 static void SV_BanID_f( void )
 {
 	float time = Q_atof( Cmd_Argv( 1 ) );
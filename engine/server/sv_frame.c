@@ -17,6 +17,7 @@ GNU General Public License for more details.
 #include "server.h"
 #include "const.h"
 #include "net_encode.h"
+#include "threads.h"
 
 typedef struct
 {
@@ -25,6 +26,42 @@ typedef struct
 	byte		sended[MAX_EDICTS_BYTES];
 } sv_ents_t;
 
+// a single MSG_WriteDeltaEntity call, recorded for later
+typedef struct
+{
+	entity_state_t	*from;
+	entity_state_t	*to;
+	int		baseline;		// custom baseline offset
+	short		type;		// DELTA_ENTITY or DELTA_PLAYER
+	short		force;
+	delta_mask_t	mask;		// fields disabled by custom encoder
+} sv_delta_op_t;
+
+typedef struct
+{
+	sv_delta_op_t	*ops;
+	int		numops;
+	int		maxops;
+	int		first_entity;	// oldest packet_entities slot referenced by ops
+} sv_packet_plan_t;
+
+// client datagram which packet entities are encoded in parallel
+typedef struct
+{
+	sv_client_t	*cl;
+	sv_packet_plan_t	plan;
+	qboolean		pending;		// plan is not written yet
+	sizebuf_t		msg;		// everything before the end of packet entities
+	sizebuf_t		tail;		// events and pings
+	sv_payloadqueue_t	datagram;		// taken from cl->datagram
+	byte		msg_buf[MAX_DATAGRAM];
+	byte		tail_buf[MAX_DATAGRAM];
+} sv_datagram_job_t;
+
+static sv_datagram_job_t	*sv_jobs[MAX_CLIENTS];
+static sv_datagram_job_t	*sv_queued[MAX_CLIENTS];
+static int		sv_numqueued;
+
 int	c_fullsend;	// just a debug counter
 int	c_notsend;
 
@@ -88,7 +125,9 @@ static void SV_AddEntitiesToPacket( edict_t *pViewEnt, edict_t *pClient, client_
 		cl->num_viewents = 0;
 	}
 
+	SV_PROFILE_BEGIN( PROF_GAME_SETUPVISIBILITY );
 	svgame.dllFuncs.pfnSetupVisibility( pViewEnt, pClient, &clientpvs, &clientphs );
+	SV_PROFILE_END();
 	if( !clientpvs ) fullvis = true;
 
 	// g-cont: of course we can send world but not want to do it :-)
@@ -250,14 +289,36 @@ int SV_FindBestBaselineForStatic( int index, entity_state_t **baseline, entity_s
 	return index - bestfound;
 }
 
+/*
+=============
+SV_AddDeltaOp
+
+=============
+*/
+static void SV_AddDeltaOp( sv_packet_plan_t *plan, entity_state_t *from, entity_state_t *to, qboolean force, int type, int baseline )
+{
+	sv_delta_op_t	*op = &plan->ops[plan->numops++];
+
+	op->from = from;
+	op->to = to;
+	op->force = force;
+	op->type = type;
+	op->baseline = baseline;
+
+	// custom encoder is game code, so run it now while we're on the main thread
+	MSG_DeltaEntityMask( from, to, type, &op->mask );
+}
+
 /*
 =============
 SV_EmitPacketEntities
 
-Writes a delta update of an entity_state_t list to the message->
+Writes a header of delta update of an entity_state_t list to the
+message and collects entity deltas to the plan. Deltas are written
+later by SV_WritePacketEntities, possibly from another thread
 =============
 */
-static void SV_EmitPacketEntities( sv_client_t *cl, client_frame_t *to, sizebuf_t *msg )
+static void SV_EmitPacketEntities( sv_client_t *cl, client_frame_t *to, sizebuf_t *msg, sv_packet_plan_t *plan )
 {
 	entity_state_t	*oldent, *newent;
 	int		oldindex, newindex;
@@ -298,6 +359,16 @@ static void SV_EmitPacketEntities( sv_client_t *cl, client_frame_t *to, sizebuf_
 		MSG_WriteUBitLong( msg, to->num_entities - 1, MAX_VISIBLE_PACKET_BITS );
 	}
 
+	// every entity produces at most one delta
+	if( plan->maxops < to->num_entities + oldmax )
+	{
+		plan->maxops = to->num_entities + oldmax;
+		plan->ops = Mem_Realloc( host.mempool, plan->ops, plan->maxops * sizeof( sv_delta_op_t ));
+	}
+
+	plan->numops = 0;
+	plan->first_entity = from ? from->first_entity : to->first_entity;
+
 	newent = NULL;
 	oldent = NULL;
 	newindex = 0;
@@ -332,7 +403,7 @@ static void SV_EmitPacketEntities( sv_client_t *cl, client_frame_t *to, sizebuf_
 			// delta update from old position
 			// because the force parm is false, this will not result
 			// in any bytes being emited if the entity has not changed at all
-			MSG_WriteDeltaEntity( oldent, newent, msg, false, player, sv.time, 0 );
+			SV_AddDeltaOp( plan, oldent, newent, false, player, 0 );
 			oldindex++;
 			newindex++;
 			continue;
@@ -363,7 +434,7 @@ static void SV_EmitPacketEntities( sv_client_t *cl, client_frame_t *to, sizebuf_
 			}
 
 			// this is a new entity, send it from the baseline
-			MSG_WriteDeltaEntity( baseline, newent, msg, true, player, sv.time, offset );
+			SV_AddDeltaOp( plan, baseline, newent, true, player, offset );
 			newindex++;
 			continue;
 		}
@@ -378,13 +449,35 @@ static void SV_EmitPacketEntities( sv_client_t *cl, client_frame_t *to, sizebuf_
 				force = true;
 
 			// remove from message
-			MSG_WriteDeltaEntity( oldent, NULL, msg, force, false, sv.time, 0 );
+			SV_AddDeltaOp( plan, oldent, NULL, force, false, 0 );
 			oldindex++;
 			continue;
 		}
 	}
+}
+
+/*
+=============
+SV_WritePacketEntities
+
+Writes entity deltas collected by SV_EmitPacketEntities.
+Doesn't touch anything but the message so it's safe to
+call for several clients at once
+=============
+*/
+static void SV_WritePacketEntities( sv_packet_plan_t *plan, sizebuf_t *msg )
+{
+	sv_delta_op_t	*op;
+	int		i;
+
+	SV_PROFILE_BEGIN( PROF_WRITEPACKETENTITIES );
+
+	for( i = 0, op = plan->ops; i < plan->numops; i++, op++ )
+		MSG_WriteDeltaEntityMasked( op->from, op->to, msg, op->force, op->type, sv.time, op->baseline, &op->mask );
 
 	MSG_WriteUBitLong( msg, LAST_EDICT, MAX_ENTITY_BITS ); // end of packetentities
+
+	SV_PROFILE_END();
 }
 
 /*
@@ -588,7 +681,9 @@ void SV_WriteClientdataToMessage( sv_client_t *cl, sizebuf_t *msg )
 	memset( &frame->clientdata, 0, sizeof( frame->clientdata ));
 
 	// update clientdata_t
+	SV_PROFILE_BEGIN( PROF_GAME_UPDATECLIENTDATA );
 	svgame.dllFuncs.pfnUpdateClientData( clent, FBitSet( cl->flags, FCL_LOCAL_WEAPONS ), &frame->clientdata );
+	SV_PROFILE_END();
 
 	MSG_BeginServerCmd( msg, svc_clientdata );
 	if( FBitSet( cl->flags, FCL_HLTV_PROXY )) return;	// don't send more nothing
@@ -628,14 +723,43 @@ void SV_WriteClientdataToMessage( sv_client_t *cl, sizebuf_t *msg )
 	MSG_WriteOneBit( msg, 0 );
 }
 
+/*
+==================
+SV_FlushQueuedDatagrams
+
+Writes packet entities of queued datagrams which reference
+packet_entities slots below the given one, they are about
+to be overwritten
+==================
+*/
+static void SV_FlushQueuedDatagrams( int first_safe )
+{
+	sv_datagram_job_t	*job;
+	int		i;
+
+	for( i = 0; i < sv_numqueued; i++ )
+	{
+		job = sv_queued[i];
+
+		if( !job->pending || job->plan.first_entity >= first_safe )
+			continue;
+
+		SV_WritePacketEntities( &job->plan, &job->msg );
+		job->pending = false;
+	}
+}
+
 /*
 ==================
 SV_WriteEntitiesToClient
 
+if plan is NULL deltas are written immediately, otherwise
+they're left in the plan and events and pings go to tail
 ==================
 */
-void SV_WriteEntitiesToClient( sv_client_t *cl, sizebuf_t *msg )
+static void SV_WriteEntitiesToClient( sv_client_t *cl, sizebuf_t *msg, sv_packet_plan_t *plan, sizebuf_t *tail )
 {
+	static sv_packet_plan_t	local_plan;
 	client_frame_t	*frame;
 	entity_state_t	*state;
 	static sv_ents_t	frame_ents;
@@ -652,7 +776,9 @@ void SV_WriteEntitiesToClient( sv_client_t *cl, sizebuf_t *msg )
 
 	// add all the entities directly visible to the eye, which
 	// may include portal entities that merge other viewpoints
+	SV_PROFILE_BEGIN( PROF_ADDENTITIESTOPACKET );
 	SV_AddEntitiesToPacket( cl->pViewEntity, cl->edict, frame, &frame_ents, true );
+	SV_PROFILE_END();
 
 	if( c_notsend != cl->ignored_ents )
 	{
@@ -670,12 +796,16 @@ void SV_WriteEntitiesToClient( sv_client_t *cl, sizebuf_t *msg )
 	// it will break all connected clients, but it takes more than one week to overflow it
 	if(( (uint)svs.next_client_entities ) + frame_ents.num_entities >= 0x7FFFFFFE )
 	{
+		SV_FlushQueuedDatagrams( 0x7FFFFFFF );
 		svs.next_client_entities = 0;
 
 		// delta is broken for now, cannot keep connected clients
 		SV_FinalMessage( "Server will restart due delta is outdated\n", true );
 	}
 
+	// queued datagrams must be written before their states are overwritten
+	SV_FlushQueuedDatagrams( svs.next_client_entities + frame_ents.num_entities - svs.num_client_entities );
+
 	// copy the entity states out
 	frame->first_entity = svs.next_client_entities;
 	frame->num_entities = 0;
@@ -689,9 +819,21 @@ void SV_WriteEntitiesToClient( sv_client_t *cl, sizebuf_t *msg )
 		frame->num_entities++;
 	}
 
-	SV_EmitPacketEntities( cl, frame, msg );
-	SV_EmitEvents( cl, frame, msg );
-	if( send_pings ) SV_EmitPings( msg );
+	SV_RecordUnlagFrame( cl, frame, frame_ents.entities, frame_ents.num_entities );
+
+	if( plan )
+	{
+		SV_EmitPacketEntities( cl, frame, msg, plan );
+	}
+	else
+	{
+		SV_EmitPacketEntities( cl, frame, msg, &local_plan );
+		SV_WritePacketEntities( &local_plan, msg );
+		tail = msg;
+	}
+
+	SV_EmitEvents( cl, frame, tail );
+	if( send_pings ) SV_EmitPings( tail );
 }
 
 /*
@@ -703,49 +845,303 @@ FRAME UPDATES
 */
 /*
 =======================
-SV_SendClientDatagram
+SV_BuildClientDatagram
+
+writes servertime, clientdata and packet entities,
+plan and tail are passed to SV_WriteEntitiesToClient
 =======================
 */
-void SV_SendClientDatagram( sv_client_t *cl )
+static void SV_BuildClientDatagram( sv_client_t *cl, sizebuf_t *msg, sv_packet_plan_t *plan, sizebuf_t *tail )
 {
-	byte	msg_buf[MAX_DATAGRAM];
-	sizebuf_t	msg;
-
-	MSG_Init( &msg, "Datagram", msg_buf, sizeof( msg_buf ));
-
 	// always send servertime at new frame
-	MSG_BeginServerCmd( &msg, svc_time );
-	MSG_WriteFloat( &msg, sv.time );
+	MSG_BeginServerCmd( msg, svc_time );
+	MSG_WriteFloat( msg, sv.time );
 
-	SV_WriteClientdataToMessage( cl, &msg );
-	SV_WriteEntitiesToClient( cl, &msg );
+	SV_WriteClientdataToMessage( cl, msg );
+	SV_WriteEntitiesToClient( cl, msg, plan, tail );
+}
 
+/*
+=======================
+SV_WriteClientPayloads
+
+copies the accumulated multicast datagram out to the message
+=======================
+*/
+static void SV_WriteClientPayloads( sv_client_t *cl, sizebuf_t *msg, sv_payloadqueue_t *datagram )
+{
 	// copy the accumulated multicast datagram
 	// for this client out to the message
-	if( MSG_CheckOverflow( &cl->datagram ))
+	if( datagram->overflowed )
 	{
-		Con_Printf( S_WARN "%s overflowed for %s\n", MSG_GetName( &cl->datagram ), cl->name );
+		Con_Printf( S_WARN "Datagram overflowed for %s\n", cl->name );
 	}
 	else
 	{
-		if( MSG_GetNumBytesWritten( &cl->datagram ) < MSG_GetNumBytesLeft( &msg ))
-			MSG_WriteBits( &msg, MSG_GetData( &cl->datagram ), MSG_GetNumBitsWritten( &cl->datagram ));
+		if( BitByte( datagram->numbits ) < MSG_GetNumBytesLeft( msg ))
+			SV_WritePayloads( msg, datagram );
 		else Con_DPrintf( S_WARN "Ignoring unreliable datagram for %s, would overflow on msg\n", cl->name );
 	}
 
-	MSG_Clear( &cl->datagram );
+	SV_ClearPayloads( datagram );
 
-	if( MSG_CheckOverflow( &msg ))
+	if( MSG_CheckOverflow( msg ))
 	{
 		// must have room left for the packet header
-		Con_Printf( S_ERROR "%s overflowed for %s\n", MSG_GetName( &msg ), cl->name );
-		MSG_Clear( &msg );
+		Con_Printf( S_ERROR "%s overflowed for %s\n", MSG_GetName( msg ), cl->name );
+		MSG_Clear( msg );
 	}
+}
+
+/*
+=======================
+SV_SendClientDatagram
+=======================
+*/
+static void SV_SendClientDatagram( sv_client_t *cl )
+{
+	byte	msg_buf[MAX_DATAGRAM];
+	sizebuf_t	msg;
+
+	MSG_Init( &msg, "Datagram", msg_buf, sizeof( msg_buf ));
+
+	SV_BuildClientDatagram( cl, &msg, NULL, NULL );
+	SV_WriteClientPayloads( cl, &msg, &cl->datagram );
 
 	// send the datagram
 	Netchan_TransmitBits( &cl->netchan, MSG_GetNumBitsWritten( &msg ), MSG_GetData( &msg ));
 }
 
+/*
+=======================
+SV_BenchmarkDatagram
+
+Builds the datagram a remote client would get in place
+of a fakeclient and returns its size without sending it.
+The client is assumed to ack every datagram
+=======================
+*/
+int SV_BenchmarkDatagram( sv_client_t *cl )
+{
+	byte	msg_buf[MAX_DATAGRAM];
+	sizebuf_t	msg;
+
+	MSG_Init( &msg, "Datagram", msg_buf, sizeof( msg_buf ));
+
+	SV_BuildClientDatagram( cl, &msg, NULL, NULL );
+	SV_WriteClientPayloads( cl, &msg, &cl->datagram );
+
+	cl->delta_sequence = cl->netchan.outgoing_sequence++;
+
+	return MSG_GetNumBytesWritten( &msg );
+}
+
+/*
+=======================
+SV_QueueClientDatagram
+
+Does everything SV_SendClientDatagram does in the same
+order, except delta encoding of packet entities, which is
+done by SV_SendQueuedDatagrams for all clients at once
+=======================
+*/
+static void SV_QueueClientDatagram( sv_client_t *cl )
+{
+	sv_datagram_job_t	*job;
+	sv_payloadqueue_t	swap;
+	int		index = cl - svs.clients;
+
+	if( !sv_jobs[index] )
+		sv_jobs[index] = Mem_Calloc( host.mempool, sizeof( sv_datagram_job_t ));
+	job = sv_jobs[index];
+
+	job->cl = cl;
+	MSG_Init( &job->msg, "Datagram", job->msg_buf, sizeof( job->msg_buf ));
+	MSG_Init( &job->tail, "Datagram", job->tail_buf, sizeof( job->tail_buf ));
+
+	SV_BuildClientDatagram( cl, &job->msg, &job->plan, &job->tail );
+	job->pending = true;
+
+	// grab the multicast datagram now, game may write more to it
+	// while other clients are processed. Job queue is always empty
+	// here, so swapping keeps both arrays allocated
+	swap = job->datagram;
+	job->datagram = cl->datagram;
+	cl->datagram = swap;
+
+	sv_queued[sv_numqueued++] = job;
+}
+
+/*
+=======================
+SV_WriteQueuedDatagram
+
+worker thread callback
+=======================
+*/
+static void SV_WriteQueuedDatagram( void *data, int index )
+{
+	sv_datagram_job_t	*job = sv_queued[index];
+
+	if( job->pending )
+		SV_WritePacketEntities( &job->plan, &job->msg );
+}
+
+/*
+=======================
+SV_SendQueuedDatagrams
+
+Encodes packet entities of all queued datagrams in parallel,
+then finishes and transmits them in client order. Netchan stays
+on the main thread, zone allocator and sockets are not thread-safe
+=======================
+*/
+static void SV_SendQueuedDatagrams( void )
+{
+	sv_datagram_job_t	*job;
+	int		i;
+
+	Jobs_Run( SV_WriteQueuedDatagram, NULL, sv_numqueued, sv_threads.value );
+	Delta_ReportOverflows();
+
+	for( i = 0; i < sv_numqueued; i++ )
+	{
+		job = sv_queued[i];
+		job->pending = false;
+
+		// client could be dropped while others were processed
+		if( job->cl->state != cs_spawned )
+		{
+			SV_ClearPayloads( &job->datagram );
+			continue;
+		}
+
+		// events and pings were written after packet entities
+		if( MSG_CheckOverflow( &job->tail ))
+			job->msg.bOverflow = true;
+		else MSG_WriteBits( &job->msg, MSG_GetData( &job->tail ), MSG_GetNumBitsWritten( &job->tail ));
+
+		SV_WriteClientPayloads( job->cl, &job->msg, &job->datagram );
+		Netchan_TransmitBits( &job->cl->netchan, MSG_GetNumBitsWritten( &job->msg ), MSG_GetData( &job->msg ));
+	}
+
+	sv_numqueued = 0;
+}
+
+/*
+=======================
+SV_FreeDatagramJobs
+
+releases queued datagram buffers
+and the payloads they still hold
+=======================
+*/
+void SV_FreeDatagramJobs( void )
+{
+	int	i;
+
+	for( i = 0; i < MAX_CLIENTS; i++ )
+	{
+		if( !sv_jobs[i] )
+			continue;
+
+		SV_FreePayloads( &sv_jobs[i]->datagram );
+		Mem_Free( sv_jobs[i] );
+		sv_jobs[i] = NULL;
+	}
+
+	sv_numqueued = 0;
+}
+
+/*
+=======================
+SV_DeltaBenchmark_f
+
+Re-encodes pairs of frames recorded for connected clients
+with field-by-field and compiled delta encoders
+=======================
+*/
+void SV_DeltaBenchmark_f( void )
+{
+	static sv_packet_plan_t	plan;
+	static byte	buf[MAX_DATAGRAM];
+	double		start, elapsed[2];
+	dword		crc[2];
+	int		numents[2];
+	int		pass, iter, iterations;
+	int		i, seq, oldsequence;
+	client_frame_t	*from, *to;
+	sv_client_t	*cl;
+	sizebuf_t		msg;
+
+	if( sv.state != ss_active )
+	{
+		Con_Printf( "delta_bench: server is not active\n" );
+		return;
+	}
+
+	iterations = ( Cmd_Argc() > 1 ) ? Q_atoi( Cmd_Argv( 1 )) : 100;
+	iterations = Q_max( iterations, 1 );
+
+	for( pass = 0; pass < 2; pass++ )
+	{
+		Delta_SetCompiledEncoders( pass != 0 );
+		CRC32_Init( &crc[pass] );
+		numents[pass] = 0;
+		start = Sys_DoubleTime();
+
+		for( iter = 0; iter < iterations; iter++ )
+		{
+			for( i = 0, cl = svs.clients; i < svs.maxclients; i++, cl++ )
+			{
+				if( cl->state != cs_spawned || FBitSet( cl->flags, FCL_FAKECLIENT ))
+					continue;
+
+				oldsequence = cl->delta_sequence;
+
+				for( seq = 1; seq < SV_UPDATE_BACKUP; seq++ )
+				{
+					from = &cl->frames[(seq - 1) & SV_UPDATE_MASK];
+					to = &cl->frames[seq & SV_UPDATE_MASK];
+
+					// both states must still be in packet_entities
+					if( from->first_entity <= svs.next_client_entities - svs.num_client_entities )
+						continue;
+					if( to->first_entity <= from->first_entity || !to->num_entities )
+						continue;
+
+					MSG_Init( &msg, "DeltaBench", buf, sizeof( buf ));
+					cl->delta_sequence = seq - 1;
+					SV_EmitPacketEntities( cl, to, &msg, &plan );
+					SV_WritePacketEntities( &plan, &msg );
+
+					if( iter == 0 )
+						CRC32_ProcessBuffer( &crc[pass], MSG_GetData( &msg ), MSG_GetNumBytesWritten( &msg ));
+					numents[pass] += to->num_entities;
+				}
+
+				cl->delta_sequence = oldsequence;
+			}
+		}
+
+		elapsed[pass] = Sys_DoubleTime() - start;
+		crc[pass] = CRC32_Final( crc[pass] );
+	}
+
+	Delta_SetCompiledEncoders( true );
+
+	if( !numents[0] )
+	{
+		Con_Printf( "delta_bench: no recorded frames\n" );
+		return;
+	}
+
+	Con_Printf( "delta_bench: %i entities in %i iterations\n", numents[0] / iterations, iterations );
+	Con_Printf( "  field-by-field: %.1f ns per entity\n", elapsed[0] * 1e9 / numents[0] );
+	Con_Printf( "  compiled:       %.1f ns per entity\n", elapsed[1] * 1e9 / numents[1] );
+	Con_Printf( "  output %s\n", ( crc[0] == crc[1] ) ? "matches" : "^1DIFFERS^7" );
+}
+
 /*
 =======================
 SV_UpdateUserInfo
@@ -765,6 +1161,8 @@ SV_UpdateToReliableMessages
 */
 void SV_UpdateToReliableMessages( void )
 {
+	sv_payload_t	*datagram = NULL;
+	sv_payload_t	*spec_datagram = NULL;
 	sv_client_t	*cl;
 	int		i;
 
@@ -803,6 +1201,19 @@ void SV_UpdateToReliableMessages( void )
 		MSG_Clear( &sv.spec_datagram );
 	}
 
+	// unreliable ones are shared between clients
+	if( MSG_GetNumBitsWritten( &sv.datagram ) > 0 )
+	{
+		datagram = SV_AllocPayload( MSG_GetData( &sv.datagram ), MSG_GetNumBitsWritten( &sv.datagram ));
+		datagram->refcount++;
+	}
+
+	if( MSG_GetNumBitsWritten( &sv.spec_datagram ) > 0 )
+	{
+		spec_datagram = SV_AllocPayload( MSG_GetData( &sv.spec_datagram ), MSG_GetNumBitsWritten( &sv.spec_datagram ));
+		spec_datagram->refcount++;
+	}
+
 	// now send the reliable and server datagrams to all clients.
 	for( i = 0, cl = svs.clients; i < svs.maxclients; i++, cl++ )
 	{
@@ -813,18 +1224,25 @@ void SV_UpdateToReliableMessages( void )
 			MSG_WriteBits( &cl->netchan.message, MSG_GetBuf( &sv.reliable_datagram ), MSG_GetNumBitsWritten( &sv.reliable_datagram ));
 		else Netchan_CreateFragments( &cl->netchan, &sv.reliable_datagram );
 
-		if( MSG_GetNumBytesWritten( &sv.datagram ) < MSG_GetNumBytesLeft( &cl->datagram ))
-			MSG_WriteBits( &cl->datagram, MSG_GetBuf( &sv.datagram ), MSG_GetNumBitsWritten( &sv.datagram ));
+		if( MSG_GetNumBytesWritten( &sv.datagram ) < SV_PayloadBytesLeft( &cl->datagram ))
+		{
+			if( datagram ) SV_QueuePayload( &cl->datagram, datagram );
+		}
 		else Con_DPrintf( S_WARN "Ignoring unreliable datagram for %s, would overflow\n", cl->name );
 
 		if( FBitSet( cl->flags, FCL_HLTV_PROXY ))
 		{
-			if( MSG_GetNumBytesWritten( &sv.spec_datagram ) < MSG_GetNumBytesLeft( &cl->datagram ))
-				MSG_WriteBits( &cl->datagram, MSG_GetBuf( &sv.spec_datagram ), MSG_GetNumBitsWritten( &sv.spec_datagram ));
+			if( MSG_GetNumBytesWritten( &sv.spec_datagram ) < SV_PayloadBytesLeft( &cl->datagram ))
+			{
+				if( spec_datagram ) SV_QueuePayload( &cl->datagram, spec_datagram );
+			}
 			else Con_DPrintf( S_WARN "Ignoring spectator datagram for %s, would overflow\n", cl->name );
 		}
 	}
 
+	if( datagram ) SV_ReleasePayload( datagram );
+	if( spec_datagram ) SV_ReleasePayload( spec_datagram );
+
 	// now clear the reliable and datagram buffers.
 	MSG_Clear( &sv.reliable_datagram );
 	MSG_Clear( &sv.spec_datagram );
@@ -847,6 +1265,10 @@ void SV_SendClientMessages( void )
 		return;
 
 	SV_UpdateToReliableMessages ();
+	SV_RecordUnlagHistory();
+
+	// datagrams go out with a few syscalls at the end
+	NET_BeginSendBatch( NS_SERVER );
 
 	// send a message to each connected client
 	for( i = 0, sv.current_client = svs.clients; i < svs.maxclients; i++, sv.current_client++ )
@@ -882,7 +1304,7 @@ void SV_SendClientMessages( void )
 		if( MSG_CheckOverflow( &cl->netchan.message ))
 		{
 			MSG_Clear( &cl->netchan.message );
-			MSG_Clear( &cl->datagram );
+			SV_ClearPayloads( &cl->datagram );
 			SV_BroadcastPrintf( NULL, "%s overflowed\n", cl->name );
 			Con_DPrintf( S_ERROR "reliable overflow for %s\n", cl->name );
 			SV_DropClient( cl, false );
@@ -916,14 +1338,21 @@ void SV_SendClientMessages( void )
 			ClearBits( cl->flags, FCL_SEND_NET_MESSAGE );
 
 			// NOTE: we should send frame even if server is not simulated to prevent overflow
-			if( cl->state == cs_spawned )
-				SV_SendClientDatagram( cl );
-			else Netchan_TransmitBits( &cl->netchan, 0, NULL ); // just update reliable
+			if( cl->state != cs_spawned )
+				Netchan_TransmitBits( &cl->netchan, 0, NULL ); // just update reliable
+			else if( sv_threads.value > 1.0f )
+				SV_QueueClientDatagram( cl );
+			else SV_SendClientDatagram( cl );
 		}
 	}
 
 	// reset current client
 	sv.current_client = NULL;
+
+	if( sv_numqueued > 0 )
+		SV_SendQueuedDatagrams();
+
+	NET_EndSendBatch( NS_SERVER );
 }
 
 /*
@@ -1016,6 +1445,6 @@ void SV_InactivateClients( void )
 			continue;
 
 		MSG_Clear( &cl->netchan.message );
-		MSG_Clear( &cl->datagram );
+		SV_ClearPayloads( &cl->datagram );
 	}
 }
@@ -261,6 +261,346 @@ void SV_ConvertTrace( TraceResult *dst, trace_t *src )
 	svgame.globals->trace_flags = 0;
 }
 
+/*
+==============================================================================
+
+	Multicast payloads are stored once and referenced from every
+	client's unreliable queue, so a message sent to N clients costs
+	one copy instead of N. Small payloads are recycled.
+
+==============================================================================
+*/
+#define PAYLOAD_SMALL_BYTES	128
+
+static sv_payload_t *sv_freepayloads;
+
+static struct
+{
+	uint		startframe;
+	size_t		messages;		// unreliable multicasts
+	size_t		bytes;		// payload bytes stored
+	size_t		sends;		// payloads queued to clients
+	size_t		sendbytes;	// bytes queued to clients
+	size_t		leafcached;	// client view leafs reused
+	size_t		leaflookups;	// client view leafs searched
+	size_t		maskcached;	// PVS/PAS masks reused
+	size_t		maskbuilds;	// PVS/PAS masks built
+} multicast_stats;
+
+/*
+=================
+SV_AllocPayload
+
+=================
+*/
+sv_payload_t *SV_AllocPayload( const void *data, int numbits )
+{
+	int		numbytes = BitByte( numbits );
+	sv_payload_t	*payload;
+
+	if( numbytes <= PAYLOAD_SMALL_BYTES && sv_freepayloads )
+	{
+		payload = sv_freepayloads;
+		sv_freepayloads = payload->next;
+	}
+	else
+	{
+		int	maxbytes = Q_max( numbytes, PAYLOAD_SMALL_BYTES );
+
+		payload = Mem_Malloc( host.mempool, sizeof( sv_payload_t ) + maxbytes );
+		payload->maxbytes = maxbytes;
+	}
+
+	payload->next = NULL;
+	payload->refcount = 0;
+	payload->numbits = numbits;
+	memcpy( payload->data, data, numbytes );
+
+	return payload;
+}
+
+/*
+=================
+SV_ReleasePayload
+
+frees payload when nobody references it
+=================
+*/
+void SV_ReleasePayload( sv_payload_t *payload )
+{
+	if( --payload->refcount > 0 )
+		return;
+
+	if( payload->maxbytes == PAYLOAD_SMALL_BYTES )
+	{
+		payload->next = sv_freepayloads;
+		sv_freepayloads = payload;
+	}
+	else Mem_Free( payload );
+}
+
+/*
+=================
+SV_QueuePayload
+
+emulates the overflow behavior of a
+MAX_DATAGRAM sized buffer
+=================
+*/
+void SV_QueuePayload( sv_payloadqueue_t *queue, sv_payload_t *payload )
+{
+	if( queue->overflowed )
+		return;
+
+	if( queue->numbits + payload->numbits > MAX_DATAGRAM * 8 )
+	{
+		queue->overflowed = true;
+		return;
+	}
+
+	if( queue->count == queue->maxcount )
+	{
+		queue->maxcount = Q_max( queue->maxcount * 2, 32 );
+		queue->payloads = Mem_Realloc( host.mempool, queue->payloads, sizeof( *queue->payloads ) * queue->maxcount );
+	}
+
+	queue->payloads[queue->count++] = payload;
+	queue->numbits += payload->numbits;
+	payload->refcount++;
+
+	multicast_stats.sends++;
+	multicast_stats.sendbytes += BitByte( payload->numbits );
+}
+
+/*
+=================
+SV_ClearPayloads
+
+=================
+*/
+void SV_ClearPayloads( sv_payloadqueue_t *queue )
+{
+	int	i;
+
+	for( i = 0; i < queue->count; i++ )
+		SV_ReleasePayload( queue->payloads[i] );
+
+	queue->count = 0;
+	queue->numbits = 0;
+	queue->overflowed = false;
+}
+
+/*
+=================
+SV_FreePayloads
+
+=================
+*/
+void SV_FreePayloads( sv_payloadqueue_t *queue )
+{
+	SV_ClearPayloads( queue );
+
+	if( queue->payloads )
+		Mem_Free( queue->payloads );
+
+	memset( queue, 0, sizeof( *queue ));
+}
+
+/*
+=================
+SV_FreePayloadCache
+
+releases recycled small payloads
+=================
+*/
+void SV_FreePayloadCache( void )
+{
+	sv_payload_t	*payload;
+
+	while(( payload = sv_freepayloads ) != NULL )
+	{
+		sv_freepayloads = payload->next;
+		Mem_Free( payload );
+	}
+}
+
+/*
+=================
+SV_PayloadBytesLeft
+
+=================
+*/
+int SV_PayloadBytesLeft( const sv_payloadqueue_t *queue )
+{
+	if( queue->overflowed )
+		return 0;
+
+	return ( MAX_DATAGRAM * 8 - queue->numbits ) >> 3;
+}
+
+/*
+=================
+SV_WritePayloads
+
+=================
+*/
+void SV_WritePayloads( sizebuf_t *msg, const sv_payloadqueue_t *queue )
+{
+	int	i;
+
+	for( i = 0; i < queue->count; i++ )
+		MSG_WriteBits( msg, queue->payloads[i]->data, queue->payloads[i]->numbits );
+}
+
+/*
+=================
+SV_PrintMulticastStats_f
+
+=================
+*/
+void SV_PrintMulticastStats_f( void )
+{
+	uint	frames = Q_max( host.framecount - multicast_stats.startframe, 1 );
+	size_t	leafs = multicast_stats.leafcached + multicast_stats.leaflookups;
+	size_t	masks = multicast_stats.maskcached + multicast_stats.maskbuilds;
+
+	Msg( "multicast over %u frames:\n", frames );
+	Msg( "%lu messages, %.1f per frame, %.1f payload bytes per frame\n",
+		(unsigned long)multicast_stats.messages, (double)multicast_stats.messages / frames,
+		(double)multicast_stats.bytes / frames );
+	Msg( "%lu client sends, %.1f bytes per frame delivered by reference\n",
+		(unsigned long)multicast_stats.sends, (double)multicast_stats.sendbytes / frames );
+	Msg( "view leaf lookups: %lu of %lu avoided\n",
+		(unsigned long)multicast_stats.leafcached, (unsigned long)leafs );
+	Msg( "PVS/PAS masks: %lu of %lu reused\n",
+		(unsigned long)multicast_stats.maskcached, (unsigned long)masks );
+
+	if( Cmd_Argc() > 1 && !Q_stricmp( Cmd_Argv( 1 ), "reset" ))
+	{
+		memset( &multicast_stats, 0, sizeof( multicast_stats ));
+		multicast_stats.startframe = host.framecount;
+	}
+}
+
+/*
+==============================================================================
+
+	Visibility caches for SV_Multicast. Every client remembers the
+	leaf of its last view origin and the last PVS and PAS masks are
+	kept until origin or map changes, so bursts of messages from one
+	spot (pellets, explosions) do the leaf and vis work only once.
+
+==============================================================================
+*/
+typedef struct
+{
+	vec3_t		origin;
+	mleaf_t		*leaf;
+	int		spawncount;
+} sv_viewleaf_t;
+
+typedef struct
+{
+	vec3_t		origin;
+	mleaf_t		*leaf;		// for PVS only
+	qboolean		fullvis;		// for PAS only
+	int		spawncount;
+	byte		*mask;		// NULL if origin is outside of the world
+	byte		data[MAX_MAP_LEAFS/8];
+} sv_maskcache_t;
+
+static sv_viewleaf_t	viewLeaf[MAX_CLIENTS];
+static sv_maskcache_t	pvsCache, pasCache;
+
+/*
+=================
+SV_ViewLeaf
+
+=================
+*/
+static mleaf_t *SV_ViewLeaf( int clientnum, const vec3_t vieworg )
+{
+	sv_viewleaf_t	*cache = &viewLeaf[clientnum];
+
+	if( cache->leaf && cache->spawncount == svs.spawncount && VectorCompare( cache->origin, vieworg ))
+	{
+		multicast_stats.leafcached++;
+		return cache->leaf;
+	}
+
+	multicast_stats.leaflookups++;
+	cache->leaf = Mod_PointInLeaf( vieworg, sv.worldmodel->nodes );
+	cache->spawncount = svs.spawncount;
+	VectorCopy( vieworg, cache->origin );
+
+	return cache->leaf;
+}
+
+/*
+=================
+SV_MulticastPAS
+
+same as Mod_FatPVS into fatphs, but cached
+=================
+*/
+static byte *SV_MulticastPAS( const vec3_t origin )
+{
+	qboolean	fullvis = ( svs.maxclients == 1 ); // GoldSource not using PHS for singleplayer
+
+	if( pasCache.mask && pasCache.spawncount == svs.spawncount && pasCache.fullvis == fullvis && VectorCompare( pasCache.origin, origin ))
+	{
+		multicast_stats.maskcached++;
+		return pasCache.mask;
+	}
+
+	multicast_stats.maskbuilds++;
+	Mod_FatPVS( origin, FATPHS_RADIUS, pasCache.data, world.fatbytes, false, fullvis );
+	VectorCopy( origin, pasCache.origin );
+	pasCache.fullvis = fullvis;
+	pasCache.spawncount = svs.spawncount;
+	pasCache.mask = pasCache.data;
+
+	return pasCache.mask;
+}
+
+/*
+=================
+SV_MulticastPVS
+
+same as Mod_GetPVSForPoint, but cached
+=================
+*/
+static byte *SV_MulticastPVS( const vec3_t origin )
+{
+	mleaf_t	*leaf;
+
+	if( pvsCache.spawncount == svs.spawncount && pvsCache.leaf && VectorCompare( pvsCache.origin, origin ))
+	{
+		multicast_stats.maskcached++;
+		return pvsCache.mask;
+	}
+
+	leaf = Mod_PointInLeaf( origin, sv.worldmodel->nodes );
+
+	if( pvsCache.spawncount != svs.spawncount || pvsCache.leaf != leaf )
+	{
+		multicast_stats.maskbuilds++;
+
+		if(( pvsCache.mask = Mod_GetPVSForPoint( origin )) != NULL )
+		{
+			memcpy( pvsCache.data, pvsCache.mask, world.visbytes );
+			pvsCache.mask = pvsCache.data;
+		}
+	}
+	else multicast_stats.maskcached++;
+
+	VectorCopy( origin, pvsCache.origin );
+	pvsCache.spawncount = svs.spawncount;
+	pvsCache.leaf = leaf;
+
+	return pvsCache.mask;
+}
+
 /*
 =============
 SV_CheckClientVisiblity
@@ -283,7 +623,7 @@ qboolean SV_CheckClientVisiblity( sv_client_t *cl, const byte *mask )
 	if( cl->pViewEntity && !VectorCompare( vieworg, cl->pViewEntity->v.origin ))
 		VectorCopy( cl->pViewEntity->v.origin, vieworg );
 
-	leaf = Mod_PointInLeaf( vieworg, sv.worldmodel->nodes );
+	leaf = SV_ViewLeaf( clientnum, vieworg );
 
 	if( CHECKVISBIT( mask, leaf->cluster ))
 		return true; // visible from player view or camera view
@@ -329,6 +669,7 @@ static int SV_Multicast( int dest, const vec3_t origin, const edict_t *ent, qboo
 	qboolean		reliable = false;
 	qboolean		specproxy = false;
 	int		numsends = 0;
+	sv_payload_t	*payload = NULL;
 
 	// some mods trying to send messages after SV_FinalMessage
 	if( !svs.initialized || sv.state == ss_dead )
@@ -359,16 +700,14 @@ static int SV_Multicast( int dest, const vec3_t origin, const edict_t *ent, qboo
 		// intentional fallthrough
 	case MSG_PAS:
 		if( origin == NULL ) return false;
-		// NOTE: GoldSource not using PHS for singleplayer
-		Mod_FatPVS( origin, FATPHS_RADIUS, fatphs, world.fatbytes, false, ( svs.maxclients == 1 ));
-		mask = fatphs; // using the FatPVS like a PHS
+		mask = SV_MulticastPAS( origin ); // using the FatPVS like a PHS
 		break;
 	case MSG_PVS_R:
 		reliable = true;
 		// intentional fallthrough
 	case MSG_PVS:
 		if( origin == NULL ) return 0;
-		mask = Mod_GetPVSForPoint( origin );
+		mask = SV_MulticastPVS( origin );
 		break;
 	case MSG_ONE:
 		reliable = true;
@@ -400,7 +739,11 @@ static int SV_Multicast( int dest, const vec3_t origin, const edict_t *ent, qboo
 		if( specproxy && !FBitSet( cl->flags, FCL_HLTV_PROXY ))
 			continue;
 
-		if( !cl->edict || FBitSet( cl->flags, FCL_FAKECLIENT ))
+		if( !cl->edict )
+			continue;
+
+		// benchmark bots only take what would go to their datagram
+		if( FBitSet( cl->flags, FCL_FAKECLIENT ) && ( !FBitSet( cl->flags, FCL_BENCHMARK ) || reliable ))
 			continue;
 
 		// reject step sounds while predicting is enabled
@@ -422,10 +765,24 @@ static int SV_Multicast( int dest, const vec3_t origin, const edict_t *ent, qboo
 
 		if( specproxy ) MSG_WriteBits( &sv.spec_datagram, MSG_GetData( &sv.multicast ), MSG_GetNumBitsWritten( &sv.multicast ));
 		else if( reliable ) MSG_WriteBits( &cl->netchan.message, MSG_GetData( &sv.multicast ), MSG_GetNumBitsWritten( &sv.multicast ));
-		else MSG_WriteBits( &cl->datagram, MSG_GetData( &sv.multicast ), MSG_GetNumBitsWritten( &sv.multicast ));
+		else
+		{
+			// stored once, referenced by every recipient
+			if( !payload )
+			{
+				payload = SV_AllocPayload( MSG_GetData( &sv.multicast ), MSG_GetNumBitsWritten( &sv.multicast ));
+				payload->refcount++; // hold it while queueing
+				multicast_stats.messages++;
+				multicast_stats.bytes += MSG_GetNumBytesWritten( &sv.multicast );
+			}
+			SV_QueuePayload( &cl->datagram, payload );
+		}
 		numsends++;
 	}
 
+	if( payload )
+		SV_ReleasePayload( payload );
+
 	MSG_Clear( &sv.multicast );
 
 	return numsends; // just for debug
@@ -986,6 +1343,8 @@ void SV_InitEdict( edict_t *pEdict )
 	pEdict->v.controller[2] = 0x7F;
 	pEdict->v.controller[3] = 0x7F;
 	pEdict->free = false;
+
+	SV_UpdateFindIndex( pEdict );
 }
 
 /*
@@ -1023,6 +1382,8 @@ void SV_FreeEdict( edict_t *pEdict )
 	VectorClear( pEdict->v.angles );
 	VectorClear( pEdict->v.origin );
 	pEdict->free = true;
+
+	SV_UpdateFindIndex( pEdict );
 }
 
 /*
@@ -1106,7 +1467,10 @@ edict_t* SV_AllocPrivateData( edict_t *ent, string_t className )
 	{
 		// attempt to create custom entity (Xash3D extension)
 		if( svgame.physFuncs.SV_CreateEntity && svgame.physFuncs.SV_CreateEntity( ent, pszClassName ) != -1 )
+		{
+			SV_UpdateFindIndex( ent );
 			return ent;
+		}
 
 		SpawnEdict = SV_GetEntityClass( "custom" );
 
@@ -1124,6 +1488,7 @@ edict_t* SV_AllocPrivateData( edict_t *ent, string_t className )
 	}
 
 	SpawnEdict( &ent->v );
+	SV_UpdateFindIndex( ent );
 
 	return ent;
 }
@@ -1524,6 +1889,84 @@ void GAME_EXPORT pfnChangePitch( edict_t* ent )
 	ent->v.angles[PITCH] = SV_AngleMod( ent->v.idealpitch, ent->v.angles[PITCH], ent->v.pitch_speed );
 }
 
+static struct
+{
+	size_t	calls;
+	size_t	visited;
+	int	maxvisited;
+} find_stats[2];
+
+#define FIND_STATS_STRING	0
+#define FIND_STATS_SPHERE	1
+
+static void SV_CountFindVisited( int query, int visited )
+{
+	find_stats[query].calls++;
+	find_stats[query].visited += visited;
+	find_stats[query].maxvisited = Q_max( find_stats[query].maxvisited, visited );
+}
+
+/*
+=========
+SV_PrintFindStats_f
+
+=========
+*/
+void SV_PrintFindStats_f( void )
+{
+	const char *names[2] = { "FindEntityByString", "FindEntityInSphere" };
+	int	i;
+
+	Msg( "edicts visited by entity searches (sv_findindex %g):\n", sv_findindex.value );
+
+	for( i = 0; i < 2; i++ )
+	{
+		Msg( "%s: %lu calls, %lu edicts visited, %.1f average, %d max\n", names[i],
+			find_stats[i].calls, find_stats[i].visited,
+			find_stats[i].calls ? (double)find_stats[i].visited / find_stats[i].calls : 0.0,
+			find_stats[i].maxvisited );
+	}
+
+	if( Cmd_Argc() > 1 && !Q_stricmp( Cmd_Argv( 1 ), "reset" ))
+		memset( find_stats, 0, sizeof( find_stats ));
+}
+
+/*
+=========
+SV_EntityStringMatch
+
+=========
+*/
+static qboolean SV_EntityStringMatch( edict_t *ed, int e, TYPEDESCRIPTION *desc, const char *pszValue )
+{
+	const char	*t;
+
+	if( !SV_IsValidEdict( ed ))
+		return false;
+
+	if( e <= svs.maxclients && !SV_ClientFromEdict( ed, ( svs.maxclients != 1 )))
+		return false;
+
+	switch( desc->fieldType )
+	{
+	case FIELD_STRING:
+	case FIELD_MODELNAME:
+	case FIELD_SOUNDNAME:
+		t = STRING( *(string_t *)&((byte *)&ed->v)[desc->fieldOffset] );
+		if( t != NULL && t != svgame.globals->pStringBase )
+		{
+			if( !Q_strcmp( t, pszValue ))
+				return true;
+		}
+		break;
+	default:
+		ASSERT( 0 );
+		break;
+	}
+
+	return false;
+}
+
 /*
 =========
 SV_FindEntityByString
@@ -1533,9 +1976,10 @@ SV_FindEntityByString
 edict_t *SV_FindEntityByString( edict_t *pStartEdict, const char *pszField, const char *pszValue )
 {
 	int		index = 0, e = 0;
+	int		field = -1;
 	TYPEDESCRIPTION	*desc = NULL;
-	edict_t		*ed;
-	const char	*t;
+	int		*list, count;
+	int		i, best;
 
 	if( !COM_CheckString( pszValue ))
 		return svgame.edicts;
@@ -1554,32 +1998,43 @@ edict_t *SV_FindEntityByString( edict_t *pStartEdict, const char *pszField, cons
 		return svgame.edicts;
 	}
 
-	for( e++; e < svgame.numEntities; e++ )
+	if( sv_findindex.value >= 2.0f )
 	{
-		ed = EDICT_NUM( e );
-		if( !SV_IsValidEdict( ed )) continue;
+		if( desc->fieldOffset == offsetof( entvars_t, classname ))
+			field = FIND_CLASSNAME;
+		else if( desc->fieldOffset == offsetof( entvars_t, targetname ))
+			field = FIND_TARGETNAME;
+		else if( desc->fieldOffset == offsetof( entvars_t, globalname ))
+			field = FIND_GLOBALNAME;
+	}
 
-		if( e <= svs.maxclients && !SV_ClientFromEdict( ed, ( svs.maxclients != 1 )))
-			continue;
+	if( field != -1 && ( list = SV_FindStringCandidates( e, field, pszValue, &count )) != NULL )
+	{
+		// candidates are unordered, pick the lowest match to keep the iteration order
+		for( i = 0, best = svgame.numEntities; i < count; i++ )
+		{
+			if( list[i] < best && SV_EntityStringMatch( EDICT_NUM( list[i] ), list[i], desc, pszValue ))
+				best = list[i];
+		}
 
-		switch( desc->fieldType )
+		SV_CountFindVisited( FIND_STATS_STRING, count );
+
+		if( best < svgame.numEntities )
+			return EDICT_NUM( best );
+		return svgame.edicts;
+	}
+
+	for( i = 0, e++; e < svgame.numEntities; e++, i++ )
+	{
+		if( SV_EntityStringMatch( EDICT_NUM( e ), e, desc, pszValue ))
 		{
-		case FIELD_STRING:
-		case FIELD_MODELNAME:
-		case FIELD_SOUNDNAME:
-			t = STRING( *(string_t *)&((byte *)&ed->v)[desc->fieldOffset] );
-			if( t != NULL && t != svgame.globals->pStringBase )
-			{
-				if( !Q_strcmp( t, pszValue ))
-					return ed;
-			}
-			break;
-		default:
-			ASSERT( 0 );
-			break;
+			SV_CountFindVisited( FIND_STATS_STRING, i + 1 );
+			return EDICT_NUM( e );
 		}
 	}
 
+	SV_CountFindVisited( FIND_STATS_STRING, i );
+
 	return svgame.edicts;
 }
 
@@ -1619,6 +2074,41 @@ int GAME_EXPORT pfnGetEntityIllum( edict_t* pEnt )
 	return SV_LightForEntity( pEnt );
 }
 
+/*
+=================
+SV_EntityInSphere
+
+=================
+*/
+static qboolean SV_EntityInSphere( edict_t *ent, int e, const float *org, float radiusSquared )
+{
+	float	distSquared;
+	float	eorg;
+	int	j;
+
+	if( !SV_IsValidEdict( ent ))
+		return false;
+
+	// ignore clients that not in a game
+	if( e <= svs.maxclients && !SV_ClientFromEdict( ent, true ))
+		return false;
+
+	distSquared = 0.0f;
+
+	for( j = 0; j < 3 && distSquared <= radiusSquared; j++ )
+	{
+		if( org[j] < ent->v.absmin[j] )
+			eorg = org[j] - ent->v.absmin[j];
+		else if( org[j] > ent->v.absmax[j] )
+			eorg = org[j] - ent->v.absmax[j];
+		else eorg = 0.0f;
+
+		distSquared += eorg * eorg;
+	}
+
+	return ( distSquared < radiusSquared );
+}
+
 /*
 =================
 pfnFindEntityInSphere
@@ -1628,44 +2118,42 @@ find the entity in sphere
 */
 edict_t *pfnFindEntityInSphere( edict_t *pStartEdict, const float *org, float flRadius )
 {
-	float	distSquared;
-	int	j, e = 0;
-	float	eorg;
-	edict_t	*ent;
+	float	radiusSquared;
+	int	*list, count;
+	int	i, e = 0, best;
 
-	flRadius *= flRadius;
+	radiusSquared = flRadius * flRadius;
 
 	if( SV_IsValidEdict( pStartEdict ))
 		e = NUM_FOR_EDICT( pStartEdict );
 
-	for( e++; e < svgame.numEntities; e++ )
+	if( sv_findindex.value >= 1.0f && ( list = SV_FindSphereCandidates( e, org, flRadius, &count )) != NULL )
 	{
-		ent = EDICT_NUM( e );
-
-		if( !SV_IsValidEdict( ent ))
-			continue;
+		// candidates are unordered, pick the lowest match to keep the iteration order
+		for( i = 0, best = svgame.numEntities; i < count; i++ )
+		{
+			if( list[i] < best && SV_EntityInSphere( EDICT_NUM( list[i] ), list[i], org, radiusSquared ))
+				best = list[i];
+		}
 
-		// ignore clients that not in a game
-		if( e <= svs.maxclients && !SV_ClientFromEdict( ent, true ))
-			continue;
+		SV_CountFindVisited( FIND_STATS_SPHERE, count );
 
-		distSquared = 0.0f;
+		if( best < svgame.numEntities )
+			return EDICT_NUM( best );
+		return svgame.edicts;
+	}
 
-		for( j = 0; j < 3 && distSquared <= flRadius; j++ )
+	for( i = 0, e++; e < svgame.numEntities; e++, i++ )
+	{
+		if( SV_EntityInSphere( EDICT_NUM( e ), e, org, radiusSquared ))
 		{
-			if( org[j] < ent->v.absmin[j] )
-				eorg = org[j] - ent->v.absmin[j];
-			else if( org[j] > ent->v.absmax[j] )
-				eorg = org[j] - ent->v.absmax[j];
-			else eorg = 0.0f;
-
-			distSquared += eorg * eorg;
+			SV_CountFindVisited( FIND_STATS_SPHERE, i + 1 );
+			return EDICT_NUM( e );
 		}
-
-		if( distSquared < flRadius )
-			return ent;
 	}
 
+	SV_CountFindVisited( FIND_STATS_SPHERE, i );
+
 	return svgame.edicts;
 }
 
@@ -3004,7 +3492,109 @@ static struct str64_s
 	size_t numdups;
 	size_t numoverflows;
 	size_t totalalloc;
+	uint *hashtable;	// offsets from pstringarray, zero marks an empty slot
+	uint hashsize;	// always power of two
+	uint hashcount;
+	size_t numlookups;
+	size_t numprobes;
 } str64;
+
+#define STR64_HASH_INITIAL	4096
+
+/*
+==================
+SV_Str64Hash
+
+case-sensitive FNV-1a, also returns string length
+==================
+*/
+static uint SV_Str64Hash( const char *s, uint *len )
+{
+	const byte *p = (const byte *)s;
+	uint hash = 2166136261u;
+
+	while( *p )
+		hash = ( hash ^ *p++ ) * 16777619u;
+
+	*len = p - (const byte *)s;
+
+	return hash;
+}
+
+/*
+==================
+SV_Str64ClearHash
+
+forget all indexed strings, called when dedup range is reset
+==================
+*/
+static void SV_Str64ClearHash( void )
+{
+	if( str64.hashtable )
+		memset( str64.hashtable, 0, str64.hashsize * sizeof( *str64.hashtable ));
+	str64.hashcount = 0;
+}
+
+/*
+==================
+SV_Str64GrowHash
+
+double the table and reinsert all strings
+==================
+*/
+static void SV_Str64GrowHash( void )
+{
+	uint *oldtable = str64.hashtable;
+	uint oldsize = str64.hashsize;
+	uint i, j, len;
+
+	str64.hashsize = oldsize ? oldsize * 2 : STR64_HASH_INITIAL;
+	str64.hashtable = Mem_Calloc( host.mempool, str64.hashsize * sizeof( *str64.hashtable ));
+
+	for( i = 0; i < oldsize; i++ )
+	{
+		if( !oldtable[i] )
+			continue;
+
+		j = SV_Str64Hash( str64.pstringarray + oldtable[i], &len ) & ( str64.hashsize - 1 );
+		while( str64.hashtable[j] )
+			j = ( j + 1 ) & ( str64.hashsize - 1 );
+		str64.hashtable[j] = oldtable[i];
+	}
+
+	if( oldtable )
+		Mem_Free( oldtable );
+}
+
+/*
+==================
+SV_Str64FindString
+
+returns string in dedup range [poldstringbase + 1, plast)
+or NULL and slot index where new string may be inserted
+==================
+*/
+static const char *SV_Str64FindString( const char *szValue, uint hash, uint *slot )
+{
+	uint i = hash & ( str64.hashsize - 1 );
+
+	str64.numlookups++;
+
+	while( str64.hashtable[i] )
+	{
+		const char *s = str64.pstringarray + str64.hashtable[i];
+
+		str64.numprobes++;
+
+		if( !Q_strcmp( s, szValue ))
+			return s;
+
+		i = ( i + 1 ) & ( str64.hashsize - 1 );
+	}
+
+	*slot = i;
+	return NULL;
+}
 #endif
 
 /*
@@ -3023,6 +3613,7 @@ void SV_EmptyStringPool( void )
 	{
 		str64.pstringbase = str64.poldstringbase = str64.pstringarraystatic;
 		str64.plast = str64.pstringbase + 1;
+		SV_Str64ClearHash();
 	}
 #else
 	Mem_EmptyPool( svgame.stringspool );
@@ -3142,6 +3733,9 @@ void SV_AllocStringPool( void )
 	str64.pstringbase = str64.poldstringbase = ptr;
 	str64.plast = (byte*)ptr + 1;
 	svgame.globals->pStringBase = ptr;
+
+	if( !str64.allowdup )
+		SV_Str64GrowHash();
 #else
 	svgame.stringspool = Mem_AllocPool( "Server Strings" );
 	svgame.globals->pStringBase = "";
@@ -3159,6 +3753,11 @@ void SV_FreeStringPool( void )
 	else
 #endif
 		Mem_Free( str64.staticstringarray );
+
+	if( str64.hashtable )
+		Mem_Free( str64.hashtable );
+	str64.hashtable = NULL;
+	str64.hashsize = str64.hashcount = 0;
 #else
 	Mem_FreePool( &svgame.stringspool );
 #endif
@@ -3177,28 +3776,34 @@ use -str64dup to disable deduplication, -str64alloc to set array size
 string_t GAME_EXPORT SV_AllocString( const char *szValue )
 {
 	const char *newString = NULL;
-	int cmp;
+#ifdef XASH_64BIT
+	uint hash = 0, len, slot = 0;
+#endif
 
 	if( svgame.physFuncs.pfnAllocString != NULL )
 		return svgame.physFuncs.pfnAllocString( szValue );
 
 #ifdef XASH_64BIT
-	cmp = 1;
+	if( !str64.allowdup )
+		hash = SV_Str64Hash( szValue, &len );
+	else len = Q_strlen( szValue );
 
 	if( !str64.allowdup )
-		for( newString = str64.poldstringbase + 1;
-			newString < str64.plast && ( cmp = Q_strcmp( newString, szValue ) );
-			newString += Q_strlen( newString ) + 1 );
+		newString = SV_Str64FindString( szValue, hash, &slot );
 
-	if( cmp )
+	if( !newString )
 	{
-		uint len = Q_strlen( szValue );
-
 		if( str64.plast - str64.poldstringbase + len + 2 > str64.maxstringarray )
 		{
 			str64.plast = str64.pstringbase + 1;
 			str64.poldstringbase = str64.pstringbase;
 			str64.numoverflows++;
+
+			if( !str64.allowdup )
+			{
+				SV_Str64ClearHash();
+				slot = hash & ( str64.hashsize - 1 );
+			}
 		}
 
 		//MsgDev( D_NOTE, "SV_AllocString: %ld %s\n", str64.plast - svgame.globals->pStringBase, szValue );
@@ -3207,6 +3812,15 @@ string_t GAME_EXPORT SV_AllocString( const char *szValue )
 
 		newString = str64.plast;
 		str64.plast += len + 1;
+
+		if( !str64.allowdup )
+		{
+			str64.hashtable[slot] = newString - str64.pstringarray;
+
+			// keep load factor below 1/2
+			if( ++str64.hashcount * 2 > str64.hashsize )
+				SV_Str64GrowHash();
+		}
 	}
 	else
 		str64.numdups++;
@@ -3233,6 +3847,20 @@ void SV_PrintStr64Stats_f( void )
 	Msg( "maximum array usage: %lu\n", str64.maxalloc );
 	Msg( "overflow counter: %lu\n", str64.numoverflows );
 	Msg( "dup string counter: %lu\n", str64.numdups );
+
+	if( str64.allowdup )
+		return;
+
+	Msg( "hash table: %u of %u slots used\n", str64.hashcount, str64.hashsize );
+	if( str64.numlookups )
+	{
+		size_t misses = str64.numlookups - str64.numdups;
+
+		Msg( "lookups: %lu, hits %lu (%.1f%%), misses %lu (%.1f%%)\n", str64.numlookups,
+			str64.numdups, str64.numdups * 100.0 / str64.numlookups,
+			misses, misses * 100.0 / str64.numlookups );
+		Msg( "average probes per lookup: %.2f\n", (double)str64.numprobes / str64.numlookups );
+	}
 }
 #endif
 
@@ -4055,7 +4683,10 @@ void GAME_EXPORT SV_PlaybackEventFull( int flags, const edict_t *pInvoker, word
 	// process all the clients
 	for( slot = 0, cl = svs.clients; slot < svs.maxclients; slot++, cl++ )
 	{
-		if( cl->state != cs_spawned || !cl->edict || FBitSet( cl->flags, FCL_FAKECLIENT ))
+		if( cl->state != cs_spawned || !cl->edict )
+			continue;
+
+		if( FBitSet( cl->flags, FCL_FAKECLIENT ) && ( !FBitSet( cl->flags, FCL_BENCHMARK ) || FBitSet( flags, FEV_RELIABLE )))
 			continue;
 
 		if( SV_IsValidEdict( pInvoker ) && pInvoker->v.groupinfo && cl->edict->v.groupinfo )
@@ -4242,7 +4873,7 @@ pfnCheckVisibility
 */
 int GAME_EXPORT pfnCheckVisibility( const edict_t *ent, byte *pset )
 {
-	int	i, leafnum;
+	int	i, leafnum, numleafs;
 
 	if( !SV_IsValidEdict( ent ))
 		return 0;
@@ -4266,6 +4897,20 @@ int GAME_EXPORT pfnCheckVisibility( const edict_t *ent, byte *pset )
 	}
 	else
 	{
+		const int	*leafs = SV_EntityLeafs( ent, &numleafs );
+
+		if( leafs )
+		{
+			// full list was kept aside, no need to guess by headnode
+			for( i = 0; i < numleafs; i++ )
+			{
+				if( CHECKVISBIT( pset, leafs[i] ))
+					return 1;
+			}
+
+			return 0;
+		}
+
 		for( i = 0; i < MAX_ENT_LEAFS; i++ )
 		{
 			leafnum = ent->leafnums[i];
@@ -4940,6 +5585,7 @@ void SV_LoadFromFile( const char *mapname, char *entities )
 					inhibited++;
 				}
 			}
+			else SV_UpdateFindIndex( ent );
 		}
 
 		Con_DPrintf( "\n%i entities inhibited\n", inhibited );
@@ -4948,6 +5594,9 @@ void SV_LoadFromFile( const char *mapname, char *entities )
 	// reset world origin and angles for some reason
 	VectorClear( svgame.edicts->v.origin );
 	VectorClear( svgame.edicts->v.angles );
+
+	// custom loaders don't tell us what was spawned
+	SV_RefreshFindIndex();
 }
 
 /*
@@ -520,6 +520,7 @@ void SV_ActivateServer( int runPhysics )
 	byte		msg_buf[MAX_INIT_MSG];
 	sizebuf_t		msg;
 	sv_client_t	*cl;
+	fs_stats_t	fsstats;
 
 	if( !svs.initialized )
 		return;
@@ -577,6 +578,7 @@ void SV_ActivateServer( int runPhysics )
 
 	// invoke to refresh all movevars
 	memset( &svgame.oldmovevars, 0, sizeof( movevars_t ));
+	SV_ClearUnlagHistory();
 	svgame.globals->changelevel = false;
 
 	// setup hostflags
@@ -600,6 +602,11 @@ void SV_ActivateServer( int runPhysics )
 
 	Con_DPrintf( "level loaded at %.2f sec\n", Sys_DoubleTime() - svs.timestart );
 
+	FS_GetStats( &fsstats );
+	Con_DPrintf( "%i file lookups in %.2f ms, %s read in %.2f ms, %s mapped\n", fsstats.lookups,
+		fsstats.lookuptime * 1000.0, Q_memprint( fsstats.readbytes ), fsstats.readtime * 1000.0,
+		Q_memprint( fsstats.mappedbytes ));
+
 	if( sv.ignored_static_ents )
 		Con_Printf( S_WARN "%i static entities was rejected due buffer overflow\n", sv.ignored_static_ents );
 
@@ -756,6 +763,7 @@ void SV_SetupClients( void )
 	SV_UPDATE_BACKUP = ( svs.maxclients == 1 ) ? SINGLEPLAYER_BACKUP : MULTIPLAYER_BACKUP;
 #endif
 
+	// Host_ShutdownServer above has freed old slots with their payloads
 	svs.clients = Z_Realloc( svs.clients, sizeof( sv_client_t ) * svs.maxclients );
 	svs.num_client_entities = svs.maxclients * SV_UPDATE_BACKUP * NUM_PACKET_ENTITIES;
 	svs.packet_entities = Z_Realloc( svs.packet_entities, sizeof( entity_state_t ) * svs.num_client_entities );
@@ -867,6 +875,7 @@ qboolean SV_SpawnServer( const char *mapname, const char *startspot, qboolean ba
 	Log_PrintServerVars();
 
 	svs.timestart = Sys_DoubleTime();
+	FS_ResetStats();
 	svs.spawncount++; // any partially connected client will be restarted
 
 	// let's not have any servers with no name
@@ -39,6 +39,15 @@ CVAR_DEFINE_AUTO( sv_maxrate, "50000", FCVAR_SERVER, "max bandwidth rate allowed
 CVAR_DEFINE_AUTO( sv_logrelay, "0", FCVAR_ARCHIVE, "allow log messages from remote machines to be logged on this server" );
 CVAR_DEFINE_AUTO( sv_newunit, "0", 0, "clear level-saves from previous SP game chapter to help keep .sav file size as minimum" );
 CVAR_DEFINE_AUTO( sv_clienttrace, "1", FCVAR_SERVER, "0 = big box(Quake), 0.5 = halfsize, 1 = normal (100%), otherwise it's a scaling factor" );
+CVAR_DEFINE_AUTO( sv_threads, "0", FCVAR_ARCHIVE, "number of threads used to encode client datagrams, 0 or 1 builds them on the main thread" );
+CVAR_DEFINE_AUTO( sv_physics_threads, "0", FCVAR_ARCHIVE, "number of threads that trace lone movers ahead of entity physics, 0 disables it" );
+CVAR_DEFINE_AUTO( sv_physics_verify, "0", 0, "redo prefetched traces and physents on the main thread and report any difference" );
+CVAR_DEFINE_AUTO( sv_pmove_threads, "0", FCVAR_ARCHIVE, "number of threads that collect physents of all players before usercmds are read, 0 disables it" );
+CVAR_DEFINE_AUTO( sv_world_maxdepth, "10", FCVAR_ARCHIVE, "how deep crowded areas of entity tree are split, 4 keeps it uniform" );
+CVAR_DEFINE_AUTO( sv_world_leafsize, "8", FCVAR_ARCHIVE, "split entity tree leaf when it holds more solid entities than this" );
+CVAR_DEFINE_AUTO( sv_profile, "0", 0, "record server frame timings, print a summary every N seconds if above zero" );
+CVAR_DEFINE_AUTO( sv_netthread, "0", FCVAR_ARCHIVE, "receive packets and answer server queries on a separate thread" );
+CVAR_DEFINE_AUTO( sv_findindex, "1", 0, "entity search acceleration: 0 - linear scan, 1 - spatial grid for FindEntityInSphere, 2 - also hash lookups by classname, targetname and globalname" );
 CVAR_DEFINE_AUTO( sv_timeout, "65", 0, "after this many seconds without a message from a client, the client is dropped" );
 CVAR_DEFINE_AUTO( sv_failuretime, "0.5", 0, "after this long without a packet from client, don't send any more until client starts sending again" );
 CVAR_DEFINE_AUTO( sv_password, "", FCVAR_SERVER|FCVAR_PROTECTED, "server password for entry into multiplayer games" );
@@ -355,6 +364,16 @@ void SV_ReadPackets( void )
 	int		i, qport;
 	size_t		curSize;
 
+	if( sv_netthread.value && !NET_RecvThreadActive( NS_SERVER ))
+		NET_StartRecvThread( NS_SERVER, SV_ThreadQuery );
+	else if( !sv_netthread.value && NET_RecvThreadActive( NS_SERVER ))
+		NET_StopRecvThread();
+
+	if( NET_RecvThreadActive( NS_SERVER ))
+		SV_UpdateQueryAnswers();
+
+	SV_PrefetchPmove();
+
 	while( NET_GetPacket( NS_SERVER, &net_from, net_message_buffer, &curSize ))
 	{
 		MSG_Init( &net_message, "ClientPacket", net_message_buffer, curSize );
@@ -451,6 +470,7 @@ void SV_ReadPackets( void )
 			continue;
 	}
 
+	SV_FinishPmovePrefetch();
 	sv.current_client = NULL;
 }
 
@@ -613,9 +633,14 @@ Host_ServerFrame
 */
 void Host_ServerFrame( void )
 {
+	qboolean	simulated;
+
 	// if server is not active, do nothing
 	if( !svs.initialized ) return;
 
+	SV_ProfileFrame();
+	SV_PROFILE_BEGIN( PROF_SERVERFRAME );
+
 	if( sv_fps.value != 0.0f && ( sv.simulating || sv.state != ss_active ))
 		sv.time_residual += host.frametime;
 
@@ -627,7 +652,9 @@ void Host_ServerFrame( void )
 	SV_CheckCmdTimes ();
 
 	// read packets from clients
+	SV_PROFILE_BEGIN( PROF_READPACKETS );
 	SV_ReadPackets ();
+	SV_PROFILE_END();
 
 	// refresh physic movevars on the client side
 	SV_UpdateMovevars ( false );
@@ -639,16 +666,25 @@ void Host_ServerFrame( void )
 	SV_CheckTimeouts ();
 
 	// let everything in the world think and move
-	if( !SV_RunGameFrame ()) return;
+	SV_PROFILE_BEGIN( PROF_RUNGAMEFRAME );
+	simulated = SV_RunGameFrame ();
+	SV_PROFILE_END();
 
-	// send messages back to the clients that had packets read this frame
-	SV_SendClientMessages ();
+	if( simulated )
+	{
+		// send messages back to the clients that had packets read this frame
+		SV_PROFILE_BEGIN( PROF_SENDCLIENTMESSAGES );
+		SV_SendClientMessages ();
+		SV_PROFILE_END();
+
+		// clear edict flags for next frame
+		SV_PrepWorldFrame ();
 
-	// clear edict flags for next frame
-	SV_PrepWorldFrame ();
+		// send a heartbeat to the master if needed
+		Master_Heartbeat ();
+	}
 
-	// send a heartbeat to the master if needed
-	Master_Heartbeat ();
+	SV_PROFILE_END();
 }
 
 /*
@@ -889,6 +925,15 @@ void SV_Init( void )
 	sv_pausable = Cvar_Get( "pausable", "1", FCVAR_SERVER, "allow players to pause or not" );
 	sv_validate_changelevel = Cvar_Get( "sv_validate_changelevel", "0", 0, "test change level for level-designer errors" );
 	Cvar_RegisterVariable( &sv_clienttrace );
+	Cvar_RegisterVariable( &sv_findindex );
+	Cvar_RegisterVariable( &sv_threads );
+	Cvar_RegisterVariable( &sv_physics_threads );
+	Cvar_RegisterVariable( &sv_physics_verify );
+	Cvar_RegisterVariable( &sv_pmove_threads );
+	Cvar_RegisterVariable( &sv_netthread );
+	Cvar_RegisterVariable( &sv_profile );
+	Cvar_RegisterVariable( &sv_world_maxdepth );
+	Cvar_RegisterVariable( &sv_world_leafsize );
 	Cvar_RegisterVariable( &sv_bounce );
 	Cvar_RegisterVariable( &sv_spectatormaxspeed );
 	Cvar_RegisterVariable( &sv_waterfriction );
@@ -958,6 +1003,7 @@ void SV_Init( void )
 	Cvar_FullSet( "sv_version", versionString, FCVAR_READ_ONLY );
 
 	SV_InitFilter();
+	SV_InitProfiler();
 	SV_ClearGameState ();	// delete all temporary *.hl files
 }
 
@@ -1025,6 +1071,10 @@ void SV_FreeClients( void )
 		// free server static data
 		if( svs.clients )
 		{
+			int	i;
+
+			for( i = 0; i < svs.maxclients; i++ )
+				SV_FreePayloads( &svs.clients[i].datagram );
 			Z_Free( svs.clients );
 			svs.clients = NULL;
 		}
@@ -1037,6 +1087,10 @@ void SV_FreeClients( void )
 			svs.next_client_entities = 0;
 		}
 	}
+
+	// payloads of all clients are released by now
+	SV_FreeDatagramJobs();
+	SV_FreePayloadCache();
 }
 
 /*
@@ -19,6 +19,7 @@ GNU General Public License for more details.
 #include "library.h"
 #include "triangleapi.h"
 #include "ref_common.h"
+#include "threads.h"
 
 typedef int (*PHYSICAPI)( int, server_physics_api_t*, physics_interface_t* );
 #if !XASH_DEDICATED
@@ -53,6 +54,8 @@ static const vec3_t current_table[] =
 { 0,  0, -1}
 };
 
+static qboolean SV_PrefetchedMove( edict_t *ent, const vec3_t end, int type, qboolean monsterclip, trace_t *trace );
+
 /*
 ===============================================================================
 
@@ -209,7 +212,9 @@ qboolean SV_RunThink( edict_t *ent )
 						// by a trigger with a local time.
 		ent->v.nextthink = 0.0f;
 		svgame.globals->time = thinktime;
+		SV_PROFILE_BEGIN( PROF_GAME_THINK );
 		svgame.dllFuncs.pfnThink( ent );
+		SV_PROFILE_END();
 	}
 
 	if( FBitSet( ent->v.flags, FL_KILLME ))
@@ -248,7 +253,9 @@ qboolean SV_PlayerRunThink( edict_t *ent, float frametime, double time )
 
 		ent->v.nextthink = 0.0f;
 		svgame.globals->time = thinktime;
+		SV_PROFILE_BEGIN( PROF_GAME_THINK );
 		svgame.dllFuncs.pfnThink( ent );
+		SV_PROFILE_END();
 	}
 
 	if( FBitSet( ent->v.flags, FL_KILLME ))
@@ -283,13 +290,17 @@ void SV_Impact( edict_t *e1, edict_t *e2, trace_t *trace )
 	if( e1->v.solid != SOLID_NOT )
 	{
 		SV_CopyTraceToGlobal( trace );
+		SV_PROFILE_BEGIN( PROF_GAME_TOUCH );
 		svgame.dllFuncs.pfnTouch( e1, e2 );
+		SV_PROFILE_END();
 	}
 
 	if( e2->v.solid != SOLID_NOT )
 	{
 		SV_CopyTraceToGlobal( trace );
+		SV_PROFILE_BEGIN( PROF_GAME_TOUCH );
 		svgame.dllFuncs.pfnTouch( e2, e1 );
+		SV_PROFILE_END();
 	}
 }
 
@@ -581,7 +592,9 @@ int SV_FlyMove( edict_t *ent, float time, trace_t *steptrace )
 			break;
 
 		VectorMA( ent->v.origin, time_left, ent->v.velocity, end );
-		trace = SV_Move( ent->v.origin, ent->v.mins, ent->v.maxs, end, MOVE_NORMAL, ent, monsterClip );
+
+		if( bumpcount || !SV_PrefetchedMove( ent, end, MOVE_NORMAL, monsterClip, &trace ))
+			trace = SV_Move( ent->v.origin, ent->v.mins, ent->v.maxs, end, MOVE_NORMAL, ent, monsterClip );
 
 		allFraction += trace.fraction;
 
@@ -773,6 +786,23 @@ qboolean SV_AllowPushRotate( edict_t *ent )
 	return false;
 }
 
+/*
+============
+SV_PushMoveType
+
+============
+*/
+static int SV_PushMoveType( edict_t *ent )
+{
+	if( ent->v.movetype == MOVETYPE_FLYMISSILE )
+		return MOVE_MISSILE;
+
+	if( ent->v.solid == SOLID_TRIGGER || ent->v.solid == SOLID_NOT )
+		return MOVE_NOMONSTERS; // only clip against bmodels
+
+	return MOVE_NORMAL;
+}
+
 /*
 ============
 SV_PushEntity
@@ -790,14 +820,10 @@ trace_t SV_PushEntity( edict_t *ent, const vec3_t lpush, const vec3_t apush, int
 
 	monsterClip = FBitSet( ent->v.flags, FL_MONSTERCLIP ) ? true : false;
 	VectorAdd( ent->v.origin, lpush, end );
+	type = SV_PushMoveType( ent );
 
-	if( ent->v.movetype == MOVETYPE_FLYMISSILE )
-		type = MOVE_MISSILE;
-	else if( ent->v.solid == SOLID_TRIGGER || ent->v.solid == SOLID_NOT )
-		type = MOVE_NOMONSTERS; // only clip against bmodels
-	else type = MOVE_NORMAL;
-
-	trace = SV_Move( ent->v.origin, ent->v.mins, ent->v.maxs, end, type, ent, monsterClip );
+	if( !SV_PrefetchedMove( ent, end, type, monsterClip, &trace ))
+		trace = SV_Move( ent->v.origin, ent->v.mins, ent->v.maxs, end, type, ent, monsterClip );
 
 	if( trace.fraction != 0.0f )
 	{
@@ -1191,7 +1217,12 @@ void SV_Physics_Pusher( edict_t *ent )
 
 	// if the pusher has a "blocked" function, call it
 	// otherwise, just stay in place until the obstacle is gone
-	if( pBlocker ) svgame.dllFuncs.pfnBlocked( ent, pBlocker );
+	if( pBlocker )
+	{
+		SV_PROFILE_BEGIN( PROF_GAME_BLOCKED );
+		svgame.dllFuncs.pfnBlocked( ent, pBlocker );
+		SV_PROFILE_END();
+	}
 
 	for( i = 0; i < 3; i++ )
 	{
@@ -1203,7 +1234,9 @@ void SV_Physics_Pusher( edict_t *ent )
 	{
 		ent->v.nextthink = 0.0f;
 		svgame.globals->time = sv.time;
+		SV_PROFILE_BEGIN( PROF_GAME_THINK );
 		svgame.dllFuncs.pfnThink( ent );
+		SV_PROFILE_END();
 	}
 }
 
@@ -1706,12 +1739,634 @@ void SV_Physics_None( edict_t *ent )
 	SV_RunThink( ent );
 }
 
+/*
+===============================================================================
+
+TRACE PREFETCH
+
+Entity physics itself is serial, every think, touch and move runs in
+edict order. Only some traces are done ahead of it by jobs: movers
+whose swept boxes overlap, or that ride or follow each other, are put
+in one contact group, and a toss mover alone in its group can only be
+disturbed by the game code, so its SV_PushEntity trace is predicted
+and prefetched, same for the first SV_FlyMove trace of a falling step
+mover. Monsters walk in their Think through pfnWalkMove, that is game
+code and isn't prefetched. The serial pass takes a prefetched trace only
+if SV_MoveCached proves that SV_Move would return the same one
+
+===============================================================================
+*/
+typedef struct
+{
+	edict_t		*ent;
+	vec3_t		mins;		// swept box
+	vec3_t		maxs;
+	int		parent;		// union-find link
+	int		size;		// movers in group, valid for roots
+} sv_mover_t;
+
+static struct
+{
+	sv_mover_t	*movers;
+	int		*sorted;
+	int		*index;		// edict number -> mover + 1
+	int		*cachenum;	// edict number -> cache entry + 1
+	int		maxedicts;
+	int		nummovers;
+
+	sv_movecache_t	*cache;
+	int		maxcache;
+	int		numcache;
+
+	// totals since the last sv_physics_stats
+	int		frames;
+	int		summovers;
+	int		sumgroups;
+	int		prefetched;
+	int		used;
+	int		invalidated;
+	int		mismatches;
+} sv_prefetch;
+
+/*
+=============
+SV_GroupRoot
+
+=============
+*/
+static int SV_GroupRoot( int i )
+{
+	sv_mover_t	*movers = sv_prefetch.movers;
+
+	while( movers[i].parent != i )
+	{
+		movers[i].parent = movers[movers[i].parent].parent;
+		i = movers[i].parent;
+	}
+
+	return i;
+}
+
+/*
+=============
+SV_GroupMerge
+
+=============
+*/
+static void SV_GroupMerge( int a, int b )
+{
+	sv_mover_t	*movers = sv_prefetch.movers;
+
+	a = SV_GroupRoot( a );
+	b = SV_GroupRoot( b );
+
+	if( a == b )
+		return;
+
+	if( movers[a].size < movers[b].size )
+	{
+		int	temp = a;
+		a = b;
+		b = temp;
+	}
+
+	movers[b].parent = a;
+	movers[a].size += movers[b].size;
+}
+
+static int SV_CompareMovers( const void *a, const void *b )
+{
+	float	fa = sv_prefetch.movers[*(const int *)a].mins[0];
+	float	fb = sv_prefetch.movers[*(const int *)b].mins[0];
+
+	return ( fa > fb ) - ( fa < fb );
+}
+
+/*
+=============
+SV_SweptBox
+
+where entity could get to during this frame, rough guess
+is fine, it only decides which traces are worth prefetching.
+Returns false for entities that don't move in SV_Physics
+=============
+*/
+static qboolean SV_SweptBox( edict_t *ent, vec3_t mins, vec3_t maxs )
+{
+	float	radius, move;
+	int	i;
+
+	switch( ent->v.movetype )
+	{
+	case MOVETYPE_NONE:
+	case MOVETYPE_WALK:
+		return false;
+	case MOVETYPE_FLY:
+	case MOVETYPE_TOSS:
+	case MOVETYPE_BOUNCE:
+	case MOVETYPE_FLYMISSILE:
+	case MOVETYPE_BOUNCEMISSILE:
+	case MOVETYPE_STEP:
+	case MOVETYPE_PUSHSTEP:
+		if( FBitSet( ent->v.flags, FL_ONGROUND ) && VectorIsNull( ent->v.velocity ) && VectorIsNull( ent->v.basevelocity ))
+		{
+			if( ent->v.nextthink <= 0.0f || ent->v.nextthink > sv.time + sv.frametime )
+				return false; // at rest
+		}
+		break;
+	}
+
+	if( ent->v.movetype == MOVETYPE_PUSH && !VectorIsNull( ent->v.avelocity ))
+	{
+		// rotating pusher may sweep all around its origin
+		radius = RadiusFromBounds( ent->v.mins, ent->v.maxs );
+
+		for( i = 0; i < 3; i++ )
+		{
+			mins[i] = ent->v.origin[i] - radius;
+			maxs[i] = ent->v.origin[i] + radius;
+		}
+	}
+	else
+	{
+		VectorCopy( ent->v.absmin, mins );
+		VectorCopy( ent->v.absmax, maxs );
+	}
+
+	for( i = 0; i < 3; i++ )
+	{
+		move = ( fabs( ent->v.velocity[i] ) + fabs( ent->v.basevelocity[i] )) * sv.frametime;
+
+		if( i == 2 )
+			move += fabs( sv_gravity.value ) * sv.frametime * sv.frametime;
+
+		mins[i] -= move + 1.0f;
+		maxs[i] += move + 1.0f;
+	}
+
+	return true;
+}
+
+/*
+=============
+SV_PredictVelocity
+
+SV_CheckVelocity without the messages, false if it would fix a nan
+=============
+*/
+static qboolean SV_PredictVelocity( const vec3_t origin, vec3_t velocity )
+{
+	float	wishspd;
+	float	maxspd;
+	int	i;
+
+	for( i = 0; i < 3; i++ )
+	{
+		if( IS_NAN( velocity[i] ) || IS_NAN( origin[i] ))
+			return false;
+	}
+
+	wishspd = DotProduct( velocity, velocity );
+	maxspd = sv_maxvelocity.value * sv_maxvelocity.value * 1.73f; // half-diagonal
+
+	if( wishspd > maxspd )
+	{
+		wishspd = sqrt( wishspd );
+		wishspd = sv_maxvelocity.value / wishspd;
+		VectorScale( velocity, wishspd, velocity );
+	}
+
+	return true;
+}
+
+/*
+=============
+SV_PredictMomentum
+
+SV_Physics_Entity part of the move
+=============
+*/
+static void SV_PredictMomentum( edict_t *ent, vec3_t velocity, vec3_t basevelocity )
+{
+	VectorCopy( ent->v.velocity, velocity );
+	VectorCopy( ent->v.basevelocity, basevelocity );
+
+	if( !FBitSet( ent->v.flags, FL_BASEVELOCITY ) && !VectorIsNull( basevelocity ))
+	{
+		VectorMA( velocity, 1.0f + (sv.frametime * 0.5f), basevelocity, velocity );
+		VectorClear( basevelocity );
+	}
+}
+
+/*
+=============
+SV_PredictGravity
+
+SV_AddGravity
+=============
+*/
+static qboolean SV_PredictGravity( edict_t *ent, vec3_t velocity, vec3_t basevelocity )
+{
+	float	ent_gravity;
+
+	if( ent->v.gravity )
+		ent_gravity = ent->v.gravity;
+	else ent_gravity = 1.0f;
+
+	velocity[2] -= ( ent_gravity * sv_gravity.value * sv.frametime );
+	velocity[2] += ( basevelocity[2] * sv.frametime );
+	basevelocity[2] = 0.0f;
+
+	return SV_PredictVelocity( ent->v.origin, velocity );
+}
+
+/*
+=============
+SV_PredictToss
+
+where SV_Physics_Toss is going to push the entity, if it
+doesn't think and nobody touches it first. Water currents
+aren't accounted for, SV_MoveCached rejects such guesses
+=============
+*/
+static qboolean SV_PredictToss( edict_t *ent, vec3_t end )
+{
+	vec3_t	velocity, basevelocity;
+	vec3_t	move;
+
+	SV_PredictMomentum( ent, velocity, basevelocity );
+
+	// SV_Physics_Toss
+	if( !SV_PredictVelocity( ent->v.origin, velocity ))
+		return false;
+
+	switch( ent->v.movetype )
+	{
+	case MOVETYPE_FLY:
+	case MOVETYPE_FLYMISSILE:
+	case MOVETYPE_BOUNCEMISSILE:
+		break;
+	default:
+		if( !SV_PredictGravity( ent, velocity, basevelocity ))
+			return false;
+		break;
+	}
+
+	VectorAdd( velocity, basevelocity, velocity );
+
+	if( !SV_PredictVelocity( ent->v.origin, velocity ))
+		return false;
+
+	VectorScale( velocity, sv.frametime, move );
+	VectorAdd( ent->v.origin, move, end );
+
+	return true;
+}
+
+/*
+=============
+SV_PredictStep
+
+where the first SV_FlyMove trace of SV_Physics_Step is going to,
+for step movers in the air. Walking on the ground isn't predicted,
+the friction there depends on SV_CheckBottom. Water is guessed from
+the last frame, SV_MoveCached rejects the wrong guesses
+=============
+*/
+static qboolean SV_PredictStep( edict_t *ent, vec3_t end )
+{
+	vec3_t	velocity, basevelocity;
+
+	if( FBitSet( ent->v.flags, FL_FLOAT ) && ent->v.waterlevel > 0 )
+		return false; // buoyancy
+
+	if( SV_CheckMover( ent ))
+		return false; // friction
+
+	SV_PredictMomentum( ent, velocity, basevelocity );
+
+	if( !SV_PredictVelocity( ent->v.origin, velocity ))
+		return false;
+
+	if( !FBitSet( ent->v.flags, FL_FLY ) && ( !FBitSet( ent->v.flags, FL_SWIM ) || ent->v.waterlevel <= 0 ))
+	{
+		if( ent->v.waterlevel <= 1 && !SV_PredictGravity( ent, velocity, basevelocity ))
+			return false;
+	}
+
+	VectorAdd( velocity, basevelocity, velocity );
+
+	if( !SV_PredictVelocity( ent->v.origin, velocity ) || VectorIsNull( velocity ))
+		return false;
+
+	VectorMA( ent->v.origin, sv.frametime, velocity, end );
+
+	return true;
+}
+
+/*
+=============
+SV_CanPrefetch
+
+lone mover that will leave its next trace to SV_Physics_Toss
+or SV_Physics_Step
+=============
+*/
+static qboolean SV_CanPrefetch( edict_t *ent )
+{
+	switch( ent->v.movetype )
+	{
+	case MOVETYPE_FLY:
+	case MOVETYPE_TOSS:
+	case MOVETYPE_BOUNCE:
+	case MOVETYPE_FLYMISSILE:
+	case MOVETYPE_BOUNCEMISSILE:
+	case MOVETYPE_STEP:
+	case MOVETYPE_PUSHSTEP:
+		break;
+	default:
+		return false;
+	}
+
+	if( FBitSet( ent->v.flags, FL_ONGROUND|FL_KILLME|FL_CLIENT|FL_FAKECLIENT ))
+		return false;
+
+	// think may change everything
+	if( ent->v.nextthink > 0.0f && ent->v.nextthink <= sv.time + sv.frametime )
+		return false;
+
+	return true;
+}
+
+static void SV_PrefetchJob( void *data, int index )
+{
+	SV_MovePrefetch( &sv_prefetch.cache[index] );
+}
+
+/*
+=============
+SV_ClearPrefetch
+
+=============
+*/
+static void SV_ClearPrefetch( void )
+{
+	// edicts may be gone already, so don't look them up
+	if( sv_prefetch.nummovers )
+		memset( sv_prefetch.index, 0, sv_prefetch.maxedicts * sizeof( int ));
+
+	if( sv_prefetch.numcache )
+		memset( sv_prefetch.cachenum, 0, sv_prefetch.maxedicts * sizeof( int ));
+
+	sv_prefetch.nummovers = sv_prefetch.numcache = 0;
+}
+
+/*
+=============
+SV_PrefetchTraces
+
+=============
+*/
+static void SV_PrefetchTraces( void )
+{
+	sv_mover_t	*movers;
+	int		i, j, numgroups;
+	edict_t		*ent;
+
+	// Host_Error could skip the last clear
+	SV_ClearPrefetch ();
+
+	if( sv_physics_threads.value < 1.0f )
+		return;
+
+	// game overrides physics or collision, keep it all serial
+	if( svgame.physFuncs.SV_PhysicsEntity || svgame.dllFuncs2.pfnShouldCollide )
+		return;
+
+	if( svgame.physFuncs.ClipMoveToEntity || svgame.physFuncs.SV_HullForBsp )
+		return;
+
+	// every edict is going to touch triggers anyway
+	if( svgame.globals->force_retouch != 0.0f )
+		return;
+
+	if( sv_prefetch.maxedicts < GI->max_edicts )
+	{
+		sv_prefetch.maxedicts = GI->max_edicts;
+		sv_prefetch.movers = Mem_Realloc( host.mempool, sv_prefetch.movers, sv_prefetch.maxedicts * sizeof( sv_mover_t ));
+		sv_prefetch.sorted = Mem_Realloc( host.mempool, sv_prefetch.sorted, sv_prefetch.maxedicts * sizeof( int ));
+		sv_prefetch.index = Mem_Realloc( host.mempool, sv_prefetch.index, sv_prefetch.maxedicts * sizeof( int ));
+		sv_prefetch.cachenum = Mem_Realloc( host.mempool, sv_prefetch.cachenum, sv_prefetch.maxedicts * sizeof( int ));
+		memset( sv_prefetch.index, 0, sv_prefetch.maxedicts * sizeof( int ));
+		memset( sv_prefetch.cachenum, 0, sv_prefetch.maxedicts * sizeof( int ));
+	}
+
+	movers = sv_prefetch.movers;
+
+	for( i = svs.maxclients + 1; i < svgame.numEntities; i++ )
+	{
+		sv_mover_t	*m = &movers[sv_prefetch.nummovers];
+
+		ent = EDICT_NUM( i );
+
+		if( !SV_IsValidEdict( ent ) || !SV_SweptBox( ent, m->mins, m->maxs ))
+			continue;
+
+		m->ent = ent;
+		m->parent = sv_prefetch.nummovers;
+		m->size = 1;
+		sv_prefetch.sorted[sv_prefetch.nummovers] = sv_prefetch.nummovers;
+		sv_prefetch.index[i] = ++sv_prefetch.nummovers;
+	}
+
+	// riders, followers and overlapping boxes share the group
+	for( i = 0; i < sv_prefetch.nummovers; i++ )
+	{
+		ent = movers[i].ent;
+
+		if( SV_IsValidEdict( ent->v.groundentity ) && sv_prefetch.index[NUM_FOR_EDICT( ent->v.groundentity )] )
+			SV_GroupMerge( i, sv_prefetch.index[NUM_FOR_EDICT( ent->v.groundentity )] - 1 );
+
+		if( SV_IsValidEdict( ent->v.aiment ) && sv_prefetch.index[NUM_FOR_EDICT( ent->v.aiment )] )
+			SV_GroupMerge( i, sv_prefetch.index[NUM_FOR_EDICT( ent->v.aiment )] - 1 );
+	}
+
+	qsort( sv_prefetch.sorted, sv_prefetch.nummovers, sizeof( int ), SV_CompareMovers );
+
+	for( i = 0; i < sv_prefetch.nummovers; i++ )
+	{
+		sv_mover_t	*a = &movers[sv_prefetch.sorted[i]];
+
+		for( j = i + 1; j < sv_prefetch.nummovers; j++ )
+		{
+			sv_mover_t	*b = &movers[sv_prefetch.sorted[j]];
+
+			if( b->mins[0] > a->maxs[0] )
+				break;
+
+			if( BoundsIntersect( a->mins, a->maxs, b->mins, b->maxs ))
+				SV_GroupMerge( sv_prefetch.sorted[i], sv_prefetch.sorted[j] );
+		}
+	}
+
+	for( i = numgroups = 0; i < sv_prefetch.nummovers; i++ )
+	{
+		sv_movecache_t	*mc;
+
+		if( SV_GroupRoot( i ) != i )
+			continue;
+
+		numgroups++;
+		ent = movers[i].ent;
+
+		if( movers[i].size != 1 || !SV_CanPrefetch( ent ))
+			continue;
+
+		if( sv_prefetch.numcache == sv_prefetch.maxcache )
+		{
+			sv_prefetch.maxcache = Q_max( 64, sv_prefetch.maxcache * 2 );
+			sv_prefetch.cache = Mem_Realloc( host.mempool, sv_prefetch.cache, sv_prefetch.maxcache * sizeof( sv_movecache_t ));
+		}
+
+		mc = &sv_prefetch.cache[sv_prefetch.numcache];
+
+		if( ent->v.movetype == MOVETYPE_STEP || ent->v.movetype == MOVETYPE_PUSHSTEP )
+		{
+			if( !SV_PredictStep( ent, mc->end ))
+				continue;
+			mc->type = MOVE_NORMAL;
+		}
+		else
+		{
+			if( !SV_PredictToss( ent, mc->end ))
+				continue;
+			mc->type = SV_PushMoveType( ent );
+		}
+
+		VectorCopy( ent->v.origin, mc->start );
+		VectorCopy( ent->v.mins, mc->mins );
+		VectorCopy( ent->v.maxs, mc->maxs );
+		mc->passedict = ent;
+		mc->monsterclip = FBitSet( ent->v.flags, FL_MONSTERCLIP ) ? true : false;
+		sv_prefetch.cachenum[NUM_FOR_EDICT( ent )] = ++sv_prefetch.numcache;
+	}
+
+	Jobs_Run( SV_PrefetchJob, NULL, sv_prefetch.numcache, sv_physics_threads.value );
+
+	for( i = 0; i < sv_prefetch.numcache; i++ )
+	{
+		if( sv_prefetch.cache[i].valid )
+			sv_prefetch.prefetched++;
+	}
+
+	sv_prefetch.frames++;
+	sv_prefetch.summovers += sv_prefetch.nummovers;
+	sv_prefetch.sumgroups += numgroups;
+}
+
+/*
+=============
+SV_TracesEqual
+
+=============
+*/
+static qboolean SV_TracesEqual( const trace_t *a, const trace_t *b )
+{
+	if( a->allsolid != b->allsolid || a->startsolid != b->startsolid || a->inopen != b->inopen || a->inwater != b->inwater )
+		return false;
+
+	if( a->fraction != b->fraction || !VectorCompare( a->endpos, b->endpos ))
+		return false;
+
+	if( a->plane.dist != b->plane.dist || !VectorCompare( a->plane.normal, b->plane.normal ))
+		return false;
+
+	return a->ent == b->ent && a->hitgroup == b->hitgroup;
+}
+
+/*
+=============
+SV_PrefetchedMove
+
+takes prefetched trace for this push if there is one and it's still good
+=============
+*/
+static qboolean SV_PrefetchedMove( edict_t *ent, const vec3_t end, int type, qboolean monsterclip, trace_t *trace )
+{
+	sv_movecache_t	*mc;
+	qboolean		valid;
+	trace_t		check;
+	int		num;
+
+	if( !sv_prefetch.numcache || !( num = sv_prefetch.cachenum[NUM_FOR_EDICT( ent )] ))
+		return false;
+
+	mc = &sv_prefetch.cache[num - 1];
+	valid = mc->valid;
+
+	if( !SV_MoveCached( mc, ent->v.origin, ent->v.mins, ent->v.maxs, end, type, ent, monsterclip, trace ))
+	{
+		if( valid && !mc->valid )
+			sv_prefetch.invalidated++;
+		return false;
+	}
+
+	sv_prefetch.used++;
+
+	if( sv_physics_verify.value )
+	{
+		// keep the serial result, just tell when they differ
+		check = SV_Move( ent->v.origin, ent->v.mins, ent->v.maxs, end, type, ent, monsterclip );
+
+		if( !SV_TracesEqual( trace, &check ))
+		{
+			Con_Printf( S_WARN "prefetched trace of %s[%i] differs from serial one\n", SV_ClassName( ent ), NUM_FOR_EDICT( ent ));
+			sv_prefetch.mismatches++;
+		}
+
+		*trace = check;
+	}
+
+	return true;
+}
+
+/*
+=============
+SV_PhysicsStats_f
+
+=============
+*/
+void SV_PhysicsStats_f( void )
+{
+	int	frames = Q_max( sv_prefetch.frames, 1 );
+
+	Con_Printf( "%i frames, %.1f movers in %.1f contact groups per frame\n", sv_prefetch.frames,
+		(float)sv_prefetch.summovers / frames, (float)sv_prefetch.sumgroups / frames );
+	Con_Printf( "prefetched %i traces: %i used, %i invalidated, %i unused\n", sv_prefetch.prefetched,
+		sv_prefetch.used, sv_prefetch.invalidated, sv_prefetch.prefetched - sv_prefetch.used - sv_prefetch.invalidated );
+
+	if( sv_physics_verify.value )
+		Con_Printf( "%i differed from serial traces\n", sv_prefetch.mismatches );
+
+	sv_prefetch.frames = sv_prefetch.summovers = sv_prefetch.sumgroups = 0;
+	sv_prefetch.prefetched = sv_prefetch.used = sv_prefetch.invalidated = sv_prefetch.mismatches = 0;
+}
+
 //============================================================================
 static void SV_Physics_Entity( edict_t *ent )
 {
 	// user dll can override movement type (Xash3D extension)
-	if( svgame.physFuncs.SV_PhysicsEntity && svgame.physFuncs.SV_PhysicsEntity( ent ))
-		return; // overrided
+	if( svgame.physFuncs.SV_PhysicsEntity )
+	{
+		qboolean	overrided;
+
+		SV_PROFILE_BEGIN( PROF_GAME_PHYSICSENTITY );
+		overrided = svgame.physFuncs.SV_PhysicsEntity( ent );
+		SV_PROFILE_END();
+
+		if( overrided )
+			return;
+	}
 
 	SV_UpdateBaseVelocity( ent );
 
@@ -1780,12 +2435,24 @@ void SV_Physics( void )
 	edict_t	*ent;
 	int    	i;
 
+	SV_PROFILE_BEGIN( PROF_PHYSICS );
+
 	SV_CheckAllEnts ();
 
+	// pick up absbox and name changes that bypassed SV_LinkEdict
+	SV_RefreshFindIndex ();
+
+	// reclaim adaptive nodes that went empty
+	SV_CheckAreaNodes ();
+
 	svgame.globals->time = sv.time;
 
 	// let the progs know that a new frame has started
+	SV_PROFILE_BEGIN( PROF_GAME_STARTFRAME );
 	svgame.dllFuncs.pfnStartFrame();
+	SV_PROFILE_END();
+
+	SV_PrefetchTraces ();
 
 	// treat each object in turn
 	for( i = 0; i < svgame.numEntities; i++ )
@@ -1801,11 +2468,17 @@ void SV_Physics( void )
 		SV_Physics_Entity( ent );
 	}
 
+	SV_ClearPrefetch ();
+
 	if( svgame.globals->force_retouch != 0.0f )
 		svgame.globals->force_retouch--;
 
 	if( svgame.physFuncs.SV_EndFrame != NULL )
+	{
+		SV_PROFILE_BEGIN( PROF_GAME_ENDFRAME );
 		svgame.physFuncs.SV_EndFrame();
+		SV_PROFILE_END();
+	}
 
 	// animate lightstyles (used for GetEntityIllum)
 	SV_RunLightStyles ();
@@ -1815,6 +2488,8 @@ void SV_Physics( void )
 
 	// decrement svgame.numEntities if the highest number entities died
 	for( ; EDICT_NUM( svgame.numEntities - 1 )->free; svgame.numEntities-- );
+
+	SV_PROFILE_END();
 }
 
 /*
@@ -2053,6 +2728,7 @@ static server_physics_api_t gPhysicsAPI =
 	COM_SaveFile,
 	pfnLoadImagePixels,
 	pfnGetModelName,
+	SV_MoveMany,
 };
 
 /*
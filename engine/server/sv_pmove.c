@@ -19,6 +19,7 @@ GNU General Public License for more details.
 #include "pm_local.h"
 #include "event_flags.h"
 #include "studio.h"
+#include "threads.h"
 
 static qboolean has_update = false;
 
@@ -200,6 +201,20 @@ void SV_GetTrueMinMax( sv_client_t *cl, int edictnum, vec3_t mins, vec3_t maxs )
 	}
 }
 
+// entities a player move should see, in area tree order
+typedef struct
+{
+	vec3_t		absmin;		// box they were collected for
+	vec3_t		absmax;
+	qboolean		valid;
+	int		numvisent;	// first slot is left for the world
+	int		numphysent;
+	int		nummoveent;
+	edict_t		*visents[MAX_PHYSENTS];
+	edict_t		*physents[MAX_PHYSENTS];
+	edict_t		*moveents[MAX_MOVEENTS];
+} sv_pmovelinks_t;
+
 /*
 ====================
 SV_AddLinksToPmove
@@ -207,15 +222,11 @@ SV_AddLinksToPmove
 collect solid entities
 ====================
 */
-void SV_AddLinksToPmove( areanode_t *node, const vec3_t pmove_mins, const vec3_t pmove_maxs )
+static void SV_AddLinksToPmove( areanode_t *node, const vec3_t pmove_mins, const vec3_t pmove_maxs, edict_t *pl, sv_client_t *unlag, sv_pmovelinks_t *links )
 {
 	link_t	*l, *next;
-	edict_t	*check, *pl;
+	edict_t	*check;
 	vec3_t	mins, maxs;
-	physent_t	*pe;
-
-	pl = EDICT_NUM( svgame.pmove->player_index + 1 );
-	Assert( SV_IsValidEdict( pl ));
 
 	// touch linked edicts
 	for( l = node->solid_edicts.next; l != &node->solid_edicts; l = next )
@@ -235,12 +246,12 @@ void SV_AddLinksToPmove( areanode_t *node, const vec3_t pmove_mins, const vec3_t
 		if( check->v.owner == pl || check->v.solid == SOLID_TRIGGER )
 			continue; // player or player's own missile
 
-		if( svgame.pmove->numvisent < MAX_PHYSENTS )
-		{
-			pe = &svgame.pmove->visents[svgame.pmove->numvisent];
-			if( SV_CopyEdictToPhysEnt( pe, check ))
-				svgame.pmove->numvisent++;
-		}
+		// can't be copied to physent
+		if( !SV_ModelHandle( check->v.modelindex ))
+			continue;
+
+		if( links->numvisent < MAX_PHYSENTS )
+			links->visents[links->numvisent++] = check;
 
 		if( check->v.solid == SOLID_NOT && ( check->v.skin == CONTENTS_NONE || check->v.modelindex == 0 ))
 			continue;
@@ -266,32 +277,27 @@ void SV_AddLinksToPmove( areanode_t *node, const vec3_t pmove_mins, const vec3_t
 
 		if( FBitSet( check->v.flags, FL_CLIENT ) && !FBitSet( check->v.flags, FL_FAKECLIENT ))
 		{
-			if( sv.current_client )
+			if( unlag )
 			{
 				// trying to get interpolated values
-				SV_GetTrueMinMax( sv.current_client, NUM_FOR_EDICT( check ), mins, maxs );
+				SV_GetTrueMinMax( unlag, NUM_FOR_EDICT( check ), mins, maxs );
 			}
 		}
 
 		if( !BoundsIntersect( pmove_mins, pmove_maxs, mins, maxs ))
 			continue;
 
-		if( svgame.pmove->numphysent < MAX_PHYSENTS )
-		{
-			pe = &svgame.pmove->physents[svgame.pmove->numphysent];
-
-			if( SV_CopyEdictToPhysEnt( pe, check ))
-				svgame.pmove->numphysent++;
-		}
+		if( links->numphysent < MAX_PHYSENTS )
+			links->physents[links->numphysent++] = check;
 	}
 
 	// recurse down both sides
 	if( node->axis == -1 ) return;
 
 	if( pmove_maxs[node->axis] > node->dist )
-		SV_AddLinksToPmove( node->children[0], pmove_mins, pmove_maxs );
+		SV_AddLinksToPmove( node->children[0], pmove_mins, pmove_maxs, pl, unlag, links );
 	if( pmove_mins[node->axis] < node->dist )
-		SV_AddLinksToPmove( node->children[1], pmove_mins, pmove_maxs );
+		SV_AddLinksToPmove( node->children[1], pmove_mins, pmove_maxs, pl, unlag, links );
 }
 
 /*
@@ -299,12 +305,11 @@ void SV_AddLinksToPmove( areanode_t *node, const vec3_t pmove_mins, const vec3_t
 SV_AddLaddersToPmove
 ====================
 */
-void SV_AddLaddersToPmove( areanode_t *node, const vec3_t pmove_mins, const vec3_t pmove_maxs )
+static void SV_AddLaddersToPmove( areanode_t *node, const vec3_t pmove_mins, const vec3_t pmove_maxs, sv_pmovelinks_t *links )
 {
 	link_t	*l, *next;
 	edict_t	*check;
 	model_t	*mod;
-	physent_t	*pe;
 
 	// get ladder edicts
 	for( l = node->solid_edicts.next; l != &node->solid_edicts; l = next )
@@ -324,21 +329,304 @@ void SV_AddLaddersToPmove( areanode_t *node, const vec3_t pmove_mins, const vec3
 		if( !BoundsIntersect( pmove_mins, pmove_maxs, check->v.absmin, check->v.absmax ))
 			continue;
 
-		if( svgame.pmove->nummoveent == MAX_MOVEENTS )
+		if( links->nummoveent == MAX_MOVEENTS )
 			return;
 
-		pe = &svgame.pmove->moveents[svgame.pmove->nummoveent];
-		if( SV_CopyEdictToPhysEnt( pe, check ))
-			svgame.pmove->nummoveent++;
+		links->moveents[links->nummoveent++] = check;
 	}
 
 	// recurse down both sides
 	if( node->axis == -1 ) return;
 
 	if( pmove_maxs[node->axis] > node->dist )
-		SV_AddLaddersToPmove( node->children[0], pmove_mins, pmove_maxs );
+		SV_AddLaddersToPmove( node->children[0], pmove_mins, pmove_maxs, links );
 	if( pmove_mins[node->axis] < node->dist )
-		SV_AddLaddersToPmove( node->children[1], pmove_mins, pmove_maxs );
+		SV_AddLaddersToPmove( node->children[1], pmove_mins, pmove_maxs, links );
+}
+
+/*
+====================
+SV_CollectPmoveLinks
+
+====================
+*/
+static void SV_CollectPmoveLinks( const vec3_t absmin, const vec3_t absmax, edict_t *pl, sv_client_t *unlag, sv_pmovelinks_t *links )
+{
+	VectorCopy( absmin, links->absmin );
+	VectorCopy( absmax, links->absmax );
+	links->numvisent = links->numphysent = 1;
+	links->nummoveent = 0;
+
+	SV_AddLinksToPmove( sv_areanodes, absmin, absmax, pl, unlag, links );
+	SV_AddLaddersToPmove( sv_areanodes, absmin, absmax, links );
+}
+
+/*
+====================
+SV_CopyPmoveLinks
+
+====================
+*/
+static void SV_CopyPmoveLinks( playermove_t *pmove, const sv_pmovelinks_t *links )
+{
+	int	i;
+
+	for( i = 1; i < links->numvisent; i++ )
+	{
+		if( SV_CopyEdictToPhysEnt( &pmove->visents[pmove->numvisent], links->visents[i] ))
+			pmove->numvisent++;
+	}
+
+	for( i = 1; i < links->numphysent; i++ )
+	{
+		if( SV_CopyEdictToPhysEnt( &pmove->physents[pmove->numphysent], links->physents[i] ))
+			pmove->numphysent++;
+	}
+
+	for( i = 0; i < links->nummoveent; i++ )
+	{
+		if( SV_CopyEdictToPhysEnt( &pmove->moveents[pmove->nummoveent], links->moveents[i] ))
+			pmove->nummoveent++;
+	}
+}
+
+/*
+===============================================================================
+
+	PREFETCHED PHYSENTS
+
+Before client packets are read, workers collect physents of every
+spawned player from its current origin. Game code run by usercmds of
+others may change the world before player's own usercmd comes, so
+every box relinked in between is logged, and collected lists are
+dropped if player moved or a change touches their box. Changes that
+don't relink anything, like an owner assigned in PostThink, aren't
+seen, sv_physics_verify collects them again to catch such games.
+Lag compensation relinks are logged too, even though they are undone,
+since relinking puts players at the end of their node lists.
+Player moves themselves stay serial, game dlls keep pmove in globals
+
+===============================================================================
+*/
+#define PMOVE_MAX_CHANGES	1024
+
+static struct
+{
+	sv_pmovelinks_t	links[MAX_CLIENTS];
+	qboolean		active;		// between prefetch and end of SV_ReadPackets
+	uint		dead;		// clients that are dead bodies for pmove
+	int		numchanges;
+	vec3_t		changes[PMOVE_MAX_CHANGES][2];
+
+	// counters for sv_pmove_stats
+	int		frames;
+	int		prefetched;
+	int		used;
+	int		invalidated;
+	int		mismatches;
+} sv_pmovejobs;
+
+/*
+====================
+SV_DeadClients
+
+====================
+*/
+static uint SV_DeadClients( void )
+{
+	sv_client_t	*cl;
+	uint		dead = 0;
+	int		i;
+
+	for( i = 0, cl = svs.clients; i < svs.maxclients; i++, cl++ )
+	{
+		if( cl->state == cs_spawned && SV_IsValidEdict( cl->edict ) && cl->edict->v.health <= 0.0f )
+			SetBits( dead, BIT( i ));
+	}
+
+	return dead;
+}
+
+/*
+====================
+SV_PrefetchPmoveJob
+
+====================
+*/
+static void SV_PrefetchPmoveJob( void *data, int index )
+{
+	sv_pmovelinks_t	*links = &sv_pmovejobs.links[index];
+	edict_t		*clent = svs.clients[index].edict;
+	vec3_t		absmin, absmax;
+	int		i;
+
+	if( !links->valid )
+		return;
+
+	for( i = 0; i < 3; i++ )
+	{
+		absmin[i] = clent->v.origin[i] - 256.0f;
+		absmax[i] = clent->v.origin[i] + 256.0f;
+	}
+
+	SV_CollectPmoveLinks( absmin, absmax, clent, NULL, links );
+}
+
+/*
+====================
+SV_PrefetchPmove
+
+called before client packets are read
+====================
+*/
+void SV_PrefetchPmove( void )
+{
+	sv_client_t	*cl;
+	int		i, count = 0;
+
+	sv_pmovejobs.active = false;
+
+	if( sv_pmove_threads.value < 1.0f || sv.state != ss_active || svs.maxclients <= 1 )
+		return;
+
+	for( i = 0, cl = svs.clients; i < svs.maxclients; i++, cl++ )
+	{
+		sv_pmovejobs.links[i].valid = false;
+
+		if( cl->state != cs_spawned || FBitSet( cl->flags, FCL_FAKECLIENT ) || !SV_IsValidEdict( cl->edict ))
+			continue;
+
+		sv_pmovejobs.links[i].valid = true;
+		count++;
+	}
+
+	if( !count )
+		return;
+
+	Jobs_Run( SV_PrefetchPmoveJob, NULL, svs.maxclients, sv_pmove_threads.value );
+
+	sv_pmovejobs.dead = SV_DeadClients();
+	sv_pmovejobs.numchanges = 0;
+	sv_pmovejobs.active = true;
+	sv_pmovejobs.prefetched += count;
+	sv_pmovejobs.frames++;
+}
+
+/*
+====================
+SV_FinishPmovePrefetch
+
+====================
+*/
+void SV_FinishPmovePrefetch( void )
+{
+	sv_pmovejobs.active = false;
+}
+
+/*
+====================
+SV_PmoveLinkChanged
+
+entity box was linked or unlinked
+====================
+*/
+void SV_PmoveLinkChanged( const vec3_t absmin, const vec3_t absmax )
+{
+	if( !sv_pmovejobs.active )
+		return;
+
+	if( sv_pmovejobs.numchanges < PMOVE_MAX_CHANGES )
+	{
+		VectorCopy( absmin, sv_pmovejobs.changes[sv_pmovejobs.numchanges][0] );
+		VectorCopy( absmax, sv_pmovejobs.changes[sv_pmovejobs.numchanges][1] );
+	}
+
+	// overflow means anything could change
+	sv_pmovejobs.numchanges++;
+}
+
+/*
+====================
+SV_PrefetchedPmoveLinks
+
+returns lists collected ahead of time if they are still good
+====================
+*/
+static const sv_pmovelinks_t *SV_PrefetchedPmoveLinks( sv_client_t *cl, const vec3_t absmin, const vec3_t absmax )
+{
+	sv_pmovelinks_t	*links;
+	int		i;
+
+	if( !sv_pmovejobs.active )
+		return NULL;
+
+	links = &sv_pmovejobs.links[cl - svs.clients];
+
+	if( !links->valid )
+		return NULL;
+
+	// only the first usercmd of the frame can take it
+	links->valid = false;
+
+	if( !VectorCompare( links->absmin, absmin ) || !VectorCompare( links->absmax, absmax ))
+		goto invalidated;
+
+	if( sv_pmovejobs.numchanges > PMOVE_MAX_CHANGES || sv_pmovejobs.dead != SV_DeadClients( ))
+		goto invalidated;
+
+	for( i = 0; i < sv_pmovejobs.numchanges; i++ )
+	{
+		if( BoundsIntersect( absmin, absmax, sv_pmovejobs.changes[i][0], sv_pmovejobs.changes[i][1] ))
+			goto invalidated;
+	}
+
+	sv_pmovejobs.used++;
+	return links;
+
+invalidated:
+	sv_pmovejobs.invalidated++;
+	return NULL;
+}
+
+/*
+====================
+SV_PmoveLinksEqual
+
+same entities in the same order, pmove keeps the first
+of equally close hits. Relinking moves an edict to the end
+of its node list, but any link inside the box invalidates
+the prefetched lists, so the order can't change otherwise
+====================
+*/
+static qboolean SV_PmoveLinksEqual( edict_t **a, edict_t **b, int count )
+{
+	int	i;
+
+	for( i = 0; i < count; i++ )
+	{
+		if( a[i] != b[i] )
+			return false;
+	}
+
+	return true;
+}
+
+/*
+====================
+SV_PmoveStats_f
+
+====================
+*/
+void SV_PmoveStats_f( void )
+{
+	Con_Printf( "%i frames, prefetched physents for %i players: %i used, %i invalidated, %i unused\n", sv_pmovejobs.frames,
+		sv_pmovejobs.prefetched, sv_pmovejobs.used, sv_pmovejobs.invalidated, sv_pmovejobs.prefetched - sv_pmovejobs.used - sv_pmovejobs.invalidated );
+
+	if( sv_physics_verify.value )
+		Con_Printf( "%i differed from serial physents\n", sv_pmovejobs.mismatches );
+
+	sv_pmovejobs.frames = sv_pmovejobs.prefetched = sv_pmovejobs.used = 0;
+	sv_pmovejobs.invalidated = sv_pmovejobs.mismatches = 0;
 }
 
 static void GAME_EXPORT pfnParticle( const float *origin, int color, float life, int zpos, int zvel )
@@ -662,9 +950,11 @@ static void PM_CheckMovingGround( edict_t *ent, float frametime )
 
 static void SV_SetupPMove( playermove_t *pmove, sv_client_t *cl, usercmd_t *ucmd, const char *physinfo )
 {
-	vec3_t	absmin, absmax;
-	edict_t	*clent = cl->edict;
-	int	i;
+	static sv_pmovelinks_t	serial;
+	const sv_pmovelinks_t	*links;
+	vec3_t		absmin, absmax;
+	edict_t		*clent = cl->edict;
+	int		i;
 
 	svgame.globals->frametime = (ucmd->msec * 0.001f);
 
@@ -736,8 +1026,28 @@ static void SV_SetupPMove( playermove_t *pmove, sv_client_t *cl, usercmd_t *ucmd
 	svgame.pmove->numphysent = 1;	// always have world
 	svgame.pmove->numvisent = 1;
 
-	SV_AddLinksToPmove( sv_areanodes, absmin, absmax );
-	SV_AddLaddersToPmove( sv_areanodes, absmin, absmax );
+	if(( links = SV_PrefetchedPmoveLinks( cl, absmin, absmax )) != NULL && sv_physics_verify.value )
+	{
+		// keep the serial result, just tell when they differ
+		SV_CollectPmoveLinks( absmin, absmax, clent, sv.current_client, &serial );
+
+		if( links->numphysent != serial.numphysent || links->nummoveent != serial.nummoveent
+			|| !SV_PmoveLinksEqual( (edict_t **)links->physents, serial.physents, links->numphysent )
+			|| !SV_PmoveLinksEqual( (edict_t **)links->moveents, serial.moveents, links->nummoveent ))
+		{
+			Con_Printf( S_WARN "prefetched physents of %s differ from serial ones\n", cl->name );
+			sv_pmovejobs.mismatches++;
+		}
+
+		links = &serial;
+	}
+	else if( !links )
+	{
+		SV_CollectPmoveLinks( absmin, absmax, clent, sv.current_client, &serial );
+		links = &serial;
+	}
+
+	SV_CopyPmoveLinks( svgame.pmove, links );
 }
 
 static void SV_FinishPMove( playermove_t *pmove, sv_client_t *cl )
@@ -807,41 +1117,526 @@ static void SV_FinishPMove( playermove_t *pmove, sv_client_t *cl )
 	pmove->runfuncs = false;
 }
 
-entity_state_t *SV_FindEntInPack( int index, client_frame_t *frame )
+qboolean SV_UnlagCheckTeleport( vec3_t old_pos, vec3_t new_pos )
+{
+	int	i;
+
+	for( i = 0; i < 3; i++ )
+	{
+		if( fabs( old_pos[i] - new_pos[i] ) > 64.0f )
+			return true;
+	}
+	return false;
+}
+
+/*
+===============================================================================
+
+	LAG COMPENSATION HISTORY
+
+Player origins are sampled once per server frame into a ring shared by
+all clients. Every frame sent to a client remembers its sample and the
+players that were in its packet, so rewinding takes the two frames the
+client got around the rewind time and reads those players straight from
+the ring instead of searching the packet entities of every frame.
+Only players the client got in that packet are rewound, as before.
+Each client also keeps, per player, the latest frame it got that can't
+be interpolated across (died, teleported or got EF_NOINTERP), which
+replaces checking every frame between the rewind time and now
+
+===============================================================================
+*/
+#define UNLAG_HISTORY	2048	// must be power of two
+#define UNLAG_MASK		( UNLAG_HISTORY - 1 )
+
+typedef struct
+{
+	uint		present[UNLAG_HISTORY];	// bit per player
+	vec3_t		origin[UNLAG_HISTORY][MAX_CLIENTS];
+	uint		count;			// samples ever recorded
+} sv_unlag_t;
+
+// what a client was sent about other players
+typedef struct
+{
+	int		sequence;			// of the latest recorded frame
+	uint		seen;			// players it got at least once
+	vec3_t		lastorigin[MAX_CLIENTS];
+	double		lasttime[MAX_CLIENTS];	// senttime of the last frame with player
+	double		breaktime[MAX_CLIENTS];	// frames up to this can't be used
+} sv_unlagview_t;
+
+static sv_unlag_t		sv_unlag_history;
+static sv_unlagview_t	sv_unlag_views[MAX_CLIENTS];
+static int		sv_unlag_sample = -1;	// recorded this frame
+
+/*
+===============
+SV_UnlagAddSample
+
+returns the sample index
+===============
+*/
+static int SV_UnlagAddSample( sv_unlag_t *ul, vec3_t *origins, uint present )
+{
+	uint	slot = ul->count & UNLAG_MASK;
+	int	i;
+
+	for( i = 0; i < MAX_CLIENTS; i++ )
+	{
+		if( FBitSet( present, BIT( i )))
+			VectorCopy( origins[i], ul->origin[slot][i] );
+	}
+
+	ul->present[slot] = present;
+
+	return ul->count++;
+}
+
+/*
+===============
+SV_UnlagRecordFrame
+
+links the frame to the sample and notes players
+that can't be interpolated across it
+===============
+*/
+static void SV_UnlagRecordFrame( sv_unlagview_t *view, int sequence, client_frame_t *frame, const entity_state_t *states, int numstates, int sample )
 {
-	entity_state_t	*state;
+	const entity_state_t	*state;
+	int		i, k;
+
+	// new client in this slot
+	if( sequence <= view->sequence )
+		memset( view, 0, sizeof( *view ));
+	view->sequence = sequence;
+
+	frame->unlagsample = sample;
+	frame->unlagplayers = 0;
+
+	for( i = 0; i < numstates; i++ )
+	{
+		state = &states[i];
+
+		if( state->number < 1 || state->number > MAX_CLIENTS )
+			continue;
+
+		k = state->number - 1;
+		SetBits( frame->unlagplayers, BIT( k ));
+
+		if( state->health <= 0 || FBitSet( state->effects, EF_NOINTERP ))
+			view->breaktime[k] = frame->senttime;
+		else if( FBitSet( view->seen, BIT( k )) && SV_UnlagCheckTeleport( view->lastorigin[k], (float *)state->origin ))
+			view->breaktime[k] = Q_max( view->breaktime[k], view->lasttime[k] );
+
+		VectorCopy( state->origin, view->lastorigin[k] );
+		view->lasttime[k] = frame->senttime;
+		SetBits( view->seen, BIT( k ));
+	}
+}
+
+/*
+===============
+SV_UnlagFindFrames
+
+finds the newest frame sent before the time and the one
+after it, only the frame headers are checked
+===============
+*/
+static qboolean SV_UnlagFindFrames( client_frame_t *frames, int backup, int sequence, double time, client_frame_t **older, client_frame_t **newer, float *frac )
+{
+	client_frame_t	*frame = NULL, *frame2 = NULL;
 	int		i;
 
-	for( i = 0; i < frame->num_entities; i++ )
+	for( i = 0; i < backup; i++, frame2 = frame )
 	{
-		state = &svs.packet_entities[(frame->first_entity+i)%svs.num_client_entities];
+		frame = &frames[( sequence - ( i + 1 )) & ( backup - 1 )];
 
-		if( state->number == index )
-			return state;
+		if( time > frame->senttime )
+			break;
 	}
-	return NULL;
+
+	if( i == backup || time - frame->senttime > 1.0 )
+		return false;
+
+	if( !frame2 )
+	{
+		frame2 = frame;
+		*frac = 0.0f;
+	}
+	else *frac = bound( 0.0f, ( time - frame->senttime ) / ( frame2->senttime - frame->senttime ), 1.0f );
+
+	*older = frame;
+	*newer = frame2;
+
+	return true;
 }
 
-qboolean SV_UnlagCheckTeleport( vec3_t old_pos, vec3_t new_pos )
+/*
+===============
+SV_UnlagFramePosition
+
+interpolates player origin between two frames
+===============
+*/
+static qboolean SV_UnlagFramePosition( const sv_unlag_t *ul, const sv_unlagview_t *view, int player, const client_frame_t *older, const client_frame_t *newer, float frac, vec3_t out )
 {
-	int	i;
+	const float	*from, *to;
+	uint		slot;
 
-	for( i = 0; i < 3; i++ )
+	// client didn't get this player
+	if( older->unlagsample < 0 || !FBitSet( older->unlagplayers, BIT( player )))
+		return false;
+
+	if( view->breaktime[player] >= older->senttime )
+		return false;
+
+	// sample is overwritten already
+	if( ul->count - (uint)older->unlagsample > UNLAG_HISTORY )
+		return false;
+
+	slot = older->unlagsample & UNLAG_MASK;
+	if( !FBitSet( ul->present[slot], BIT( player )))
+		return false;
+
+	from = ul->origin[slot][player];
+
+	if( newer->unlagsample < 0 || !FBitSet( newer->unlagplayers, BIT( player )))
 	{
-		if( fabs( old_pos[i] - new_pos[i] ) > 64.0f )
-			return true;
+		VectorCopy( from, out );
+		return true;
 	}
-	return false;
+
+	slot = newer->unlagsample & UNLAG_MASK;
+	if( !FBitSet( ul->present[slot], BIT( player )))
+	{
+		VectorCopy( from, out );
+		return true;
+	}
+
+	to = ul->origin[slot][player];
+	VectorLerp( from, frac, to, out );
+
+	return true;
+}
+
+/*
+===============
+SV_RecordUnlagHistory
+
+called before client frames are sent
+===============
+*/
+void SV_RecordUnlagHistory( void )
+{
+	vec3_t		origins[MAX_CLIENTS];
+	uint		present = 0;
+	sv_client_t	*cl;
+	int		i;
+
+	sv_unlag_sample = -1;
+
+	if( svs.maxclients <= 1 || sv.state != ss_active )
+		return;
+
+	for( i = 0, cl = svs.clients; i < svs.maxclients; i++, cl++ )
+	{
+		if( cl->state != cs_spawned || !SV_IsValidEdict( cl->edict ))
+			continue;
+
+		VectorCopy( cl->edict->v.origin, origins[i] );
+		SetBits( present, BIT( i ));
+	}
+
+	sv_unlag_sample = SV_UnlagAddSample( &sv_unlag_history, origins, present );
+}
+
+/*
+===============
+SV_RecordUnlagFrame
+
+called when packet entities of the frame are built
+===============
+*/
+void SV_RecordUnlagFrame( sv_client_t *cl, client_frame_t *frame, const entity_state_t *states, int numstates )
+{
+	SV_UnlagRecordFrame( &sv_unlag_views[cl - svs.clients], cl->netchan.outgoing_sequence, frame, states, numstates, sv_unlag_sample );
+}
+
+/*
+===============
+SV_ClearUnlagHistory
+
+===============
+*/
+void SV_ClearUnlagHistory( void )
+{
+	memset( &sv_unlag_history, 0, sizeof( sv_unlag_history ));
+	memset( sv_unlag_views, 0, sizeof( sv_unlag_views ));
+	sv_unlag_sample = -1;
+}
+
+/*
+===============
+SV_UnlagScanFrames
+
+old way of rewinding, searches frames sent to client
+and their packet entities, kept for unlag_bench
+===============
+*/
+static int SV_UnlagScanFrames( const entity_state_t *states, const double *senttime, int numframes, int numstates, int shooter, double finalpush, vec3_t *out )
+{
+	const entity_state_t	*state, *lerpstate;
+	qboolean		nointerp[MAX_CLIENTS];
+	qboolean		firstframe[MAX_CLIENTS];
+	vec3_t		finalpos[MAX_CLIENTS];
+	int		i, j, k, frame, frame2 = -1;
+	int		rewound = 0;
+	float		lerpFrac;
+
+	memset( nointerp, 0, sizeof( nointerp ));
+	memset( firstframe, 0, sizeof( firstframe ));
+
+	for( i = 0; i < numframes; i++, frame2 = frame )
+	{
+		frame = numframes - 1 - i;
+
+		for( j = 0; j < numstates; j++ )
+		{
+			state = &states[frame * numstates + j];
+
+			if( state->number < 1 || state->number > MAX_CLIENTS )
+				continue;
+
+			k = state->number - 1;
+			if( nointerp[k] ) continue;
+
+			if( state->health <= 0 || FBitSet( state->effects, EF_NOINTERP ))
+				nointerp[k] = true;
+
+			if( firstframe[k] )
+			{
+				if( SV_UnlagCheckTeleport( (float *)state->origin, finalpos[k] ))
+					nointerp[k] = true;
+			}
+			else firstframe[k] = true;
+
+			VectorCopy( state->origin, finalpos[k] );
+		}
+
+		if( finalpush > senttime[frame] )
+			break;
+	}
+
+	if( i == numframes )
+		return 0;
+
+	if( frame2 < 0 )
+	{
+		frame2 = frame;
+		lerpFrac = 0.0f;
+	}
+	else lerpFrac = bound( 0.0f, ( finalpush - senttime[frame] ) / ( senttime[frame2] - senttime[frame] ), 1.0f );
+
+	for( i = 0; i < numstates; i++ )
+	{
+		state = &states[frame * numstates + i];
+
+		if( state->number < 1 || state->number > MAX_CLIENTS || state->number - 1 == shooter || nointerp[state->number - 1] )
+			continue;
+
+		for( j = 0, lerpstate = NULL; j < numstates; j++ )
+		{
+			if( states[frame2 * numstates + j].number == state->number )
+			{
+				lerpstate = &states[frame2 * numstates + j];
+				break;
+			}
+		}
+
+		if( lerpstate )
+			VectorLerp( state->origin, lerpFrac, lerpstate->origin, out[state->number - 1] );
+		else VectorCopy( state->origin, out[state->number - 1] );
+		rewound++;
+	}
+
+	return rewound;
 }
 
+/*
+===============
+SV_UnlagSimulate
+
+rewinds simulated bots for every shooter, with frame search
+and with history ring, returns how far apart the results are
+===============
+*/
+static float SV_UnlagSimulate( int numbots, int numcmds, int numstates, int skip, double *elapsed, int *rewound )
+{
+	int		i, j, cmd, frame, first, sample;
+	vec3_t		origins[MAX_CLIENTS];
+	vec3_t		oldpos[MAX_CLIENTS], newpos[MAX_CLIENTS];
+	client_frame_t	frames[MULTIPLAYER_BACKUP];
+	client_frame_t	*older, *newer;
+	double		senttime[MULTIPLAYER_BACKUP];
+	double		start, now = 0.0;
+	entity_state_t	*states;
+	sv_unlagview_t	*view;
+	sv_unlag_t	*ul;
+	float		frac, error = 0.0f;
+
+	ul = Mem_Calloc( host.mempool, sizeof( *ul ));
+	view = Mem_Calloc( host.mempool, sizeof( *view ));
+	states = Mem_Calloc( host.mempool, sizeof( *states ) * numstates * MULTIPLAYER_BACKUP );
+	memset( frames, 0, sizeof( frames ));
+
+	// bots run in circles at 100 fps and teleport now and then, the client gets
+	// every skip-th frame, some bots are dead or out of its PVS in some of them
+	first = UNLAG_HISTORY - MULTIPLAYER_BACKUP * skip;
+
+	for( i = 0; i < UNLAG_HISTORY; i++ )
+	{
+		now = i * 0.01;
+
+		for( j = 0; j < numbots; j++ )
+		{
+			VectorSet( origins[j], cos( now + j ) * 256.0f, sin( now + j ) * 256.0f, j * 72.0f );
+			origins[j][0] += (( i + j * 37 ) / 500 ) * 128.0f;
+		}
+
+		sample = SV_UnlagAddSample( ul, origins, ( numbots < 32 ) ? BIT( numbots ) - 1 : ~0U );
+
+		if( i < first || ( i - first ) % skip )
+			continue;
+
+		frame = ( i - first ) / skip;
+		senttime[frame] = now;
+		frames[frame].senttime = now;
+
+		for( j = 0; j < numstates; j++ )
+		{
+			entity_state_t	*state = &states[frame * numstates + j];
+
+			state->health = 100;
+
+			if( j >= numbots )
+				state->number = MAX_CLIENTS + 1 + j; // ordinary entities
+			else if(( frame + j ) % 7 == 3 )
+				state->number = 0; // not in PVS
+			else
+			{
+				state->number = j + 1;
+				if(( frame + j ) % 23 == 0 )
+					state->health = 0;
+				VectorCopy( origins[j], state->origin );
+			}
+		}
+
+		SV_UnlagRecordFrame( view, frame + 1, &frames[frame], &states[frame * numstates], numstates, sample );
+	}
+
+	for( j = 0; j < 2; j++ )
+	{
+		rewound[j] = 0;
+		start = Sys_DoubleTime();
+
+		for( cmd = 0; cmd < numcmds; cmd++ )
+		{
+			int	shooter = cmd % numbots;
+			double	finalpush = now - 0.02 - ( cmd % 50 ) * 0.01 - 0.005;
+
+			if( j == 0 )
+			{
+				rewound[j] += SV_UnlagScanFrames( states, senttime, MULTIPLAYER_BACKUP, numstates, shooter, finalpush, oldpos );
+			}
+			else
+			{
+				if( !SV_UnlagFindFrames( frames, MULTIPLAYER_BACKUP, MULTIPLAYER_BACKUP, finalpush, &older, &newer, &frac ))
+					continue;
+
+				for( i = 0; i < numbots; i++ )
+				{
+					if( i != shooter && SV_UnlagFramePosition( ul, view, i, older, newer, frac, newpos[i] ))
+						rewound[j]++;
+				}
+			}
+		}
+
+		elapsed[j] = Sys_DoubleTime() - start;
+	}
+
+	// rewind at every lag once more, players skipped by both stay at zero
+	for( cmd = 0; cmd < 50; cmd++ )
+	{
+		double	finalpush = now - 0.02 - cmd * 0.01 - 0.005;
+
+		memset( oldpos, 0, sizeof( oldpos ));
+		memset( newpos, 0, sizeof( newpos ));
+
+		SV_UnlagScanFrames( states, senttime, MULTIPLAYER_BACKUP, numstates, 0, finalpush, oldpos );
+
+		if( SV_UnlagFindFrames( frames, MULTIPLAYER_BACKUP, MULTIPLAYER_BACKUP, finalpush, &older, &newer, &frac ))
+		{
+			for( i = 1; i < numbots; i++ )
+				SV_UnlagFramePosition( ul, view, i, older, newer, frac, newpos[i] );
+		}
+
+		for( i = 1; i < numbots; i++ )
+			error = Q_max( error, VectorDistance( oldpos[i], newpos[i] ));
+	}
+
+	Mem_Free( states );
+	Mem_Free( view );
+	Mem_Free( ul );
+
+	return error;
+}
+
+/*
+===============
+SV_UnlagBenchmark_f
+
+===============
+*/
+void SV_UnlagBenchmark_f( void )
+{
+	int	numbots, numcmds, numstates, skip;
+	int	rewound[2];
+	double	elapsed[2];
+	float	error;
+
+	numbots = ( Cmd_Argc() > 1 ) ? Q_atoi( Cmd_Argv( 1 )) : MAX_CLIENTS;
+	numbots = bound( 2, numbots, MAX_CLIENTS );
+	numcmds = ( Cmd_Argc() > 2 ) ? Q_atoi( Cmd_Argv( 2 )) : 10000;
+	numcmds = Q_max( numcmds, 1 );
+	skip = ( Cmd_Argc() > 3 ) ? Q_atoi( Cmd_Argv( 3 )) : 3;
+	skip = bound( 1, skip, UNLAG_HISTORY / MULTIPLAYER_BACKUP );
+	numstates = numbots + 64; // and some ordinary entities in every packet
+
+	error = SV_UnlagSimulate( numbots, numcmds, numstates, skip, elapsed, rewound );
+
+	Con_Printf( "unlag_bench: %i bots, %i usercmds, %i entities per packet, 1 of %i frames sent\n", numbots, numcmds, numstates, skip );
+	Con_Printf( "  frame search:    %.1f ns per usercmd\n", elapsed[0] * 1e9 / numcmds );
+	Con_Printf( "  history ring:    %.1f ns per usercmd\n", elapsed[1] * 1e9 / numcmds );
+	Con_Printf( "  rewound %s, largest difference %g units\n", ( rewound[0] == rewound[1] ) ? "same players" : "^1different players^7", error );
+}
+
+/*
+===============
+SV_SetupMoveInterpolant
+
+rewinds other players to where the client saw them,
+between the two frames it got around the rewind time
+===============
+*/
 void SV_SetupMoveInterpolant( sv_client_t *cl )
 {
-	int		i, j, clientnum;
+	int		i;
 	float		finalpush, lerp_msec;
 	float		latency, lerpFrac;
 	client_frame_t	*frame, *frame2;
-	entity_state_t	*state, *lerpstate;
-	vec3_t		curpos, newpos;
+	sv_unlagview_t	*view;
+	vec3_t		curpos;
 	sv_client_t	*check;
 	sv_interp_t	*lerp;
 
@@ -884,92 +1679,29 @@ void SV_SetupMoveInterpolant( sv_client_t *cl )
 	finalpush = ( host.realtime - latency - lerp_msec ) + sv_unlagpush.value;
 	if( finalpush > host.realtime ) finalpush = host.realtime; // pushed too much ?
 
-	frame = frame2 = NULL;
-
-	for( i = 0; i < SV_UPDATE_BACKUP; i++, frame2 = frame )
-	{
-		frame = &cl->frames[(cl->netchan.outgoing_sequence - (i + 1)) & SV_UPDATE_MASK];
-
-		for( j = 0; j < frame->num_entities; j++ )
-		{
-			state = &svs.packet_entities[(frame->first_entity+j)%svs.num_client_entities];
-
-			if( state->number < 1 || state->number > svs.maxclients )
-				continue;
-
-			lerp = &svgame.interp[state->number-1];
-			if( lerp->nointerp ) continue;
-
-			if( state->health <= 0 || FBitSet( state->effects, EF_NOINTERP ))
-				lerp->nointerp = true;
-
-			if( lerp->firstframe )
-			{
-				if( SV_UnlagCheckTeleport( state->origin, lerp->finalpos ))
-					lerp->nointerp = true;
-			}
-			else lerp->firstframe = true;
-
-			VectorCopy( state->origin, lerp->finalpos );
-		}
-
-		if( finalpush > frame->senttime )
-			break;
-	}
-
-	if( i == SV_UPDATE_BACKUP || finalpush - frame->senttime > 1.0f )
+	if( !SV_UnlagFindFrames( cl->frames, SV_UPDATE_BACKUP, cl->netchan.outgoing_sequence, finalpush, &frame, &frame2, &lerpFrac ))
 	{
 		memset( svgame.interp, 0, sizeof( svgame.interp ));
 		has_update = false;
 		return;
 	}
 
-	if( !frame2 )
-	{
-		frame2 = frame;
-		lerpFrac = 0;
-	}
-	else
-	{
-		if( frame2->senttime - frame->senttime == 0.0 )
-		{
-			lerpFrac = 0;
-		}
-		else
-		{
-			lerpFrac = (finalpush - frame->senttime) / (frame2->senttime - frame->senttime);
-			lerpFrac = bound( 0.0f, lerpFrac, 1.0f );
-		}
-	}
+	view = &sv_unlag_views[cl - svs.clients];
 
-	for( i = 0; i < frame->num_entities; i++ )
+	for( i = 0, check = svs.clients; i < svs.maxclients; i++, check++ )
 	{
-		state = &svs.packet_entities[(frame->first_entity+i)%svs.num_client_entities];
-
-		if( state->number < 1 || state->number > svs.maxclients )
-			continue;
-
-		clientnum = state->number - 1;
-		check = &svs.clients[clientnum];
-
 		if( check->state != cs_spawned || check == cl )
 			continue;
 
-		lerp = &svgame.interp[clientnum];
+		lerp = &svgame.interp[i];
 
-		if( !lerp->active || lerp->nointerp )
+		if( !lerp->active )
 			continue;
 
-		lerpstate = SV_FindEntInPack( state->number, frame2 );
-
-		if( !lerpstate )
-		{
-			VectorCopy( state->origin, curpos );
-		}
-		else
+		if( !SV_UnlagFramePosition( &sv_unlag_history, view, i, frame, frame2, lerpFrac, curpos ))
 		{
-			VectorSubtract( lerpstate->origin, state->origin, newpos );
-			VectorMA( state->origin, lerpFrac, newpos, curpos );
+			lerp->nointerp = true;
+			continue;
 		}
 
 		VectorCopy( curpos, lerp->curpos );
@@ -1061,7 +1793,9 @@ void SV_RunCmd( sv_client_t *cl, usercmd_t *ucmd, int random_seed )
 	if( !FBitSet( cl->flags, FCL_FAKECLIENT ))
 		SV_SetupMoveInterpolant( cl );
 
+	SV_PROFILE_BEGIN( PROF_GAME_CMDSTART );
 	svgame.dllFuncs.pfnCmdStart( cl->edict, ucmd, random_seed );
+	SV_PROFILE_END();
 
 	frametime = ((double)ucmd->msec / 1000.0 );
 	cl->timebase += frametime;
@@ -1086,7 +1820,9 @@ void SV_RunCmd( sv_client_t *cl, usercmd_t *ucmd, int random_seed )
 	}
 
 	svgame.globals->time = cl->timebase;
+	SV_PROFILE_BEGIN( PROF_GAME_PRETHINK );
 	svgame.dllFuncs.pfnPlayerPreThink( clent );
+	SV_PROFILE_END();
 	SV_PlayerRunThink( clent, frametime, cl->timebase );
 
 	// If conveyor, or think, set basevelocity, then send to client asap too.
@@ -1097,7 +1833,9 @@ void SV_RunCmd( sv_client_t *cl, usercmd_t *ucmd, int random_seed )
 	SV_SetupPMove( svgame.pmove, cl, ucmd, cl->physinfo );
 
 	// motor!
+	SV_PROFILE_BEGIN( PROF_GAME_PM_MOVE );
 	svgame.dllFuncs.pfnPM_Move( svgame.pmove, true );
+	SV_PROFILE_END();
 
 	// copy results back to client
 	SV_FinishPMove( svgame.pmove, cl );
@@ -1135,11 +1873,43 @@ void SV_RunCmd( sv_client_t *cl, usercmd_t *ucmd, int random_seed )
 	svgame.globals->frametime = frametime;
 
 	// run post-think
+	SV_PROFILE_BEGIN( PROF_GAME_POSTTHINK );
 	svgame.dllFuncs.pfnPlayerPostThink( clent );
+	SV_PROFILE_END();
+	SV_PROFILE_BEGIN( PROF_GAME_CMDEND );
 	svgame.dllFuncs.pfnCmdEnd( clent );
+	SV_PROFILE_END();
 
 	if( !FBitSet( cl->flags, FCL_FAKECLIENT ))
 	{
 		SV_RestoreMoveInterpolant( cl );
 	}
 }
+
+#if XASH_ENGINE_TESTS
+#include "tests.h"
+
+static void Test_UnlagHistory( void )
+{
+	double	elapsed[2];
+	int	rewound[2];
+	float	error;
+
+	int	skip;
+
+	// every frame and a client with low cl_updaterate
+	for( skip = 1; skip <= 4; skip += 3 )
+	{
+		error = SV_UnlagSimulate( MAX_CLIENTS, 500, MAX_CLIENTS + 64, skip, elapsed, rewound );
+
+		TASSERT( rewound[0] > 0 );
+		TASSERT( rewound[0] == rewound[1] );
+		TASSERT( error < 0.01f );
+	}
+}
+
+void Test_RunUnlag( void )
+{
+	TRUN( Test_UnlagHistory() );
+}
+#endif
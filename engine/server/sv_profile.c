@@ -0,0 +1,443 @@
+/*
+sv_profile.c - scoped timers for server frame
+Copyright (C) 2026 Xash3D FWGS contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+
+#include "common.h"
+#include "server.h"
+#include "threads.h"
+
+/*
+==============================================================================
+
+Every thread that enters a scope gets its own ring of finished
+events, so recording needs no locks. Rings are read only from
+console commands, between frames, when worker threads are idle.
+sv_profile is latched at the frame start so scopes never straddle
+the moment profiling was switched on or off
+
+==============================================================================
+*/
+#define PROF_MAX_EVENTS	65536	// per thread, must be power of two
+#define PROF_MAX_THREADS	( MAX_JOB_THREADS + 1 )
+#define PROF_MAX_DEPTH	32
+
+typedef struct
+{
+	double		start;
+	double		end;
+	int		scope;
+} prof_event_t;
+
+typedef struct
+{
+	prof_event_t	*events;
+	uint		count;		// events ever written
+	uint		reported;		// count at the last summary
+	int		depth;
+	double		stack[PROF_MAX_DEPTH];
+	int		scopes[PROF_MAX_DEPTH];
+	double		totals[PROF_NUM_SCOPES];	// survive ring wrapping
+	uint		calls[PROF_NUM_SCOPES];
+} prof_thread_t;
+
+static const char *prof_names[PROF_NUM_SCOPES] =
+{
+	"Host_ServerFrame",
+	"SV_ReadPackets",
+	"SV_RunGameFrame",
+	"SV_Physics",
+	"SV_SendClientMessages",
+	"SV_AddEntitiesToPacket",
+	"SV_WritePacketEntities",
+	"StartFrame",
+	"Think",
+	"Touch",
+	"Blocked",
+	"PlayerPreThink",
+	"PlayerPostThink",
+	"CmdStart",
+	"CmdEnd",
+	"PM_Move",
+	"ClientCommand",
+	"SetupVisibility",
+	"UpdateClientData",
+	"SV_PhysicsEntity",
+	"SV_EndFrame",
+};
+
+static prof_thread_t	prof_threads[PROF_MAX_THREADS];
+static volatile int		prof_numthreads = 1;	// main thread is always first
+static double		prof_lastreport;
+qboolean			sv_profiling;
+
+#ifdef XASH_THREADS_AVAILABLE
+static XASH_THREAD_LOCAL int	prof_slot; // 1-based, so zero means not registered yet
+#endif
+
+/*
+================
+SV_ProfileThread
+
+================
+*/
+static prof_thread_t *SV_ProfileThread( void )
+{
+#ifdef XASH_THREADS_AVAILABLE
+	if( !prof_slot )
+	{
+		// main thread gets the first slot on its first frame
+		prof_slot = Sys_AtomicAdd( &prof_numthreads, 1 ) + 1;
+	}
+
+	if( prof_slot > PROF_MAX_THREADS )
+		return NULL;
+
+	return &prof_threads[prof_slot - 1];
+#else
+	return &prof_threads[0];
+#endif
+}
+
+/*
+================
+SV_ProfileBegin
+
+================
+*/
+void SV_ProfileBegin( profscope_t scope )
+{
+	prof_thread_t	*pt = SV_ProfileThread();
+
+	if( !pt || !pt->events )
+		return;
+
+	if( pt->depth < PROF_MAX_DEPTH )
+	{
+		pt->scopes[pt->depth] = scope;
+		pt->stack[pt->depth] = Sys_DoubleTime();
+	}
+	pt->depth++;
+}
+
+/*
+================
+SV_ProfileEnd
+
+closes the innermost scope
+================
+*/
+void SV_ProfileEnd( void )
+{
+	prof_thread_t	*pt = SV_ProfileThread();
+	prof_event_t	*ev;
+
+	if( !pt || !pt->events || pt->depth <= 0 )
+		return;
+
+	if( --pt->depth >= PROF_MAX_DEPTH )
+		return;
+
+	ev = &pt->events[pt->count & ( PROF_MAX_EVENTS - 1 )];
+	ev->scope = pt->scopes[pt->depth];
+	ev->start = pt->stack[pt->depth];
+	ev->end = Sys_DoubleTime();
+	pt->totals[ev->scope] += ev->end - ev->start;
+	pt->calls[ev->scope]++;
+	pt->count++;
+}
+
+/*
+================
+SV_ProfileFrame
+
+called on the main thread before any scope is opened
+================
+*/
+void SV_ProfileFrame( void )
+{
+	int	i;
+
+	if( sv_profile.value <= 0.0f )
+	{
+		sv_profiling = false;
+		return;
+	}
+
+#ifdef XASH_THREADS_AVAILABLE
+	// claim the first slot before any worker could
+	if( !prof_slot )
+		prof_slot = 1;
+#endif
+
+	if( !sv_profiling )
+	{
+		// start over, old events belong to another session
+		for( i = 0; i < PROF_MAX_THREADS; i++ )
+		{
+			prof_threads[i].count = prof_threads[i].reported = 0;
+			memset( prof_threads[i].totals, 0, sizeof( prof_threads[i].totals ));
+			memset( prof_threads[i].calls, 0, sizeof( prof_threads[i].calls ));
+		}
+		prof_lastreport = host.realtime;
+		sv_profiling = true;
+	}
+
+	// workers can only appear between frames, give them rings here
+	for( i = 0; i < Q_min( prof_numthreads, PROF_MAX_THREADS ); i++ )
+	{
+		if( !prof_threads[i].events )
+			prof_threads[i].events = Mem_Malloc( host.mempool, PROF_MAX_EVENTS * sizeof( prof_event_t ));
+	}
+
+	// recover after Host_Error thrown out of a scope
+	prof_threads[0].depth = 0;
+
+	if( host.realtime - prof_lastreport >= sv_profile.value )
+	{
+		SV_ProfileReport( true );
+		prof_lastreport = host.realtime;
+	}
+}
+
+static int SV_CompareTimes( const void *a, const void *b )
+{
+	double	da = *(const double *)a;
+	double	db = *(const double *)b;
+
+	return ( da > db ) - ( da < db );
+}
+
+/*
+================
+SV_ProfileReport
+
+prints p50/p99 of every scope seen since the last report,
+or over everything still in rings
+================
+*/
+void SV_ProfileReport( qboolean rolling )
+{
+	double	*times;
+	int	numtimes[PROF_NUM_SCOPES];
+	int	maxtimes = 0;
+	qboolean	truncated = false;
+	int	i, j, scope;
+
+	memset( numtimes, 0, sizeof( numtimes ));
+
+	for( i = 0; i < Q_min( prof_numthreads, PROF_MAX_THREADS ); i++ )
+	{
+		prof_thread_t	*pt = &prof_threads[i];
+		uint		first = rolling ? pt->reported : 0;
+
+		if( pt->count - first > PROF_MAX_EVENTS )
+		{
+			truncated = rolling;
+			first = pt->count - PROF_MAX_EVENTS;
+		}
+
+		for( ; first != pt->count; first++ )
+			numtimes[pt->events[first & ( PROF_MAX_EVENTS - 1 )].scope]++;
+	}
+
+	for( scope = 0; scope < PROF_NUM_SCOPES; scope++ )
+		maxtimes = Q_max( maxtimes, numtimes[scope] );
+
+	if( !maxtimes )
+	{
+		Con_Printf( "no profile data\n" );
+		return;
+	}
+
+	times = Mem_Malloc( host.mempool, maxtimes * sizeof( *times ));
+
+	Con_Printf( "%-24s %8s %9s %9s %9s %10s\n", "scope", "count", "p50 ms", "p99 ms", "max ms", "total ms" );
+
+	for( scope = 0; scope < PROF_NUM_SCOPES; scope++ )
+	{
+		double	total = 0.0;
+		int	count = 0;
+
+		if( !numtimes[scope] )
+			continue;
+
+		for( i = 0; i < Q_min( prof_numthreads, PROF_MAX_THREADS ); i++ )
+		{
+			prof_thread_t	*pt = &prof_threads[i];
+			uint		first = rolling ? pt->reported : 0;
+
+			if( pt->count - first > PROF_MAX_EVENTS )
+				first = pt->count - PROF_MAX_EVENTS;
+
+			for( ; first != pt->count; first++ )
+			{
+				prof_event_t	*ev = &pt->events[first & ( PROF_MAX_EVENTS - 1 )];
+
+				if( ev->scope != scope )
+					continue;
+
+				times[count++] = ( ev->end - ev->start ) * 1000.0;
+				total += ev->end - ev->start;
+			}
+		}
+
+		qsort( times, count, sizeof( *times ), SV_CompareTimes );
+
+		j = Q_min( count - 1, (int)( count * 0.99 ));
+		Con_Printf( "%-24s %8i %9.3f %9.3f %9.3f %10.2f\n", prof_names[scope], count,
+			times[count / 2], times[j], times[count - 1], total * 1000.0 );
+	}
+
+	if( truncated )
+		Con_Printf( "^3Warning:^7 rings wrapped, only the last %i events per thread are counted\n", PROF_MAX_EVENTS );
+
+	Mem_Free( times );
+
+	if( rolling )
+	{
+		for( i = 0; i < PROF_MAX_THREADS; i++ )
+			prof_threads[i].reported = prof_threads[i].count;
+	}
+}
+
+/*
+================
+SV_ProfileTotals
+
+time and calls of every scope, summed over
+all threads, since profiling was switched on
+================
+*/
+void SV_ProfileTotals( double *totals, int *calls )
+{
+	int	i, scope;
+
+	memset( totals, 0, PROF_NUM_SCOPES * sizeof( *totals ));
+	memset( calls, 0, PROF_NUM_SCOPES * sizeof( *calls ));
+
+	for( i = 0; i < Q_min( prof_numthreads, PROF_MAX_THREADS ); i++ )
+	{
+		for( scope = 0; scope < PROF_NUM_SCOPES; scope++ )
+		{
+			totals[scope] += prof_threads[i].totals[scope];
+			calls[scope] += prof_threads[i].calls[scope];
+		}
+	}
+}
+
+/*
+================
+SV_ProfileScopeName
+
+================
+*/
+const char *SV_ProfileScopeName( profscope_t scope )
+{
+	if( scope < 0 || scope >= PROF_NUM_SCOPES )
+		return "unknown";
+	return prof_names[scope];
+}
+
+/*
+================
+SV_ProfileReport_f
+
+================
+*/
+static void SV_ProfileReport_f( void )
+{
+	SV_ProfileReport( false );
+}
+
+/*
+================
+SV_ProfileDump_f
+
+writes everything still in rings as Chrome trace JSON,
+open it in chrome://tracing or Perfetto
+================
+*/
+static void SV_ProfileDump_f( void )
+{
+	const char	*filename = "sv_profile.json";
+	double		base = 0.0;
+	qboolean		first = true;
+	int		i, written = 0;
+	file_t		*f;
+
+	if( Cmd_Argc() > 1 )
+		filename = Cmd_Argv( 1 );
+
+	// timestamps are relative to the earliest start, outer
+	// scopes are stored after inner ones so check them all
+	for( i = 0; i < Q_min( prof_numthreads, PROF_MAX_THREADS ); i++ )
+	{
+		prof_thread_t	*pt = &prof_threads[i];
+		uint		ev = pt->count > PROF_MAX_EVENTS ? pt->count - PROF_MAX_EVENTS : 0;
+
+		for( ; ev != pt->count; ev++ )
+		{
+			if( base == 0.0 || pt->events[ev & ( PROF_MAX_EVENTS - 1 )].start < base )
+				base = pt->events[ev & ( PROF_MAX_EVENTS - 1 )].start;
+		}
+	}
+
+	if( !( f = FS_Open( filename, "w", true )))
+	{
+		Con_Printf( S_ERROR "couldn't write %s\n", filename );
+		return;
+	}
+
+	FS_Printf( f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+
+	for( i = 0; i < Q_min( prof_numthreads, PROF_MAX_THREADS ); i++ )
+	{
+		prof_thread_t	*pt = &prof_threads[i];
+		uint		ev = pt->count > PROF_MAX_EVENTS ? pt->count - PROF_MAX_EVENTS : 0;
+
+		if( !pt->count )
+			continue;
+
+		FS_Printf( f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%i,\"args\":{\"name\":\"%s\"}}",
+			first ? "" : ",\n", i, i ? va( "worker %i", i ) : "main" );
+		first = false;
+
+		for( ; ev != pt->count; ev++ )
+		{
+			prof_event_t	*e = &pt->events[ev & ( PROF_MAX_EVENTS - 1 )];
+
+			FS_Printf( f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%i,\"ts\":%.3f,\"dur\":%.3f}",
+				prof_names[e->scope], e->scope >= PROF_GAME_STARTFRAME ? "game" : "engine", i,
+				( e->start - base ) * 1000000.0, ( e->end - e->start ) * 1000000.0 );
+			written++;
+		}
+	}
+
+	FS_Printf( f, "\n]}\n" );
+	FS_Close( f );
+
+	Con_Printf( "wrote %i events to %s\n", written, filename );
+}
+
+/*
+================
+SV_InitProfiler
+
+================
+*/
+void SV_InitProfiler( void )
+{
+	Cmd_AddCommand( "sv_profile_report", SV_ProfileReport_f, "print timings of every recorded server scope" );
+	Cmd_AddCommand( "sv_profile_dump", SV_ProfileDump_f, "write recorded server scopes as Chrome trace JSON" );
+}
@@ -18,6 +18,7 @@ GNU General Public License for more details.
 #include "const.h"
 #include "pm_local.h"
 #include "studio.h"
+#include "threads.h"
 
 typedef struct moveclip_s
 {
@@ -40,9 +41,10 @@ HULL BOXES
 ===============================================================================
 */
 
-static hull_t	box_hull;
-static mclipnode_t	box_clipnodes[6];
-static mplane_t	box_planes[6];
+// physics jobs clip against boxes too, so every thread has its own
+static XASH_THREAD_LOCAL hull_t	box_hull;
+static XASH_THREAD_LOCAL mplane_t	box_planes[6];
+static mclipnode_t		box_clipnodes[6];
 
 /*
 ===================
@@ -56,11 +58,6 @@ void SV_InitBoxHull( void )
 {
 	int	i, side;
 
-	box_hull.clipnodes = box_clipnodes;
-	box_hull.planes = box_planes;
-	box_hull.firstclipnode = 0;
-	box_hull.lastclipnode = 5;
-
 	for( i = 0; i < 6; i++ )
 	{
 		box_clipnodes[i].planenum = i;
@@ -70,12 +67,33 @@ void SV_InitBoxHull( void )
 		box_clipnodes[i].children[side] = CONTENTS_EMPTY;
 		if( i != 5 ) box_clipnodes[i].children[side^1] = i + 1;
 		else box_clipnodes[i].children[side^1] = CONTENTS_SOLID;
+	}
+}
+
+/*
+===================
+SV_InitBoxPlanes
+
+called once by every thread that clips against a box
+===================
+*/
+static void SV_InitBoxPlanes( void )
+{
+	int	i;
+
+	box_hull.clipnodes = box_clipnodes;
+	box_hull.planes = box_planes;
+	box_hull.firstclipnode = 0;
+	box_hull.lastclipnode = 5;
 
+	memset( box_planes, 0, sizeof( box_planes ));
+
+	for( i = 0; i < 6; i++ )
+	{
 		box_planes[i].type = i>>1;
 		box_planes[i].normal[i>>1] = 1;
 		box_planes[i].signbits = 0;
 	}
-
 }
 
 /*
@@ -160,6 +178,9 @@ BSP trees instead of being compared directly.
 */
 hull_t *SV_HullForBox( const vec3_t mins, const vec3_t maxs )
 {
+	if( !box_hull.planes )
+		SV_InitBoxPlanes();
+
 	box_planes[0].dist = maxs[0];
 	box_planes[1].dist = mins[0];
 	box_planes[2].dist = maxs[1];
@@ -401,975 +422,2500 @@ hull_t *SV_HullForStudioModel( edict_t *ent, vec3_t mins, vec3_t maxs, vec3_t of
 /*
 ===============================================================================
 
-ENTITY AREA CHECKING
+ENTITY SEARCH INDEX
 
 ===============================================================================
 */
-static int	iTouchLinkSemaphore = 0;	// prevent recursion when SV_TouchLinks is active
-areanode_t	sv_areanodes[AREA_NODES];
-static int	sv_numareanodes;
+#define FIND_GRID_CELLS	64		// cells per axis, grid covers world bounds on x and y
+#define FIND_GRID_MINSIZE	256.0f		// don't make cells smaller than this
+#define FIND_STRING_HASH	1024
+
+static const size_t find_string_offsets[FIND_STRING_FIELDS] =
+{
+	offsetof( entvars_t, classname ),
+	offsetof( entvars_t, targetname ),
+	offsetof( entvars_t, globalname ),
+};
+
+// doubly linked lists of edict numbers, each edict can be in a single bucket
+typedef struct
+{
+	int		*head;		// [numbuckets]
+	int		*next;		// [max_edicts]
+	int		*prev;		// [max_edicts]
+	int		*bucket;		// [max_edicts], -1 if not listed
+} findlist_t;
+
+typedef struct sv_findindex_s
+{
+	// loose grid: entity is stored in cell which contains center of its absbox,
+	// entities that are larger than a cell are kept in the extra bucket
+	vec2_t		gridmins;
+	vec2_t		cellsize;
+	int		gridsize[2];
+	findlist_t	grid;
+
+	// edicts hashed by string value
+	findlist_t	strings[FIND_STRING_FIELDS];
+	string_t		*indexed[FIND_STRING_FIELDS];	// values which the edicts were hashed with
+
+	int		*candidates;		// [max_edicts] scratch list for queries
+} sv_findindex_t;
+
+#define FIND_GRID_LARGE	( FIND_GRID_CELLS * FIND_GRID_CELLS )
+
+static void SV_FindListAlloc( findlist_t *list, int numbuckets )
+{
+	int	i;
+
+	list->head = Mem_Malloc( svgame.mempool, sizeof( int ) * numbuckets );
+	list->next = Mem_Malloc( svgame.mempool, sizeof( int ) * GI->max_edicts );
+	list->prev = Mem_Malloc( svgame.mempool, sizeof( int ) * GI->max_edicts );
+	list->bucket = Mem_Malloc( svgame.mempool, sizeof( int ) * GI->max_edicts );
+
+	for( i = 0; i < numbuckets; i++ )
+		list->head[i] = -1;
+
+	for( i = 0; i < GI->max_edicts; i++ )
+		list->bucket[i] = -1;
+}
+
+static void SV_FindListRemove( findlist_t *list, int e )
+{
+	if( list->bucket[e] == -1 )
+		return;
+
+	if( list->prev[e] != -1 )
+		list->next[list->prev[e]] = list->next[e];
+	else list->head[list->bucket[e]] = list->next[e];
+
+	if( list->next[e] != -1 )
+		list->prev[list->next[e]] = list->prev[e];
+
+	list->bucket[e] = -1;
+}
+
+static void SV_FindListInsert( findlist_t *list, int e, int bucket )
+{
+	if( list->bucket[e] == bucket )
+		return;
+
+	SV_FindListRemove( list, e );
+
+	list->bucket[e] = bucket;
+	list->prev[e] = -1;
+	list->next[e] = list->head[bucket];
+	if( list->head[bucket] != -1 )
+		list->prev[list->head[bucket]] = e;
+	list->head[bucket] = e;
+}
 
 /*
 ===============
-SV_CreateAreaNode
+SV_FindGridCoord
 
-builds a uniformly subdivided tree for the given world size
+monotonic, clamps everything outside of the world into the border cells
 ===============
 */
-areanode_t *SV_CreateAreaNode( int depth, vec3_t mins, vec3_t maxs )
+static int SV_FindGridCoord( const sv_findindex_t *fi, int axis, float value )
 {
-	areanode_t	*anode;
-	vec3_t		size;
-	vec3_t		mins1, maxs1;
-	vec3_t		mins2, maxs2;
+	float	f = ( value - fi->gridmins[axis] ) / fi->cellsize[axis];
 
-	anode = &sv_areanodes[sv_numareanodes++];
+	if( !( f > 0.0f ))
+		return 0;
 
-	ClearLink( &anode->trigger_edicts );
-	ClearLink( &anode->solid_edicts );
-	ClearLink( &anode->portal_edicts );
+	if( f >= fi->gridsize[axis] )
+		return fi->gridsize[axis] - 1;
 
-	if( depth == AREA_DEPTH )
-	{
-		anode->axis = -1;
-		anode->children[0] = anode->children[1] = NULL;
-		return anode;
-	}
+	return (int)f;
+}
 
-	VectorSubtract( maxs, mins, size );
-	if( size[0] > size[1] )
-		anode->axis = 0;
-	else anode->axis = 1;
+static int SV_FindGridBucket( const sv_findindex_t *fi, const edict_t *ent )
+{
+	int	i, coord[2];
 
-	anode->dist = 0.5f * ( maxs[anode->axis] + mins[anode->axis] );
-	VectorCopy( mins, mins1 );
-	VectorCopy( mins, mins2 );
-	VectorCopy( maxs, maxs1 );
-	VectorCopy( maxs, maxs2 );
+	for( i = 0; i < 2; i++ )
+	{
+		// also catches NaN
+		if( !( ent->v.absmax[i] - ent->v.absmin[i] <= fi->cellsize[i] ))
+			return FIND_GRID_LARGE;
 
-	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
-	anode->children[0] = SV_CreateAreaNode( depth+1, mins2, maxs2 );
-	anode->children[1] = SV_CreateAreaNode( depth+1, mins1, maxs1 );
+		coord[i] = SV_FindGridCoord( fi, i, ( ent->v.absmin[i] + ent->v.absmax[i] ) * 0.5f );
+	}
 
-	return anode;
+	return coord[1] * FIND_GRID_CELLS + coord[0];
 }
 
 /*
 ===============
-SV_ClearWorld
+SV_UpdateFindIndex
 
+sync index with the current edict state
 ===============
 */
-void SV_ClearWorld( void )
+void SV_UpdateFindIndex( const edict_t *ent )
 {
-	int	i;
+	sv_findindex_t	*fi = svgame.findindex;
+	int		i, e;
 
-	SV_InitBoxHull(); // for box testing
+	if( !fi ) return;
 
-	// clear lightstyles
-	for( i = 0; i < MAX_LIGHTSTYLES; i++ )
+	e = NUM_FOR_EDICT( ent );
+
+	if( e <= 0 || e >= GI->max_edicts )
+		return;
+
+	if( ent->free )
 	{
-		sv.lightstyles[i].value = 256.0f;
-		sv.lightstyles[i].time = 0.0f;
+		SV_FindListRemove( &fi->grid, e );
+
+		for( i = 0; i < FIND_STRING_FIELDS; i++ )
+		{
+			SV_FindListRemove( &fi->strings[i], e );
+			fi->indexed[i][e] = 0;
+		}
+		return;
 	}
 
-	memset( sv_areanodes, 0, sizeof( sv_areanodes ));
-	iTouchLinkSemaphore = 0;
-	sv_numareanodes = 0;
+	SV_FindListInsert( &fi->grid, e, SV_FindGridBucket( fi, ent ));
 
-	SV_CreateAreaNode( 0, sv.worldmodel->mins, sv.worldmodel->maxs );
+	for( i = 0; i < FIND_STRING_FIELDS; i++ )
+	{
+		string_t	value = *(string_t *)((byte *)&ent->v + find_string_offsets[i] );
+		const char	*s;
+
+		if( fi->indexed[i][e] == value && fi->strings[i].bucket[e] != -1 )
+			continue;
+
+		fi->indexed[i][e] = value;
+		s = value ? STRING( value ) : NULL;
+
+		if( COM_CheckString( s ))
+			SV_FindListInsert( &fi->strings[i], e, COM_HashKey( s, FIND_STRING_HASH ));
+		else SV_FindListRemove( &fi->strings[i], e );
+	}
 }
 
 /*
 ===============
-SV_UnlinkEdict
+SV_RefreshFindIndex
+
+resync all the edicts, catches changes that was made
+by game dll directly without relinking
 ===============
 */
-void SV_UnlinkEdict( edict_t *ent )
+void SV_RefreshFindIndex( void )
 {
-	// not linked in anywhere
-	if( !ent->area.prev ) return;
+	int	e;
 
-	RemoveLink( &ent->area );
-	ent->area.prev = NULL;
-	ent->area.next = NULL;
+	if( !svgame.findindex )
+		return;
+
+	for( e = 1; e < svgame.numEntities; e++ )
+		SV_UpdateFindIndex( EDICT_NUM( e ));
 }
 
 /*
-====================
-SV_TouchLinks
-====================
+===============
+SV_ClearFindIndex
+
+setup grid for a new world and reindex everything
+===============
 */
-void SV_TouchLinks( edict_t *ent, areanode_t *node )
+static void SV_ClearFindIndex( void )
 {
-	link_t	*l, *next;
-	edict_t	*touch;
-	hull_t	*hull;
-	vec3_t	test, offset;
-	model_t	*mod;
+	sv_findindex_t	*fi = svgame.findindex;
+	int		i;
 
-	// touch linked edicts
-	for( l = node->trigger_edicts.next; l != &node->trigger_edicts; l = next )
+	if( !fi )
 	{
-		next = l->next;
-		touch = EDICT_FROM_AREA( l );
+		fi = svgame.findindex = Mem_Calloc( svgame.mempool, sizeof( *fi ));
 
-		if( svgame.physFuncs.SV_TriggerTouch != NULL )
+		SV_FindListAlloc( &fi->grid, FIND_GRID_LARGE + 1 );
+
+		for( i = 0; i < FIND_STRING_FIELDS; i++ )
 		{
-			// user dll can override trigger checking (Xash3D extension)
-			if( !svgame.physFuncs.SV_TriggerTouch( ent, touch ))
-				continue;
+			SV_FindListAlloc( &fi->strings[i], FIND_STRING_HASH );
+			fi->indexed[i] = Mem_Calloc( svgame.mempool, sizeof( string_t ) * GI->max_edicts );
 		}
-		else
-		{
-			if( touch == ent || touch->v.solid != SOLID_TRIGGER ) // disabled ?
-				continue;
-
-			if( touch->v.groupinfo && ent->v.groupinfo )
-			{
-				if( svs.groupop == GROUP_OP_AND && !FBitSet( touch->v.groupinfo, ent->v.groupinfo ))
-					continue;
-
-				if( svs.groupop == GROUP_OP_NAND && FBitSet( touch->v.groupinfo, ent->v.groupinfo ))
-					continue;
-			}
-
-			if( !BoundsIntersect( ent->v.absmin, ent->v.absmax, touch->v.absmin, touch->v.absmax ))
-				continue;
-
-			mod = SV_ModelHandle( touch->v.modelindex );
 
-			// check brush triggers accuracy
-			if( mod && mod->type == mod_brush )
-			{
-				// force to select bsp-hull
-				hull = SV_HullForBsp( touch, ent->v.mins, ent->v.maxs, offset );
+		fi->candidates = Mem_Malloc( svgame.mempool, sizeof( int ) * GI->max_edicts );
+	}
+	else
+	{
+		// grid is going to be changed
+		for( i = 0; i <= FIND_GRID_LARGE; i++ )
+			fi->grid.head[i] = -1;
 
-				// support for rotational triggers
-				if( FBitSet( mod->flags, MODEL_HAS_ORIGIN ) && !VectorIsNull( touch->v.angles ))
-				{
-					matrix4x4	matrix;
-					Matrix4x4_CreateFromEntity( matrix, touch->v.angles, offset, 1.0f );
-					Matrix4x4_VectorITransform( matrix, ent->v.origin, test );
-				}
-				else
-				{
-					// offset the test point appropriately for this hull.
-					VectorSubtract( ent->v.origin, offset, test );
-				}
+		for( i = 0; i < GI->max_edicts; i++ )
+			fi->grid.bucket[i] = -1;
+	}
 
-				// test hull for intersection with this model
-				if( PM_HullPointContents( hull, hull->firstclipnode, test ) != CONTENTS_SOLID )
-					continue;
-			}
-		}
+	for( i = 0; i < 2; i++ )
+	{
+		float	size = sv.worldmodel->maxs[i] - sv.worldmodel->mins[i];
 
-		// never touch the triggers when "playersonly" is active
-		if( !sv.playersonly )
-		{
-			svgame.globals->time = sv.time;
-			svgame.dllFuncs.pfnTouch( touch, ent );
-		}
+		fi->gridmins[i] = sv.worldmodel->mins[i];
+		fi->cellsize[i] = Q_max( size / FIND_GRID_CELLS, FIND_GRID_MINSIZE );
+		fi->gridsize[i] = bound( 1, (int)ceil( size / fi->cellsize[i] ), FIND_GRID_CELLS );
 	}
 
-	// recurse down both sides
-	if( node->axis == -1 ) return;
-
-	if( ent->v.absmax[node->axis] > node->dist )
-		SV_TouchLinks( ent, node->children[0] );
-	if( ent->v.absmin[node->axis] < node->dist )
-		SV_TouchLinks( ent, node->children[1] );
+	SV_RefreshFindIndex();
 }
 
 /*
 ===============
-SV_FindTouchedLeafs
+SV_FindSphereCandidates
 
+collect edicts after start which absbox may touch the sphere,
+returns unordered list
 ===============
 */
-void SV_FindTouchedLeafs( edict_t *ent, mnode_t *node, int *headnode )
+int *SV_FindSphereCandidates( int start, const vec3_t org, float radius, int *count )
 {
-	int	sides;
-	mleaf_t	*leaf;
+	sv_findindex_t	*fi = svgame.findindex;
+	int		mins[2], maxs[2];
+	int		i, x, y, e;
 
-	if( node->contents == CONTENTS_SOLID )
-		return;
+	*count = 0;
 
-	// add an efrag if the node is a leaf
-	if( node->contents < 0 )
+	if( !fi ) return NULL;
+
+	radius = fabs( radius );
+
+	// expand by half cell so loose placement is covered
+	for( i = 0; i < 2; i++ )
 	{
-		if( ent->num_leafs > ( MAX_ENT_LEAFS - 1 ))
-		{
-			// continue counting leafs,
-			// so we know how many it's overrun
-			ent->num_leafs = (MAX_ENT_LEAFS + 1);
-		}
-		else
+		mins[i] = SV_FindGridCoord( fi, i, org[i] - radius - fi->cellsize[i] * 0.5f );
+		maxs[i] = SV_FindGridCoord( fi, i, org[i] + radius + fi->cellsize[i] * 0.5f );
+	}
+
+	for( y = mins[1]; y <= maxs[1]; y++ )
+	{
+		for( x = mins[0]; x <= maxs[0]; x++ )
 		{
-			leaf = (mleaf_t *)node;
-			ent->leafnums[ent->num_leafs] = leaf->cluster;
-			ent->num_leafs++;
+			for( e = fi->grid.head[y * FIND_GRID_CELLS + x]; e != -1; e = fi->grid.next[e] )
+			{
+				if( e > start )
+					fi->candidates[(*count)++] = e;
+			}
 		}
-		return;
 	}
 
-	// NODE_MIXED
-	sides = BOX_ON_PLANE_SIDE( ent->v.absmin, ent->v.absmax, node->plane );
-
-	if(( sides == 3 ) && ( *headnode == -1 ))
-		*headnode = node - sv.worldmodel->nodes;
+	for( e = fi->grid.head[FIND_GRID_LARGE]; e != -1; e = fi->grid.next[e] )
+	{
+		if( e > start )
+			fi->candidates[(*count)++] = e;
+	}
 
-	// recurse down the contacted sides
-	if( sides & 1 ) SV_FindTouchedLeafs( ent, node->children[0], headnode );
-	if( sides & 2 ) SV_FindTouchedLeafs( ent, node->children[1], headnode );
+	return fi->candidates;
 }
 
 /*
 ===============
-SV_LinkEdict
+SV_FindStringCandidates
+
+collect edicts after start which field value may be equal to the given string,
+returns unordered list. Game dlls assign names directly, e.g. right after
+DispatchSpawn, so edicts after start are checked for values the index
+doesn't know yet. That's a string_t compare per edict instead of a string
+compare, but keeps results the same as the linear scan
 ===============
 */
-void SV_LinkEdict( edict_t *ent, qboolean touch_triggers )
+int *SV_FindStringCandidates( int start, int field, const char *value, int *count )
 {
-	areanode_t	*node;
-	int		headnode;
+	sv_findindex_t	*fi = svgame.findindex;
+	const edict_t	*ent;
+	string_t		live;
+	int		e;
 
-	if( ent->area.prev ) SV_UnlinkEdict( ent );	// unlink from old position
-	if( ent == svgame.edicts ) return;		// don't add the world
-	if( !SV_IsValidEdict( ent )) return;		// never add freed ents
+	*count = 0;
 
-	// set the abs box
-	svgame.dllFuncs.pfnSetAbsBox( ent );
+	if( !fi || field < 0 || field >= FIND_STRING_FIELDS )
+		return NULL;
 
-	if( ent->v.movetype == MOVETYPE_FOLLOW && SV_IsValidEdict( ent->v.aiment ))
-	{
-		memcpy( ent->leafnums, ent->v.aiment->leafnums, sizeof( ent->leafnums ));
-		ent->num_leafs = ent->v.aiment->num_leafs;
-		ent->headnode = ent->v.aiment->headnode;
-	}
-	else
+	for( e = Q_max( start + 1, 1 ); e < svgame.numEntities; e++ )
 	{
-		// link to PVS leafs
-		ent->num_leafs = 0;
-		ent->headnode = -1;
-		headnode = -1;
+		ent = EDICT_NUM( e );
+		live = ent->free ? 0 : *(string_t *)((byte *)&ent->v + find_string_offsets[field] );
 
-		if( ent->v.modelindex )
-			SV_FindTouchedLeafs( ent, sv.worldmodel->nodes, &headnode );
+		if( fi->indexed[field][e] != live )
+			SV_UpdateFindIndex( ent );
+	}
 
-		if( ent->num_leafs > MAX_ENT_LEAFS )
-		{
-			memset( ent->leafnums, -1, sizeof( ent->leafnums ));
-			ent->num_leafs = 0;	// so we use headnode instead
-			ent->headnode = headnode;
-		}
+	for( e = fi->strings[field].head[COM_HashKey( value, FIND_STRING_HASH )]; e != -1; e = fi->strings[field].next[e] )
+	{
+		if( e > start )
+			fi->candidates[(*count)++] = e;
 	}
 
-	// ignore non-solid bodies
-	if( ent->v.solid == SOLID_NOT && ent->v.skin >= CONTENTS_EMPTY )
-		return;
+	return fi->candidates;
+}
 
-	// find the first node that the ent's box crosses
-	node = sv_areanodes;
+/*
+===============================================================================
 
-	while( 1 )
-	{
-		if( node->axis == -1 ) break;
-		if( ent->v.absmin[node->axis] > node->dist )
-			node = node->children[0];
-		else if( ent->v.absmax[node->axis] < node->dist )
-			node = node->children[1];
-		else break; // crosses the node
-	}
+ENTITY AREA CHECKING
 
-	// link it in
-	if( ent->v.solid == SOLID_TRIGGER )
-		InsertLinkBefore( &ent->area, &node->trigger_edicts );
-	else if( ent->v.solid == SOLID_PORTAL )
-		InsertLinkBefore( &ent->area, &node->portal_edicts );
-	else InsertLinkBefore( &ent->area, &node->solid_edicts );
+===============================================================================
+*/
+static int	iTouchLinkSemaphore = 0;	// prevent recursion when SV_TouchLinks is active
+areanode_t	sv_areanodes[MAX_AREA_NODES];
+static int	sv_numareanodes;
 
-	if( touch_triggers && !iTouchLinkSemaphore )
+// kept apart from areanode_t, game dlls see that one through physint
+typedef struct
+{
+	vec3_t		mins, maxs;
+	int		depth;
+	int		numsolids;	// only grows between recounts, unlinks aren't tracked
+} areanodeinfo_t;
+
+static areanodeinfo_t	sv_areanodeinfo[MAX_AREA_NODES];
+static int		sv_areamaxdepth;	// overrides sv_world_maxdepth if non-zero
+static qboolean		sv_areafull;	// a split was refused, see SV_CheckAreaNodes
+static double		sv_arearebuildtime;
+
+/*
+===============
+SV_CreateAreaNode
+
+builds a uniformly subdivided tree for the given world size
+===============
+*/
+areanode_t *SV_CreateAreaNode( int depth, vec3_t mins, vec3_t maxs )
+{
+	areanodeinfo_t	*info;
+	areanode_t	*anode;
+	vec3_t		size;
+	vec3_t		mins1, maxs1;
+	vec3_t		mins2, maxs2;
+
+	info = &sv_areanodeinfo[sv_numareanodes];
+	anode = &sv_areanodes[sv_numareanodes++];
+
+	ClearLink( &anode->trigger_edicts );
+	ClearLink( &anode->solid_edicts );
+	ClearLink( &anode->portal_edicts );
+
+	VectorCopy( mins, info->mins );
+	VectorCopy( maxs, info->maxs );
+	info->depth = depth;
+	info->numsolids = 0;
+
+	if( depth >= AREA_DEPTH )
 	{
-		iTouchLinkSemaphore = true;
-		SV_TouchLinks( ent, sv_areanodes );
-		iTouchLinkSemaphore = false;
+		anode->axis = -1;
+		anode->children[0] = anode->children[1] = NULL;
+		return anode;
 	}
+
+	VectorSubtract( maxs, mins, size );
+	if( size[0] > size[1] )
+		anode->axis = 0;
+	else anode->axis = 1;
+
+	anode->dist = 0.5f * ( maxs[anode->axis] + mins[anode->axis] );
+	VectorCopy( mins, mins1 );
+	VectorCopy( mins, mins2 );
+	VectorCopy( maxs, maxs1 );
+	VectorCopy( maxs, maxs2 );
+
+	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+	anode->children[0] = SV_CreateAreaNode( depth+1, mins2, maxs2 );
+	anode->children[1] = SV_CreateAreaNode( depth+1, mins1, maxs1 );
+
+	return anode;
 }
 
 /*
-===============================================================================
-
-POINT TESTING IN HULLS
+===============
+SV_AreaMaxDepth
 
-===============================================================================
+===============
 */
-void SV_WaterLinks( const vec3_t origin, int *pCont, areanode_t *node )
+static int SV_AreaMaxDepth( void )
 {
-	link_t	*l, *next;
-	edict_t	*touch;
-	hull_t	*hull;
-	vec3_t	test, offset;
-	model_t	*mod;
+	if( sv_areamaxdepth )
+		return sv_areamaxdepth;
 
-	// get water edicts
-	for( l = node->solid_edicts.next; l != &node->solid_edicts; l = next )
-	{
-		next = l->next;
-		touch = EDICT_FROM_AREA( l );
+	return bound( AREA_DEPTH, (int)sv_world_maxdepth.value, 32 );
+}
 
-		if( touch->v.solid != SOLID_NOT ) // disabled ?
-			continue;
+/*
+===============
+SV_SplitAreaNode
 
-		if( touch->v.groupinfo )
-		{
-			if( svs.groupop == GROUP_OP_AND && !FBitSet( touch->v.groupinfo, svs.groupmask ))
-				continue;
+turns a crowded leaf into a node and moves down the solid
+edicts that fit into one of its halves, keeping their order.
+Triggers and portals never go below AREA_DEPTH so the touch
+order stays the same as with the uniform tree
+===============
+*/
+static void SV_SplitAreaNode( areanode_t *node )
+{
+	areanodeinfo_t	*info = &sv_areanodeinfo[node - sv_areanodes];
+	areanode_t	*child;
+	link_t		*l, *next;
+	vec3_t		size, mins, maxs;
+	edict_t		*check;
+	int		axis;
+
+	if( sv_numareanodes + 2 > MAX_AREA_NODES )
+	{
+		sv_areafull = true;
+		return;
+	}
 
-			if( svs.groupop == GROUP_OP_NAND && FBitSet( touch->v.groupinfo, svs.groupmask ))
-				continue;
-		}
+	VectorSubtract( info->maxs, info->mins, size );
+	if( size[0] >= size[1] && size[0] >= size[2] )
+		axis = 0;
+	else if( size[1] >= size[2] )
+		axis = 1;
+	else axis = 2;
 
-		mod = SV_ModelHandle( touch->v.modelindex );
+	node->axis = axis;
+	node->dist = 0.5f * ( info->maxs[axis] + info->mins[axis] );
 
-		// only brushes can have special contents
-		if( !mod || mod->type != mod_brush )
-			continue;
+	VectorCopy( info->mins, mins );
+	VectorCopy( info->maxs, maxs );
+	mins[axis] = maxs[axis] = node->dist;
 
-		if( !BoundsIntersect( origin, origin, touch->v.absmin, touch->v.absmax ))
-			continue;
+	// leafs because depth is past AREA_DEPTH
+	node->children[0] = SV_CreateAreaNode( info->depth + 1, mins, info->maxs );
+	node->children[1] = SV_CreateAreaNode( info->depth + 1, info->mins, maxs );
+	info->numsolids = 0;
 
-		// check water brushes accuracy
-		hull = SV_HullForBsp( touch, vec3_origin, vec3_origin, offset );
+	for( l = node->solid_edicts.next; l != &node->solid_edicts; l = next )
+	{
+		next = l->next;
+		check = EDICT_FROM_AREA( l );
 
-		// support for rotational water
-		if( FBitSet( mod->flags, MODEL_HAS_ORIGIN ) && !VectorIsNull( touch->v.angles ))
-		{
-			matrix4x4	matrix;
-			Matrix4x4_CreateFromEntity( matrix, touch->v.angles, offset, 1.0f );
-			Matrix4x4_VectorITransform( matrix, origin, test );
-		}
+		if( check->v.absmin[axis] > node->dist )
+			child = node->children[0];
+		else if( check->v.absmax[axis] < node->dist )
+			child = node->children[1];
 		else
 		{
-			// offset the test point appropriately for this hull.
-			VectorSubtract( origin, offset, test );
-		}
-
-		// test hull for intersection with this model
-		if( PM_HullPointContents( hull, hull->firstclipnode, test ) == CONTENTS_EMPTY )
+			info->numsolids++;
 			continue;
+		}
 
-		// compare contents ranking
-		if( RankForContents( touch->v.skin ) > RankForContents( *pCont ))
-			*pCont = touch->v.skin; // new content has more priority
+		RemoveLink( l );
+		InsertLinkBefore( l, &child->solid_edicts );
+		sv_areanodeinfo[child - sv_areanodes].numsolids++;
 	}
-
-	// recurse down both sides
-	if( node->axis == -1 ) return;
-
-	if( origin[node->axis] > node->dist )
-		SV_WaterLinks( origin, pCont, node->children[0] );
-	if( origin[node->axis] < node->dist )
-		SV_WaterLinks( origin, pCont, node->children[1] );
 }
 
 /*
-=============
-SV_TruePointContents
+===============
+SV_LinkToAreaNode
 
-=============
+find the first node that the ent's box crosses
+===============
 */
-int SV_TruePointContents( const vec3_t p )
+static void SV_LinkToAreaNode( edict_t *ent )
 {
-	int	cont;
+	areanodeinfo_t	*info;
+	areanode_t	*node = sv_areanodes;
+	qboolean		solid = ent->v.solid != SOLID_TRIGGER && ent->v.solid != SOLID_PORTAL;
+	link_t		*l;
+	int		count;
 
-	// sanity check
-	if( !p ) return CONTENTS_NONE;
+	while( 1 )
+	{
+		if( node->axis == -1 ) break;
+		if( !solid && sv_areanodeinfo[node - sv_areanodes].depth >= AREA_DEPTH )
+			break; // below are adaptive nodes
+		if( ent->v.absmin[node->axis] > node->dist )
+			node = node->children[0];
+		else if( ent->v.absmax[node->axis] < node->dist )
+			node = node->children[1];
+		else break; // crosses the node
+	}
 
-	// get base contents from world
-	cont = PM_HullPointContents( &sv.worldmodel->hulls[0], 0, p );
+	// link it in
+	if( ent->v.solid == SOLID_TRIGGER )
+		InsertLinkBefore( &ent->area, &node->trigger_edicts );
+	else if( ent->v.solid == SOLID_PORTAL )
+		InsertLinkBefore( &ent->area, &node->portal_edicts );
+	else InsertLinkBefore( &ent->area, &node->solid_edicts );
 
-	// check all water entities
-	SV_WaterLinks( p, &cont, sv_areanodes );
+	if( !solid || node->axis != -1 )
+		return;
 
-	return cont;
-}
+	info = &sv_areanodeinfo[node - sv_areanodes];
 
-/*
-=============
-SV_PointContents
+	if( ++info->numsolids <= Q_max( 2, (int)sv_world_leafsize.value ) || info->depth >= SV_AreaMaxDepth( ))
+		return;
 
-=============
-*/
-int GAME_EXPORT SV_PointContents( const vec3_t p )
-{
-	int cont = SV_TruePointContents( p );
+	// some of counted edicts may have left already
+	for( count = 0, l = node->solid_edicts.next; l != &node->solid_edicts; l = l->next )
+		count++;
+	info->numsolids = count;
 
-	if( cont <= CONTENTS_CURRENT_0 && cont >= CONTENTS_CURRENT_DOWN )
-		cont = CONTENTS_WATER;
-	return cont;
+	if( count > Q_max( 2, (int)sv_world_leafsize.value ))
+		SV_SplitAreaNode( node );
 }
 
-//===========================================================================
-
 /*
-============
-SV_TestEntityPosition
+===============
+SV_RebuildAreaNodes
 
-returns true if the entity is in solid currently
-============
+relinks everything into a fresh tree, edicts come back in
+the same order so triggers keep their touch order
+===============
 */
-qboolean SV_TestEntityPosition( edict_t *ent, edict_t *blocker )
+static void SV_RebuildAreaNodes( void )
 {
-	qboolean	monsterClip = FBitSet( ent->v.flags, FL_MONSTERCLIP ) ? true : false;
-	trace_t	trace;
+	link_t	*lists[3], *l;
+	vec3_t	mins, maxs;
+	edict_t	**list;
+	int	i, j, count = 0;
 
-	if( FBitSet( ent->v.flags, FL_CLIENT|FL_FAKECLIENT ))
+	for( i = 0; i < sv_numareanodes; i++ )
 	{
-		// to avoid falling through tracktrain update client mins\maxs here
-		if( FBitSet( ent->v.flags, FL_DUCKING ))
-			SV_SetMinMaxSize( ent, svgame.pmove->player_mins[1], svgame.pmove->player_maxs[1], true );
-		else SV_SetMinMaxSize( ent, svgame.pmove->player_mins[0], svgame.pmove->player_maxs[0], true );
+		for( l = sv_areanodes[i].solid_edicts.next; l != &sv_areanodes[i].solid_edicts; l = l->next )
+			count++;
+		for( l = sv_areanodes[i].trigger_edicts.next; l != &sv_areanodes[i].trigger_edicts; l = l->next )
+			count++;
+		for( l = sv_areanodes[i].portal_edicts.next; l != &sv_areanodes[i].portal_edicts; l = l->next )
+			count++;
 	}
 
-	trace = SV_Move( ent->v.origin, ent->v.mins, ent->v.maxs, ent->v.origin, MOVE_NORMAL, ent, monsterClip );
+	list = Mem_Malloc( host.mempool, sizeof( *list ) * Q_max( count, 1 ));
 
-	if( SV_IsValidEdict( blocker ) && SV_IsValidEdict( trace.ent ))
+	for( i = count = 0; i < sv_numareanodes; i++ )
 	{
-		if( trace.ent->v.movetype == MOVETYPE_PUSH || trace.ent == blocker )
-			return trace.startsolid;
-		return false;
+		lists[0] = &sv_areanodes[i].trigger_edicts;
+		lists[1] = &sv_areanodes[i].solid_edicts;
+		lists[2] = &sv_areanodes[i].portal_edicts;
+
+		for( j = 0; j < 3; j++ )
+		{
+			for( l = lists[j]->next; l != lists[j]; l = l->next )
+				list[count++] = EDICT_FROM_AREA( l );
+		}
 	}
 
-	return trace.startsolid;
+	VectorCopy( sv_areanodeinfo[0].mins, mins );
+	VectorCopy( sv_areanodeinfo[0].maxs, maxs );
+
+	memset( sv_areanodes, 0, sizeof( sv_areanodes ));
+	sv_numareanodes = 0;
+
+	SV_CreateAreaNode( 0, mins, maxs );
+
+	for( i = 0; i < count; i++ )
+		SV_LinkToAreaNode( list[i] );
+
+	Mem_Free( list );
 }
 
 /*
-===============================================================================
-
-LINE TESTING IN HULLS
+===============
+SV_CheckAreaNodes
 
-===============================================================================
+Adaptive nodes are never merged back when their edicts leave,
+so the tree could run out of nodes on a long map. When a split
+was refused the tree is rebuilt, which keeps only the splits
+that are still crowded. At most once a second, if it's full
+even after that, the crowded leafs just stay unsplit
+===============
 */
+void SV_CheckAreaNodes( void )
+{
+	if( !sv_areafull || host.realtime < sv_arearebuildtime )
+		return;
+
+	SV_RebuildAreaNodes();
+	sv_areafull = false;
+	sv_arearebuildtime = host.realtime + 1.0;
+}
+
 /*
-==================
-SV_ClipMoveToEntity
+===============
+SV_ClearWorld
 
-Handles selection or creation of a clipping hull, and offseting (and
-eventually rotation) of the end points
-==================
+===============
 */
-void SV_ClipMoveToEntity( edict_t *ent, const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, trace_t *trace )
+void SV_ClearWorld( void )
 {
-	hull_t	*hull;
-	model_t	*model;
-	vec3_t	start_l, end_l;
-	vec3_t	offset, temp;
-	int	last_hitgroup;
-	trace_t	trace_hitbox;
-	int	i, j, hullcount;
-	qboolean	rotated, transform_bbox;
-	matrix4x4	matrix;
-
-	memset( trace, 0, sizeof( trace_t ));
-	VectorCopy( end, trace->endpos );
-	trace->fraction = 1.0f;
-	trace->allsolid = 1;
+	int	i;
 
-	model = SV_ModelHandle( ent->v.modelindex );
+	SV_InitBoxHull(); // for box testing
 
-	if( model && model->type == mod_studio )
+	// clear lightstyles
+	for( i = 0; i < MAX_LIGHTSTYLES; i++ )
 	{
-		hull = SV_HullForStudioModel( ent, mins, maxs, offset, &hullcount );
+		sv.lightstyles[i].value = 256.0f;
+		sv.lightstyles[i].time = 0.0f;
+	}
+
+	memset( sv_areanodes, 0, sizeof( sv_areanodes ));
+	iTouchLinkSemaphore = 0;
+	sv_numareanodes = 0;
+	sv_areafull = false;
+	sv_arearebuildtime = 0.0;
+
+	SV_CreateAreaNode( 0, sv.worldmodel->mins, sv.worldmodel->maxs );
+
+	SV_ClearFindIndex();
+	SV_ClearEntityLeafs();
+}
+
+/*
+===============
+SV_UnlinkEdict
+===============
+*/
+void SV_UnlinkEdict( edict_t *ent )
+{
+	// not linked in anywhere
+	if( !ent->area.prev ) return;
+
+	SV_PmoveLinkChanged( ent->v.absmin, ent->v.absmax );
+	RemoveLink( &ent->area );
+	ent->area.prev = NULL;
+	ent->area.next = NULL;
+}
+
+/*
+====================
+SV_TouchLinks
+====================
+*/
+void SV_TouchLinks( edict_t *ent, areanode_t *node )
+{
+	link_t	*l, *next;
+	edict_t	*touch;
+	hull_t	*hull;
+	vec3_t	test, offset;
+	model_t	*mod;
+
+	// touch linked edicts
+	for( l = node->trigger_edicts.next; l != &node->trigger_edicts; l = next )
+	{
+		next = l->next;
+		touch = EDICT_FROM_AREA( l );
+
+		if( svgame.physFuncs.SV_TriggerTouch != NULL )
+		{
+			// user dll can override trigger checking (Xash3D extension)
+			if( !svgame.physFuncs.SV_TriggerTouch( ent, touch ))
+				continue;
+		}
+		else
+		{
+			if( touch == ent || touch->v.solid != SOLID_TRIGGER ) // disabled ?
+				continue;
+
+			if( touch->v.groupinfo && ent->v.groupinfo )
+			{
+				if( svs.groupop == GROUP_OP_AND && !FBitSet( touch->v.groupinfo, ent->v.groupinfo ))
+					continue;
+
+				if( svs.groupop == GROUP_OP_NAND && FBitSet( touch->v.groupinfo, ent->v.groupinfo ))
+					continue;
+			}
+
+			if( !BoundsIntersect( ent->v.absmin, ent->v.absmax, touch->v.absmin, touch->v.absmax ))
+				continue;
+
+			mod = SV_ModelHandle( touch->v.modelindex );
+
+			// check brush triggers accuracy
+			if( mod && mod->type == mod_brush )
+			{
+				// force to select bsp-hull
+				hull = SV_HullForBsp( touch, ent->v.mins, ent->v.maxs, offset );
+
+				// support for rotational triggers
+				if( FBitSet( mod->flags, MODEL_HAS_ORIGIN ) && !VectorIsNull( touch->v.angles ))
+				{
+					matrix4x4	matrix;
+					Matrix4x4_CreateFromEntity( matrix, touch->v.angles, offset, 1.0f );
+					Matrix4x4_VectorITransform( matrix, ent->v.origin, test );
+				}
+				else
+				{
+					// offset the test point appropriately for this hull.
+					VectorSubtract( ent->v.origin, offset, test );
+				}
+
+				// test hull for intersection with this model
+				if( PM_HullPointContents( hull, hull->firstclipnode, test ) != CONTENTS_SOLID )
+					continue;
+			}
+		}
+
+		// never touch the triggers when "playersonly" is active
+		if( !sv.playersonly )
+		{
+			svgame.globals->time = sv.time;
+			SV_PROFILE_BEGIN( PROF_GAME_TOUCH );
+			svgame.dllFuncs.pfnTouch( touch, ent );
+			SV_PROFILE_END();
+		}
+	}
+
+	// recurse down both sides, triggers aren't linked to adaptive nodes
+	if( node->axis == -1 || sv_areanodeinfo[node - sv_areanodes].depth >= AREA_DEPTH ) return;
+
+	if( ent->v.absmax[node->axis] > node->dist )
+		SV_TouchLinks( ent, node->children[0] );
+	if( ent->v.absmin[node->axis] < node->dist )
+		SV_TouchLinks( ent, node->children[1] );
+}
+
+/*
+===============================================================================
+
+ENTITY LEAFS
+
+Leafs touched by a box only change when some node plane on the way
+to them starts to classify the box differently. The walk remembers
+how close the box came to any of those planes, so a relink that moves
+it by less than that keeps the leafs without walking the tree again.
+Lists that don't fit into edict are kept here too, so visibility
+checks can use them instead of headnode
+
+===============================================================================
+*/
+#define LINK_MAX_LEAFS	1024	// more than that is tracked by headnode only
+#define LINK_EPSILON	0.125f	// room for rounding in plane distances
+
+typedef struct sv_entleafs_s
+{
+	vec3_t		absmin;		// box the leafs were collected for
+	vec3_t		absmax;
+	float		slack;		// negative if the box must be walked again
+	int		headnode;
+	int		numleafs;		// may be more than fits into edict
+	int		maxleafs;
+	int		*leafs;
+} sv_entleafs_t;
+
+static struct
+{
+	int		leafs[LINK_MAX_LEAFS];
+	int		numleafs;
+	int		headnode;
+	float		slack;
+} sv_leafwalk;
+
+static struct
+{
+	uint		relinks;
+	uint		skipped;
+	uint		extended;		// didn't fit into edict, kept aside
+	uint		headnodes;	// didn't fit anywhere
+} link_stats;
+
+/*
+===============
+SV_PlaneSlack
+
+how far the box may move before it's on other side of the plane
+===============
+*/
+static float SV_PlaneSlack( const vec3_t mins, const vec3_t maxs, const mplane_t *plane )
+{
+	float	dmin, dmax;
+	int	i;
+
+	if( plane->type < 3 )
+	{
+		dmin = mins[plane->type] - plane->dist;
+		dmax = maxs[plane->type] - plane->dist;
+	}
+	else
+	{
+		dmin = dmax = -plane->dist;
+
+		for( i = 0; i < 3; i++ )
+		{
+			if( plane->normal[i] >= 0.0f )
+			{
+				dmin += plane->normal[i] * mins[i];
+				dmax += plane->normal[i] * maxs[i];
+			}
+			else
+			{
+				dmin += plane->normal[i] * maxs[i];
+				dmax += plane->normal[i] * mins[i];
+			}
+		}
+	}
+
+	return Q_min( fabs( dmin ), fabs( dmax ));
+}
+
+/*
+===============
+SV_WalkTouchedLeafs
+
+===============
+*/
+static void SV_WalkTouchedLeafs( const vec3_t mins, const vec3_t maxs, mnode_t *node )
+{
+	int	sides;
+
+	if( node->contents == CONTENTS_SOLID )
+		return;
+
+	if( node->contents < 0 )
+	{
+		// continue counting leafs,
+		// so we know how many it's overrun
+		if( sv_leafwalk.numleafs < LINK_MAX_LEAFS )
+			sv_leafwalk.leafs[sv_leafwalk.numleafs] = ((mleaf_t *)node)->cluster;
+		sv_leafwalk.numleafs++;
+		return;
+	}
+
+	// NODE_MIXED
+	sides = BOX_ON_PLANE_SIDE( mins, maxs, node->plane );
+	sv_leafwalk.slack = Q_min( sv_leafwalk.slack, SV_PlaneSlack( mins, maxs, node->plane ));
+
+	if(( sides == 3 ) && ( sv_leafwalk.headnode == -1 ))
+		sv_leafwalk.headnode = node - sv.worldmodel->nodes;
+
+	// recurse down the contacted sides
+	if( sides & 1 ) SV_WalkTouchedLeafs( mins, maxs, node->children[0] );
+	if( sides & 2 ) SV_WalkTouchedLeafs( mins, maxs, node->children[1] );
+}
+
+/*
+===============
+SV_CollectLeafs
+
+fills the list with leafs the box touches,
+returns false if the tree had to be walked
+===============
+*/
+static qboolean SV_CollectLeafs( sv_entleafs_t *el, const vec3_t absmin, const vec3_t absmax, poolhandle_t pool )
+{
+	float	moved = 0.0f;
+	int	i;
+
+	for( i = 0; i < 3; i++ )
+		moved += Q_max( fabs( absmin[i] - el->absmin[i] ), fabs( absmax[i] - el->absmax[i] ));
+
+	// nan never passes
+	if( el->slack >= 0.0f && ( moved == 0.0f || moved + LINK_EPSILON < el->slack ))
+		return true;
+
+	sv_leafwalk.numleafs = 0;
+	sv_leafwalk.headnode = -1;
+	sv_leafwalk.slack = 1e30f;
+
+	SV_WalkTouchedLeafs( absmin, absmax, sv.worldmodel->nodes );
+
+	if( sv_leafwalk.numleafs > el->maxleafs && sv_leafwalk.numleafs <= LINK_MAX_LEAFS )
+	{
+		el->maxleafs = Q_max( sv_leafwalk.numleafs, MAX_ENT_LEAFS * 2 );
+		el->leafs = Mem_Realloc( pool, el->leafs, el->maxleafs * sizeof( int ));
+	}
+
+	if( sv_leafwalk.numleafs <= LINK_MAX_LEAFS )
+		memcpy( el->leafs, sv_leafwalk.leafs, sv_leafwalk.numleafs * sizeof( int ));
+
+	VectorCopy( absmin, el->absmin );
+	VectorCopy( absmax, el->absmax );
+	el->numleafs = sv_leafwalk.numleafs;
+	el->headnode = sv_leafwalk.headnode;
+	el->slack = sv_leafwalk.slack;
+
+	return false;
+}
+
+/*
+===============
+SV_FindTouchedLeafs
+
+same as walking the tree for edict every time
+===============
+*/
+static void SV_FindTouchedLeafs( edict_t *ent )
+{
+	sv_entleafs_t	*el;
+	int		i;
+
+	if( !svgame.entleafs )
+	{
+		svgame.entleafs = Mem_Calloc( svgame.mempool, sizeof( sv_entleafs_t ) * GI->max_edicts );
+		SV_ClearEntityLeafs();
+	}
+
+	el = &svgame.entleafs[NUM_FOR_EDICT( ent )];
+	link_stats.relinks++;
+
+	if( SV_CollectLeafs( el, ent->v.absmin, ent->v.absmax, svgame.mempool ))
+		link_stats.skipped++;
+
+	if( el->numleafs <= MAX_ENT_LEAFS )
+	{
+		for( i = 0; i < el->numleafs; i++ )
+			ent->leafnums[i] = el->leafs[i];
+		ent->num_leafs = el->numleafs;
+		ent->headnode = -1;
+		return;
+	}
+
+	if( el->numleafs <= LINK_MAX_LEAFS )
+		link_stats.extended++;
+	else link_stats.headnodes++;
+
+	memset( ent->leafnums, -1, sizeof( ent->leafnums ));
+	ent->num_leafs = 0;	// so we use headnode instead
+	ent->headnode = el->headnode;
+}
+
+/*
+===============
+SV_EntityLeafs
+
+full leaf list of edict that has too many for its own
+array, NULL if there is none and headnode should be used.
+Followers take the leafs of their aiment
+===============
+*/
+const int *SV_EntityLeafs( const edict_t *ent, int *numleafs )
+{
+	const sv_entleafs_t	*el;
+
+	if( !svgame.entleafs || ent->headnode < 0 )
+		return NULL;
+
+	if( ent->v.movetype == MOVETYPE_FOLLOW && SV_IsValidEdict( ent->v.aiment ))
+		ent = ent->v.aiment;
+
+	el = &svgame.entleafs[NUM_FOR_EDICT( ent )];
+
+	if( el->headnode != ent->headnode || el->numleafs <= MAX_ENT_LEAFS || el->numleafs > LINK_MAX_LEAFS )
+		return NULL;
+
+	*numleafs = el->numleafs;
+	return el->leafs;
+}
+
+/*
+===============
+SV_ClearEntityLeafs
+
+===============
+*/
+void SV_ClearEntityLeafs( void )
+{
+	int	i;
+
+	if( !svgame.entleafs )
+		return;
+
+	// other map, other tree
+	for( i = 0; i < GI->max_edicts; i++ )
+	{
+		svgame.entleafs[i].slack = -1.0f;
+		svgame.entleafs[i].numleafs = 0;
+		svgame.entleafs[i].headnode = -1;
+	}
+}
+
+/*
+===============
+SV_PrintLinkStats_f
+
+===============
+*/
+void SV_PrintLinkStats_f( void )
+{
+	Msg( "%u relinks, %u kept their leafs (%.1f%%)\n", link_stats.relinks, link_stats.skipped,
+		link_stats.relinks ? link_stats.skipped * 100.0 / link_stats.relinks : 0.0 );
+	Msg( "%u had more than %i leafs and kept a full list, %u fell back to headnode\n",
+		link_stats.extended, MAX_ENT_LEAFS, link_stats.headnodes );
+
+	if( Cmd_Argc() > 1 && !Q_stricmp( Cmd_Argv( 1 ), "reset" ))
+		memset( &link_stats, 0, sizeof( link_stats ));
+}
+
+/*
+===============
+SV_LinkEdict
+===============
+*/
+void SV_LinkEdict( edict_t *ent, qboolean touch_triggers )
+{
+	if( ent->area.prev ) SV_UnlinkEdict( ent );	// unlink from old position
+	if( ent == svgame.edicts ) return;		// don't add the world
+	if( !SV_IsValidEdict( ent )) return;		// never add freed ents
+
+	// set the abs box
+	svgame.dllFuncs.pfnSetAbsBox( ent );
+	SV_PmoveLinkChanged( ent->v.absmin, ent->v.absmax );
+
+	SV_UpdateFindIndex( ent );
+
+	if( ent->v.movetype == MOVETYPE_FOLLOW && SV_IsValidEdict( ent->v.aiment ))
+	{
+		memcpy( ent->leafnums, ent->v.aiment->leafnums, sizeof( ent->leafnums ));
+		ent->num_leafs = ent->v.aiment->num_leafs;
+		ent->headnode = ent->v.aiment->headnode;
+
+		// own list is from the last position it was linked alone
+		if( svgame.entleafs )
+		{
+			sv_entleafs_t	*el = &svgame.entleafs[NUM_FOR_EDICT( ent )];
+
+			el->slack = -1.0f;
+			el->numleafs = 0;
+			el->headnode = -1;
+		}
+	}
+	else if( ent->v.modelindex )
+	{
+		// link to PVS leafs
+		SV_FindTouchedLeafs( ent );
+	}
+	else
+	{
+		ent->num_leafs = 0;
+		ent->headnode = -1;
+	}
+
+	// ignore non-solid bodies
+	if( ent->v.solid == SOLID_NOT && ent->v.skin >= CONTENTS_EMPTY )
+		return;
+
+	SV_LinkToAreaNode( ent );
+
+	if( touch_triggers && !iTouchLinkSemaphore )
+	{
+		iTouchLinkSemaphore = true;
+		SV_TouchLinks( ent, sv_areanodes );
+		iTouchLinkSemaphore = false;
+	}
+}
+
+/*
+===============================================================================
+
+POINT TESTING IN HULLS
+
+===============================================================================
+*/
+void SV_WaterLinks( const vec3_t origin, int *pCont, areanode_t *node )
+{
+	link_t	*l, *next;
+	edict_t	*touch;
+	hull_t	*hull;
+	vec3_t	test, offset;
+	model_t	*mod;
+
+	// get water edicts
+	for( l = node->solid_edicts.next; l != &node->solid_edicts; l = next )
+	{
+		next = l->next;
+		touch = EDICT_FROM_AREA( l );
+
+		if( touch->v.solid != SOLID_NOT ) // disabled ?
+			continue;
+
+		if( touch->v.groupinfo )
+		{
+			if( svs.groupop == GROUP_OP_AND && !FBitSet( touch->v.groupinfo, svs.groupmask ))
+				continue;
+
+			if( svs.groupop == GROUP_OP_NAND && FBitSet( touch->v.groupinfo, svs.groupmask ))
+				continue;
+		}
+
+		mod = SV_ModelHandle( touch->v.modelindex );
+
+		// only brushes can have special contents
+		if( !mod || mod->type != mod_brush )
+			continue;
+
+		if( !BoundsIntersect( origin, origin, touch->v.absmin, touch->v.absmax ))
+			continue;
+
+		// check water brushes accuracy
+		hull = SV_HullForBsp( touch, vec3_origin, vec3_origin, offset );
+
+		// support for rotational water
+		if( FBitSet( mod->flags, MODEL_HAS_ORIGIN ) && !VectorIsNull( touch->v.angles ))
+		{
+			matrix4x4	matrix;
+			Matrix4x4_CreateFromEntity( matrix, touch->v.angles, offset, 1.0f );
+			Matrix4x4_VectorITransform( matrix, origin, test );
+		}
+		else
+		{
+			// offset the test point appropriately for this hull.
+			VectorSubtract( origin, offset, test );
+		}
+
+		// test hull for intersection with this model
+		if( PM_HullPointContents( hull, hull->firstclipnode, test ) == CONTENTS_EMPTY )
+			continue;
+
+		// compare contents ranking
+		if( RankForContents( touch->v.skin ) > RankForContents( *pCont ))
+			*pCont = touch->v.skin; // new content has more priority
+	}
+
+	// recurse down both sides
+	if( node->axis == -1 ) return;
+
+	if( origin[node->axis] > node->dist )
+		SV_WaterLinks( origin, pCont, node->children[0] );
+	if( origin[node->axis] < node->dist )
+		SV_WaterLinks( origin, pCont, node->children[1] );
+}
+
+/*
+=============
+SV_TruePointContents
+
+=============
+*/
+int SV_TruePointContents( const vec3_t p )
+{
+	int	cont;
+
+	// sanity check
+	if( !p ) return CONTENTS_NONE;
+
+	// get base contents from world
+	cont = PM_HullPointContents( &sv.worldmodel->hulls[0], 0, p );
+
+	// check all water entities
+	SV_WaterLinks( p, &cont, sv_areanodes );
+
+	return cont;
+}
+
+/*
+=============
+SV_PointContents
+
+=============
+*/
+int GAME_EXPORT SV_PointContents( const vec3_t p )
+{
+	int cont = SV_TruePointContents( p );
+
+	if( cont <= CONTENTS_CURRENT_0 && cont >= CONTENTS_CURRENT_DOWN )
+		cont = CONTENTS_WATER;
+	return cont;
+}
+
+//===========================================================================
+
+/*
+============
+SV_TestEntityPosition
+
+returns true if the entity is in solid currently
+============
+*/
+qboolean SV_TestEntityPosition( edict_t *ent, edict_t *blocker )
+{
+	qboolean	monsterClip = FBitSet( ent->v.flags, FL_MONSTERCLIP ) ? true : false;
+	trace_t	trace;
+
+	if( FBitSet( ent->v.flags, FL_CLIENT|FL_FAKECLIENT ))
+	{
+		// to avoid falling through tracktrain update client mins\maxs here
+		if( FBitSet( ent->v.flags, FL_DUCKING ))
+			SV_SetMinMaxSize( ent, svgame.pmove->player_mins[1], svgame.pmove->player_maxs[1], true );
+		else SV_SetMinMaxSize( ent, svgame.pmove->player_mins[0], svgame.pmove->player_maxs[0], true );
+	}
+
+	trace = SV_Move( ent->v.origin, ent->v.mins, ent->v.maxs, ent->v.origin, MOVE_NORMAL, ent, monsterClip );
+
+	if( SV_IsValidEdict( blocker ) && SV_IsValidEdict( trace.ent ))
+	{
+		if( trace.ent->v.movetype == MOVETYPE_PUSH || trace.ent == blocker )
+			return trace.startsolid;
+		return false;
+	}
+
+	return trace.startsolid;
+}
+
+/*
+===============================================================================
+
+LINE TESTING IN HULLS
+
+===============================================================================
+*/
+/*
+==================
+SV_ClipMoveToEntity
+
+Handles selection or creation of a clipping hull, and offseting (and
+eventually rotation) of the end points
+==================
+*/
+void SV_ClipMoveToEntity( edict_t *ent, const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, trace_t *trace )
+{
+	hull_t	*hull;
+	model_t	*model;
+	vec3_t	start_l, end_l;
+	vec3_t	offset, temp;
+	int	last_hitgroup;
+	trace_t	trace_hitbox;
+	int	i, j, hullcount;
+	qboolean	rotated, transform_bbox;
+	matrix4x4	matrix;
+
+	memset( trace, 0, sizeof( trace_t ));
+	VectorCopy( end, trace->endpos );
+	trace->fraction = 1.0f;
+	trace->allsolid = 1;
+
+	model = SV_ModelHandle( ent->v.modelindex );
+
+	if( model && model->type == mod_studio )
+	{
+		hull = SV_HullForStudioModel( ent, mins, maxs, offset, &hullcount );
+	}
+	else
+	{
+		hull = SV_HullForEntity( ent, mins, maxs, offset );
+		hullcount = 1;
+	}
+
+	// rotate start and end into the models frame of reference
+	if(( ent->v.solid == SOLID_BSP || ent->v.solid == SOLID_PORTAL ) && !VectorIsNull( ent->v.angles ))
+		rotated = true;
+	else rotated = false;
+
+	if( FBitSet( host.features, ENGINE_PHYSICS_PUSHER_EXT ))
+	{
+		// keep untransformed bbox less than 45 degress or train on subtransit.bsp will stop working
+		if(( check_angles( ent->v.angles[0] ) || check_angles( ent->v.angles[2] )) && !VectorIsNull( mins ))
+			transform_bbox = true;
+		else transform_bbox = false;
+	}
+	else transform_bbox = false;
+
+	if( rotated )
+	{
+		vec3_t	out_mins, out_maxs;
+
+		if( transform_bbox )
+			Matrix4x4_CreateFromEntity( matrix, ent->v.angles, ent->v.origin, 1.0f );
+		else Matrix4x4_CreateFromEntity( matrix, ent->v.angles, offset, 1.0f );
+
+		Matrix4x4_VectorITransform( matrix, start, start_l );
+		Matrix4x4_VectorITransform( matrix, end, end_l );
+
+		if( transform_bbox )
+		{
+			World_TransformAABB( matrix, mins, maxs, out_mins, out_maxs );
+			VectorSubtract( hull->clip_mins, out_mins, offset ); // calc new local offset
+
+			for( j = 0; j < 3; j++ )
+			{
+				if( start_l[j] >= 0.0f )
+					start_l[j] -= offset[j];
+				else start_l[j] += offset[j];
+				if( end_l[j] >= 0.0f )
+					end_l[j] -= offset[j];
+				else end_l[j] += offset[j];
+			}
+		}
+	}
+	else
+	{
+		VectorSubtract( start, offset, start_l );
+		VectorSubtract( end, offset, end_l );
+	}
+
+	if( hullcount == 1 )
+	{
+		PM_RecursiveHullCheck( hull, hull->firstclipnode, 0.0f, 1.0f, start_l, end_l, (pmtrace_t *)trace );
+	}
+	else
+	{
+		last_hitgroup = 0;
+
+		for( i = 0; i < hullcount; i++ )
+		{
+			memset( &trace_hitbox, 0, sizeof( trace_t ));
+			VectorCopy( end, trace_hitbox.endpos );
+			trace_hitbox.fraction = 1.0;
+			trace_hitbox.allsolid = 1;
+
+			PM_RecursiveHullCheck( &hull[i], hull[i].firstclipnode, 0.0f, 1.0f, start_l, end_l, (pmtrace_t *)&trace_hitbox );
+
+			if( i == 0 || trace_hitbox.allsolid || trace_hitbox.startsolid || trace_hitbox.fraction < trace->fraction )
+			{
+				if( trace->startsolid )
+				{
+					*trace = trace_hitbox;
+					trace->startsolid = true;
+				}
+				else *trace = trace_hitbox;
+
+				last_hitgroup = i;
+			}
+		}
+
+		trace->hitgroup = Mod_HitgroupForStudioHull( last_hitgroup );
+	}
+
+	if( trace->fraction != 1.0f )
+	{
+		// compute endpos (generic case)
+		VectorLerp( start, trace->fraction, end, trace->endpos );
+
+		if( rotated )
+		{
+			// transform plane
+			VectorCopy( trace->plane.normal, temp );
+			Matrix4x4_TransformPositivePlane( matrix, temp, trace->plane.dist, trace->plane.normal, &trace->plane.dist );
+		}
+		else
+		{
+			trace->plane.dist = DotProduct( trace->endpos, trace->plane.normal );
+		}
+	}
+
+	if( trace->fraction < 1.0f || trace->startsolid )
+		trace->ent = ent;
+}
+
+/*
+==================
+SV_PortalCSG
+
+a portal is flush with a world surface behind it. this causes problems. namely that we can't pass through the portal plane
+if the bsp behind it prevents out origin from getting through. so if the trace was clipped and ended infront of the portal,
+continue the trace to the edges of the portal cutout instead.
+==================
+*/
+void SV_PortalCSG( edict_t *portal, const vec3_t trace_mins, const vec3_t trace_maxs, const vec3_t start, const vec3_t end, trace_t *trace )
+{
+	vec4_t	planes[6];	//far, near, right, left, up, down
+	int	plane, k;
+	vec3_t	worldpos;
+	float	bestfrac;
+	int	hitplane;
+	model_t	*model;
+	float	portalradius;
+
+	// only run this code if we impacted on the portal's parent.
+	if( trace->fraction == 1.0f && !trace->startsolid )
+		return;
+
+	// decide which clipping hull to use, based on the size
+	model = SV_ModelHandle( portal->v.modelindex );
+
+	if( !model || model->type != mod_brush )
+		return;
+
+	// make sure we use a sane valid position.
+	if( trace->startsolid ) VectorCopy( start, worldpos );
+	else VectorCopy( trace->endpos, worldpos );
+
+	// determine the csg area. normals should be facing in
+	AngleVectors( portal->v.angles, planes[1], planes[3], planes[5] );
+	VectorNegate(planes[1], planes[0]);
+	VectorNegate(planes[3], planes[2]);
+	VectorNegate(planes[5], planes[4]);
+
+	portalradius = model->radius * 0.5f;
+	planes[0][3] = DotProduct( portal->v.origin, planes[0] ) - (4.0f / 32.0f);
+	planes[1][3] = DotProduct( portal->v.origin, planes[1] ) - (4.0f / 32.0f);	//an epsilon beyond the portal
+	planes[2][3] = DotProduct( portal->v.origin, planes[2] ) - portalradius;
+	planes[3][3] = DotProduct( portal->v.origin, planes[3] ) - portalradius;
+	planes[4][3] = DotProduct( portal->v.origin, planes[4] ) - portalradius;
+	planes[5][3] = DotProduct( portal->v.origin, planes[5] ) - portalradius;
+
+	// if we're actually inside the csg region
+	for( plane = 0; plane < 6; plane++ )
+	{
+		float	d = DotProduct( worldpos, planes[plane] );
+		vec3_t	nearest;
+
+		for( k = 0; k < 3; k++ )
+			nearest[k] = (planes[plane][k]>=0) ? trace_maxs[k] : trace_mins[k];
+
+		// front plane gets further away with side
+		if( !plane )
+		{
+			planes[plane][3] -= DotProduct( nearest, planes[plane] );
+		}
+		else if( plane > 1 )
+		{
+			// side planes get nearer with size
+			planes[plane][3] += 24; // DotProduct( nearest, planes[plane] );
+		}
+
+		if( d - planes[plane][3] >= 0 )
+			continue;	// endpos is inside
+		else return; // end is already outside
+	}
+
+	// yup, we're inside, the trace shouldn't end where it actually did
+	bestfrac = 1;
+	hitplane = -1;
+
+	for( plane = 0; plane < 6; plane++ )
+	{
+		float	ds = DotProduct( start, planes[plane] ) - planes[plane][3];
+		float	de = DotProduct( end, planes[plane] ) - planes[plane][3];
+		float	frac;
+
+		if( ds >= 0 && de < 0 )
+		{
+			frac = (ds) / (ds - de);
+			if( frac < bestfrac )
+			{
+				if( frac < 0 )
+					frac = 0;
+				bestfrac = frac;
+				hitplane = plane;
+			}
+		}
+	}
+
+	trace->startsolid = trace->allsolid = false;
+
+	// if we cross the front of the portal, don't shorten the trace,
+	// that will artificially clip us
+	if( hitplane == 0 && trace->fraction > bestfrac )
+		return;
+
+	// okay, elongate to clip to the portal hole properly.
+	VectorLerp( start, bestfrac, end, trace->endpos );
+	trace->fraction = bestfrac;
+
+	if( hitplane >= 0 )
+	{
+		VectorCopy( planes[hitplane], trace->plane.normal );
+		trace->plane.dist = planes[hitplane][3];
+		if( hitplane == 1 ) trace->ent = portal;
+	}
+}
+
+/*
+==================
+SV_CustomClipMoveToEntity
+
+A part of physics engine implementation
+or custom physics implementation
+==================
+*/
+void SV_CustomClipMoveToEntity( edict_t *ent, const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, trace_t *trace )
+{
+	// initialize custom trace
+	memset( trace, 0, sizeof( trace_t ));
+	VectorCopy( end, trace->endpos );
+	trace->allsolid = true;
+	trace->fraction = 1.0f;
+
+	if( svgame.physFuncs.ClipMoveToEntity != NULL )
+	{
+		// do custom sweep test
+		svgame.physFuncs.ClipMoveToEntity( ent, start, mins, maxs, end, trace );
+	}
+	else
+	{
+		// function is missed, so we didn't hit anything
+		trace->allsolid = false;
+	}
+}
+
+/*
+====================
+SV_ClipToEntity
+
+generic clip function
+====================
+*/
+static qboolean SV_ClipToEntity( edict_t *touch, moveclip_t *clip )
+{
+	trace_t	trace;
+	model_t	*mod;
+
+	if( touch->v.groupinfo && SV_IsValidEdict( clip->passedict ) && clip->passedict->v.groupinfo != 0 )
+	{
+		if( svs.groupop == GROUP_OP_AND && !FBitSet( touch->v.groupinfo, clip->passedict->v.groupinfo ))
+			return true;
+
+		if( svs.groupop == GROUP_OP_NAND && FBitSet( touch->v.groupinfo, clip->passedict->v.groupinfo ))
+			return true;
+	}
+
+	if( touch == clip->passedict || touch->v.solid == SOLID_NOT )
+		return true;
+
+	if( touch->v.solid == SOLID_TRIGGER )
+		Host_Error( "trigger in clipping list\n" );
+
+	// custom user filter
+	if( svgame.dllFuncs2.pfnShouldCollide )
+	{
+		if( !svgame.dllFuncs2.pfnShouldCollide( touch, clip->passedict ))
+			return true;
+	}
+
+	// monsterclip filter (solid custom is a static or dynamic bodies)
+	if( touch->v.solid == SOLID_BSP || touch->v.solid == SOLID_CUSTOM )
+	{
+		// func_monsterclip works only with monsters that have same flag!
+		if( FBitSet( touch->v.flags, FL_MONSTERCLIP ) && !clip->monsterclip )
+			return true;
 	}
 	else
 	{
-		hull = SV_HullForEntity( ent, mins, maxs, offset );
-		hullcount = 1;
+		// ignore all monsters but pushables
+		if( clip->type == MOVE_NOMONSTERS && touch->v.movetype != MOVETYPE_PUSHSTEP )
+			return true;
+	}
+
+	mod = SV_ModelHandle( touch->v.modelindex );
+
+	if( mod && mod->type == mod_brush && clip->ignoretrans )
+	{
+		// we ignore brushes with rendermode != kRenderNormal and without FL_WORLDBRUSH set
+		if( touch->v.rendermode != kRenderNormal && !FBitSet( touch->v.flags, FL_WORLDBRUSH ))
+			return true;
+	}
+
+	if( !BoundsIntersect( clip->boxmins, clip->boxmaxs, touch->v.absmin, touch->v.absmax ))
+		return true;
+
+	// aditional check to intersects clients with sphere
+	if( touch->v.solid != SOLID_SLIDEBOX && !SV_CheckSphereIntersection( touch, clip->start, clip->end ))
+		return true;
+
+	// Xash3D extension
+	if( SV_IsValidEdict( clip->passedict ) && clip->passedict->v.solid == SOLID_TRIGGER )
+	{
+		// never collide items and player (because call "give" always stuck item in player
+		// and total trace returns fail (old half-life bug)
+		// items touch should be done in SV_TouchLinks not here
+		if( FBitSet( touch->v.flags, FL_CLIENT|FL_FAKECLIENT ))
+			return true;
+	}
+
+	// g-cont. make sure what size is really zero - check all the components
+	if( SV_IsValidEdict( clip->passedict ) && !VectorIsNull( clip->passedict->v.size ) && VectorIsNull( touch->v.size ))
+		return true; // points never interact
+
+	// might intersect, so do an exact clip
+	if( clip->trace.allsolid ) return false;
+
+	if( SV_IsValidEdict( clip->passedict ))
+	{
+	 	if( touch->v.owner == clip->passedict )
+			return true; // don't clip against own missiles
+		if( clip->passedict->v.owner == touch )
+			return true; // don't clip against owner
+	}
+
+	// make sure we don't hit the world if we're inside the portal
+	if( touch->v.solid == SOLID_PORTAL )
+		SV_PortalCSG( touch, clip->mins, clip->maxs, clip->start, clip->end, &clip->trace );
+
+	if( touch->v.solid == SOLID_CUSTOM )
+		SV_CustomClipMoveToEntity( touch, clip->start, clip->mins, clip->maxs, clip->end, &trace );
+	else if( FBitSet( touch->v.flags, FL_MONSTER ))
+		SV_ClipMoveToEntity( touch, clip->start, clip->mins2, clip->maxs2, clip->end, &trace );
+	else SV_ClipMoveToEntity( touch, clip->start, clip->mins, clip->maxs, clip->end, &trace );
+
+	clip->trace = World_CombineTraces( &clip->trace, &trace, touch );
+
+	return true;
+}
+
+/*
+===============================================================================
+
+TRACE BENCHMARK
+
+===============================================================================
+*/
+typedef struct
+{
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	int		type;
+	int		passent;		// -1 if none
+	qboolean		monsterclip;
+} sv_savedtrace_t;
+
+static struct
+{
+	sv_savedtrace_t	*traces;
+	int		numtraces;
+	int		maxtraces;	// recording while below that
+	int		tested;		// edicts checked by SV_ClipToLinks
+	qboolean		replaying;	// only count while SV_ReplayTraces runs serially
+} sv_tracebench;
+
+/*
+====================
+SV_SaveTrace
+
+====================
+*/
+static void SV_SaveTrace( const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, int type, edict_t *e, qboolean monsterclip )
+{
+	sv_savedtrace_t	*trace = &sv_tracebench.traces[sv_tracebench.numtraces++];
+
+	VectorCopy( start, trace->start );
+	VectorCopy( end, trace->end );
+	VectorCopy( mins, trace->mins );
+	VectorCopy( maxs, trace->maxs );
+	trace->type = type;
+	trace->passent = e ? NUM_FOR_EDICT( e ) : -1;
+	trace->monsterclip = monsterclip;
+
+	if( sv_tracebench.numtraces == sv_tracebench.maxtraces )
+		Con_Printf( "recorded %i traces\n", sv_tracebench.numtraces );
+}
+
+/*
+====================
+SV_ReplayTraces
+
+====================
+*/
+static void SV_ReplayTraces( const char *name, int passes )
+{
+	sv_savedtrace_t	*trace;
+	double		start, time;
+	int		i, j;
+
+	SV_RebuildAreaNodes();
+	sv_tracebench.tested = 0;
+	sv_tracebench.replaying = true;
+	start = Sys_DoubleTime();
+
+	for( i = 0; i < passes; i++ )
+	{
+		for( j = 0, trace = sv_tracebench.traces; j < sv_tracebench.numtraces; j++, trace++ )
+		{
+			edict_t	*e = NULL;
+
+			if( trace->passent >= 0 && trace->passent < svgame.numEntities )
+				e = EDICT_NUM( trace->passent );
+
+			SV_Move( trace->start, trace->mins, trace->maxs, trace->end, trace->type, e, trace->monsterclip );
+		}
+	}
+
+	time = Sys_DoubleTime() - start;
+	sv_tracebench.replaying = false;
+
+	Con_Printf( "%-9s %5i nodes, %10.0f traces/s, %6.2f edicts tested per trace\n", name, sv_numareanodes,
+		sv_tracebench.numtraces * passes / Q_max( time, 0.000001 ),
+		(double)sv_tracebench.tested / ( sv_tracebench.numtraces * passes ));
+}
+
+/*
+====================
+SV_ReplayTracesBatched
+
+replays runs of recorded traces that could be
+one SV_MoveMany call both ways and compares them
+====================
+*/
+static void SV_ReplayTracesBatched( int passes )
+{
+	tracequery_t	queries[64];
+	trace_t		batched[64];
+	trace_t		single;
+	double		time[2] = { 0.0, 0.0 }, start;
+	int		i, j, k, count, total = 0, mismatch = 0;
+
+	for( j = 0; j < sv_tracebench.numtraces; j += count )
+	{
+		sv_savedtrace_t	*first = &sv_tracebench.traces[j];
+		edict_t		*e = NULL;
+
+		for( count = 0; count < 64 && j + count < sv_tracebench.numtraces; count++ )
+		{
+			sv_savedtrace_t	*trace = &sv_tracebench.traces[j + count];
+
+			if( trace->monsterclip || trace->type != first->type || trace->passent != first->passent )
+				break;
+
+			if( !VectorCompare( trace->mins, first->mins ) || !VectorCompare( trace->maxs, first->maxs ))
+				break;
+
+			VectorCopy( trace->start, queries[count].start );
+			VectorCopy( trace->end, queries[count].end );
+		}
+
+		if( !count )
+		{
+			count = 1; // monsterclip, not batchable
+			continue;
+		}
+
+		if( first->passent >= 0 && first->passent < svgame.numEntities )
+			e = EDICT_NUM( first->passent );
+
+		start = Sys_DoubleTime();
+		for( i = 0; i < passes; i++ )
+		{
+			for( k = 0; k < count; k++ )
+				single = SV_Move( queries[k].start, first->mins, first->maxs, queries[k].end, first->type, e, false );
+		}
+		time[0] += Sys_DoubleTime() - start;
+
+		start = Sys_DoubleTime();
+		for( i = 0; i < passes; i++ )
+			SV_MoveMany( queries, count, first->mins, first->maxs, first->type, e, batched );
+		time[1] += Sys_DoubleTime() - start;
+
+		for( k = 0; k < count; k++ )
+		{
+			single = SV_Move( queries[k].start, first->mins, first->maxs, queries[k].end, first->type, e, false );
+
+			if( single.fraction != batched[k].fraction || single.ent != batched[k].ent || !VectorCompare( single.endpos, batched[k].endpos )
+				|| single.allsolid != batched[k].allsolid || single.startsolid != batched[k].startsolid
+				|| !VectorCompare( single.plane.normal, batched[k].plane.normal ) || single.hitgroup != batched[k].hitgroup )
+				mismatch++;
+		}
+
+		total += count;
+	}
+
+	if( !total )
+		return;
+
+	Con_Printf( "batched   %5i traces in runs, %10.0f single/s, %10.0f batched/s, %i mismatches\n", total,
+		total * passes / Q_max( time[0], 0.000001 ), total * passes / Q_max( time[1], 0.000001 ), mismatch );
+}
+
+/*
+====================
+SV_TraceBench_f
+
+record SV_Move calls, then replay them with the uniform
+and the adaptive entity tree, and batched by SV_MoveMany
+====================
+*/
+void SV_TraceBench_f( void )
+{
+	if( Cmd_Argc() < 2 )
+	{
+		Con_Printf( S_USAGE "sv_tracebench record <count> | run [passes] | clear\n" );
+		return;
+	}
+
+	if( sv.state != ss_active )
+	{
+		Con_Printf( "server is not running\n" );
+		return;
+	}
+
+	if( !Q_stricmp( Cmd_Argv( 1 ), "record" ))
+	{
+		int	count = Q_max( 1, Q_atoi( Cmd_Argv( 2 )));
+
+		if( sv_tracebench.traces )
+			Mem_Free( sv_tracebench.traces );
+
+		sv_tracebench.traces = Mem_Malloc( host.mempool, sizeof( sv_savedtrace_t ) * count );
+		sv_tracebench.numtraces = 0;
+		sv_tracebench.maxtraces = count;
+		Con_Printf( "recording %i traces\n", count );
+	}
+	else if( !Q_stricmp( Cmd_Argv( 1 ), "run" ))
+	{
+		int	passes = Cmd_Argc() > 2 ? Q_max( 1, Q_atoi( Cmd_Argv( 2 ))) : 10;
+
+		if( !sv_tracebench.numtraces )
+		{
+			Con_Printf( "nothing recorded\n" );
+			return;
+		}
+
+		// stop recording, replays would go into the buffer too
+		sv_tracebench.maxtraces = sv_tracebench.numtraces;
+
+		sv_areamaxdepth = AREA_DEPTH;
+		SV_ReplayTraces( "uniform", passes );
+
+		sv_areamaxdepth = 0;
+		SV_ReplayTraces( "adaptive", passes );
+		SV_ReplayTracesBatched( passes );
+	}
+	else if( !Q_stricmp( Cmd_Argv( 1 ), "clear" ))
+	{
+		if( sv_tracebench.traces )
+			Mem_Free( sv_tracebench.traces );
+		memset( &sv_tracebench, 0, sizeof( sv_tracebench ));
 	}
+	else Con_Printf( S_USAGE "sv_tracebench record <count> | run [passes] | clear\n" );
+}
 
-	// rotate start and end into the models frame of reference
-	if(( ent->v.solid == SOLID_BSP || ent->v.solid == SOLID_PORTAL ) && !VectorIsNull( ent->v.angles ))
-		rotated = true;
-	else rotated = false;
+/*
+====================
+SV_HullTraceBench_f
 
-	if( FBitSet( host.features, ENGINE_PHYSICS_PUSHER_EXT ))
+compare hull trace kernels on the world hulls
+====================
+*/
+void SV_HullTraceBench_f( void )
+{
+	int	numrays = Cmd_Argc() > 1 ? Q_atoi( Cmd_Argv( 1 )) : 65536;
+	int	passes = Cmd_Argc() > 2 ? Q_atoi( Cmd_Argv( 2 )) : 4;
+
+	if( sv.state != ss_active || !sv.worldmodel )
 	{
-		// keep untransformed bbox less than 45 degress or train on subtransit.bsp will stop working
-		if(( check_angles( ent->v.angles[0] ) || check_angles( ent->v.angles[2] )) && !VectorIsNull( mins ))
-			transform_bbox = true;
-		else transform_bbox = false;
+		Con_Printf( "server is not running\n" );
+		return;
 	}
-	else transform_bbox = false;
 
-	if( rotated )
-	{
-		vec3_t	out_mins, out_maxs;
+	PM_HullTraceBench( sv.worldmodel, numrays, passes );
+}
 
-		if( transform_bbox )
-			Matrix4x4_CreateFromEntity( matrix, ent->v.angles, ent->v.origin, 1.0f );
-		else Matrix4x4_CreateFromEntity( matrix, ent->v.angles, offset, 1.0f );
+/*
+====================
+SV_ClipToLinks
 
-		Matrix4x4_VectorITransform( matrix, start, start_l );
-		Matrix4x4_VectorITransform( matrix, end, end_l );
+Mins and maxs enclose the entire area swept by the move
+====================
+*/
+static void SV_ClipToLinks( areanode_t *node, moveclip_t *clip )
+{
+	link_t	*l, *next;
+	edict_t	*touch;
 
-		if( transform_bbox )
-		{
-			World_TransformAABB( matrix, mins, maxs, out_mins, out_maxs );
-			VectorSubtract( hull->clip_mins, out_mins, offset ); // calc new local offset
+	// touch linked edicts
+	for( l = node->solid_edicts.next; l != &node->solid_edicts; l = next )
+	{
+		next = l->next;
 
-			for( j = 0; j < 3; j++ )
-			{
-				if( start_l[j] >= 0.0f )
-					start_l[j] -= offset[j];
-				else start_l[j] += offset[j];
-				if( end_l[j] >= 0.0f )
-					end_l[j] -= offset[j];
-				else end_l[j] += offset[j];
-			}
-		}
+		touch = EDICT_FROM_AREA( l );
+		if( sv_tracebench.replaying )
+			sv_tracebench.tested++;
+
+		if( !SV_ClipToEntity( touch, clip ))
+			return; // trace.allsoild
 	}
-	else
+
+	// recurse down both sides
+	if( node->axis == -1 ) return;
+
+	if( clip->boxmaxs[node->axis] > node->dist )
+		SV_ClipToLinks( node->children[0], clip );
+	if( clip->boxmins[node->axis] < node->dist )
+		SV_ClipToLinks( node->children[1], clip );
+}
+
+/*
+====================
+SV_ClipToPortals
+
+Mins and maxs enclose the entire area swept by the move
+====================
+*/
+static void SV_ClipToPortals( areanode_t *node, moveclip_t *clip )
+{
+	link_t	*l, *next;
+	edict_t	*touch;
+
+	// touch linked edicts
+	for( l = node->portal_edicts.next; l != &node->portal_edicts; l = next )
 	{
-		VectorSubtract( start, offset, start_l );
-		VectorSubtract( end, offset, end_l );
+		next = l->next;
+
+		touch = EDICT_FROM_AREA( l );
+
+		if( !SV_ClipToEntity( touch, clip ))
+			return; // trace.allsoild
 	}
 
-	if( hullcount == 1 )
+	// recurse down both sides, portals aren't linked to adaptive nodes
+	if( node->axis == -1 || sv_areanodeinfo[node - sv_areanodes].depth >= AREA_DEPTH ) return;
+
+	if( clip->boxmaxs[node->axis] > node->dist )
+		SV_ClipToPortals( node->children[0], clip );
+	if( clip->boxmins[node->axis] < node->dist )
+		SV_ClipToPortals( node->children[1], clip );
+}
+
+/*
+====================
+SV_ClipToWorldBrush
+
+Mins and maxs enclose the entire area swept by the move
+====================
+*/
+void SV_ClipToWorldBrush( areanode_t *node, moveclip_t *clip )
+{
+	link_t	*l, *next;
+	edict_t	*touch;
+	trace_t	trace;
+
+	for( l = node->solid_edicts.next; l != &node->solid_edicts; l = next )
 	{
-		PM_RecursiveHullCheck( hull, hull->firstclipnode, 0.0f, 1.0f, start_l, end_l, (pmtrace_t *)trace );
+		next = l->next;
+
+		touch = EDICT_FROM_AREA( l );
+
+		if( touch->v.solid != SOLID_BSP || touch == clip->passedict || !( touch->v.flags & FL_WORLDBRUSH ))
+			continue;
+
+		if( !BoundsIntersect( clip->boxmins, clip->boxmaxs, touch->v.absmin, touch->v.absmax ))
+			continue;
+
+		if( clip->trace.allsolid ) return;
+
+		SV_ClipMoveToEntity( touch, clip->start, clip->mins, clip->maxs, clip->end, &trace );
+
+		clip->trace = World_CombineTraces( &clip->trace, &trace, touch );
 	}
-	else
+
+	// recurse down both sides
+	if( node->axis == -1 ) return;
+
+	if( clip->boxmaxs[node->axis] > node->dist )
+		SV_ClipToWorldBrush( node->children[0], clip );
+
+	if( clip->boxmins[node->axis] < node->dist )
+		SV_ClipToWorldBrush( node->children[1], clip );
+}
+
+/*
+==================
+SV_Move
+==================
+*/
+trace_t SV_Move( const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, int type, edict_t *e, qboolean monsterclip )
+{
+	moveclip_t	clip;
+	vec3_t		trace_endpos;
+	float		trace_fraction;
+
+	if( sv_tracebench.numtraces < sv_tracebench.maxtraces )
+		SV_SaveTrace( start, mins, maxs, end, type, e, monsterclip );
+
+	memset( &clip, 0, sizeof( moveclip_t ));
+	SV_ClipMoveToEntity( EDICT_NUM( 0 ), start, mins, maxs, end, &clip.trace );
+
+	if( clip.trace.fraction != 0.0f )
 	{
-		last_hitgroup = 0;
+		VectorCopy( clip.trace.endpos, trace_endpos );
+		trace_fraction = clip.trace.fraction;
+		clip.trace.fraction = 1.0f;
+		clip.start = start;
+		clip.end = trace_endpos;
+		clip.type = (type & 0xFF);
+		clip.ignoretrans = type >> 8;
+		clip.monsterclip = false;
+		clip.passedict = (e) ? e : EDICT_NUM( 0 );
+		clip.mins = mins;
+		clip.maxs = maxs;
 
-		for( i = 0; i < hullcount; i++ )
+		if( monsterclip && !FBitSet( host.features, ENGINE_QUAKE_COMPATIBLE ))
+			clip.monsterclip = true;
+
+		if( clip.type == MOVE_MISSILE )
 		{
-			memset( &trace_hitbox, 0, sizeof( trace_t ));
-			VectorCopy( end, trace_hitbox.endpos );
-			trace_hitbox.fraction = 1.0;
-			trace_hitbox.allsolid = 1;
+			VectorSet( clip.mins2, -15.0f, -15.0f, -15.0f );
+			VectorSet( clip.maxs2,  15.0f,  15.0f,  15.0f );
+		}
+		else
+		{
+			VectorCopy( mins, clip.mins2 );
+			VectorCopy( maxs, clip.maxs2 );
+		}
 
-			PM_RecursiveHullCheck( &hull[i], hull[i].firstclipnode, 0.0f, 1.0f, start_l, end_l, (pmtrace_t *)&trace_hitbox );
+		World_MoveBounds( start, clip.mins2, clip.maxs2, trace_endpos, clip.boxmins, clip.boxmaxs );
+		SV_ClipToLinks( sv_areanodes, &clip );
+		SV_ClipToPortals( sv_areanodes, &clip );
 
-			if( i == 0 || trace_hitbox.allsolid || trace_hitbox.startsolid || trace_hitbox.fraction < trace->fraction )
-			{
-				if( trace->startsolid )
-				{
-					*trace = trace_hitbox;
-					trace->startsolid = true;
-				}
-				else *trace = trace_hitbox;
+		clip.trace.fraction *= trace_fraction;
+		svgame.globals->trace_ent = clip.trace.ent;
+	}
 
-				last_hitgroup = i;
-			}
-		}
+	SV_CopyTraceToGlobal( &clip.trace );
+
+	return clip.trace;
+}
+
+trace_t SV_MoveNormal( const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, int type, edict_t *e )
+{
+	return SV_Move( start, mins, maxs, end, type, e, false );
+}
+
+/*
+==================
+SV_MoveNoEnts
+==================
+*/
+trace_t SV_MoveNoEnts( const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, int type, edict_t *e )
+{
+	moveclip_t	clip;
+	vec3_t		trace_endpos;
+	float		trace_fraction;
+
+	memset( &clip, 0, sizeof( moveclip_t ));
+	SV_ClipMoveToEntity( EDICT_NUM( 0 ), start, mins, maxs, end, &clip.trace );
+
+	if( clip.trace.fraction != 0.0f )
+	{
+		VectorCopy( clip.trace.endpos, trace_endpos );
+		trace_fraction = clip.trace.fraction;
+		clip.trace.fraction = 1.0f;
+		clip.start = start;
+		clip.end = trace_endpos;
+		clip.type = (type & 0xFF);
+		clip.ignoretrans = type >> 8;
+		clip.monsterclip = false;
+		clip.passedict = (e) ? e : EDICT_NUM( 0 );
+		clip.mins = mins;
+		clip.maxs = maxs;
+
+		VectorCopy( mins, clip.mins2 );
+		VectorCopy( maxs, clip.maxs2 );
+
+		World_MoveBounds( start, clip.mins2, clip.maxs2, trace_endpos, clip.boxmins, clip.boxmaxs );
+		SV_ClipToWorldBrush( sv_areanodes, &clip );
+		SV_ClipToPortals( sv_areanodes, &clip );
 
-		trace->hitgroup = Mod_HitgroupForStudioHull( last_hitgroup );
+		clip.trace.fraction *= trace_fraction;
+		svgame.globals->trace_ent = clip.trace.ent;
 	}
 
-	if( trace->fraction != 1.0f )
-	{
-		// compute endpos (generic case)
-		VectorLerp( start, trace->fraction, end, trace->endpos );
-
-		if( rotated )
-		{
-			// transform plane
-			VectorCopy( trace->plane.normal, temp );
-			Matrix4x4_TransformPositivePlane( matrix, temp, trace->plane.dist, trace->plane.normal, &trace->plane.dist );
-		}
-		else
-		{
-			trace->plane.dist = DotProduct( trace->endpos, trace->plane.normal );
-		}
-	}
+	SV_CopyTraceToGlobal( &clip.trace );
 
-	if( trace->fraction < 1.0f || trace->startsolid )
-		trace->ent = ent;
+	return clip.trace;
 }
 
 /*
-==================
-SV_PortalCSG
+===============================================================================
 
-a portal is flush with a world surface behind it. this causes problems. namely that we can't pass through the portal plane
-if the bsp behind it prevents out origin from getting through. so if the trace was clipped and ended infront of the portal,
-continue the trace to the edges of the portal cutout instead.
-==================
-*/
-void SV_PortalCSG( edict_t *portal, const vec3_t trace_mins, const vec3_t trace_maxs, const vec3_t start, const vec3_t end, trace_t *trace )
-{
-	vec4_t	planes[6];	//far, near, right, left, up, down
-	int	plane, k;
-	vec3_t	worldpos;
-	float	bestfrac;
-	int	hitplane;
-	model_t	*model;
-	float	portalradius;
+BATCHED TRACES
 
-	// only run this code if we impacted on the portal's parent.
-	if( trace->fraction == 1.0f && !trace->startsolid )
-		return;
+===============================================================================
+*/
+#define MOVE_WORLD_BATCH	64
 
-	// decide which clipping hull to use, based on the size
-	model = SV_ModelHandle( portal->v.modelindex );
+static edict_t	*sv_movetouch[MAX_EDICTS];
 
-	if( !model || model->type != mod_brush )
-		return;
+/*
+====================
+SV_ClipWorldMany
 
-	// make sure we use a sane valid position.
-	if( trace->startsolid ) VectorCopy( start, worldpos );
-	else VectorCopy( trace->endpos, worldpos );
+SV_ClipMoveToEntity against the world for every query
+====================
+*/
+static void SV_ClipWorldMany( const tracequery_t *queries, int count, vec3_t mins, vec3_t maxs, trace_t *traces )
+{
+	edict_t	*world = EDICT_NUM( 0 );
+	vec3_t	start_l[MOVE_WORLD_BATCH], end_l[MOVE_WORLD_BATCH];
+	pmtrace_t	pmtraces[MOVE_WORLD_BATCH];
+	vec3_t	offset;
+	hull_t	*hull;
+	int	i, base, num;
 
-	// determine the csg area. normals should be facing in
-	AngleVectors( portal->v.angles, planes[1], planes[3], planes[5] );
-	VectorNegate(planes[1], planes[0]);
-	VectorNegate(planes[3], planes[2]);
-	VectorNegate(planes[5], planes[4]);
+	if( !VectorIsNull( world->v.angles ))
+	{
+		for( i = 0; i < count; i++ )
+			SV_ClipMoveToEntity( world, queries[i].start, mins, maxs, queries[i].end, &traces[i] );
+		return;
+	}
 
-	portalradius = model->radius * 0.5f;
-	planes[0][3] = DotProduct( portal->v.origin, planes[0] ) - (4.0f / 32.0f);
-	planes[1][3] = DotProduct( portal->v.origin, planes[1] ) - (4.0f / 32.0f);	//an epsilon beyond the portal
-	planes[2][3] = DotProduct( portal->v.origin, planes[2] ) - portalradius;
-	planes[3][3] = DotProduct( portal->v.origin, planes[3] ) - portalradius;
-	planes[4][3] = DotProduct( portal->v.origin, planes[4] ) - portalradius;
-	planes[5][3] = DotProduct( portal->v.origin, planes[5] ) - portalradius;
+	hull = SV_HullForEntity( world, mins, maxs, offset );
 
-	// if we're actually inside the csg region
-	for( plane = 0; plane < 6; plane++ )
+	for( base = 0; base < count; base += MOVE_WORLD_BATCH )
 	{
-		float	d = DotProduct( worldpos, planes[plane] );
-		vec3_t	nearest;
-
-		for( k = 0; k < 3; k++ )
-			nearest[k] = (planes[plane][k]>=0) ? trace_maxs[k] : trace_mins[k];
+		num = Q_min( count - base, MOVE_WORLD_BATCH );
 
-		// front plane gets further away with side
-		if( !plane )
-		{
-			planes[plane][3] -= DotProduct( nearest, planes[plane] );
-		}
-		else if( plane > 1 )
+		for( i = 0; i < num; i++ )
 		{
-			// side planes get nearer with size
-			planes[plane][3] += 24; // DotProduct( nearest, planes[plane] );
-		}
+			const tracequery_t	*q = &queries[base + i];
 
-		if( d - planes[plane][3] >= 0 )
-			continue;	// endpos is inside
-		else return; // end is already outside
-	}
+			memset( &pmtraces[i], 0, sizeof( pmtrace_t ));
+			VectorCopy( q->end, pmtraces[i].endpos );
+			pmtraces[i].fraction = 1.0f;
+			pmtraces[i].allsolid = true;
 
-	// yup, we're inside, the trace shouldn't end where it actually did
-	bestfrac = 1;
-	hitplane = -1;
+			VectorSubtract( q->start, offset, start_l[i] );
+			VectorSubtract( q->end, offset, end_l[i] );
+		}
 
-	for( plane = 0; plane < 6; plane++ )
-	{
-		float	ds = DotProduct( start, planes[plane] ) - planes[plane][3];
-		float	de = DotProduct( end, planes[plane] ) - planes[plane][3];
-		float	frac;
+		PM_HullTraceMany( hull, num, (const vec3_t *)start_l, (const vec3_t *)end_l, pmtraces );
 
-		if( ds >= 0 && de < 0 )
+		for( i = 0; i < num; i++ )
 		{
-			frac = (ds) / (ds - de);
-			if( frac < bestfrac )
+			const tracequery_t	*q = &queries[base + i];
+			trace_t		*trace = &traces[base + i];
+
+			memset( trace, 0, sizeof( trace_t ));
+			PM_ConvertTrace( trace, &pmtraces[i], NULL );
+
+			if( trace->fraction != 1.0f )
 			{
-				if( frac < 0 )
-					frac = 0;
-				bestfrac = frac;
-				hitplane = plane;
+				VectorLerp( q->start, trace->fraction, q->end, trace->endpos );
+				trace->plane.dist = DotProduct( trace->endpos, trace->plane.normal );
 			}
+
+			if( trace->fraction < 1.0f || trace->startsolid )
+				trace->ent = world;
 		}
 	}
+}
 
-	trace->startsolid = trace->allsolid = false;
+/*
+====================
+SV_GatherLinks
 
-	// if we cross the front of the portal, don't shorten the trace,
-	// that will artificially clip us
-	if( hitplane == 0 && trace->fraction > bestfrac )
-		return;
+collects solid edicts, then portals, that SV_ClipToLinks
+and SV_ClipToPortals could reach with that box
+====================
+*/
+static int SV_GatherLinks( areanode_t *node, const vec3_t boxmins, const vec3_t boxmaxs, qboolean portals, int count )
+{
+	link_t	*list = portals ? &node->portal_edicts : &node->solid_edicts;
+	link_t	*l;
 
-	// okay, elongate to clip to the portal hole properly.
-	VectorLerp( start, bestfrac, end, trace->endpos );
-	trace->fraction = bestfrac;
+	for( l = list->next; l != list; l = l->next )
+		sv_movetouch[count++] = EDICT_FROM_AREA( l );
 
-	if( hitplane >= 0 )
-	{
-		VectorCopy( planes[hitplane], trace->plane.normal );
-		trace->plane.dist = planes[hitplane][3];
-		if( hitplane == 1 ) trace->ent = portal;
-	}
+	if( node->axis == -1 )
+		return count;
+
+	if( portals && sv_areanodeinfo[node - sv_areanodes].depth >= AREA_DEPTH )
+		return count;
+
+	if( boxmaxs[node->axis] > node->dist )
+		count = SV_GatherLinks( node->children[0], boxmins, boxmaxs, portals, count );
+	if( boxmins[node->axis] < node->dist )
+		count = SV_GatherLinks( node->children[1], boxmins, boxmaxs, portals, count );
+
+	return count;
 }
 
 /*
 ==================
-SV_CustomClipMoveToEntity
+SV_MoveMany
 
-A part of physics engine implementation
-or custom physics implementation
+SV_Move for many queries of one size and one ignored edict.
+The world is traced for all of them at once and edicts are
+gathered once for the union of their boxes. Unlike SV_Move
+it doesn't write game trace globals
 ==================
 */
-void SV_CustomClipMoveToEntity( edict_t *ent, const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, trace_t *trace )
+void SV_MoveMany( const tracequery_t *queries, int count, vec3_t mins, vec3_t maxs, int type, edict_t *e, trace_t *traces )
 {
-	// initialize custom trace
-	memset( trace, 0, sizeof( trace_t ));
-	VectorCopy( end, trace->endpos );
-	trace->allsolid = true;
-	trace->fraction = 1.0f;
+	vec3_t		unionmins, unionmaxs;
+	vec3_t		trace_endpos;
+	float		trace_fraction;
+	moveclip_t	clip;
+	int		i, j, numtouch, numportals;
 
-	if( svgame.physFuncs.ClipMoveToEntity != NULL )
+	if( !queries || !traces || count <= 0 )
+		return;
+
+	SV_ClipWorldMany( queries, count, mins, maxs, traces );
+
+	memset( &clip, 0, sizeof( moveclip_t ));
+	clip.type = (type & 0xFF);
+	clip.ignoretrans = type >> 8;
+	clip.monsterclip = false;
+	clip.passedict = (e) ? e : EDICT_NUM( 0 );
+	clip.mins = mins;
+	clip.maxs = maxs;
+
+	if( clip.type == MOVE_MISSILE )
 	{
-		// do custom sweep test
-		svgame.physFuncs.ClipMoveToEntity( ent, start, mins, maxs, end, trace );
+		VectorSet( clip.mins2, -15.0f, -15.0f, -15.0f );
+		VectorSet( clip.maxs2,  15.0f,  15.0f,  15.0f );
 	}
 	else
 	{
-		// function is missed, so we didn't hit anything
-		trace->allsolid = false;
+		VectorCopy( mins, clip.mins2 );
+		VectorCopy( maxs, clip.maxs2 );
 	}
-}
-
-/*
-====================
-SV_ClipToEntity
 
-generic clip function
-====================
-*/
-static qboolean SV_ClipToEntity( edict_t *touch, moveclip_t *clip )
-{
-	trace_t	trace;
-	model_t	*mod;
+	ClearBounds( unionmins, unionmaxs );
 
-	if( touch->v.groupinfo && SV_IsValidEdict( clip->passedict ) && clip->passedict->v.groupinfo != 0 )
+	for( i = 0; i < count; i++ )
 	{
-		if( svs.groupop == GROUP_OP_AND && !FBitSet( touch->v.groupinfo, clip->passedict->v.groupinfo ))
-			return true;
+		if( traces[i].fraction == 0.0f )
+			continue;
 
-		if( svs.groupop == GROUP_OP_NAND && FBitSet( touch->v.groupinfo, clip->passedict->v.groupinfo ))
-			return true;
+		World_MoveBounds( queries[i].start, clip.mins2, clip.maxs2, traces[i].endpos, clip.boxmins, clip.boxmaxs );
+		AddPointToBounds( clip.boxmins, unionmins, unionmaxs );
+		AddPointToBounds( clip.boxmaxs, unionmins, unionmaxs );
 	}
 
-	if( touch == clip->passedict || touch->v.solid == SOLID_NOT )
-		return true;
-
-	if( touch->v.solid == SOLID_TRIGGER )
-		Host_Error( "trigger in clipping list\n" );
+	// everything was stuck in the world
+	if( unionmins[0] > unionmaxs[0] )
+		return;
 
-	// custom user filter
-	if( svgame.dllFuncs2.pfnShouldCollide )
-	{
-		if( !svgame.dllFuncs2.pfnShouldCollide( touch, clip->passedict ))
-			return true;
-	}
+	numtouch = SV_GatherLinks( sv_areanodes, unionmins, unionmaxs, false, 0 );
+	numportals = SV_GatherLinks( sv_areanodes, unionmins, unionmaxs, true, numtouch ) - numtouch;
 
-	// monsterclip filter (solid custom is a static or dynamic bodies)
-	if( touch->v.solid == SOLID_BSP || touch->v.solid == SOLID_CUSTOM )
-	{
-		// func_monsterclip works only with monsters that have same flag!
-		if( FBitSet( touch->v.flags, FL_MONSTERCLIP ) && !clip->monsterclip )
-			return true;
-	}
-	else
+	for( i = 0; i < count; i++ )
 	{
-		// ignore all monsters but pushables
-		if( clip->type == MOVE_NOMONSTERS && touch->v.movetype != MOVETYPE_PUSHSTEP )
-			return true;
-	}
-
-	mod = SV_ModelHandle( touch->v.modelindex );
+		if( traces[i].fraction == 0.0f )
+			continue;
 
-	if( mod && mod->type == mod_brush && clip->ignoretrans )
-	{
-		// we ignore brushes with rendermode != kRenderNormal and without FL_WORLDBRUSH set
-		if( touch->v.rendermode != kRenderNormal && !FBitSet( touch->v.flags, FL_WORLDBRUSH ))
-			return true;
-	}
+		clip.trace = traces[i];
+		VectorCopy( clip.trace.endpos, trace_endpos );
+		trace_fraction = clip.trace.fraction;
+		clip.trace.fraction = 1.0f;
+		clip.start = queries[i].start;
+		clip.end = trace_endpos;
 
-	if( !BoundsIntersect( clip->boxmins, clip->boxmaxs, touch->v.absmin, touch->v.absmax ))
-		return true;
+		World_MoveBounds( clip.start, clip.mins2, clip.maxs2, clip.end, clip.boxmins, clip.boxmaxs );
 
-	// aditional check to intersects clients with sphere
-	if( touch->v.solid != SOLID_SLIDEBOX && !SV_CheckSphereIntersection( touch, clip->start, clip->end ))
-		return true;
+		// edicts that can't touch this box are skipped early,
+		// SV_ClipToEntity would discard them anyway
+		for( j = 0; j < numtouch; j++ )
+		{
+			edict_t	*touch = sv_movetouch[j];
 
-	// Xash3D extension
-	if( SV_IsValidEdict( clip->passedict ) && clip->passedict->v.solid == SOLID_TRIGGER )
-	{
-		// never collide items and player (because call "give" always stuck item in player
-		// and total trace returns fail (old half-life bug)
-		// items touch should be done in SV_TouchLinks not here
-		if( FBitSet( touch->v.flags, FL_CLIENT|FL_FAKECLIENT ))
-			return true;
-	}
+			if( !BoundsIntersect( clip.boxmins, clip.boxmaxs, touch->v.absmin, touch->v.absmax ))
+				continue;
 
-	// g-cont. make sure what size is really zero - check all the components
-	if( SV_IsValidEdict( clip->passedict ) && !VectorIsNull( clip->passedict->v.size ) && VectorIsNull( touch->v.size ))
-		return true; // points never interact
+			if( !SV_ClipToEntity( touch, &clip ))
+				break; // trace.allsoild
+		}
 
-	// might intersect, so do an exact clip
-	if( clip->trace.allsolid ) return false;
+		for( j = numtouch; j < numtouch + numportals; j++ )
+		{
+			if( !SV_ClipToEntity( sv_movetouch[j], &clip ))
+				break;
+		}
 
-	if( SV_IsValidEdict( clip->passedict ))
-	{
-	 	if( touch->v.owner == clip->passedict )
-			return true; // don't clip against own missiles
-		if( clip->passedict->v.owner == touch )
-			return true; // don't clip against owner
+		clip.trace.fraction *= trace_fraction;
+		traces[i] = clip.trace;
 	}
+}
 
-	// make sure we don't hit the world if we're inside the portal
-	if( touch->v.solid == SOLID_PORTAL )
-		SV_PortalCSG( touch, clip->mins, clip->maxs, clip->start, clip->end, &clip->trace );
-
-	if( touch->v.solid == SOLID_CUSTOM )
-		SV_CustomClipMoveToEntity( touch, clip->start, clip->mins, clip->maxs, clip->end, &trace );
-	else if( FBitSet( touch->v.flags, FL_MONSTER ))
-		SV_ClipMoveToEntity( touch, clip->start, clip->mins2, clip->maxs2, clip->end, &trace );
-	else SV_ClipMoveToEntity( touch, clip->start, clip->mins, clip->maxs, clip->end, &trace );
+/*
+===============================================================================
 
-	clip->trace = World_CombineTraces( &clip->trace, &trace, touch );
+PREFETCHED TRACES
 
-	return true;
+===============================================================================
+*/
+/*
+====================
+SV_SaveClipState
+
+====================
+*/
+static void SV_SaveClipState( sv_clipstate_t *cs, edict_t *ent )
+{
+	cs->ent = ent;
+	cs->owner = ent->v.owner;
+	cs->solid = ent->v.solid;
+	cs->movetype = ent->v.movetype;
+	cs->flags = ent->v.flags;
+	cs->modelindex = ent->v.modelindex;
+	cs->rendermode = ent->v.rendermode;
+	cs->groupinfo = ent->v.groupinfo;
+	cs->sequence = ent->v.sequence;
+	cs->gaitsequence = ent->v.gaitsequence;
+	cs->skin = ent->v.skin;
+	cs->body = ent->v.body;
+	cs->gamestate = ent->v.gamestate;
+	cs->frame = ent->v.frame;
+	cs->scale = ent->v.scale;
+	VectorCopy( ent->v.origin, cs->origin );
+	VectorCopy( ent->v.angles, cs->angles );
+	VectorCopy( ent->v.mins, cs->mins );
+	VectorCopy( ent->v.maxs, cs->maxs );
+	VectorCopy( ent->v.size, cs->size );
+	VectorCopy( ent->v.absmin, cs->absmin );
+	VectorCopy( ent->v.absmax, cs->absmax );
+	memcpy( cs->controller, ent->v.controller, sizeof( cs->controller ));
+	memcpy( cs->blending, ent->v.blending, sizeof( cs->blending ));
 }
 
 /*
 ====================
-SV_ClipToLinks
+SV_ClipStateChanged
 
-Mins and maxs enclose the entire area swept by the move
+exact compare, so nan is a change too
 ====================
 */
-static void SV_ClipToLinks( areanode_t *node, moveclip_t *clip )
+static qboolean SV_ClipStateChanged( const sv_clipstate_t *cs )
 {
-	link_t	*l, *next;
-	edict_t	*touch;
+	const entvars_t	*v = &cs->ent->v;
 
-	// touch linked edicts
-	for( l = node->solid_edicts.next; l != &node->solid_edicts; l = next )
-	{
-		next = l->next;
+	if( cs->owner != v->owner || cs->solid != v->solid || cs->movetype != v->movetype || cs->flags != v->flags )
+		return true;
 
-		touch = EDICT_FROM_AREA( l );
+	if( cs->modelindex != v->modelindex || cs->rendermode != v->rendermode || cs->groupinfo != v->groupinfo )
+		return true;
 
-		if( !SV_ClipToEntity( touch, clip ))
-			return; // trace.allsoild
-	}
+	if( cs->sequence != v->sequence || cs->gaitsequence != v->gaitsequence || cs->skin != v->skin || cs->body != v->body )
+		return true;
 
-	// recurse down both sides
-	if( node->axis == -1 ) return;
+	if( cs->gamestate != v->gamestate )
+		return true;
 
-	if( clip->boxmaxs[node->axis] > node->dist )
-		SV_ClipToLinks( node->children[0], clip );
-	if( clip->boxmins[node->axis] < node->dist )
-		SV_ClipToLinks( node->children[1], clip );
+	if( !( cs->frame == v->frame ) || !( cs->scale == v->scale ))
+		return true;
+
+	if( !VectorCompare( cs->origin, v->origin ) || !VectorCompare( cs->angles, v->angles ))
+		return true;
+
+	if( !VectorCompare( cs->mins, v->mins ) || !VectorCompare( cs->maxs, v->maxs ) || !VectorCompare( cs->size, v->size ))
+		return true;
+
+	if( !VectorCompare( cs->absmin, v->absmin ) || !VectorCompare( cs->absmax, v->absmax ))
+		return true;
+
+	return memcmp( cs->controller, v->controller, sizeof( cs->controller )) || memcmp( cs->blending, v->blending, sizeof( cs->blending ));
 }
 
 /*
 ====================
-SV_ClipToPortals
+SV_GatherTouch
 
-Mins and maxs enclose the entire area swept by the move
+same walk as SV_ClipToLinks and SV_ClipToPortals, but only keeps
+edicts inside the box. Returns -1 if the list is full or there is
+an edict that SV_ClipToEntity would complain about
 ====================
 */
-static void SV_ClipToPortals( areanode_t *node, moveclip_t *clip )
+static int SV_GatherTouch( areanode_t *node, const vec3_t boxmins, const vec3_t boxmaxs, qboolean portals, edict_t **list, int count )
 {
-	link_t	*l, *next;
-	edict_t	*touch;
+	link_t	*head = portals ? &node->portal_edicts : &node->solid_edicts;
+	link_t	*l;
 
-	// touch linked edicts
-	for( l = node->portal_edicts.next; l != &node->portal_edicts; l = next )
+	for( l = head->next; l != head; l = l->next )
 	{
-		next = l->next;
+		edict_t	*touch = EDICT_FROM_AREA( l );
 
-		touch = EDICT_FROM_AREA( l );
+		if( touch->v.solid == SOLID_TRIGGER )
+			return -1;
 
-		if( !SV_ClipToEntity( touch, clip ))
-			return; // trace.allsoild
+		if( !BoundsIntersect( boxmins, boxmaxs, touch->v.absmin, touch->v.absmax ))
+			continue;
+
+		if( count == MOVE_PREFETCH_TOUCH )
+			return -1;
+
+		list[count++] = touch;
 	}
 
-	// recurse down both sides
-	if( node->axis == -1 ) return;
+	if( node->axis == -1 )
+		return count;
 
-	if( clip->boxmaxs[node->axis] > node->dist )
-		SV_ClipToPortals( node->children[0], clip );
-	if( clip->boxmins[node->axis] < node->dist )
-		SV_ClipToPortals( node->children[1], clip );
+	if( portals && sv_areanodeinfo[node - sv_areanodes].depth >= AREA_DEPTH )
+		return count;
+
+	if( boxmaxs[node->axis] > node->dist )
+		count = SV_GatherTouch( node->children[0], boxmins, boxmaxs, portals, list, count );
+	if( count >= 0 && boxmins[node->axis] < node->dist )
+		count = SV_GatherTouch( node->children[1], boxmins, boxmaxs, portals, list, count );
+
+	return count;
 }
 
 /*
 ====================
-SV_ClipToWorldBrush
+SV_MoveTouchList
 
-Mins and maxs enclose the entire area swept by the move
+edicts that SV_Move would clip the rest of the move against
 ====================
 */
-void SV_ClipToWorldBrush( areanode_t *node, moveclip_t *clip )
+static int SV_MoveTouchList( const sv_movecache_t *mc, edict_t **list )
 {
-	link_t	*l, *next;
-	edict_t	*touch;
-	trace_t	trace;
+	vec3_t	mins2, maxs2;
+	vec3_t	boxmins, boxmaxs;
+	int	count;
 
-	for( l = node->solid_edicts.next; l != &node->solid_edicts; l = next )
+	if(( mc->type & 0xFF ) == MOVE_MISSILE )
 	{
-		next = l->next;
-
-		touch = EDICT_FROM_AREA( l );
-
-		if( touch->v.solid != SOLID_BSP || touch == clip->passedict || !( touch->v.flags & FL_WORLDBRUSH ))
-			continue;
-
-		if( !BoundsIntersect( clip->boxmins, clip->boxmaxs, touch->v.absmin, touch->v.absmax ))
-			continue;
-
-		if( clip->trace.allsolid ) return;
-
-		SV_ClipMoveToEntity( touch, clip->start, clip->mins, clip->maxs, clip->end, &trace );
-
-		clip->trace = World_CombineTraces( &clip->trace, &trace, touch );
+		VectorSet( mins2, -15.0f, -15.0f, -15.0f );
+		VectorSet( maxs2,  15.0f,  15.0f,  15.0f );
+	}
+	else
+	{
+		VectorCopy( mc->mins, mins2 );
+		VectorCopy( mc->maxs, maxs2 );
 	}
 
-	// recurse down both sides
-	if( node->axis == -1 ) return;
+	World_MoveBounds( mc->start, mins2, maxs2, mc->worldend, boxmins, boxmaxs );
 
-	if( clip->boxmaxs[node->axis] > node->dist )
-		SV_ClipToWorldBrush( node->children[0], clip );
+	count = SV_GatherTouch( sv_areanodes, boxmins, boxmaxs, false, list, 0 );
 
-	if( clip->boxmins[node->axis] < node->dist )
-		SV_ClipToWorldBrush( node->children[1], clip );
+	if( count >= 0 )
+		count = SV_GatherTouch( sv_areanodes, boxmins, boxmaxs, true, list, count );
+
+	return count;
 }
 
 /*
 ==================
-SV_Move
+SV_MovePrefetch
+
+SV_Move that physics jobs can run while the main thread waits.
+Everything the result depends on is stored along with it, so
+SV_MoveCached can tell later whether it's still the same.
+Leaves mc->valid false if the trace must be done on the main thread
 ==================
 */
-trace_t SV_Move( const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, int type, edict_t *e, qboolean monsterclip )
+void SV_MovePrefetch( sv_movecache_t *mc )
 {
+	edict_t		*list[MOVE_PREFETCH_TOUCH];
 	moveclip_t	clip;
-	vec3_t		trace_endpos;
-	float		trace_fraction;
+	int		i, numtouch;
+
+	mc->valid = false;
+
+	// these call back into the game
+	if( svgame.dllFuncs2.pfnShouldCollide || svgame.physFuncs.ClipMoveToEntity || svgame.physFuncs.SV_HullForBsp )
+		return;
 
 	memset( &clip, 0, sizeof( moveclip_t ));
-	SV_ClipMoveToEntity( EDICT_NUM( 0 ), start, mins, maxs, end, &clip.trace );
+	SV_ClipMoveToEntity( EDICT_NUM( 0 ), mc->start, mc->mins, mc->maxs, mc->end, &clip.trace );
+
+	mc->worldfraction = clip.trace.fraction;
+	VectorCopy( clip.trace.endpos, mc->worldend );
+	mc->numtouch = 0;
 
 	if( clip.trace.fraction != 0.0f )
 	{
-		VectorCopy( clip.trace.endpos, trace_endpos );
-		trace_fraction = clip.trace.fraction;
+		numtouch = SV_MoveTouchList( mc, list );
+
+		if( numtouch < 0 )
+			return;
+
+		// let SV_Move throw the errors
+		for( i = 0; i < numtouch; i++ )
+		{
+			model_t	*mod = SV_ModelHandle( list[i]->v.modelindex );
+
+			if( list[i]->v.solid == SOLID_BSP && list[i]->v.movetype != MOVETYPE_PUSH && list[i]->v.movetype != MOVETYPE_PUSHSTEP )
+				return;
+
+			if(( list[i]->v.solid == SOLID_BSP || list[i]->v.solid == SOLID_PORTAL ) && ( !mod || mod->type != mod_brush ))
+				return;
+		}
+
 		clip.trace.fraction = 1.0f;
-		clip.start = start;
-		clip.end = trace_endpos;
-		clip.type = (type & 0xFF);
-		clip.ignoretrans = type >> 8;
+		clip.start = mc->start;
+		clip.end = mc->worldend;
+		clip.type = (mc->type & 0xFF);
+		clip.ignoretrans = mc->type >> 8;
 		clip.monsterclip = false;
-		clip.passedict = (e) ? e : EDICT_NUM( 0 );
-		clip.mins = mins;
-		clip.maxs = maxs;
+		clip.passedict = mc->passedict ? mc->passedict : EDICT_NUM( 0 );
+		clip.mins = mc->mins;
+		clip.maxs = mc->maxs;
 
-		if( monsterclip && !FBitSet( host.features, ENGINE_QUAKE_COMPATIBLE ))
+		if( mc->monsterclip && !FBitSet( host.features, ENGINE_QUAKE_COMPATIBLE ))
 			clip.monsterclip = true;
 
 		if( clip.type == MOVE_MISSILE )
@@ -1379,70 +2925,101 @@ trace_t SV_Move( const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end,
 		}
 		else
 		{
-			VectorCopy( mins, clip.mins2 );
-			VectorCopy( maxs, clip.maxs2 );
+			VectorCopy( mc->mins, clip.mins2 );
+			VectorCopy( mc->maxs, clip.maxs2 );
 		}
 
-		World_MoveBounds( start, clip.mins2, clip.maxs2, trace_endpos, clip.boxmins, clip.boxmaxs );
-		SV_ClipToLinks( sv_areanodes, &clip );
-		SV_ClipToPortals( sv_areanodes, &clip );
+		World_MoveBounds( clip.start, clip.mins2, clip.maxs2, clip.end, clip.boxmins, clip.boxmaxs );
 
-		clip.trace.fraction *= trace_fraction;
-		svgame.globals->trace_ent = clip.trace.ent;
-	}
+		// hitboxes need bones from the blending interface and may
+		// load sequence groups, neither can be done by the jobs
+		for( i = 0; i < numtouch; i++ )
+		{
+			model_t	*mod = SV_ModelHandle( list[i]->v.modelindex );
+			vec3_t	size;
 
-	SV_CopyTraceToGlobal( &clip.trace );
+			if( !mod || mod->type != mod_studio )
+				continue;
 
-	return clip.trace;
-}
+			if( FBitSet( list[i]->v.flags, FL_MONSTER ))
+				VectorSubtract( clip.maxs2, clip.mins2, size );
+			else VectorSubtract( clip.maxs, clip.mins, size );
 
-trace_t SV_MoveNormal( const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, int type, edict_t *e )
-{
-	return SV_Move( start, mins, maxs, end, type, e, false );
+			if( FBitSet( mod->flags, STUDIO_TRACE_HITBOX ) || VectorIsNull( size ))
+				return;
+		}
+
+		for( i = 0; i < numtouch; i++ )
+		{
+			if( !SV_ClipToEntity( list[i], &clip ))
+				break; // trace.allsoild
+		}
+
+		for( i = 0; i < numtouch; i++ )
+			SV_SaveClipState( &mc->touch[i], list[i] );
+
+		mc->numtouch = numtouch;
+		clip.trace.fraction *= mc->worldfraction;
+	}
+
+	SV_SaveClipState( &mc->pass, clip.passedict ? clip.passedict : EDICT_NUM( 0 ));
+	mc->groupop = svs.groupop;
+	mc->traceflags = svgame.globals->trace_flags;
+	mc->clienttrace = sv_clienttrace.value;
+	mc->trace = clip.trace;
+	mc->valid = true;
 }
 
 /*
 ==================
-SV_MoveNoEnts
+SV_MoveCached
+
+returns prefetched trace if SV_Move with these arguments would
+return the very same right now. Entry is spent once the arguments
+match, whether it was still good or not
 ==================
 */
-trace_t SV_MoveNoEnts( const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, int type, edict_t *e )
+qboolean SV_MoveCached( sv_movecache_t *mc, const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, int type, edict_t *e, qboolean monsterclip, trace_t *trace )
 {
-	moveclip_t	clip;
-	vec3_t		trace_endpos;
-	float		trace_fraction;
+	edict_t	*list[MOVE_PREFETCH_TOUCH];
+	int	i;
 
-	memset( &clip, 0, sizeof( moveclip_t ));
-	SV_ClipMoveToEntity( EDICT_NUM( 0 ), start, mins, maxs, end, &clip.trace );
+	if( !mc->valid || e != mc->passedict || type != mc->type || monsterclip != mc->monsterclip )
+		return false;
 
-	if( clip.trace.fraction != 0.0f )
-	{
-		VectorCopy( clip.trace.endpos, trace_endpos );
-		trace_fraction = clip.trace.fraction;
-		clip.trace.fraction = 1.0f;
-		clip.start = start;
-		clip.end = trace_endpos;
-		clip.type = (type & 0xFF);
-		clip.ignoretrans = type >> 8;
-		clip.monsterclip = false;
-		clip.passedict = (e) ? e : EDICT_NUM( 0 );
-		clip.mins = mins;
-		clip.maxs = maxs;
+	if( !VectorCompare( start, mc->start ) || !VectorCompare( end, mc->end ))
+		return false;
 
-		VectorCopy( mins, clip.mins2 );
-		VectorCopy( maxs, clip.maxs2 );
+	if( !VectorCompare( mins, mc->mins ) || !VectorCompare( maxs, mc->maxs ))
+		return false;
 
-		World_MoveBounds( start, clip.mins2, clip.maxs2, trace_endpos, clip.boxmins, clip.boxmaxs );
-		SV_ClipToWorldBrush( sv_areanodes, &clip );
-		SV_ClipToPortals( sv_areanodes, &clip );
+	mc->valid = false;
 
-		clip.trace.fraction *= trace_fraction;
-		svgame.globals->trace_ent = clip.trace.ent;
+	if( mc->groupop != svs.groupop || mc->traceflags != svgame.globals->trace_flags || mc->clienttrace != sv_clienttrace.value )
+		return false;
+
+	if( SV_ClipStateChanged( &mc->pass ))
+		return false;
+
+	if( mc->worldfraction != 0.0f )
+	{
+		if( SV_MoveTouchList( mc, list ) != mc->numtouch )
+			return false;
+
+		for( i = 0; i < mc->numtouch; i++ )
+		{
+			if( list[i] != mc->touch[i].ent || SV_ClipStateChanged( &mc->touch[i] ))
+				return false;
+		}
 	}
 
-	SV_CopyTraceToGlobal( &clip.trace );
+	if( sv_tracebench.numtraces < sv_tracebench.maxtraces )
+		SV_SaveTrace( start, mins, maxs, end, type, e, monsterclip );
 
-	return clip.trace;
+	*trace = mc->trace;
+	SV_CopyTraceToGlobal( trace );
+
+	return true;
 }
 
 /*
@@ -1742,3 +3319,210 @@ int SV_LightForEntity( edict_t *pEdict )
 
 	return VectorAvg( sv_pointColor );
 }
+
+#if XASH_ENGINE_TESTS
+#include "tests.h"
+
+static qboolean Test_CheckAreaNode( areanode_t *node )
+{
+	link_t	*l;
+	edict_t	*check;
+
+	for( l = node->solid_edicts.next; l != &node->solid_edicts; l = l->next )
+	{
+		check = EDICT_FROM_AREA( l );
+
+		// edicts stay in nodes only if they cross the plane
+		if( node->axis != -1 && ( check->v.absmin[node->axis] > node->dist || check->v.absmax[node->axis] < node->dist ))
+			return false;
+	}
+
+	for( l = node->trigger_edicts.next; l != &node->trigger_edicts; l = l->next )
+	{
+		if( sv_areanodeinfo[node - sv_areanodes].depth > AREA_DEPTH )
+			return false;
+	}
+
+	if( node->axis == -1 )
+		return true;
+
+	return Test_CheckAreaNode( node->children[0] ) && Test_CheckAreaNode( node->children[1] );
+}
+
+static void Test_TriggerKeys( edict_t *ents, int *keys )
+{
+	link_t	*l;
+	int	i, pos;
+
+	for( i = 0; i < sv_numareanodes; i++ )
+	{
+		pos = 0;
+		for( l = sv_areanodes[i].trigger_edicts.next; l != &sv_areanodes[i].trigger_edicts; l = l->next )
+			keys[EDICT_FROM_AREA( l ) - ents] = i * MAX_AREA_NODES + pos++;
+	}
+}
+
+static void Test_AdaptiveAreaNodes( void )
+{
+	static edict_t	ents[256];
+	vec3_t		mins = { -4096, -4096, -4096 };
+	vec3_t		maxs = { 4096, 4096, 4096 };
+	vec3_t		shift = { -3000, -2000, 0 };
+	int		keys[4], keys2[4];
+	int		i, j, count;
+
+	memset( sv_areanodes, 0, sizeof( sv_areanodes ));
+	sv_numareanodes = 0;
+	SV_CreateAreaNode( 0, mins, maxs );
+	sv_areamaxdepth = AREA_DEPTH + 6;
+
+	// few triggers and a crowd of monsters in one corner
+	for( i = 0; i < 256; i++ )
+	{
+		edict_t	*ent = &ents[i];
+
+		ent->v.solid = i < 4 ? SOLID_TRIGGER : SOLID_BBOX;
+		VectorSet( ent->v.absmin, 1000.0f + ( i % 16 ) * 40.0f, 1000.0f + ( i / 16 ) * 40.0f, 0.0f );
+		VectorSet( ent->v.absmax, ent->v.absmin[0] + 32.0f, ent->v.absmin[1] + 32.0f, 72.0f );
+		SV_LinkToAreaNode( ent );
+	}
+
+	TASSERT( sv_numareanodes > AREA_NODES );
+	TASSERT( Test_CheckAreaNode( sv_areanodes ));
+
+	// moving everything refits the tree as they go
+	for( i = 0; i < 256; i++ )
+	{
+		RemoveLink( &ents[i].area );
+		VectorAdd( ents[i].v.absmin, shift, ents[i].v.absmin );
+		VectorAdd( ents[i].v.absmax, shift, ents[i].v.absmax );
+		SV_LinkToAreaNode( &ents[i] );
+	}
+
+	TASSERT( Test_CheckAreaNode( sv_areanodes ));
+	Test_TriggerKeys( ents, keys );
+
+	SV_RebuildAreaNodes();
+	Test_TriggerKeys( ents, keys2 );
+	TASSERT( Test_CheckAreaNode( sv_areanodes ));
+	TASSERT( !memcmp( keys, keys2, sizeof( keys )));
+
+	// wandering crowd leaves empty splits behind until the tree is full
+	sv_areamaxdepth = AREA_DEPTH + 12;
+	for( j = 0; j < 1000 && !sv_areafull; j++ )
+	{
+		VectorSet( shift, ( j * 997 ) % 6400 - 3600.0f, ( j * 631 ) % 6400 - 3600.0f, 0.0f );
+
+		for( i = 0; i < 256; i++ )
+		{
+			RemoveLink( &ents[i].area );
+			VectorSet( ents[i].v.absmin, shift[0] + ( i % 16 ) * 40.0f, shift[1] + ( i / 16 ) * 40.0f, 100.0f );
+			VectorSet( ents[i].v.absmax, ents[i].v.absmin[0] + 32.0f, ents[i].v.absmin[1] + 32.0f, 172.0f );
+			SV_LinkToAreaNode( &ents[i] );
+		}
+	}
+
+	TASSERT( sv_areafull );
+	count = sv_numareanodes;
+	sv_arearebuildtime = 0.0;
+	SV_CheckAreaNodes();
+	TASSERT( !sv_areafull );
+	TASSERT( sv_numareanodes < count );
+	TASSERT( Test_CheckAreaNode( sv_areanodes ));
+	Test_TriggerKeys( ents, keys );
+
+	// uniform tree never goes deeper and triggers don't notice
+	sv_areamaxdepth = AREA_DEPTH;
+	SV_RebuildAreaNodes();
+	Test_TriggerKeys( ents, keys2 );
+	TASSERT( sv_numareanodes == AREA_NODES - 1 );
+	TASSERT( Test_CheckAreaNode( sv_areanodes ));
+	TASSERT( !memcmp( keys, keys2, sizeof( keys )));
+
+	sv_areamaxdepth = 0;
+	sv_areafull = false;
+	memset( sv_areanodes, 0, sizeof( sv_areanodes ));
+	sv_numareanodes = 0;
+}
+
+static void Test_LinkLeafs( void )
+{
+	static mplane_t	planes[3];
+	static mnode_t	nodes[3];
+	static mleaf_t	leafs[4];
+	model_t		world, *oldworld = sv.worldmodel;
+	sv_entleafs_t	el, ref;
+	int		i, walks = 0;
+
+	// x splits the world, y the negative half, diagonal the positive one
+	VectorSet( planes[0].normal, 1.0f, 0.0f, 0.0f );
+	VectorSet( planes[1].normal, 0.0f, 1.0f, 0.0f );
+	VectorSet( planes[2].normal, 0.70710678f, -0.70710678f, 0.0f );
+	planes[2].dist = 16.0f;
+
+	for( i = 0; i < 3; i++ )
+	{
+		planes[i].type = PlaneTypeForNormal( planes[i].normal );
+		planes[i].signbits = SignbitsForPlane( planes[i].normal );
+		nodes[i].plane = &planes[i];
+	}
+
+	for( i = 0; i < 4; i++ )
+	{
+		leafs[i].contents = CONTENTS_EMPTY;
+		leafs[i].cluster = i;
+	}
+
+	nodes[0].children[0] = &nodes[2];
+	nodes[0].children[1] = &nodes[1];
+	nodes[1].children[0] = (mnode_t *)&leafs[0];
+	nodes[1].children[1] = (mnode_t *)&leafs[1];
+	nodes[2].children[0] = (mnode_t *)&leafs[2];
+	nodes[2].children[1] = (mnode_t *)&leafs[3];
+
+	memset( &world, 0, sizeof( world ));
+	world.nodes = nodes;
+	sv.worldmodel = &world;
+
+	memset( &el, 0, sizeof( el ));
+	memset( &ref, 0, sizeof( ref ));
+	el.maxleafs = ref.maxleafs = MAX_ENT_LEAFS;
+	el.leafs = Mem_Malloc( host.mempool, MAX_ENT_LEAFS * sizeof( int ));
+	ref.leafs = Mem_Malloc( host.mempool, MAX_ENT_LEAFS * sizeof( int ));
+	el.slack = -1.0f;
+
+	// box wanders around the planes in small steps,
+	// reused leafs must be what a fresh walk finds
+	for( i = 0; i < 2000; i++ )
+	{
+		vec3_t	mins, maxs;
+		float	t = i * 0.01f;
+
+		VectorSet( mins, sin( t * 3.0f ) * 96.0f, cos( t * 2.0f ) * 96.0f, 0.0f );
+		VectorSet( maxs, mins[0] + 32.0f, mins[1] + 32.0f, 72.0f );
+
+		if( !SV_CollectLeafs( &el, mins, maxs, host.mempool ))
+			walks++;
+
+		ref.slack = -1.0f;
+		SV_CollectLeafs( &ref, mins, maxs, host.mempool );
+
+		if( el.numleafs != ref.numleafs || el.headnode != ref.headnode
+			|| memcmp( el.leafs, ref.leafs, ref.numleafs * sizeof( int )))
+			break;
+	}
+
+	TASSERT( i == 2000 );
+	TASSERT( walks > 0 && walks < 1000 );
+
+	Mem_Free( el.leafs );
+	Mem_Free( ref.leafs );
+	sv.worldmodel = oldworld;
+}
+
+void Test_RunWorld( void )
+{
+	TRUN( Test_AdaptiveAreaNodes() );
+	TRUN( Test_LinkLeafs() );
+}
+#endif